@@ -129,6 +129,22 @@ enum {
         kTestRegister2				= 0x7F	// DO NOT WRITE TO THESE REGISTERS
 };
 
+/*
+ * Sensor value blocks. Each block can be fetched with one auto-incrementing
+ * combined mode read. Reading the extended resolution registers freezes
+ * the value registers until they have all been read, so the extended
+ * block must be read before the sensor block.
+ */
+
+enum {
+	kSensorBlockStart		= k2_5VReading,
+	kSensorBlockLength		= kTACH4HighByte - k2_5VReading + 1,	// 0x20 - 0x2F
+	kExtResBlockStart		= kExtendedRes1,
+	kExtResBlockLength		= kExtendedRes2 - kExtendedRes1 + 1,	// 0x76 - 0x77
+	kTempLimitBlockStart	= kRemote1TempLowLimit,
+	kTempLimitBlockLength	= kRemote2TempHighLimit - kRemote1TempLowLimit + 1	// 0x4E - 0x53
+};
+
 /*
  * Constants for the Extended Temperature Resolution Register
  */
@@ -146,6 +162,25 @@ enum {
     kExtVoltageShift	= 0
 };
 
+/*
+ * Interrupt Status Register 1 and 2 bits. A bit is set while the channel
+ * is out of its limit window (value > high limit or <= low limit) and stays
+ * latched until the register is read.
+ */
+
+enum {
+	kStatus1Remote1Temp		= 0x10,
+	kStatus1LocalTemp		= 0x20,
+	kStatus1Remote2Temp		= 0x40,
+	kStatus1OutOfLimit		= 0x80,	// a bit in Interrupt Status Register 2 is set
+	kStatus1TempMask		= kStatus1Remote1Temp | kStatus1LocalTemp | kStatus1Remote2Temp,
+
+	kStatus2Fan1			= 0x04,	// TACH 1 below its minimum
+	kStatus2Fan2			= 0x08,
+	kStatus2Remote1Fault	= 0x40,	// Remote 1 diode open or short
+	kStatus2Remote2Fault	= 0x80
+};
+
 /*
  * Constants for Configuration Register 2
  */
@@ -41,11 +41,22 @@ bool AppleADT746x::init(OSDictionary *dict)
         
     fClearSMBAlertStatus = false;
 
+	if (!fShadow.init()) return(false);
+
+	// getVoltage wants the attenuation bits and getFanTach the pulses per
+	// revolution every time, none of which change unless written.  Config1
+	// stays live, its RDY bit is status.
+	fShadow.declare(kDeviceIDReg, kRevisionNum - kDeviceIDReg + 1, kI2CRegister_Static);
+	fShadow.declare(kConfigReg2, 1, kI2CRegister_Config);
+	fShadow.declare(kConfigReg4, 1, kI2CRegister_Config);
+	fShadow.declare(kFanPulsePerRev, 1, kI2CRegister_Config);
+
 	return(true);
 }
 
 void AppleADT746x::free(void)
 {
+	fShadow.free();
 	super::free();
 }
 
@@ -721,6 +732,9 @@ bool AppleADT746x::doI2CRead(UInt8 sub, UInt8 *bytes, UInt16 len)
 			fI2CAddr, sub, (unsigned int)bytes, len);
 #endif
 
+	if (fShadow.read(sub, bytes, len))
+		return(true);
+
 	fI2CInterface->setCombinedMode();
 
 	retries = kNumRetries;
@@ -741,6 +755,7 @@ bool AppleADT746x::doI2CRead(UInt8 sub, UInt8 *bytes, UInt16 len)
 
 //	DLOG("%s (first byte %02x)\n", debugStr, bytes[0]);
 
+	fShadow.didRead(sub, bytes, len);
 	return(true);
 }
 
@@ -751,6 +766,9 @@ bool AppleADT746x::doI2CWrite(UInt8 sub, UInt8 *bytes, UInt16 len)
 	DLOG("@AppleADT746x::doI2CWrite addr=%02x sub=%02x bytes=%08x len=%04x (first byte %02x)\n",
 			fI2CAddr, sub, (unsigned int)bytes, len, bytes[0]);
 
+	if (fShadow.isRedundantWrite(sub, bytes, len))
+		return(true);
+
 	fI2CInterface->setStandardSubMode();
 
 	retries = kNumRetries;
@@ -765,10 +783,12 @@ bool AppleADT746x::doI2CWrite(UInt8 sub, UInt8 *bytes, UInt16 len)
 		else
 		{
 			IOLog("AppleADT746x::doI2CWrite cannot write to I2C!!\n");
+			fShadow.didWrite(sub, bytes, len, false);
 			return(false);
 		}
 	}
 
+	fShadow.didWrite(sub, bytes, len, true);
 	return(true);
 }
 
@@ -788,6 +808,9 @@ IOReturn AppleADT746x::powerStateWillChangeTo(IOPMPowerFlags theFlags, unsigned
 	{   // Set the boolean to make sure we read the 7460 status register to clear the SMBAlert status.
          
             fClearSMBAlertStatus = true;
+
+            // The chip may have lost power, read its configuration again.
+            fShadow.invalidate();
         }
 	
     return IOPMAckImplied;
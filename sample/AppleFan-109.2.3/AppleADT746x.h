@@ -30,6 +30,7 @@
 #include <IOKit/IOService.h>
 #include <IOKit/i2c/PPCI2CInterface.h>
 #include <IOKit/pwr_mgt/RootDomain.h>
+#include <IOI2C/IOI2CRegisterShadow.h>
 #include "ADT746x.h"
 
 // Uncomment to enable debug output
@@ -121,6 +122,10 @@ class AppleADT746x : public IOService
 		UInt8	fI2CAddr;	// I2C address, 7-bit
 
 		UInt8	fDeviceID;	// Contents of the Device ID Register
+
+		// Identification and configuration registers as last read or written,
+		// doI2CRead and doI2CWrite skip the bus when they already know the answer.
+		IOI2CRegisterShadow	fShadow;
                 
                 // On Q54 ( 12" G4 1Ghz miniPB) there is a chance we went to sleep due
                 // to an overtemp situation and we need to read both status registers
@@ -26,6 +26,7 @@
 
 #include <IOKit/pwr_mgt/RootDomain.h>
 #include <IOKit/IOMessage.h>
+#include <IOKit/IOUserClient.h>
 #include <mach/clock_types.h>
 #include "AppleFan.h"
 
@@ -65,6 +66,30 @@ static UInt64 gDefaultSpeedupDelay = 8;
  */
 static UInt64 gDefaultSlowdownDelay = 48;
 
+/*
+ * Control mode, table unless the personality asks for PID
+ */
+static UInt32 gDefaultControlMode = kFanControlTable;
+
+/*
+ * PID setpoint 58 C, in the middle of the default table's ramp
+ */
+static SInt16 gDefaultPIDSetpoint = 0x3A00;
+
+/*
+ * PID gains (16.16): 2 speeds per C, 1/32 speed per C second, and
+ * 8 speeds per C per second of rise
+ */
+static SInt32 gDefaultPIDKp = 0x20000;
+static SInt32 gDefaultPIDKi = 0x800;
+static SInt32 gDefaultPIDKd = 0x80000;
+
+/*
+ * Load feedforward (16.16): off unless the personality sets
+ * fan-load-feedforward, 0x80000 (full load worth 8 fan speeds) is a start
+ */
+static SInt32 gDefaultLoadFeedforward = 0;
+
 
 #define super IOService
 
@@ -89,6 +114,14 @@ bool AppleFan::init(OSDictionary *dict)
 	slowdownDelayKey = OSSymbol::withCString(kSlowdownDelayKey);
 	hysteresisTempKey = OSSymbol::withCString(kHysteresisTempKey);
 	getTempSymbol = OSSymbol::withCString(kGetTempSymbol);
+	updateTransactionsKey = OSSymbol::withCString(kFanUpdateTransactionsKey);
+	updateBusHoldKey = OSSymbol::withCString(kFanUpdateBusHoldKey);
+	controlModeKey = OSSymbol::withCString(kFanControlModeKey);
+	pidSetpointKey = OSSymbol::withCString(kPIDSetpointKey);
+	pidProportionalKey = OSSymbol::withCString(kPIDProportionalKey);
+	pidIntegralKey = OSSymbol::withCString(kPIDIntegralKey);
+	pidDerivativeKey = OSSymbol::withCString(kPIDDerivativeKey);
+	loadFeedforwardKey = OSSymbol::withCString(kLoadFeedforwardKey);
 
 #ifdef APPLEFAN_DEBUG
 	currentSpeedKey = OSSymbol::withCString(kFanCurrentSpeedKey);
@@ -101,6 +134,14 @@ bool AppleFan::init(OSDictionary *dict)
 	fLastRmtTemp = 0;
 	AbsoluteTime_to_scalar(&fWakeTime) = 0;
 
+	fSpeedRegsKnown = false;
+	fUpdateTransactions = 0;
+	fUpdateBusHold_uS = 0;
+
+	fPIDIntegral = 0;
+	fPIDLastTemp = 0;
+	fCPUTicksValid = false;
+
 	return(true);
 }
 
@@ -112,6 +153,14 @@ void AppleFan::free(void)
 	if (slowdownDelayKey) slowdownDelayKey->release();
 	if (hysteresisTempKey) hysteresisTempKey->release();
 	if (getTempSymbol) getTempSymbol->release();
+	if (updateTransactionsKey) updateTransactionsKey->release();
+	if (updateBusHoldKey) updateBusHoldKey->release();
+	if (controlModeKey) controlModeKey->release();
+	if (pidSetpointKey) pidSetpointKey->release();
+	if (pidProportionalKey) pidProportionalKey->release();
+	if (pidIntegralKey) pidIntegralKey->release();
+	if (pidDerivativeKey) pidDerivativeKey->release();
+	if (loadFeedforwardKey) loadFeedforwardKey->release();
 
 #ifdef APPLEFAN_DEBUG
 	if (currentSpeedKey) currentSpeedKey->release();
@@ -374,12 +423,15 @@ bool AppleFan::initHW(IOService *provider)
 		speed lookup table
 		speedup delay time
 		slowdown delay time
+		control mode
+		PID setpoint and gains
+		load feedforward
 
 	There should be defaults for these provided in the I/O Kit personality.  If those
 	are not found, then we revert to the hardcoded defaults declared statically in
 	this code.
 	
-	parseDict is also called from setProperties when we're in debug mode.
+	parseDict is also called from setProperties.
 *************************************************************************************/
 bool AppleFan::initParms(IOService *provider)
 {
@@ -394,6 +446,12 @@ bool AppleFan::initParms(IOService *provider)
 	fSpeedupDelay = gDefaultSpeedupDelay * NSEC_PER_SEC;
 	fSlowdownDelay = gDefaultSlowdownDelay * NSEC_PER_SEC;
 	fHysteresisTemp = gDefaultHysteresisTemp;
+	fControlMode = gDefaultControlMode;
+	fPIDSetpoint = gDefaultPIDSetpoint;
+	fPIDKp = gDefaultPIDKp;
+	fPIDKi = gDefaultPIDKi;
+	fPIDKd = gDefaultPIDKd;
+	fLoadFeedforward = gDefaultLoadFeedforward;
 
 	personality = OSDynamicCast(OSDictionary, getProperty(kDefaultParamsKey));
 
@@ -432,6 +490,36 @@ bool AppleFan::initParms(IOService *provider)
 		defaults->setObject(hysteresisTempKey, value);
 	}
 
+	if (value = personality->getObject(controlModeKey))
+	{
+		DLOG("@AppleFan::initParams using personality's control mode\n");
+		defaults->setObject(controlModeKey, value);
+	}
+
+	if (value = personality->getObject(pidSetpointKey))
+	{
+		DLOG("@AppleFan::initParams using personality's PID setpoint\n");
+		defaults->setObject(pidSetpointKey, value);
+	}
+
+	if (value = personality->getObject(pidProportionalKey))
+	{
+		DLOG("@AppleFan::initParams using personality's PID gains\n");
+		defaults->setObject(pidProportionalKey, value);
+	}
+
+	if (value = personality->getObject(pidIntegralKey))
+		defaults->setObject(pidIntegralKey, value);
+
+	if (value = personality->getObject(pidDerivativeKey))
+		defaults->setObject(pidDerivativeKey, value);
+
+	if (value = personality->getObject(loadFeedforwardKey))
+	{
+		DLOG("@AppleFan::initParams using personality's load feedforward\n");
+		defaults->setObject(loadFeedforwardKey, value);
+	}
+
 	parseDict(defaults);
 
 	return(true);
@@ -473,6 +561,40 @@ void AppleFan::parseDict(OSDictionary *props)
 		fHysteresisTemp = (SInt16)number->unsigned16BitValue();
 	}
 
+	if ((number = OSDynamicCast(OSNumber, props->getObject(controlModeKey))) != 0)
+	{
+		if (number->unsigned32BitValue() == kFanControlPID)
+			fControlMode = kFanControlPID;
+		else
+			fControlMode = kFanControlTable;
+	}
+
+	if ((number = OSDynamicCast(OSNumber, props->getObject(pidSetpointKey))) != 0)
+	{
+		fPIDSetpoint = (SInt16)number->unsigned16BitValue();
+	}
+
+	// Negative gains would drive the fan the wrong way
+	if ((number = OSDynamicCast(OSNumber, props->getObject(pidProportionalKey))) != 0)
+	{
+		fPIDKp = (SInt32)(number->unsigned32BitValue() & 0x7FFFFFFF);
+	}
+
+	if ((number = OSDynamicCast(OSNumber, props->getObject(pidIntegralKey))) != 0)
+	{
+		fPIDKi = (SInt32)(number->unsigned32BitValue() & 0x7FFFFFFF);
+	}
+
+	if ((number = OSDynamicCast(OSNumber, props->getObject(pidDerivativeKey))) != 0)
+	{
+		fPIDKd = (SInt32)(number->unsigned32BitValue() & 0x7FFFFFFF);
+	}
+
+	if ((number = OSDynamicCast(OSNumber, props->getObject(loadFeedforwardKey))) != 0)
+	{
+		fLoadFeedforward = (SInt32)(number->unsigned32BitValue() & 0x7FFFFFFF);
+	}
+
 	if ((speeds = OSDynamicCast(OSArray, props->getObject(speedTableKey))) != 0)
 	{
 		count = speeds->getCount();
@@ -495,8 +617,8 @@ void AppleFan::parseDict(OSDictionary *props)
 }
 
 /*************************************************************************************
-	doUpdate() is where we read the CPU temp and look it up in the speed table to
-	choose a fan speed.  Also here is the timer callback routine which repeatedly
+	doUpdate() is where we read the CPU temp and look it up in the speed table, or
+	run it through the PID controller, to choose a fan speed.  Also here is the timer callback routine which repeatedly
 	calls doUpdate().
 *************************************************************************************/
 
@@ -510,13 +632,17 @@ void AppleFan::timerEventOccured( void *self )
 
 void AppleFan::doUpdate(bool first)
 {
-	AbsoluteTime interval;
-	UInt8 newSpeed;
-	SInt16 cpu_temp;
+	AbsoluteTime interval, opened, held;
+	UInt64 nsec;
+	SInt64 feedforward;
+	UInt8 newSpeed, floorSpeed;
+	SInt16 cpu_temp, rmt_temp;
+	bool success;
 
 	DLOG("+AppleFan::doUpdate\n");
 
-	// Get temperature data
+	// Get temperature data.  AppleCPUThermo does its own I2C, so this comes
+	// before our bus session.
 	if (!getCPUTemp(&cpu_temp))
 	{
 		IOLog("AppleFan::doUpdate ERROR FETCHING CPU TEMP!!!\n");
@@ -525,13 +651,78 @@ void AppleFan::doUpdate(bool first)
 		return;
 	}
 
+	// what the CPU load since the last update is going to need
+	feedforward = loadFeedforward();
+
 	// look up the fan speed
-	newSpeed = 0;
-	while ((cpu_temp >= fSpeedTable[newSpeed]) && (newSpeed < (kNumFanSpeeds - 1)))
-		newSpeed++;
+	if (fControlMode == kFanControlPID)
+	{
+		newSpeed = pidFanSpeed(cpu_temp, feedforward, first);
+		floorSpeed = 0;
+	}
+	else
+	{
+		newSpeed = 0;
+		while ((cpu_temp >= fSpeedTable[newSpeed]) && (newSpeed < (kNumFanSpeeds - 1)))
+			newSpeed++;
+
+		floorSpeed = (UInt8)((feedforward + 0x8000) >> 16);
+		if (newSpeed < floorSpeed)
+			newSpeed = floorSpeed;
+	}
+
+	// One bus session per update: read the remote channel, decide, and write
+	// whichever of T_min/T_range and the speed config changed.  A first
+	// update (start, wake, new parameters) writes both regardless.
+	if (first)
+		fSpeedRegsKnown = false;
+
+	fUpdateTransactions = 0;
+	success = false;
+
+	if (!doI2COpen())
+	{
+		IOLog("AppleFan::doUpdate cannot open I2C!!\n");
+	}
+	else
+	{
+		clock_get_uptime(&opened);
 
-	// set fan speed cfg register
-	setFanSpeed(newSpeed, cpu_temp, first);
+		if (success = getRemoteTemp(&rmt_temp))
+		{
+			// The PID output is already smoothed, it needs none of the table's
+			// delays and goes straight to the chip
+			if (fControlMode == kFanControlPID)
+				writeADM1030Speed(newSpeed, rmt_temp);
+			else if (!first && floorSpeed > fLastFanSpeed)
+			{
+				// the load went up: get ahead of the heat instead of waiting out
+				// the speedup delay one step at a time
+				DLOG("@AppleFan::doUpdate load feedforward to %u\n", floorSpeed);
+				writeADM1030Speed(floorSpeed, rmt_temp);
+				clock_get_uptime(&fLastTransition);
+			}
+			else
+				setFanSpeed(newSpeed, cpu_temp, rmt_temp, first);
+		}
+
+		doI2CClose();
+
+		clock_get_uptime(&held);
+		SUB_ABSOLUTETIME(&held, &opened);
+		absolutetime_to_nanoseconds(held, &nsec);
+		fUpdateBusHold_uS = (nsec / 1000 > 0xFFFFFFFFULL) ? 0xFFFFFFFF : (UInt32)(nsec / 1000);
+
+		publishUpdateStats();
+	}
+
+	if (!success)
+	{
+		IOLog("AppleFan::doUpdate FATAL ERROR FETCHING REMOTE CHANNEL TEMP!!!\n");
+		restoreADM1030State(&fSavedRegs);
+		terminate();
+		return;
+	}
 
 	// implement a periodic timer
 	if (first) clock_get_uptime(&fWakeTime);
@@ -544,36 +735,146 @@ void AppleFan::doUpdate(bool first)
 	DLOG("-AppleFan::doUpdate\n");
 }
 
+/*************************************************************************************
+	pidFanSpeed() is the kFanControlPID replacement for the table lookup.  It runs
+	once per polling period and returns the fan speed to program, 0 to
+	kNumFanSpeeds - 1.
+
+	Everything is fixed point: temperatures 8.8 as they come from AppleCPUThermo,
+	gains and the controller output 16.16 fan speeds.  The derivative acts on the
+	measured temperature rather than the error, so changing the setpoint does not
+	kick the fan.  The integral stops accumulating while the output is pinned at
+	either end in the direction of the error (anti-windup).  The speed changes
+	when the rounded output differs from the current speed and the output is at
+	least kPIDSpeedHysteresis away from it.
+
+	feedforward, from loadFeedforward, is added to the output as is.
+
+	A first update (start, wake, new parameters) loads the integral so the output
+	starts at the current speed instead of jumping.
+*************************************************************************************/
+UInt8 AppleFan::pidFanSpeed(SInt16 cpu_temp, SInt64 feedforward, bool first)
+{
+	const SInt64 maxOutput = (SInt64)(kNumFanSpeeds - 1) << 16;
+	SInt64 error, proportional, integral, derivative, output, current;
+	UInt32 period_ms;
+	UInt8 speed;
+
+	period_ms = (UInt32)(fPollingPeriod / 1000000ULL);
+	if (period_ms == 0) period_ms = 1;
+
+	error = (SInt64)cpu_temp - fPIDSetpoint;
+	proportional = (fPIDKp * error) >> 8;
+	current = (SInt64)fLastFanSpeed << 16;
+
+	if (first)
+	{
+		derivative = 0;
+		integral = current - proportional - feedforward;
+	}
+	else
+	{
+		derivative = ((fPIDKd * ((SInt64)cpu_temp - fPIDLastTemp) * 1000) / period_ms) >> 8;
+		integral = fPIDIntegral + (((fPIDKi * error * period_ms) / 1000) >> 8);
+
+		// anti-windup: don't integrate further into saturation
+		output = proportional + integral + derivative + feedforward;
+		if ((output > maxOutput && error > 0) || (output < 0 && error < 0))
+			integral = fPIDIntegral;
+	}
+
+	// below zero only to take back feedforward the CPU turned out not to need
+	if (integral < -maxOutput) integral = -maxOutput;
+	if (integral > maxOutput) integral = maxOutput;
+
+	fPIDIntegral = integral;
+	fPIDLastTemp = cpu_temp;
+
+	output = proportional + integral + derivative + feedforward;
+	if (output < 0) output = 0;
+	if (output > maxOutput) output = maxOutput;
+
+	speed = (UInt8)((output + 0x8000) >> 16);
+	if (!first && speed != fLastFanSpeed &&
+			output < current + kPIDSpeedHysteresis && output > current - kPIDSpeedHysteresis)
+		speed = fLastFanSpeed;
+
+	DLOG("@AppleFan::pidFanSpeed cpu_temp=%04x P=%llx I=%llx D=%llx FF=%llx speed=%u\n",
+			cpu_temp, proportional, integral, derivative, feedforward, speed);
+
+	return(speed);
+}
+
+/*************************************************************************************
+	loadFeedforward() turns the CPU load since the previous update into fan speed
+	(16.16) ahead of the heat it is going to make.  The load comes from the host's
+	per state tick counters, so it costs no I/O.  It returns 0 when the feature is
+	off, on the first call and whenever the counters can't be read.
+*************************************************************************************/
+SInt64 AppleFan::loadFeedforward(void)
+{
+	host_cpu_load_info_data_t	info;
+	mach_msg_type_number_t		count = HOST_CPU_LOAD_INFO_COUNT;
+	natural_t					total, idle;
+	UInt32						load;
+	bool						valid;
+	int							i;
+
+	if (fLoadFeedforward == 0 ||
+		host_statistics(host_self(), HOST_CPU_LOAD_INFO, (host_info_t)&info, &count) != KERN_SUCCESS)
+	{
+		fCPUTicksValid = false;
+		return(0);
+	}
+
+	// the counters wrap, the differences don't care
+	idle = info.cpu_ticks[CPU_STATE_IDLE] - fCPUTicks[CPU_STATE_IDLE];
+	total = 0;
+	for (i = 0; i < CPU_STATE_MAX; i++)
+	{
+		total += info.cpu_ticks[i] - fCPUTicks[i];
+		fCPUTicks[i] = info.cpu_ticks[i];
+	}
+
+	valid = fCPUTicksValid;
+	fCPUTicksValid = true;
+
+	if (!valid || total == 0)
+		return(0);
+
+	load = 1000 - (UInt32)(((UInt64)idle * 1000) / total);
+
+	DLOG("@AppleFan::loadFeedforward load=%u permille\n", load);
+
+	if (load <= kLoadFeedforwardFloor)
+		return(0);
+
+	return(((SInt64)fLoadFeedforward * (load - kLoadFeedforwardFloor)) / (1000 - kLoadFeedforwardFloor));
+}
+
 /*************************************************************************************
 	Routines which take a fan speed as input and program the ADM1030 to run at the
 	desired speed.  Some nasty tricks are in this code, but it is pretty well
 	encapsulated and explained in comments...
 	
-	The routines are setFanSpeed and setADM1030SpeedMagically (lots of comments in
-	the latter for obvious reasons...)
+	The routines are setFanSpeed and writeADM1030Speed (lots of comments in
+	the latter for obvious reasons...)  Both expect the bus to be open already;
+	setADM1030SpeedMagically opens it around writeADM1030Speed for callers
+	outside doUpdate.
 *************************************************************************************/
-void AppleFan::setFanSpeed(UInt8 speed, SInt16 cpu_temp, bool first)
+void AppleFan::setFanSpeed(UInt8 speed, SInt16 cpu_temp, SInt16 rmt_temp, bool first)
 {
 	UInt8 desiredSpeed;
-	SInt16 rmt_temp;
 	AbsoluteTime ticksPassed;
 	UInt64 nsecPassed;
 
-	if (!getRemoteTemp(&rmt_temp))
-	{
-		IOLog("AppleFan::setFanSpeed FATAL ERROR FETCHING REMOTE CHANNEL TEMP!!!\n");
-		restoreADM1030State(&fSavedRegs);
-		terminate();
-		return;
-	}
-
 	if (first)
 	{
 		// If this is the first run, don't apply any of the hysteresis mechanisms,
 		// just program the chip with the speed that was produced from the table
 		// lookup
 		DLOG("@AppleFan::setFanSpeed initial speed is %u\n", speed);
-		setADM1030SpeedMagically(speed, rmt_temp);
+		writeADM1030Speed(speed, rmt_temp);
 		clock_get_uptime(&fLastTransition);
 	}
 	else
@@ -584,7 +885,7 @@ void AppleFan::setFanSpeed(UInt8 speed, SInt16 cpu_temp, bool first)
 			{
 				// need to update the remote temp limit register
 				DLOG("@AppleFan::setFanSpeed environmental update\n");
-				setADM1030SpeedMagically(speed, rmt_temp);
+				writeADM1030Speed(speed, rmt_temp);
 				return;
 			}
 
@@ -612,7 +913,7 @@ void AppleFan::setFanSpeed(UInt8 speed, SInt16 cpu_temp, bool first)
 
 						// do an environmental update if needed
 						if (rmt_temp != fLastRmtTemp)
-							setADM1030SpeedMagically(fLastFanSpeed, rmt_temp);
+							writeADM1030Speed(fLastFanSpeed, rmt_temp);
 
 						return;
 					}
@@ -626,7 +927,7 @@ void AppleFan::setFanSpeed(UInt8 speed, SInt16 cpu_temp, bool first)
 				{
 					desiredSpeed = fLastFanSpeed - 1;
 					DLOG("@AppleFan::setFanSpeed slowdown to %u\n", desiredSpeed);
-					setADM1030SpeedMagically(desiredSpeed, rmt_temp);
+					writeADM1030Speed(desiredSpeed, rmt_temp);
 					clock_get_uptime(&fLastTransition);
 				}
 				else
@@ -635,7 +936,7 @@ void AppleFan::setFanSpeed(UInt8 speed, SInt16 cpu_temp, bool first)
 
 					// do an environmental update if needed
 					if (rmt_temp != fLastRmtTemp)
-						setADM1030SpeedMagically(fLastFanSpeed, rmt_temp);
+						writeADM1030Speed(fLastFanSpeed, rmt_temp);
 				}
 			}
 			else if (speed > fLastFanSpeed)
@@ -648,7 +949,7 @@ void AppleFan::setFanSpeed(UInt8 speed, SInt16 cpu_temp, bool first)
 				{
 					desiredSpeed = fLastFanSpeed + 1;
 					DLOG("@AppleFan::setFanSpeed speedup to %u\n", desiredSpeed);
-					setADM1030SpeedMagically(desiredSpeed, rmt_temp);
+					writeADM1030Speed(desiredSpeed, rmt_temp);
 					clock_get_uptime(&fLastTransition);
 				}
 				else
@@ -657,7 +958,7 @@ void AppleFan::setFanSpeed(UInt8 speed, SInt16 cpu_temp, bool first)
 
 					// do an environmental update if needed
 					if (rmt_temp != fLastRmtTemp)
-						setADM1030SpeedMagically(fLastFanSpeed, rmt_temp);
+						writeADM1030Speed(fLastFanSpeed, rmt_temp);
 				}
 			}
 			else { /* not reached */ }
@@ -666,6 +967,19 @@ void AppleFan::setFanSpeed(UInt8 speed, SInt16 cpu_temp, bool first)
 }
 
 void AppleFan::setADM1030SpeedMagically(UInt8 desiredSpeed, SInt16 rmt_temp)
+{
+	if (!doI2COpen())
+	{
+		IOLog("AppleFan failed to open bus for setting fan speed\n");
+		return;
+	}
+
+	writeADM1030Speed(desiredSpeed, rmt_temp);
+
+	doI2CClose();
+}
+
+bool AppleFan::writeADM1030Speed(UInt8 desiredSpeed, SInt16 rmt_temp)
 {
 	UInt8 TminTrange, speed;
 
@@ -730,35 +1044,41 @@ void AppleFan::setADM1030SpeedMagically(UInt8 desiredSpeed, SInt16 rmt_temp)
 	temp2str(rmt_temp, debug);
 #endif
 
-	DLOG("@AppleFan::setADM1030SpeedMagically speed=%u rmt_temp=%x (%sC) TminTrange=%x\n",
+	DLOG("@AppleFan::writeADM1030Speed speed=%u rmt_temp=%x (%sC) TminTrange=%x\n",
 			speed, rmt_temp, debug, TminTrange);
 
-	if (!doI2COpen())
+	// Tmin moves in whole degree steps, so most environmental updates and
+	// every update at a steady speed leave one or both registers as they are.
+	if (!fSpeedRegsKnown || (TminTrange != fLastTminTrange))
 	{
-		IOLog("AppleFan failed to open bus for setting fan speed\n");
-		return;
+		if (!doI2CWrite(kRmtTminTrange, &TminTrange, 1))
+		{
+			fSpeedRegsKnown = false;
+			IOLog("AppleFan failed to write to T_min/T_range register!\n");
+			return(false);
+		}
 	}
 
-	if (!doI2CWrite(kRmtTminTrange, &TminTrange, 1))
+	if (!fSpeedRegsKnown || (speed != fLastSpeedCfg))
 	{
-		doI2CClose();
-		IOLog("AppleFan failed to write to T_min/T_range register!\n");
-		return;
-	}		
-
-	if (!doI2CWrite(kSpeedCfgReg, &speed, 1))
-	{
-		doI2CClose();
-		IOLog("AppleFan failed to write to fan speed register\n");
-		return;
+		if (!doI2CWrite(kSpeedCfgReg, &speed, 1))
+		{
+			fSpeedRegsKnown = false;
+			IOLog("AppleFan failed to write to fan speed register\n");
+			return(false);
+		}
 	}
 
-	doI2CClose();
+	fLastTminTrange = TminTrange;
+	fLastSpeedCfg = speed;
+	fSpeedRegsKnown = true;
+
+	return(true);
 }
 
 /*************************************************************************************
-	Read temperature registers -- cpu temp (via AppleCPUThermo) and remote channel
-	
+	Read temperature registers -- cpu temp (via AppleCPUThermo) and remote channel.
+	getRemoteTemp expects the bus to be open already.
 *************************************************************************************/
 
 bool AppleFan::getRemoteTemp(SInt16 *rmt_temp)
@@ -775,12 +1095,6 @@ bool AppleFan::getRemoteTemp(SInt16 *rmt_temp)
 	}
 
 	// get local and remote temperatures from ADM1030
-	if (!doI2COpen())
-	{
-		IOLog("AppleFan::getRemoteTemp cannot open I2C!!\n");
-		return(false);
-	}
-
 	failed = false;
 	if (!doI2CRead(kExtTempReg, &ext_res_reg, 1) ||
 	    !doI2CRead(kRemoteTempReg, &remote_reg, 1))
@@ -789,8 +1103,6 @@ bool AppleFan::getRemoteTemp(SInt16 *rmt_temp)
 		failed = true;
 	}
 
-	doI2CClose();
-
 	if (failed) return(false);
 
 	scratch = (SInt16)(ext_res_reg & kRemoteExtMask);
@@ -839,6 +1151,8 @@ void AppleFan::setRestartMode(void)
 
 	DLOG("+AppleFan::setRestartMode\n");
 
+	fSpeedRegsKnown = false;
+
 	if (!doI2COpen())
 	{
 		IOLog("AppleFan::setRestartMode failed to open bus\n");
@@ -1051,6 +1365,8 @@ void AppleFan::restoreADM1030State(adm1030_regs_t *regs)
 {
 	bool success = false;
 
+	fSpeedRegsKnown = false;
+
 	if (!doI2COpen())
 	{
 		IOLog("AppleFan::restoreADM1030State failed to open bus!!\n");
@@ -1104,12 +1420,14 @@ bool AppleFan::doI2CRead(UInt8 sub, UInt8 *bytes, UInt16 len)
 
 	retries = kNumRetries;
 
+	fUpdateTransactions++;
 	while (!I2C_iface->readI2CBus(fI2CAddr, sub, bytes, len))
 	{
 		if (retries > 0)
 		{
 			IOLog("AppleFan::doI2CRead read failed, retrying...\n");
 			retries--;
+			fUpdateTransactions++;
 		}
 		else
 		{
@@ -1134,12 +1452,14 @@ bool AppleFan::doI2CWrite(UInt8 sub, UInt8 *bytes, UInt16 len)
 
 	retries = kNumRetries;
 
+	fUpdateTransactions++;
 	while (!I2C_iface->writeI2CBus(fI2CAddr, sub, bytes, len))
 	{
 		if (retries > 0)
 		{
 			IOLog("AppleFan::doI2CWrite write failed, retrying...\n");
 			retries--;
+			fUpdateTransactions++;
 		}
 		else
 		{
@@ -1151,20 +1471,15 @@ bool AppleFan::doI2CWrite(UInt8 sub, UInt8 *bytes, UInt16 len)
 	return(true);
 }
 
-//###################################################################################
-// Routines to publish internal variables to I/O Registry
-// Only enabled for APPLEFAN_DEBUG builds
-//
-
-#ifdef APPLEFAN_DEBUG
-
-// User-land clients can call into this to force an update of the I/O Registry or
-// or set parameters at run-time.
+// User-land clients can call into this to set parameters at run-time, e.g. to
+// switch to the PID controller, and in debug builds to force an update of the
+// I/O Registry.
 IOReturn AppleFan::setProperties(OSObject *properties)
 {
 	OSDictionary *props = OSDynamicCast(OSDictionary, properties);
 	if (props == NULL) return kIOReturnBadArgument;
 
+#ifdef APPLEFAN_DEBUG
 	if (props->getObject(forceUpdateKey) != NULL)
 	{
 		// refresh the I/O registry
@@ -1172,10 +1487,18 @@ IOReturn AppleFan::setProperties(OSObject *properties)
 		publishPollingPeriod();
 		publishDelays();
 		publishHysteresisTemp();
+		publishController();
 		publishCurrentSpeed();
 		publishCurrentCPUTemp();
 		return kIOReturnSuccess;
 	}
+#else
+	// Debug builds stay open to the fan monitor app; otherwise only an
+	// administrator gets to change how the fan is driven
+	if (IOUserClient::clientHasPrivilege(current_task(), kIOClientPrivilegeAdministrator)
+			!= kIOReturnSuccess)
+		return kIOReturnNotPrivileged;
+#endif
 
 	// The ground is about to move beneath us, so disable the timer while
 	// we are changing things up
@@ -1190,6 +1513,13 @@ IOReturn AppleFan::setProperties(OSObject *properties)
 	return kIOReturnSuccess;
 }
 
+//###################################################################################
+// Routines to publish internal variables to I/O Registry
+// Only enabled for APPLEFAN_DEBUG builds
+//
+
+#ifdef APPLEFAN_DEBUG
+
 void AppleFan::publishSpeedTable(void)
 {
 	int i;
@@ -1261,6 +1591,45 @@ void AppleFan::publishHysteresisTemp(void)
 	}
 }
 
+void AppleFan::publishController(void)
+{
+	OSNumber *mode = OSNumber::withNumber(fControlMode, sizeof(fControlMode) * 8);
+	OSNumber *setpoint = OSNumber::withNumber(fPIDSetpoint, sizeof(fPIDSetpoint) * 8);
+	OSNumber *kp = OSNumber::withNumber(fPIDKp, sizeof(fPIDKp) * 8);
+	OSNumber *ki = OSNumber::withNumber(fPIDKi, sizeof(fPIDKi) * 8);
+	OSNumber *kd = OSNumber::withNumber(fPIDKd, sizeof(fPIDKd) * 8);
+
+	if (mode)
+	{
+		setProperty(controlModeKey, mode);
+		mode->release();
+	}
+
+	if (setpoint)
+	{
+		setProperty(pidSetpointKey, setpoint);
+		setpoint->release();
+	}
+
+	if (kp)
+	{
+		setProperty(pidProportionalKey, kp);
+		kp->release();
+	}
+
+	if (ki)
+	{
+		setProperty(pidIntegralKey, ki);
+		ki->release();
+	}
+
+	if (kd)
+	{
+		setProperty(pidDerivativeKey, kd);
+		kd->release();
+	}
+}
+
 void AppleFan::publishCurrentSpeed(void)
 {
 	UInt64 mylonglong = (UInt64)fLastFanSpeed;
@@ -1292,5 +1661,24 @@ void AppleFan::publishCurrentCPUTemp(void)
 	}
 }
 #endif
+
+// Not debug only: what the last doUpdate cost on the bus.
+void AppleFan::publishUpdateStats(void)
+{
+	OSNumber *transactions = OSNumber::withNumber(fUpdateTransactions, sizeof(fUpdateTransactions) * 8);
+	OSNumber *busHold = OSNumber::withNumber(fUpdateBusHold_uS, sizeof(fUpdateBusHold_uS) * 8);
+
+	if (transactions)
+	{
+		setProperty(updateTransactionsKey, transactions);
+		transactions->release();
+	}
+
+	if (busHold)
+	{
+		setProperty(updateBusHoldKey, busHold);
+		busHold->release();
+	}
+}
 //
 //###################################################################################
@@ -33,6 +33,10 @@
 
 __BEGIN_DECLS
 #include <kern/thread_call.h>
+#include <mach/host_info.h>
+extern host_t host_self(void);
+extern kern_return_t host_statistics(host_t host, host_flavor_t flavor,
+		host_info_t info, mach_msg_type_number_t *count);
 __END_DECLS
 
 // Uncomment to enable debug output and fan monitor app support
@@ -171,6 +175,14 @@ __END_DECLS
 #define kHysteresisTempKey		"fan-hysteresis-temp"
 #define kFanCurrentSpeedKey		"fan-current-speed"
 #define kCPUCurrentTempKey		"cpu-current-temp"
+#define kFanUpdateTransactionsKey	"fan-update-transactions"	// I2C transactions of the last update
+#define kFanUpdateBusHoldKey	"fan-update-bus-hold-us"	// how long the last update held the bus
+#define kFanControlModeKey		"fan-control-mode"
+#define kPIDSetpointKey			"fan-pid-setpoint"
+#define kPIDProportionalKey		"fan-pid-kp"
+#define kPIDIntegralKey			"fan-pid-ki"
+#define kPIDDerivativeKey		"fan-pid-kd"
+#define kLoadFeedforwardKey		"fan-load-feedforward"
 
 // Property key for platform function.  The value is the phandle of the
 // ds1775 thermistor's device tree node.
@@ -226,6 +238,31 @@ enum {
 #define kNumFanSpeeds	16
 typedef SInt16 fan_speed_table_t[kNumFanSpeeds];
 
+// fan-control-mode selects how doUpdate picks the speed.  kFanControlTable
+// is the table lookup above with its speedup/slowdown delays and hysteresis.
+// kFanControlPID holds the CPU at fan-pid-setpoint (8.8, like the table)
+// with a PID controller whose output is a fractional fan speed; its gains
+// are 16.16 fixed point fan speeds per degree C (fan-pid-kp), per degree C
+// second (fan-pid-ki) and per degree C per second (fan-pid-kd).
+enum {
+	kFanControlTable	= 0,
+	kFanControlPID		= 1
+};
+
+// The controller output must move this far (16.16 fan speeds) past the
+// current speed before the speed changes, so a temperature sitting
+// between two speeds does not toggle the speed config register.  Kept
+// under one speed so that current + kPIDSpeedHysteresis still rounds to
+// the next speed and the PID can settle one speed up or down.
+#define kPIDSpeedHysteresis	0x0C000
+
+// fan-load-feedforward is the fan speed (16.16) full CPU load is worth before
+// it shows up as heat, scaled down linearly to nothing at this load (permille).
+// In PID mode it is added to the controller output; in table mode it is a
+// floor under the table's speed that the fan jumps to without waiting out
+// the speedup delay.  0 turns it off.
+#define kLoadFeedforwardFloor	250
+
 // Compatible string for ADM1030
 #define kADM1030Compatible	"adm1030"
 
@@ -258,6 +295,31 @@ class AppleFan : public IOService
 		SInt16				fLastRmtTemp;
 		AbsoluteTime		fWakeTime;
 
+		// What writeADM1030Speed last put in the remote T_min/T_range and
+		// speed config registers, so unchanged values are not written again.
+		// Cleared whenever something else may have written them.
+		UInt8				fLastTminTrange;
+		UInt8				fLastSpeedCfg;
+		bool				fSpeedRegsKnown;
+
+		// Closed loop control, see kFanControlPID
+		UInt32				fControlMode;
+		SInt16				fPIDSetpoint;
+		SInt32				fPIDKp;
+		SInt32				fPIDKi;
+		SInt32				fPIDKd;
+		SInt64				fPIDIntegral;	// integral term, 16.16 fan speeds
+		SInt16				fPIDLastTemp;	// cpu temp of the previous update
+
+		// CPU load feedforward, see kLoadFeedforwardFloor
+		SInt32				fLoadFeedforward;
+		natural_t			fCPUTicks[CPU_STATE_MAX];	// host tick counters at the previous update
+		bool				fCPUTicksValid;
+
+		// Cost of the last update's bus session
+		UInt32				fUpdateTransactions;	// counted by doI2CRead/doI2CWrite, retries included
+		UInt32				fUpdateBusHold_uS;
+
 		unsigned long fCurrentPowerState;
 
 		thread_call_t timerCallout;
@@ -268,6 +330,14 @@ class AppleFan : public IOService
 		const OSSymbol *slowdownDelayKey;
 		const OSSymbol *hysteresisTempKey;
 		const OSSymbol *getTempSymbol;
+		const OSSymbol *updateTransactionsKey;
+		const OSSymbol *updateBusHoldKey;
+		const OSSymbol *controlModeKey;
+		const OSSymbol *pidSetpointKey;
+		const OSSymbol *pidProportionalKey;
+		const OSSymbol *pidIntegralKey;
+		const OSSymbol *pidDerivativeKey;
+		const OSSymbol *loadFeedforwardKey;
 
 #ifdef APPLEFAN_DEBUG
 		const OSSymbol *currentSpeedKey;
@@ -281,9 +351,12 @@ class AppleFan : public IOService
 		bool getRemoteTemp(SInt16 *rmt_temp);
 		bool getCPUTemp(SInt16 *cpu_temp);
 		void doUpdate(bool first);
+		UInt8 pidFanSpeed(SInt16 cpu_temp, SInt64 feedforward, bool first);
+		SInt64 loadFeedforward(void);
 
-		void setFanSpeed(UInt8 speed, SInt16 cpu_temp, bool first);
+		void setFanSpeed(UInt8 speed, SInt16 cpu_temp, SInt16 rmt_temp, bool first);
 		void setADM1030SpeedMagically(UInt8 desiredSpeed, SInt16 rmt_temp);
+		bool writeADM1030Speed(UInt8 desiredSpeed, SInt16 rmt_temp);
 
 		void doSleep(void);
 		void doWake(void);
@@ -306,13 +379,13 @@ class AppleFan : public IOService
 		void publishHysteresisTemp(void);
 		void publishCurrentSpeed(void);
 		void publishCurrentCPUTemp(void);
+		void publishController(void);
 #endif
+		void publishUpdateStats(void);
 
 	public:
 
-#ifdef APPLEFAN_DEBUG
 		virtual IOReturn setProperties(OSObject *properties);
-#endif
 		void parseDict(OSDictionary *props);
 		virtual IOReturn powerStateWillChangeTo(IOPMPowerFlags flags,
 				unsigned long stateNumber, IOService *whatDevice);
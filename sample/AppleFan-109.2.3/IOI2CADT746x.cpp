@@ -30,6 +30,17 @@
 
 OSDefineMetaClassAndStructors(IOI2CADT746x, IOI2CDevice)
 
+// Combined mode read of count registers starting at subAddress, for executeI2CCommands.
+static void setReadCommand(IOI2CCommand *cmd, UInt32 subAddress, UInt8 *data, UInt32 count)
+{
+	bzero(cmd, sizeof(*cmd));
+	cmd->command = kI2CCommand_Read;
+	cmd->mode = kI2CMode_Combined;
+	cmd->subAddress = subAddress;
+	cmd->buffer = data;
+	cmd->count = count;
+}
+
 bool IOI2CADT746x::start(IOService *provider)
 {
 	IOService		*childNub;
@@ -38,6 +49,29 @@ bool IOI2CADT746x::start(IOService *provider)
 	if (false == super::start(provider))
 		return false;
 
+	if (NULL == (fSampleLock = IOLockAlloc()))
+	{
+		freeI2CResources();
+		return false;
+	}
+
+	if (kIOReturnSuccess != registerI2CFunction(kGetSensorValueSymbol, &IOI2CADT746x::sGetSensorValue))
+	{
+		freeI2CResources();
+		return false;
+	}
+
+	fMaxStalenessMS = kDefaultMaxStalenessMS;
+	if (OSNumber *staleness = OSDynamicCast(OSNumber, getProperty(kMaxStalenessKey)))
+		fMaxStalenessMS = staleness->unsigned32BitValue();
+
+	// Identification never changes and the configuration only changes when written,
+	// readI2C answers them from the register shadow after the first read.  Config1
+	// stays live: its RDY bit is read-only status.
+	declareI2CRegisters(kDeviceIDReg, kRevisionNum - kDeviceIDReg + 1, kI2CRegister_Static);
+	declareI2CRegisters(kConfigReg2, 1, kI2CRegister_Config);
+	declareI2CRegisters(kConfigReg4, 1, kI2CRegister_Config);
+
 	// Read the device ID register so we know whether this is an ADM1030 or an ADM1031
 	if (kIOReturnSuccess != readI2C(kDeviceIDReg, &fDeviceID, 1))
 	{
@@ -47,6 +81,10 @@ bool IOI2CADT746x::start(IOService *provider)
 		return false;
 	}
 
+	// The attenuation bit is needed to scale voltage readings
+	if (kIOReturnSuccess != readI2C(kConfigReg2, &fConfig2, 1))
+		fConfig2 = 0;
+
 	// Parse the sensor parameters and create nubs
 	// If I didn't create any nubs, I have no reason to exist
 	nubArray = parseSensorParamsAndCreateNubs(provider);
@@ -73,6 +111,17 @@ bool IOI2CADT746x::start(IOService *provider)
 }
 
 
+void IOI2CADT746x::free(void)
+{
+	if (fSampleLock)
+	{
+		IOLockFree(fSampleLock);
+		fSampleLock = NULL;
+	}
+
+	super::free();
+}
+
 OSArray * IOI2CADT746x::parseSensorParamsAndCreateNubs(IOService *provider)
 {
 	IOService *nub;
@@ -230,330 +279,359 @@ OSArray * IOI2CADT746x::parseSensorParamsAndCreateNubs(IOService *provider)
 
 
 
-IOReturn IOI2CADT746x::callPlatformFunction(const OSSymbol *functionName,
+IOReturn IOI2CADT746x::sGetSensorValue(OSObject *target, const OSSymbol *functionName,
+				bool waitForFunction, void *param1, void *param2,
+				void *param3, void *param4)
+{
+	return(((IOI2CADT746x *)target)->getSensorValue(functionName, waitForFunction,
+				param1, param2, param3, param4));
+}
+
+IOReturn IOI2CADT746x::getSensorValue(const OSSymbol *functionName,
 				bool waitForFunction, void *param1, void *param2,
 				void *param3, void *param4)
 {
 	UInt32 		id = (UInt32)param1;
 	SInt32 		*temp_buf = (SInt32 *)param2;
  	UInt8 		statusByte;
-	UInt32		key;
            
-	if (0 == functionName)
+	if (fClearSMBAlertStatus == true)
 	{
-		ERRLOG("@IOI2CADT746x::callPlatformFunction bad arg!\n");
-		return kIOReturnBadArgument;
-	}
-        
-	if (functionName->isEqualTo(kGetSensorValueSymbol) == true)
-	{
-		if (fClearSMBAlertStatus == true)
+		IOI2CCommand		cmds[3];
+		IOReturn			cmdStatus[3];
+		IOI2CCommandList	list;
+		IOReturn			status;
+
+		// Reading the interrupt status registers clears them.
+		setReadCommand(&cmds[0], kIntStatusReg1, &statusByte, 1);
+		setReadCommand(&cmds[1], kIntStatusReg2, &statusByte, 1);
+		setReadCommand(&cmds[2], kConfigReg2, &fConfig2, 1);
+
+		bzero(&list, sizeof(list));
+		list.commands = cmds;
+		list.status = cmdStatus;
+		list.count = 3;
+		// SMBALERT means a limit was crossed, go ahead of routine sensor polling.
+		list.options = kI2CListOption_StopOnError | i2cPriorityToOptions(kI2CPriority_Emergency);
+
+		if (kIOReturnSuccess != (status = executeI2CCommands(&list)))
 		{
-			IOReturn status;
-			if (kIOReturnSuccess == (status = lockI2CBus(&key)))
-			{
-				if (kIOReturnSuccess != (status = readI2C(kIntStatusReg1, &statusByte, 1, key)))
-					ERRLOG("@IOI2CADT746x::CPF error reading I2C reg:0x%x: 0x%lx\n", kIntStatusReg1, (UInt32)status);
-				else
-				if (kIOReturnSuccess != (status = readI2C(kIntStatusReg2, &statusByte, 1, key)))
-					ERRLOG("@IOI2CADT746x::CPF error reading I2C reg:0x%x: 0x%lx\n", kIntStatusReg2, (UInt32)status);
-				
-				unlockI2CBus(key);
-			}
-			else
+			if (list.completed == 0)
 			{
 				ERRLOG("@IOI2CADT746x::CPF error locking I2C bus: 0x%lx\n", (UInt32)status);
 				return status;
 			}
-
-			fClearSMBAlertStatus = false;
+			ERRLOG("@IOI2CADT746x::CPF error reading I2C reg:0x%lx: 0x%lx\n",
+				cmds[list.completed - 1].subAddress, (UInt32)status);
 		}
+
+		fClearSMBAlertStatus = false;
+
+		// fConfig2 may have changed the voltage scale
+		IOLockLock(fSampleLock);
+		publishSnapshot(NULL, false);
+		IOLockUnlock(fSampleLock);
+	}
         
-		if (id == fHWSensorIDMap[0])
-		{
-			return(getLocalTemp(temp_buf));
-		}
-		else if (id == fHWSensorIDMap[1])
-		{
-			return(getRemote1Temp(temp_buf));
-		}
-		else if (id == fHWSensorIDMap[2])
-		{
-			return(getRemote2Temp(temp_buf));
-		}
-		else if (id == fHWSensorIDMap[3])
-		{
-			return(getVoltage(temp_buf));
-		}
-		else if (id == fHWSensorIDMap[4])
-		{
-			return(getFanTach(temp_buf, kFanTachOne));
-		}
-		else if (id == fHWSensorIDMap[5])
-		{
-			return(getFanTach(temp_buf, kFanTachTwo));
-		}
+	if (id == fHWSensorIDMap[0])
+	{
+		return(getLocalTemp(temp_buf));
+	}
+	else if (id == fHWSensorIDMap[1])
+	{
+		return(getRemote1Temp(temp_buf));
+	}
+	else if (id == fHWSensorIDMap[2])
+	{
+		return(getRemote2Temp(temp_buf));
+	}
+	else if (id == fHWSensorIDMap[3])
+	{
+		return(getVoltage(temp_buf));
+	}
+	else if (id == fHWSensorIDMap[4])
+	{
+		return(getFanTach(temp_buf, kFanTachOne));
+	}
+	else if (id == fHWSensorIDMap[5])
+	{
+		return(getFanTach(temp_buf, kFanTachTwo));
 	}
 
-	return(super::callPlatformFunction(functionName, waitForFunction,
+	// Not one of our sensors: IOI2CDevice has nothing for getSensorValue,
+	// skip its table and go on to the provider.
+	return(IOService::callPlatformFunction(functionName, waitForFunction,
 				param1, param2, param3, param4));
 }
 
-IOReturn IOI2CADT746x::getFanTach(SInt32 *fanSpeed, SInt16 whichFan)
+IOReturn IOI2CADT746x::readSensorSnapshot(ADT746xSensorSnapshot *snapshot, UInt32 clientKey)
 {
-	UInt8		tachLowByteAddr, tachHighByteAddr;
-	UInt8		tachLowByte, tachHighByte;
-	UInt16		fullValue;
-	UInt8		fanPulsePerRev;
-	UInt16		fanWhole;
-	IOReturn	status;
-	UInt32		key;
-
-	if (fanSpeed == NULL)
+	UInt8				sensorBlock[kSensorBlockLength];
+	UInt8				extBlock[kExtResBlockLength];
+	IOI2CCommand		cmds[3];
+	IOReturn			cmdStatus[3];
+	IOI2CCommandList	list;
+	IOReturn			status;
+
+	if (snapshot == NULL)
 		return kIOReturnBadArgument;
 
-	if (whichFan == kFanTachOne)
-	{
-		tachLowByteAddr = kTACH1LowByte;
-		tachHighByteAddr = kTACH1HighByte;
-	}
-	else if (whichFan == kFanTachTwo)
+	// The extended resolution registers must be read first, they freeze the
+	// temperature and voltage registers until all of them have been read.
+	// Both blocks auto-increment, so each one is a single combined mode transaction,
+	// and the whole list runs under one bus lock.
+
+	setReadCommand(&cmds[0], kExtResBlockStart, extBlock, kExtResBlockLength);
+	setReadCommand(&cmds[1], kSensorBlockStart, sensorBlock, kSensorBlockLength);
+	setReadCommand(&cmds[2], kDeviceIDReg, &fDeviceID, 1);
+
+	bzero(&list, sizeof(list));
+	list.commands = cmds;
+	list.status = cmdStatus;
+	list.count = (fDeviceID == 0xFF) ? 3 : 2;	// Something went wrong first time, try it again.
+	list.options = kI2CListOption_StopOnError;
+
+	status = executeI2CCommands(&list, clientKey);
+	if (list.completed == 0)
+		return status;
+
+	if (kIOReturnSuccess != (status = cmdStatus[0]))
+		ERRLOG("IOI2CADT746x@%lx::readSensorSnapshot i2c read A:0x%x error:0x%x\n", getI2CAddress(), kExtResBlockStart, status);
+	else
+	if (kIOReturnSuccess != (status = cmdStatus[1]))
+		ERRLOG("IOI2CADT746x@%lx::readSensorSnapshot i2c read A:0x%x error:0x%x\n", getI2CAddress(), kSensorBlockStart, status);
+
+	if (kIOReturnSuccess != status)
+		return status;
+
+	decodeSensorSnapshot(sensorBlock, extBlock, snapshot);
+	return kIOReturnSuccess;
+}
+
+void IOI2CADT746x::publishSnapshot(const ADT746xSensorSnapshot *snapshot, bool valid)
+{
+	fSnapshotSequence++;
+	ADT746X_MEMORY_BARRIER();
+
+	if (valid)
 	{
-		tachLowByteAddr = kTACH2LowByte;
-		tachHighByteAddr = kTACH2HighByte;
+		fPublishedSnapshot = *snapshot;
+		clock_get_uptime(&fPublishedTime);
+		clock_interval_to_deadline(fMaxStalenessMS, kMillisecondScale, &fPublishedDeadline);
 	}
-	else // We can only read first two tachs right now.
+	else
+		AbsoluteTime_to_scalar(&fPublishedDeadline) = 0;
+
+	ADT746X_MEMORY_BARRIER();
+	fSnapshotSequence++;
+}
+
+bool IOI2CADT746x::copyPublishedSnapshot(ADT746xSensorSnapshot *snapshot,
+		UInt32 maxStalenessMS, AbsoluteTime *sampleTime)
+{
+	AbsoluteTime	published, deadline, now;
+	UInt32			sequence;
+
+	do
 	{
-		*fanSpeed = -1;
-		return kIOReturnUnsupported;
-	}
+		// odd: the sampler is writing it right now, which takes a few stores
+		while ((sequence = fSnapshotSequence) & 1)
+			;
+
+		ADT746X_MEMORY_BARRIER();
+		*snapshot = fPublishedSnapshot;
+		published = fPublishedTime;
+		deadline = fPublishedDeadline;
+		ADT746X_MEMORY_BARRIER();
+	} while (sequence != fSnapshotSequence);
+
+	if (AbsoluteTime_to_scalar(&deadline) == 0)
+		return false;
 
-	if (kIOReturnSuccess == (status = lockI2CBus(&key)))
+	clock_get_uptime(&now);
+	if (maxStalenessMS == fMaxStalenessMS)
 	{
-		// extended needs to be read first, it will freeze the other two voltage registers till all are read.
-
-		// Read the low byte, must be read first
-		if (kIOReturnSuccess != (status = readI2C(tachLowByteAddr, &tachLowByte, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getFanTach i2c read low A:0x%x error:0x%x\n", getI2CAddress(), tachLowByteAddr, status);
-		else // Then lets get the high byte
-		if (kIOReturnSuccess != (status = readI2C(tachHighByteAddr, &tachHighByte, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getFanTach i2c read high A:0x%x error:0x%x\n", getI2CAddress(), tachHighByteAddr, status);
-		else // And of course we need to know the proper pulse per revolution
-		if (kIOReturnSuccess != (status = readI2C(kFanPulsePerRev, &fanPulsePerRev, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getFanTach i2c read ppr A:0x%x error:0x%x\n", getI2CAddress(), kFanPulsePerRev, status);
-
-		unlockI2CBus(key);
+		if (CMP_ABSOLUTETIME(&now, &deadline) > 0)
+			return false;
 	}
-        
-	if (kIOReturnSuccess != status)
+	else
 	{
-		*fanSpeed = -1;
-		return status;
+		nanoseconds_to_absolutetime((UInt64)maxStalenessMS * 1000000ULL, &deadline);
+		ADD_ABSOLUTETIME(&deadline, &published);
+		if (CMP_ABSOLUTETIME(&now, &deadline) > 0)
+			return false;
 	}
 
-	fullValue = ((UInt16)tachHighByte << 8) | tachLowByte;
-	if ((fullValue == 0xFFFF) || (fullValue == 0x0))		// Fan not spinning or stalled
-		fanWhole = 0;
-	else
-		fanWhole = ((90000 * 60) / fullValue);			// 90K based on 11.11 microsec timing period
+	if (sampleTime)
+		*sampleTime = published;
+	return true;
+}
+
+IOReturn IOI2CADT746x::getSensorSnapshot(ADT746xSensorSnapshot *snapshot,
+		UInt32 maxStalenessMS, AbsoluteTime *sampleTime)
+{
+	IOReturn	status = kIOReturnSuccess;
 
-	*fanSpeed = (fanWhole << 16);					// Fixed number, so shift it high.
+	if (snapshot == NULL)
+		return kIOReturnBadArgument;
 
-	return kIOReturnSuccess;
+	if (copyPublishedSnapshot(snapshot, maxStalenessMS, sampleTime))
+		return kIOReturnSuccess;
+
+	// Stale: one reader goes to the bus, the rest wait here and then find
+	// what it published instead of queueing up on the bus lock themselves.
+	IOLockLock(fSampleLock);
+
+	if (!copyPublishedSnapshot(snapshot, maxStalenessMS, sampleTime))
+	{
+		if (kIOReturnSuccess == (status = readSensorSnapshot(snapshot)))
+		{
+			publishSnapshot(snapshot, true);
+			if (sampleTime)
+				*sampleTime = fPublishedTime;
+		}
+	}
+
+	IOLockUnlock(fSampleLock);
+	return status;
 }
 
-IOReturn IOI2CADT746x::getVoltage(SInt32 *voltage)
+void IOI2CADT746x::decodeSensorSnapshot(const UInt8 *sensorBlock, const UInt8 *extBlock,
+		ADT746xSensorSnapshot *snapshot)
 {
-	UInt8 		fullByte, ext, dummybyte, config4, config2;
+	UInt8		ext1 = extBlock[kExtendedRes1 - kExtResBlockStart];
+	UInt8		ext2 = extBlock[kExtendedRes2 - kExtResBlockStart];
+	UInt8		vccReadAddr;
 	UInt32		volIndex;
 	UInt32		incrementsPerVolt;
-	UInt8		vccReadAddr;
-	IOReturn	status;
-	UInt32		key;
-        
-	if (voltage == NULL)
-		return kIOReturnBadArgument;
+	UInt16		fullValue;
+	UInt16		fanWhole;
+	int			i;
+
+	#define SENSOR_BYTE(reg)	(sensorBlock[(reg) - kSensorBlockStart])
 
-	if (kIOReturnSuccess == (status = lockI2CBus(&key)))
+	snapshot->localTemp = SIGNED_TEMP_FROM_BYTES((SInt8)SENSOR_BYTE(kLocalTemperature), LOCAL_FROM_EXT_TEMP(ext2));
+	snapshot->remote1Temp = SIGNED_TEMP_FROM_BYTES((SInt8)SENSOR_BYTE(kRemote1Temp), REMOTE1_FROM_EXT_TEMP(ext2));
+	snapshot->remote2Temp = SIGNED_TEMP_FROM_BYTES((SInt8)SENSOR_BYTE(kRemote2Temp), REMOTE2_FROM_EXT_TEMP(ext2));
+
+	// Are we a 7460 or a 7467
+	vccReadAddr = ((fDeviceID == kDeviceIDADT7460) ? k2_5VReading : k2_5VccpReading );
+
+	volIndex = (SInt32) VOLTAGE_INDEX_FROM_BYTES(SENSOR_BYTE(vccReadAddr), ext1) * 100;
+
+	if (fDeviceID == kDeviceIDADT7460)			// Voltage calculations for a 7460
 	{
-		if (fDeviceID == 0xFF) 			// Something went wrong first time, try it again.
-			status = readI2C(kDeviceIDReg, &fDeviceID, 1, key);
-
-        // Are we a 7460 or a 7467
-        vccReadAddr = ((fDeviceID == kDeviceIDADT7460) ? k2_5VReading : k2_5VccpReading );
-    
-		// extended needs to be read first, it will freeze the other two voltage registers till all are read.
-
-		// Read the config4 reg
-		if (kIOReturnSuccess != (status = readI2C(kConfigReg4, &config4, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getVoltage i2c read config1 A:0x%x error:0x%x\n", getI2CAddress(), kConfigReg1, status);
-		else // Read the config2 reg
-		if (kIOReturnSuccess != (status = readI2C(kConfigReg2, &config2, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getVoltage i2c read config2 A:0x%x error:0x%x\n", getI2CAddress(), kConfigReg2, status);
-		else // Read the extended resolution reg
-		if (kIOReturnSuccess != (status = readI2C(kExtendedRes1, &ext, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getVoltage i2c read kExtendedRes1 A:0x%x error:0x%x\n", getI2CAddress(), kExtendedRes1, status);
-		else // Read the local temp reg
-		if (kIOReturnSuccess != (status = readI2C(vccReadAddr, &fullByte, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getVoltage i2c read vccReadAddr A:0x%x error:0x%x\n", getI2CAddress(), vccReadAddr, status);
-
-		// Now we read the other two so that we can unstick the frozen sampling.
-		else // Read the local temp reg
-		if (kIOReturnSuccess != (status = readI2C(kVccReading, &dummybyte, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getVoltage i2c read kVccReading A:0x%x error:0x%x\n", getI2CAddress(), kVccReading, status);
-
-		// Should we do anything if we did fail?
-
-		unlockI2CBus(key);
+		if ((fConfig2 & k2_5VAttenuationMask) != 0)
+			incrementsPerVolt = kIncrementPerVolt2_25Max;
+		else
+			incrementsPerVolt = kIncrementPerVolt3_3Max;
 	}
-
-	if (kIOReturnSuccess != status)
+	else										// Voltage calculations for a 7467
 	{
-		return status;
+		// getVoltage also tested (kConfigReg4 & k2_5VAttenuationMask), the register's address
+		// rather than its contents, which is always true: a 7467 has always been scaled as attenuated.
+		incrementsPerVolt = kUnitsPerVoltWithAttenuation7467;
 	}
 
- 	volIndex = (SInt32) VOLTAGE_INDEX_FROM_BYTES(fullByte, ext) * 100;
-
-    if (fDeviceID == kDeviceIDADT7460)			// Voltage calculations for a 7460
-    {
-        if ((config2 & k2_5VAttenuationMask) != 0)
-            incrementsPerVolt = kIncrementPerVolt2_25Max;
-        else
-            incrementsPerVolt = kIncrementPerVolt3_3Max;
-    }
-    else										// Voltage calculations for a 7467
-    {
-        if (((config2 & k2_5VAttenuationMask) != 0) || ((kConfigReg4 & k2_5VAttenuationMask) != 0))
-            incrementsPerVolt = kUnitsPerVoltWithAttenuation7467;
-        else
-            incrementsPerVolt = kUnitsPerVoltWithoutAttenuation7467;
-    }
-    
-    *voltage = ((volIndex << 16) / incrementsPerVolt);
+	snapshot->voltage = ((volIndex << 16) / incrementsPerVolt);
 
-	return kIOReturnSuccess;
+	for (i = 0; i < 4; i++)
+	{
+		fullValue = ((UInt16)SENSOR_BYTE(kTACH1HighByte + (i * 2)) << 8) | SENSOR_BYTE(kTACH1LowByte + (i * 2));
+		if ((fullValue == 0xFFFF) || (fullValue == 0x0))		// Fan not spinning or stalled
+			fanWhole = 0;
+		else
+			fanWhole = ((90000 * 60) / fullValue);			// 90K based on 11.11 microsec timing period
+
+		snapshot->fanTach[i] = (fanWhole << 16);				// Fixed number, so shift it high.
+	}
+
+	#undef SENSOR_BYTE
 }
 
-IOReturn IOI2CADT746x::getLocalTemp(SInt32 *temperature)
+IOReturn IOI2CADT746x::getFanTach(SInt32 *fanSpeed, SInt16 whichFan)
 {
-    SInt8 highbyte;
-	UInt8 lowbyte, ext, dummybyte;
-	SInt32 sensor_value;
-	IOReturn	status;
-	UInt32		key;
+	ADT746xSensorSnapshot	snapshot;
+	IOReturn				status;
 
-	if (temperature == NULL)
+	if (fanSpeed == NULL)
 		return kIOReturnBadArgument;
 
-	if (kIOReturnSuccess == (status = lockI2CBus(&key)))
+	if ((whichFan != kFanTachOne) && (whichFan != kFanTachTwo))
 	{
-		// As per the documentation on the ADT7460 chip once the extended register is read, all
-		// three remaining thermal registers must also be read, and sampling is stalled until that happens.
-		// Extended needs to be read first, it will freeze the other three registers till all are read.
-
-		// Read the extended resolution reg
-		if (kIOReturnSuccess != (status = readI2C(kExtendedRes2, &ext, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getLocalTemp i2c read kExtendedRes2 A:0x%x error:0x%x\n", getI2CAddress(), kExtendedRes2, status);
-		else // Read the local temp reg
-		if (kIOReturnSuccess != (status = readI2C(kLocalTemperature, (UInt8 *)&highbyte, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getLocalTemp i2c read kLocalTemperature A:0x%x error:0x%x\n", getI2CAddress(), kLocalTemperature, status);
-		else // Read the kRemote1Temp reg
-		if (kIOReturnSuccess != (status = readI2C(kRemote1Temp, &dummybyte, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getLocalTemp i2c read kRemote1Temp A:0x%x error:0x%x\n", getI2CAddress(), kRemote1Temp, status);
-		else // Read the kRemote2Temp reg
-		if (kIOReturnSuccess != (status = readI2C(kRemote2Temp, &dummybyte, 1, key)))
-			ERRLOG("IOI2CADT746x@%lx::getLocalTemp i2c read kRemote2Temp A:0x%x error:0x%x\n", getI2CAddress(), kRemote2Temp, status);
-
-		unlockI2CBus(key);
+		// We can only read first two tachs right now.
+		*fanSpeed = -1;
+		return kIOReturnUnsupported;
 	}
 
-	if (kIOReturnSuccess != status)
+	if (kIOReturnSuccess != (status = getSensorSnapshot(&snapshot, fMaxStalenessMS)))
+	{
+		*fanSpeed = -1;
 		return status;
+	}
+
+	*fanSpeed = snapshot.fanTach[whichFan - kFanTachOne];
+	return kIOReturnSuccess;
+}
 
-	lowbyte = LOCAL_FROM_EXT_TEMP(ext);
-	sensor_value = SIGNED_TEMP_FROM_BYTES(highbyte, lowbyte);
+IOReturn IOI2CADT746x::getVoltage(SInt32 *voltage)
+{
+	ADT746xSensorSnapshot	snapshot;
+	IOReturn				status;
+
+	if (voltage == NULL)
+		return kIOReturnBadArgument;
+
+	if (kIOReturnSuccess != (status = getSensorSnapshot(&snapshot, fMaxStalenessMS)))
+		return status;
 
-	*temperature = sensor_value;
+	*voltage = snapshot.voltage;
 	return kIOReturnSuccess;
 }
 
-IOReturn IOI2CADT746x::getRemote1Temp(SInt32 *temperature)
+IOReturn IOI2CADT746x::getLocalTemp(SInt32 *temperature)
 {
-    SInt8 highbyte;
-	UInt8 lowbyte, ext, dummybyte;
-	SInt32 sensor_value;
-	IOReturn status;
+	ADT746xSensorSnapshot	snapshot;
+	IOReturn				status;
 
 	if (temperature == NULL)
 		return kIOReturnBadArgument;
 
-	// extended needs to be read first, it will freeze the other three registers till all are read.
-        
-	// Read the extended resolution reg
-	if (kIOReturnSuccess != (status = readI2C(kExtendedRes2, &ext, 1)))
-		ERRLOG("IOI2CADT746x::getRemote1Temp error:0x%lx reading I2C reg:%d\n", (UInt32)status, kExtendedRes2);
-
-	// Read the remote 1 temp reg
-	if (kIOReturnSuccess != (status = readI2C(kRemote1Temp, (UInt8 *) &highbyte, 1)))
-		ERRLOG("IOI2CADT746x::getRemote1Temp error:0x%lx reading I2C reg:%d\n", (UInt32)status, kRemote1Temp);
+	if (kIOReturnSuccess != (status = getSensorSnapshot(&snapshot, fMaxStalenessMS)))
+		return status;
 
-	// Now we read the other two so that we can unstick the frozen sampling.
+	*temperature = snapshot.localTemp;
+	return kIOReturnSuccess;
+}
 
-	readI2C(kLocalTemperature, &dummybyte, 1);	// Should we do anything if we did fail?
-	readI2C(kRemote2Temp, &dummybyte, 1);		// Should we do anything if we did fail?
+IOReturn IOI2CADT746x::getRemote1Temp(SInt32 *temperature)
+{
+	ADT746xSensorSnapshot	snapshot;
+	IOReturn				status;
 
-	// As per the documentation on the ADT7460 chip once the extended register is read, all
-	// three remaining thermal registers must also be read, and sampling is stalled until
-	// that happens.
+	if (temperature == NULL)
+		return kIOReturnBadArgument;
 
-	if (status != kIOReturnSuccess)
+	if (kIOReturnSuccess != (status = getSensorSnapshot(&snapshot, fMaxStalenessMS)))
 		return status;
 
-	lowbyte = REMOTE1_FROM_EXT_TEMP(ext);
-	sensor_value = SIGNED_TEMP_FROM_BYTES(highbyte, lowbyte);
-
-	*temperature = sensor_value;
+	*temperature = snapshot.remote1Temp;
 	return kIOReturnSuccess;
 }
 
 IOReturn IOI2CADT746x::getRemote2Temp(SInt32 *temperature)
 {
-    SInt8 highbyte;
-	UInt8 lowbyte, ext, dummybyte;
-	SInt32 sensor_value;
-	IOReturn status;
+	ADT746xSensorSnapshot	snapshot;
+	IOReturn				status;
 
 	if (temperature == NULL)
 		return kIOReturnBadArgument;
 
-	// extended needs to be read first, it will freeze the other three registers till all are read.
-        
-    // Read the extended resolution reg
-	if (kIOReturnSuccess != (status = readI2C(kExtendedRes2, &ext, 1)))
-		ERRLOG("IOI2CADT746x::getRemote2Temp error:0x%lx reading I2C reg:%d\n", (UInt32)status, kExtendedRes2);
-
-	// Read the remote 2 temp reg
-	if (kIOReturnSuccess != (status = readI2C(kRemote2Temp, (UInt8 *) &highbyte, 1)))
-		ERRLOG("IOI2CADT746x::getRemote2Temp error:0x%lx reading I2C reg:%d\n", (UInt32)status, kRemote2Temp);
-
-	// Now we read the other two so that we can unstick the frozen sampling.
-                
-	readI2C(kRemote1Temp, &dummybyte, 1);		// Should we do anything if we did fail?
-	readI2C(kLocalTemperature, &dummybyte, 1);	// Should we do anything if we did fail?
-            
-	// As per the documentation on the ADT7460 chip once the extended register is read, all
-	// three remaining thermal registers must also be read, and sampling is stalled until
-	// that happens.
-
-	if (status != kIOReturnSuccess)
+	if (kIOReturnSuccess != (status = getSensorSnapshot(&snapshot, fMaxStalenessMS)))
 		return status;
 
-	lowbyte = REMOTE2_FROM_EXT_TEMP(ext);
-	sensor_value = SIGNED_TEMP_FROM_BYTES(highbyte, lowbyte);
-
-	*temperature = sensor_value;
-
-    return kIOReturnSuccess;
+	*temperature = snapshot.remote2Temp;
+	return kIOReturnSuccess;
 }
 
 void IOI2CADT746x::processPowerEvent(UInt32 eventType)
@@ -564,6 +642,17 @@ void IOI2CADT746x::processPowerEvent(UInt32 eventType)
 		case kI2CPowerEvent_WAKE:
 			fClearSMBAlertStatus = true;	// 3944335 Need to setup to clear SMB alerts on wake.
 			break;
+
+		case kI2CPowerEvent_OFF:
+		case kI2CPowerEvent_SLEEP:
+			// Nothing read before sleep is worth handing out after wake
+			if (fSampleLock)
+			{
+				IOLockLock(fSampleLock);
+				publishSnapshot(NULL, false);
+				IOLockUnlock(fSampleLock);
+			}
+			break;
 	}
 }
 
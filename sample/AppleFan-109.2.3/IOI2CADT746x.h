@@ -40,6 +40,24 @@
 
 #define kNumRetries 10	// I2C transactions are retried before failing
 
+/*
+ * Sensor queries are answered from the last published snapshot while it
+ * is younger than this. Overridden by a "sensor-max-staleness-ms" number
+ * in the driver personality.
+ */
+#define kMaxStalenessKey			"sensor-max-staleness-ms"
+#define kDefaultMaxStalenessMS		500
+
+/*
+ * Full memory barrier for the published snapshot sequence lock. eieio
+ * (OSSynchronizeIO) does not order loads from cacheable memory.
+ */
+#if defined(__ppc__)
+#define ADT746X_MEMORY_BARRIER()	__asm__ volatile("sync" : : : "memory")
+#else
+#define ADT746X_MEMORY_BARRIER()	__asm__ volatile("mfence" : : : "memory")
+#endif
+
 /*
  * If we find a property key "playform-getTemp" in our provider's node,
  * we DO NOT want to load.  That is AppleFan territory.
@@ -88,6 +106,20 @@ enum {
 	kHWSensorPollingPeriodNULL = 0xFFFFFFFF
 };
 
+/*
+ * One decoded reading of every sensor on the chip, taken from a single
+ * pair of burst reads (see IOI2CADT746x::readSensorSnapshot).
+ */
+typedef struct
+{
+	SInt32	localTemp;		// 16.16 fixed point degrees C
+	SInt32	remote1Temp;	// 16.16 fixed point degrees C
+	SInt32	remote2Temp;	// 16.16 fixed point degrees C
+	SInt32	voltage;		// 16.16 fixed point volts
+	SInt32	fanTach[4];		// 16.16 fixed point RPM, 0 if stalled or not connected
+
+} ADT746xSensorSnapshot;
+
 class IOI2CADT746x : public IOI2CDevice
 {
 
@@ -101,6 +133,10 @@ class IOI2CADT746x : public IOI2CDevice
 		// to make sure we reset its status as approprate.
 	
 		bool	fClearSMBAlertStatus; 
+
+		// Contents of Configuration Register 2, only the attenuation bit is
+		// used to scale voltage readings. Read at start and on wake.
+		UInt8	fConfig2;
 	
 		// We need a way to map a hwsensor-id onto a temperature
 		// channel.  This is done by assuming that the sensors are
@@ -112,6 +148,18 @@ class IOI2CADT746x : public IOI2CDevice
 		// responsible for populating this array with the sensor ids
 		// from the device tree.
 		UInt32 fHWSensorIDMap[6];
+
+		// Last snapshot read off the bus, published with a sequence lock so
+		// any number of sensor queries can copy it without the bus lock. The
+		// sequence is odd while it is being written; only the holder of
+		// fSampleLock writes it. fPublishedDeadline is when it goes stale,
+		// zero if there is nothing valid to copy.
+		volatile UInt32			fSnapshotSequence;
+		ADT746xSensorSnapshot	fPublishedSnapshot;
+		AbsoluteTime			fPublishedTime;
+		AbsoluteTime			fPublishedDeadline;
+		UInt32					fMaxStalenessMS;
+		IOLock					*fSampleLock;
 	
 		const OSSymbol *getSensorValueSymbol;
 	
@@ -138,15 +186,47 @@ class IOI2CADT746x : public IOI2CDevice
 	
 		IOReturn getFanTach(SInt32 *fanSpeed, SInt16 whichFan);
 
+		void decodeSensorSnapshot(const UInt8 *sensorBlock, const UInt8 *extBlock,
+				ADT746xSensorSnapshot *snapshot);
+
+		// Called with fSampleLock held.
+		void publishSnapshot(const ADT746xSensorSnapshot *snapshot, bool valid);
+
+		// Lock free copy of the published snapshot, false if there is none
+		// or it was sampled longer than maxStalenessMS ago.
+		bool copyPublishedSnapshot(ADT746xSensorSnapshot *snapshot,
+				UInt32 maxStalenessMS, AbsoluteTime *sampleTime);
+
 		virtual void processPowerEvent(UInt32 eventType);
 	
 	public:
 		virtual bool start(IOService *provider);
-//		virtual void free(void);
+		virtual void free(void);
 	
-		virtual IOReturn callPlatformFunction(const OSSymbol *functionName,
+		// getSensorValue, registered with registerI2CFunction so that
+		// IOI2CDevice::callPlatformFunction finds it with one lookup.
+		// Sensor IDs that are not ours go on to the provider.
+		IOReturn getSensorValue(const OSSymbol *functionName,
 				bool waitForFunction, void *param1, void *param2,
 				void *param3, void *param4);
+
+		static IOReturn sGetSensorValue(OSObject *target, const OSSymbol *functionName,
+				bool waitForFunction, void *param1, void *param2,
+				void *param3, void *param4);
+
+		// Reads the whole sensor block (0x20-0x2F) and the extended resolution
+		// registers (0x76-0x77) in two combined mode transactions under one bus
+		// lock, and decodes every temperature, voltage and tach from them.
+		// Pass a key from lockI2CBus to read under a lock the caller holds.
+		IOReturn readSensorSnapshot(ADT746xSensorSnapshot *snapshot,
+				UInt32 clientKey = kIOI2C_CLIENT_KEY_DEFAULT);
+
+		// Returns the published snapshot if it is at most maxStalenessMS old,
+		// otherwise one reader samples the chip and publishes for the others
+		// waiting on it. The fast path takes no lock at all. sampleTime, if
+		// not NULL, gets the uptime the snapshot was read at.
+		IOReturn getSensorSnapshot(ADT746xSensorSnapshot *snapshot,
+				UInt32 maxStalenessMS, AbsoluteTime *sampleTime = NULL);
 };
 
 #endif	// _APPLEADT746x_H
@@ -46,6 +46,25 @@ OSDefineMetaClassAndStructors( PPCI2CInterface, IOService )
 // Delay after accessing to an I2C register
 #define I2C_REGISTERDELAY 10
 
+// Completion waits spin, polling every kI2CSpinStepUS, for about twice the
+// time the transfer is expected to take (never more than kI2CMaxSpinUS)
+// before they fall back to sleeping or blocking. A short transfer at
+// 100 kHz is over in a few hundred microseconds, well before an IOSleep(1)
+// or a semaphore wakeup would return.
+#define kI2CSpinStepUS		10
+#define kI2CMaxSpinUS		2000
+#define kI2CBitsPerByte		9		// 8 data bits and the acknowledge
+#define kI2CWireBytes(len)	((len) + 2)	// address and sub-address go out first
+
+static uint64_t I2CUptimeNS(void)
+{
+	uint64_t now, nano;
+
+	clock_get_uptime (&now);
+	absolutetime_to_nanoseconds (now, &nano);
+	return nano;
+}
+
 // Private Methods:
 // ===============
 
@@ -592,7 +611,11 @@ PPCI2CInterface::i2cStandardSubModeInterrupts(UInt8 interruptStatus)
 
             setInterruptStatus(kIStopISR);
             currentState = ki2cStateIdle;
-            semaphore_signal(mySync);
+
+            // the polled waiters watch currentState, only an interrupt
+            // driven transfer waits on the semaphore
+            if (!pollingMode)
+                semaphore_signal(mySync);
            break;
 
         case ki2cStateWaitingForISTART:
@@ -631,6 +654,41 @@ PPCI2CInterface::abortTransfer()
     return false;
 }
 
+// --------------------------------------------------------------------------
+// Method: spinBudgetUS
+//
+// Purpose:
+//        how long to spin on a transfer of wireBytes before giving up the CPU.
+UInt32
+PPCI2CInterface::spinBudgetUS(UInt16 wireBytes)
+{
+    UInt32 budget = (2 * completionNSPerByte * wireBytes) / 1000;
+
+    if (budget < kI2CSpinStepUS)
+        budget = kI2CSpinStepUS;
+    else if (budget > kI2CMaxSpinUS)
+        budget = kI2CMaxSpinUS;
+
+    return budget;
+}
+
+// --------------------------------------------------------------------------
+// Method: learnCompletion
+//
+// Purpose:
+//        moves the expected time per byte a quarter of the way towards
+//        what the last transfer took.
+void
+PPCI2CInterface::learnCompletion(UInt64 elapsedNS, UInt16 wireBytes)
+{
+    SInt64 perByte = elapsedNS / wireBytes;
+
+    if (perByte > 0xFFFFFFFFLL)
+        perByte = 0xFFFFFFFFLL;
+
+    completionNSPerByte += (SInt32)((perByte - (SInt64)completionNSPerByte) / 4);
+}
+
 // --------------------------------------------------------------------------
 // Method: waitForCompletion
 //
@@ -638,12 +696,17 @@ PPCI2CInterface::abortTransfer()
 //        waits until the last command was executed correctly and when it
 //        happens it calls the interrupt handler. This is useful for when
 //        we use this object without an interrupt handler.
+//        The status is polled every few microseconds for as long as the
+//        transfer should take, then once per millisecond for slow parts.
 bool
 PPCI2CInterface::waitForCompletion()
 {
     // increase timeout for AppleTexasAudio (part can take seconds to come back)
     // UInt16 loop = 50 + nBytes * 1500;   //Old timeout
 	UInt16 loop = waitTime;   	// New timeout is variable			   
+	UInt16 wireBytes = kI2CWireBytes(nBytes);
+	uint64_t start = I2CUptimeNS();
+	uint64_t spinEnd = start + (uint64_t)spinBudgetUS(wireBytes) * 1000;
     
     UInt8 intStat = getInterruptStatus();
  
@@ -654,7 +717,17 @@ PPCI2CInterface::waitForCompletion()
     if (intStat & kISRMask)
         handleI2CInterrupt();
 
-    // makes 10 loops for each expected interrupt with 1 millisecond delay for each loop:
+    // spin while the transfer should still be on the wire:
+    while ((currentState != ki2cStateIdle) && (I2CUptimeNS() < spinEnd)) {
+		I2CIODelay (kI2CSpinStepUS);
+
+        intStat = getInterruptStatus();
+
+        if (intStat & kISRMask)
+            handleI2CInterrupt();
+    }
+
+    // then 1 millisecond per loop for parts that stretch the clock:
     while((loop--) && (currentState != ki2cStateIdle)) {
 		// If at interrupt context, use spin delay instead of sleep
 		if (ml_at_interrupt_context())
@@ -679,10 +752,45 @@ PPCI2CInterface::waitForCompletion()
 #ifdef DEBUGMODE
         IOLog("PPCI2CInterface::waitForCompletion loop is complete\n");
 #endif
+        learnCompletion(I2CUptimeNS() - start, wireBytes);
         return true;        
     }
 }
 
+// --------------------------------------------------------------------------
+// Method: waitForInterruptCompletion
+//
+// Purpose:
+//        waits for the interrupt handler to finish the transfer. Spins first,
+//        since a short transfer completes before a block and wakeup would,
+//        then blocks on mySync for up to waitTime milliseconds.
+bool
+PPCI2CInterface::waitForInterruptCompletion(UInt16 wireBytes)
+{
+	mach_timespec_t  timeout;
+	uint64_t start = I2CUptimeNS();
+	uint64_t spinEnd = start + (uint64_t)spinBudgetUS(wireBytes) * 1000;
+
+    while ((currentState != ki2cStateIdle) && (I2CUptimeNS() < spinEnd))
+		IODelay (kI2CSpinStepUS);
+
+    // the interrupt handler has signalled already if the transfer is done,
+    // so this returns at once in that case
+	timeout.tv_sec = waitTime / 1000;
+	timeout.tv_nsec = (waitTime % 1000) * 1000000;
+
+    if (0 != semaphore_timedwait( mySync, timeout )) {
+        // A late ISTOP would signal the next transfer early, start that
+        // one with a fresh semaphore instead
+        semaphore_destroy(current_task(), mySync);
+        semaphore_create(current_task(), (semaphore**)&mySync, SYNC_POLICY_FIFO, 0);
+        return false;
+    }
+
+    learnCompletion(I2CUptimeNS() - start, wireBytes);
+    return true;
+}
+
 // Protected setup methods:
 // These instead set the speed:
 bool
@@ -711,6 +819,9 @@ PPCI2CInterface::setKhzSpeed(UInt speed)
             break;
     }
 
+    // what a byte takes on the wire at this speed, until transfers tell otherwise
+    completionNSPerByte = (kI2CBitsPerByte * 1000000) / speed;
+
     return true;
 }
 
@@ -808,6 +919,12 @@ PPCI2CInterface::start(IOService *provider)
     }
     IORecursiveLockLock(mutexLock);  //Keep clients from accessing until start is complete
 
+    // Interrupt driven transfers wait on this, signalled from the interrupt handler
+    if (KERN_SUCCESS != semaphore_create(current_task(), (semaphore**)&mySync, SYNC_POLICY_FIFO, 0)) {
+        IORecursiveLockUnlock(mutexLock);
+        return false;
+    }
+
 #ifdef DEBUGMODE
     IOLog("PPCI2CInterface::start(%s)\n", provider->getName());
 #endif
@@ -1017,6 +1134,11 @@ PPCI2CInterface::free()
     if (mutexLock != NULL)
         IORecursiveLockFree(mutexLock);
 
+    if (mySync != 0) {
+        semaphore_destroy(current_task(), mySync);
+        mySync = 0;
+    }
+
     if (i2cRegisterMap != NULL)
         i2cRegisterMap->release();
         
@@ -1310,7 +1432,6 @@ PPCI2CInterface::openI2CBus(UInt8 port)
 bool
 PPCI2CInterface::writeI2CBus(UInt8 address, UInt8 subAddress, UInt8 *newData, UInt16 len)
 {    
-	mach_timespec_t  timeout;
 	// Don't check lock if I'm being called at interrupt context - if you're calling me at interrupt context
 	// you better know what you're doing
 	if (!ml_at_interrupt_context())
@@ -1359,42 +1480,20 @@ PPCI2CInterface::writeI2CBus(UInt8 address, UInt8 subAddress, UInt8 *newData, UI
         }
     }
     else {
-        // We are interrupt driven, so create the syncer so
-        // that we know we will wait here until the transfer is
-        // finished
-        semaphore_create(current_task(), (semaphore**)&mySync, SYNC_POLICY_FIFO, 0);
+        // We are interrupt driven, the interrupt handler runs the transfer
+        // and signals mySync when it is finished
 
         // Enables the interrupts:
         myProvider->enableInterrupt(0);
 
         if ((success = setAddressAndDirection()) == true ) {
-            // Waits until the transfer is finished (look in the interrupt driver where this
-            // gets the signal).
-            //semaphore_wait(mySync);
-			timeout.tv_sec = waitTime/1000;  // 15 second timeout
-			timeout.tv_nsec = 0;
-
-            if (0 != semaphore_timedwait( mySync, timeout ))  {
-				// timeout exceeded
-				success = false;
-				semaphore_destroy(current_task(), mySync);  // JUST SO IOLOG IS OK
-				myProvider->disableInterrupt(0);   // JUST SO IOLOG IS OK
+            if (!(success = waitForInterruptCompletion(kI2CWireBytes(len))))
 				kprintf("APPLE I2C WRITE SEMAPHORE EXCEEDED TIMEOUT OR OTHER ERROR\n");
-				}
-			else 
-				{
-				semaphore_destroy(current_task(), mySync); // JUST SO IOLOG IS OK
-				myProvider->disableInterrupt(0); // JUST SO IOLOG IS OK
-				}
-       } else {
-
-        // Since we are here we had been already uunblocked and we
-        // do not need the semaphore anymore:
-        semaphore_destroy(current_task(), mySync);
+        }
 
         // We do not need interrupts anymore so:
         myProvider->disableInterrupt(0);
-		}
+
 		if (!(transferWasSuccesful && success))
 			kprintf("APPLE I2C WRITE FAILED INTERRUPT TRANSFER, address = 0x%2x\n", address);
 
@@ -1406,7 +1505,6 @@ PPCI2CInterface::writeI2CBus(UInt8 address, UInt8 subAddress, UInt8 *newData, UI
 bool
 PPCI2CInterface::readI2CBus(UInt8 address, UInt8 subAddress, UInt8 *newData, UInt16 len)
 {
-	mach_timespec_t  timeout;
 	// Don't check lock if I'm being called at interrupt context - if you're calling me at interrupt context
 	// you better know what you're doing
 	if (!ml_at_interrupt_context())
@@ -1461,42 +1559,20 @@ PPCI2CInterface::readI2CBus(UInt8 address, UInt8 subAddress, UInt8 *newData, UIn
         // Later, we should start a timer that will fire if no data has arrived.
         // return false;
 
-        // We are interrupt driven, so create the syncer so
-        // that we know we will wait here until the transfer is
-        // finished
-        semaphore_create(current_task(), (semaphore**)&mySync, SYNC_POLICY_FIFO, 0);
+        // We are interrupt driven, the interrupt handler runs the transfer
+        // and signals mySync when it is finished
 
         // Enables the interrupts:
         myProvider->enableInterrupt(0);
 
         if ((success = setAddressAndDirection()) == true ) {
-            // Waits until the transfer is finished (look in the interrupt driver where this
-            // gets the signal).
-            //semaphore_wait(mySync);
-			timeout.tv_sec = waitTime/1000;  // 15 second timeout
-			timeout.tv_nsec = 0;
-
-            if (0 != semaphore_timedwait( mySync, timeout ))  {
-				// timeout exceeded
-				success = false;
-				semaphore_destroy(current_task(), mySync);  // JUST SO IOLOG IS OK
-				myProvider->disableInterrupt(0);   // JUST SO IOLOG IS OK
+            if (!(success = waitForInterruptCompletion(kI2CWireBytes(len))))
 				kprintf("APPLE I2C READ SEMAPHORE EXCEEDED TIMEOUT OR OTHER ERROR\n");
-				}
-			else 
-				{
-				semaphore_destroy(current_task(), mySync); // JUST SO IOLOG IS OK
-				myProvider->disableInterrupt(0); // JUST SO IOLOG IS OK
-				}
-       } else {
-
-        // Since we are here we had been already uunblocked and we
-        // do not need the semaphore anymore:
-        semaphore_destroy(current_task(), mySync);
+        }
 
         // We do not need interrupts anymore so:
         myProvider->disableInterrupt(0);
-		}
+
 		if (!(transferWasSuccesful && success))
 			kprintf("APPLE I2C READ FAILED INTERRUPT TRANSFER, address = 0x%2x, bus = %s\n", address, (i2cUniN ? "UniN" : "MacIO"));
 
@@ -335,8 +335,14 @@ private:
     bool transferWasSuccesful;
 
     // When the driver is not in polling mode (so it is interrupt driven) the
-    // following assures that all the transactions are syncronous.
+    // following assures that all the transactions are syncronous. Created
+    // once in start and signalled from the interrupt handler on ISTOP.
     volatile semaphore_t mySync;
+
+    // How long the last transfers took, in nanoseconds per byte on the wire
+    // (including address and sub-address). Seeded from the bus speed and
+    // used to decide how long to spin before sleeping or blocking.
+    UInt32 completionNSPerByte;
     
     // This is a parameter used in memory cells and useless for
     // the mac-io. It's also the bus number in the PMU:
@@ -524,6 +530,15 @@ protected:
     // Waits for the completion of a read or write
     // operation:
     bool waitForCompletion();
+
+    // Same for an interrupt driven transfer: spins on the state the
+    // interrupt handler advances, then blocks on mySync.
+    bool waitForInterruptCompletion(UInt16 wireBytes);
+
+    // Spin budget for a transfer of wireBytes, and learning from one that
+    // completed after elapsedNS.
+    UInt32 spinBudgetUS(UInt16 wireBytes);
+    void learnCompletion(UInt64 elapsedNS, UInt16 wireBytes);
 	
     // Each mode requires a specific interrupt handler (since the states are different for each mode)
     // so here it is the one for the Standard + SubAddress mode:
@@ -41,6 +41,12 @@ bool IOPlatformMonitor::start(IOService *nub)
 		IOLog ("IOPlatformMonitor::start - no commandGateCaller\n");
 		return false;
 	}
+
+	// One worker, allocated once, drains every command posted from here on
+	if (((commandLock = IOSimpleLockAlloc ()) == NULL) ||
+		((commandWorker = thread_call_allocate (&drainCommandRing, (thread_call_param_t) this)) == NULL))
+		return false;
+	IOSimpleLockInit (commandLock);
 	
     // Creates the Workloop and attaches all the event handlers to it:
     // ---------------------------------------------------------------
@@ -81,6 +87,17 @@ bool IOPlatformMonitor::start(IOService *nub)
 // **********************************************************************************
 void IOPlatformMonitor::free()
 {
+	UInt32		i;
+
+	if (commandWorker) {
+		thread_call_cancel (commandWorker);
+		thread_call_free (commandWorker);
+	}
+	for (i = 0; i < commandCount; i++)
+		if (commandRing[(commandHead + i) % kIOPMonCommandRingSize].eventData.eventDict)
+			commandRing[(commandHead + i) % kIOPMonCommandRingSize].eventData.eventDict->release();
+	if (commandLock)
+		IOSimpleLockFree (commandLock);
 	if (commandGate)
 		commandGate->release();
 	if (workLoop)
@@ -181,22 +198,38 @@ IOReturn IOPlatformMonitor::monitorPower (OSDictionary *dict, IOService *provide
 }
 
 // **********************************************************************************
-// executeEventThread - thread created to send a runCommand to the commandGate
+// drainCommandRing - the one worker, sends each queued command to the commandGate
 //
 // **********************************************************************************
 /* static */
-void IOPlatformMonitor::executeCommandThread (IOPMonCommandThreadSet *threadSet)
+void IOPlatformMonitor::drainCommandRing (thread_call_param_t param0, thread_call_param_t param1)
 {
-	thread_call_t	workThreadCopy;
-	
-	// run the command - single threaded
-	threadSet->me->commandGate->runCommand (threadSet);
-	workThreadCopy = threadSet->workThread;					// remember our thread
-	if (threadSet->eventData.eventDict)
-		threadSet->eventData.eventDict->release();
-	IOFree (threadSet, sizeof (IOPMonCommandThreadSet));	// free the data
-	thread_call_free (workThreadCopy);						// kill ourself off
-	
+	IOPlatformMonitor			*me = (IOPlatformMonitor *) param0;
+	IOPMonCommandThreadSet		threadSet;
+	IOInterruptState			intState;
+
+	while (true) {
+		intState = IOSimpleLockLockDisableInterrupt (me->commandLock);
+		if (me->commandCount == 0) {
+			me->commandWorkerActive = false;				// the next post enters us again
+			IOSimpleLockUnlockEnableInterrupt (me->commandLock, intState);
+			break;
+		}
+		threadSet = me->commandRing[me->commandHead];		// take it out, it can no longer be merged into
+		me->commandHead = (me->commandHead + 1) % kIOPMonCommandRingSize;
+		me->commandCount--;
+		if (threadSet.command == kIOPMonCommandHandleEvent)
+			me->eventStats.processed++;
+		IOSimpleLockUnlockEnableInterrupt (me->commandLock, intState);
+
+		// run the command - single threaded
+		me->commandGate->runCommand (&threadSet);
+		if (threadSet.eventData.eventDict)
+			threadSet.eventData.eventDict->release();
+	}
+
+	me->publishEventStats ();
+	me->release ();											// taken when the worker was entered
 	return;
 }
 
@@ -216,14 +249,12 @@ bool IOPlatformMonitor::initPlatformState ()
 // **********************************************************************************
 void IOPlatformMonitor::savePlatformState ()
 {
-	IOPMonCommandThreadSet		*threadSet;
+	IOPMonCommandThreadSet		threadSet;
 		
-	// create the thread data - freed in executeCommandThread
-	if ((threadSet = (IOPMonCommandThreadSet *)IOMalloc (sizeof (IOPMonCommandThreadSet))) == NULL)
-		return;
-
-	threadSet->command = kIOPMonCommandSaveState;			// command to execute
-	threadCommon (threadSet);
+	// copied into the command ring
+	bzero (&threadSet, sizeof (threadSet));
+	threadSet.command = kIOPMonCommandSaveState;			// command to execute
+	threadCommon (&threadSet);
 	
 	return;
 }
@@ -234,14 +265,12 @@ void IOPlatformMonitor::savePlatformState ()
 // **********************************************************************************
 void IOPlatformMonitor::restorePlatformState ()
 {
-	IOPMonCommandThreadSet		*threadSet;
+	IOPMonCommandThreadSet		threadSet;
 		
-	// create the thread data - freed in executeCommandThread
-	if ((threadSet = (IOPMonCommandThreadSet *)IOMalloc (sizeof (IOPMonCommandThreadSet))) == NULL)
-		return;
-
-	threadSet->command = kIOPMonCommandRestoreState;		// command to execute
-	threadCommon (threadSet);
+	// copied into the command ring
+	bzero (&threadSet, sizeof (threadSet));
+	threadSet.command = kIOPMonCommandRestoreState;		// command to execute
+	threadCommon (&threadSet);
 	
 	return;
 }
@@ -323,36 +352,201 @@ bool IOPlatformMonitor::retrieveCurrentValue (OSDictionary *dict, UInt32 *value)
 // **********************************************************************************
 IOReturn IOPlatformMonitor::handleEvent (IOPMonEventData *event)
 {
-	IOPMonCommandThreadSet		*threadSet;
+	IOPMonCommandThreadSet		threadSet;
 		
-	// create the thread data - freed in executeCommandThread
-	if ((threadSet = (IOPMonCommandThreadSet *)IOMalloc (sizeof (IOPMonCommandThreadSet))) == NULL)
-		return kIOReturnNoMemory;
+	// copied into the command ring
+	bzero (&threadSet, sizeof (threadSet));
+	threadSet.command = kIOPMonCommandHandleEvent;		// command to execute
+	threadSet.eventData = *event;						// private copy of event data
 
-	threadSet->command = kIOPMonCommandHandleEvent;		// command to execute
-	threadSet->eventData = *event;						// private copy of event data
-	threadCommon (threadSet);
+	// back-pressure: the sender learns the ring was full and the event lost
+	return threadCommon (&threadSet) ? kIOReturnSuccess : kIOReturnBusy;
+}
 
-	return kIOReturnSuccess;
+// **********************************************************************************
+// getEventStats
+//
+// **********************************************************************************
+void IOPlatformMonitor::getEventStats (IOPMonEventStats *stats)
+{
+	IOInterruptState			intState;
+
+	if (!commandLock) {
+		bzero (stats, sizeof (*stats));
+		return;
+	}
+
+	intState = IOSimpleLockLockDisableInterrupt (commandLock);
+	*stats = eventStats;
+	IOSimpleLockUnlockEnableInterrupt (commandLock, intState);
 }
 
 // **********************************************************************************
-// threadCommon
+// publishEventStats - copy the event counters into the registry
+//
+// Called by the worker each time it runs out of commands.  Two workers can
+// overlap here, so a snapshot can be replaced by an older one until the next
+// time; the counters only grow, so that is never more than one drain behind.
+//
+// **********************************************************************************
+void IOPlatformMonitor::publishEventStats ()
+{
+	IOPMonEventStats			stats;
+	OSDictionary				*dict;
+	OSNumber					*num;
+	UInt32						i;
+	const struct {
+		const char				*key;
+		UInt32					*value;
+	} counters[] = {
+		{ "received",	&stats.received },
+		{ "posted",		&stats.posted },
+		{ "coalesced",	&stats.coalesced },
+		{ "merged",		&stats.merged },
+		{ "dropped",	&stats.dropped },
+		{ "processed",	&stats.processed },
+		{ "high-water",	&stats.highWater },
+	};
+
+	getEventStats (&stats);
+	if ((dict = OSDictionary::withCapacity (sizeof (counters) / sizeof (counters[0]))) == NULL)
+		return;
+
+	for (i = 0; i < sizeof (counters) / sizeof (counters[0]); i++) {
+		if ((num = OSNumber::withNumber (*counters[i].value, 32)) != NULL) {
+			dict->setObject (counters[i].key, num);
+			num->release ();
+		}
+	}
+
+	setProperty (kIOPMonEventStatsKey, dict);
+	dict->release ();
+	return;
+}
+
+// **********************************************************************************
+// isThresholdEvent
+//
+// **********************************************************************************
+/* static */
+bool IOPlatformMonitor::isThresholdEvent (UInt32 event)
+{
+	return ((event == kIOPMonMessageLowThresholdHit) || (event == kIOPMonMessageHighThresholdHit));
+}
+
+// **********************************************************************************
+// sameEventSource - queued is an event of threadSet's type from the same sensor
+//
+// A low and a high threshold hit count as the same type: either one only tells
+// the handler the sensor's current value.  Called with commandLock held, so it
+// only compares what was looked up when the commands were posted.
+//
+// **********************************************************************************
+/* static */
+bool IOPlatformMonitor::sameEventSource (IOPMonCommandThreadSet *queued, IOPMonCommandThreadSet *threadSet)
+{
+	if ((queued->command != kIOPMonCommandHandleEvent) ||
+		(queued->eventData.conSensor != threadSet->eventData.conSensor))
+		return false;
+	if ((queued->eventData.event != threadSet->eventData.event) &&
+		!(isThresholdEvent (queued->eventData.event) && isThresholdEvent (threadSet->eventData.event)))
+		return false;
+
+	// one provider can speak for several sensors
+	return (queued->sensorID == threadSet->sensorID);
+}
+
+// **********************************************************************************
+// threadCommon - post a command to the worker
+//
+// Commands are copied into the ring and run in order by the one worker.  Events
+// may not take the last kIOPMonStateCommandReserve records, so a sleep or wake
+// can always be posted.  A threshold hit from a sensor that already has one
+// queued overwrites it in place: the handler only needs the newest value, and
+// would otherwise re-arm the thresholds once per stale one.  Any other event
+// that finds no room replaces the dictionary of a queued event of the same type
+// from the same sensor, or is dropped.  Neither looks past a queued sleep or wake:
+// an event posted after one is never run before it.  Returns false if it was
+// dropped.
 //
 // **********************************************************************************
 bool IOPlatformMonitor::threadCommon (IOPMonCommandThreadSet *threadSet)
 {
+	IOPMonCommandThreadSet		*queued;
+	OSDictionary				*unused;
+	IOInterruptState			intState;
+	UInt32						i, limit;
+	bool						isEvent, coalesce, posted = false, merged = false, enterWorker = false;
+
+	if (!commandLock || !commandWorker)
+		return false;
+
 	// Remember me
 	threadSet->me = this;								// object reference for static functions
-	threadSet->commandFunction = &executeCommandThread;	// function to execute
-	if (threadSet->eventData.eventDict)
-		threadSet->eventData.eventDict->retain();
-	threadSet->workThread = thread_call_allocate((thread_call_func_t)executeCommandThread, 
-		(thread_call_param_t)threadSet);				// create the thread
-	
-	thread_call_enter(threadSet->workThread);			// invoke it
-	
-	return true;
+	threadSet->workThread = commandWorker;
+	threadSet->commandFunction = NULL;
+	if ((unused = threadSet->eventData.eventDict) != NULL)
+		unused->retain();								// released by the worker, or below if not queued
+	if (!unused || !retrieveSensorIndex (unused, &threadSet->sensorID))
+		threadSet->sensorID = (UInt32) -1;
+
+	isEvent = (threadSet->command == kIOPMonCommandHandleEvent);
+	coalesce = isEvent && isThresholdEvent (threadSet->eventData.event);
+	limit = kIOPMonCommandRingSize;
+	if (isEvent)
+		limit -= kIOPMonStateCommandReserve;
+
+	intState = IOSimpleLockLockDisableInterrupt (commandLock);
+	if (isEvent)
+		eventStats.received++;
+
+	if (coalesce || (isEvent && (commandCount >= limit))) {
+		// newest first, the one the handler would see last
+		for (i = commandCount; i-- > 0; ) {
+			queued = &commandRing[(commandHead + i) % kIOPMonCommandRingSize];
+			if (queued->command != kIOPMonCommandHandleEvent)
+				break;									// never across a sleep or wake
+			if (sameEventSource (queued, threadSet)) {
+				unused = queued->eventData.eventDict;		// superseded
+				queued->eventData.event = threadSet->eventData.event;
+				queued->eventData.eventDict = threadSet->eventData.eventDict;
+				merged = true;
+				break;
+			}
+		}
+	}
+
+	if (merged) {
+		if (coalesce)
+			eventStats.coalesced++;
+		else
+			eventStats.merged++;
+	} else if (commandCount < limit) {
+		commandRing[(commandHead + commandCount) % kIOPMonCommandRingSize] = *threadSet;
+		commandCount++;
+		unused = NULL;
+		posted = true;
+
+		eventStats.posted++;
+		if (commandCount > eventStats.highWater)
+			eventStats.highWater = commandCount;
+
+		if (!commandWorkerActive)
+			commandWorkerActive = enterWorker = true;
+	} else
+		eventStats.dropped++;
+	IOSimpleLockUnlockEnableInterrupt (commandLock, intState);
+
+	if (enterWorker) {
+		retain ();										// released when the worker runs out of commands
+		thread_call_enter (commandWorker);
+	}
+
+	// dictionaries are never released with the lock held
+	if (unused)
+		unused->release();
+
+	return (posted || merged);
 }
 
 // **********************************************************************************
@@ -65,6 +65,7 @@
 #define kIOPMonHighThresholdKey		"high-threshold"
 #define kIOPMonThresholdValueKey	"threshold-value"
 #define kIOPMonCurrentValueKey		"current-value"
+#define kIOPMonEventStatsKey		"IOPMonEventStats"		// IOPMonEventStats, published when the worker runs out of commands
 
 enum {
 	kIOPMonMessageRegister			= 1,
@@ -168,6 +169,20 @@ typedef struct ConSensorInfo {
 
 typedef bool (*IOPlatformMonitorAction)( );
 
+// Commands waiting for the worker are kept in a ring preallocated with the monitor
+#define kIOPMonCommandRingSize		32
+#define kIOPMonStateCommandReserve	2		// Records only save and restore may take
+
+typedef struct IOPMonEventStats {
+	UInt32			received;				// Events handed to handleEvent
+	UInt32			posted;					// Commands queued for the worker
+	UInt32			coalesced;				// Threshold hits folded into the same sensor's queued threshold hit
+	UInt32			merged;					// Other events folded into a queued event of the same sensor and type, ring full
+	UInt32			dropped;				// Events refused with kIOReturnBusy, ring full and nothing to fold into
+	UInt32			processed;				// Events taken out of the ring by the worker
+	UInt32			highWater;				// Most commands queued at once
+} IOPMonEventStats;
+
 /*!
     @class IOPlatformMonitor
     @abstract A class for monitor system functions such as power and thermal */
@@ -194,12 +209,24 @@ typedef struct IOPMonCommandThreadSet {
 	thread_call_t				workThread;
 	IOPMonCommandFunctionType	commandFunction;
 	IOPMonEventData				eventData;
+	UInt32						sensorID;			// eventDict's sensor-id, looked up once when the command is posted
 };
 
 private:
 	bool retrieveValueByKey (const OSSymbol *key, OSDictionary *dict, UInt32 *value);
-	static void executeCommandThread (IOPMonCommandThreadSet *threadSet);
+	static void drainCommandRing (thread_call_param_t param0, thread_call_param_t param1);
 	virtual bool threadCommon (IOPMonCommandThreadSet *threadSet);	
+	static bool sameEventSource (IOPMonCommandThreadSet *queued, IOPMonCommandThreadSet *threadSet);
+	static bool isThresholdEvent (UInt32 event);
+	void publishEventStats ();
+
+	IOSimpleLock				*commandLock;		// Protects the ring, commandWorkerActive and eventStats
+	thread_call_t				commandWorker;		// Drains the ring, allocated once in start
+	IOPMonCommandThreadSet		commandRing[kIOPMonCommandRingSize];
+	UInt32						commandHead;		// Oldest queued command
+	UInt32						commandCount;
+	bool						commandWorkerActive;	// commandWorker entered and not yet out of commands
+	IOPMonEventStats			eventStats;
 
 protected:
 
@@ -293,6 +320,7 @@ public:
 	virtual IOReturn registerConSensor (OSDictionary *dict, IOService *conSensor);
 	virtual bool unregisterSensor (UInt32 sensorID);
 	virtual IOReturn handleEvent (IOPMonEventData *event);
+	void getEventStats (IOPMonEventStats *stats);
 	
 	
 };
@@ -850,14 +850,42 @@ bool Portable2004_PlatformMonitor::start ( IOService * nub )
 	publishResource ("IOPlatformMonitor", this);
 
 	if (super::start (nub)) {
+		IOTimerEventSource		*timer;
+
 		// pmRootDomain (found by our parent) is the recipient of GPU controller messages
 		conSensorArray[kGPUController].conSensor = pmRootDomain;
                 gIOPMon = this;
+
+		// Thermal thresholds are re-armed without a dwell until the timer is on the workloop
+		nanoseconds_to_absolutetime ((UInt64) kThermalMinDwellMS * 1000000ULL, &thermalDwell);
+		if ((timer = IOTimerEventSource::timerEventSource (this, &thermalDwellExpired)) != NULL) {
+			if (workLoop->addEventSource (timer) == kIOReturnSuccess)
+				thermalDwellTimer = timer;
+			else
+				timer->release ();
+		}
 		return true;
 	} else
 		return false;
 }
 
+// **********************************************************************************
+// free
+//
+// **********************************************************************************
+void Portable2004_PlatformMonitor::free ()
+{
+	if (thermalDwellTimer) {
+		thermalDwellTimer->cancelTimeout ();
+		workLoop->removeEventSource (thermalDwellTimer);
+		thermalDwellTimer->release ();
+		thermalDwellTimer = NULL;
+	}
+
+	super::free ();
+	return;
+}
+
 // **********************************************************************************
 // powerStateWillChangeTo
 //
@@ -1028,8 +1056,13 @@ bool Portable2004_PlatformMonitor::restoreThermalState ()
         // reset current thermal state to the initial state since we're starting fresh...
         currentThermalState = kThermalState0;
 
+	// a value held back by the dwell is from before the sleep
+	if (thermalDwellTimer)
+		thermalDwellTimer->cancelTimeout ();
+
 	// need to get updated info from sensors
 	for (i = 0; i < kMaxSensorIndex; i++) {
+		thermalHeld[i] = false;
 		if (subSensorArray[i].registered) { // Is sensor registered?
 			subSensorArray[i].state = kThermalState0;	//Set indeterminate state
 			
@@ -1334,7 +1367,12 @@ bool Portable2004_PlatformMonitor::adjustPlatformState ()
             UInt32 		i;
             OSNumber		*threshLow, *threshHigh;
             
+            // a value held back by the dwell is from the old clamshell state
+            if (thermalDwellTimer)
+                thermalDwellTimer->cancelTimeout ();
+
             for (i = 0; i < kMaxSensorIndex; i++) {
+                    thermalHeld[i] = false;
                     if (subSensorArray[i].registered) { // Is sensor registered?
                             subSensorArray[i].state = kMaxThermalStates;	//Set indeterminate state
                             
@@ -1595,9 +1633,8 @@ bool Portable2004_PlatformMonitor::handlePowerEvent (IOPMonEventData *eventData)
 // **********************************************************************************
 bool Portable2004_PlatformMonitor::handleThermalEvent (IOPMonEventData *eventData)
 {
-	UInt32					type, csi, subsi, myThermalState;
+	UInt32					type, csi, subsi;
 	ThermalValue			value;
-	OSNumber				*threshLow, *threshHigh;
 	bool					result;
 
         debug_msg("Portable2004_PlatformMonitor::handleThermalEvent - started\n");
@@ -1609,11 +1646,9 @@ bool Portable2004_PlatformMonitor::handleThermalEvent (IOPMonEventData *eventDat
 		case kIOPMonMessageLowThresholdHit:		
 		case kIOPMonMessageHighThresholdHit:
 			if (lookupConSensorInfo (eventData->eventDict, eventData->conSensor, &type, &csi, &subsi) &&
-				subSensorArray[subsi].registered) {
-				myThermalState = lookupThermalStateFromValue (subsi, value);
-				if (myThermalState >= kMaxSensorIndex)
-					result = false;
-			} else
+				subSensorArray[subsi].registered)
+				result = updateThermalSensor (subsi, value);
+			else
 				result = false;
 			break;
 				
@@ -1624,47 +1659,175 @@ bool Portable2004_PlatformMonitor::handleThermalEvent (IOPMonEventData *eventDat
 			break;
 	}
 	
-	if (result) {
-		if (myThermalState != subSensorArray[subsi].state) {
-			subSensorArray[subsi].state = myThermalState;
-			if (!subSensorArray[subsi].registered) 
-				// Not registered
-				return false;
-			
-			threshLow = (OSNumber *)subSensorArray[subsi].threshDict->getObject (gIOPMonLowThresholdKey);
-			threshLow->setValue((long long)thermalThresholdInfoArray[machineType][subsi][currentClamshellState][myThermalState].thresholdLow);
-			threshHigh = (OSNumber *)subSensorArray[subsi].threshDict->getObject (gIOPMonHighThresholdKey);
-			threshHigh->setValue((long long)thermalThresholdInfoArray[machineType][subsi][currentClamshellState][myThermalState].thresholdHigh);
-			// Send thresholds to sensor
-			subSensorArray[subsi].conSensor->setProperties (subSensorArray[subsi].threshDict);
+	return result;
+}
+
+// **********************************************************************************
+// updateThermalSensor - move a registered thermal sensor to the state of value
+//
+// A sensor whose value is near a threshold can hit it again and again.  So that
+// each hit does not flip the platform state back and forth, a sensor stays in a
+// state for at least kThermalMinDwellMS before it is moved to a cooler one.  A
+// cooler value that arrives sooner is held, a newer one replacing it, until
+// thermalDwellExpired applies it; meanwhile the sensor only reports if it cools
+// further or gets hotter than its state allows.  A hotter value is acted on at
+// once, as is any value for a sensor left in no state by a clamshell change.
+//
+//		-- protected by CommandGate
+//
+// **********************************************************************************
+bool Portable2004_PlatformMonitor::updateThermalSensor (UInt32 subsi, ThermalValue value)
+{
+	UInt32					myThermalState;
+	AbsoluteTime			now, rearmAt;
+	bool					result;
+
+	myThermalState = lookupThermalStateFromValue (subsi, value);
+	if (myThermalState >= kMaxSensorIndex)
+		return false;
+	
+	result = true; 
+	if (myThermalState != subSensorArray[subsi].state) {
+		if (!subSensorArray[subsi].registered) 
+			// Not registered
+			return false;
+
+		// only cooling waits out the dwell
+		if (thermalDwellTimer && (myThermalState < subSensorArray[subsi].state) &&
+			(subSensorArray[subsi].state < kMaxThermalStates)) {
+			clock_get_uptime (&now);
+			rearmAt = thermalArmedAt[subsi];
+			ADD_ABSOLUTETIME (&rearmAt, &thermalDwell);
+			if (CMP_ABSOLUTETIME (&now, &rearmAt) < 0) {
+				// quiet until it cools further or gets hotter than its state allows
+				if (!thermalHeld[subsi] || (thermalHeldState[subsi] != myThermalState))
+					setThermalThresholds (subsi,
+						thermalThresholdInfoArray[machineType][subsi][currentClamshellState][myThermalState].thresholdLow,
+						thermalThresholdInfoArray[machineType][subsi][currentClamshellState][subSensorArray[subsi].state].thresholdHigh);
+				thermalHeldValue[subsi] = value;
+				thermalHeldState[subsi] = myThermalState;
+				if (!thermalHeld[subsi]) {
+					thermalHeld[subsi] = true;
+					armThermalDwellTimer ();
+				}
+				return true;
+			}
 		}
+
+		thermalHeld[subsi] = false;
+		clock_get_uptime (&thermalArmedAt[subsi]);
+		subSensorArray[subsi].state = myThermalState;
+		setThermalThresholds (subsi,
+			thermalThresholdInfoArray[machineType][subsi][currentClamshellState][myThermalState].thresholdLow,
+			thermalThresholdInfoArray[machineType][subsi][currentClamshellState][myThermalState].thresholdHigh);
+	} else if (thermalHeld[subsi]) {
+		thermalHeld[subsi] = false;			// back in its state before the dwell ran out
+		setThermalThresholds (subsi,
+			thermalThresholdInfoArray[machineType][subsi][currentClamshellState][myThermalState].thresholdLow,
+			thermalThresholdInfoArray[machineType][subsi][currentClamshellState][myThermalState].thresholdHigh);
+	}
 		
-		if (currentThermalState != myThermalState) {
-			UInt32 i, maxState;
-			
-			// Find the current max state among all the sensors
-			maxState = 0;
-			for (i = 0; i < kMaxSensorIndex; i++) 
-				if (subSensorArray[i].registered)
-					maxState = (maxState > subSensorArray[i].state) ? maxState : subSensorArray[i].state;
-			
-			// If new max state is different than current, update platform state
-                        if (currentThermalState != maxState)
-                        {
-                            if (maxState < kMaxThermalStates)	// Don't want to set a thermal state too high
-                            {
-                                kprintf("*** Portable2004_PlatformMonitor::handleThermalEvent,  maxState = %d, currentThermalState = %d ***\n", maxState, currentThermalState);
-                                
-                                currentThermalState = maxState;
-                                result = adjustPlatformState ();
-                            }
-                        }
-		}
+	if (currentThermalState != myThermalState) {
+		UInt32 i, maxState;
+		
+		// Find the current max state among all the sensors
+		maxState = 0;
+		for (i = 0; i < kMaxSensorIndex; i++) 
+			if (subSensorArray[i].registered)
+				maxState = (maxState > subSensorArray[i].state) ? maxState : subSensorArray[i].state;
+		
+		// If new max state is different than current, update platform state
+                if (currentThermalState != maxState)
+                {
+                    if (maxState < kMaxThermalStates)	// Don't want to set a thermal state too high
+                    {
+                        kprintf("*** Portable2004_PlatformMonitor::handleThermalEvent,  maxState = %d, currentThermalState = %d ***\n", maxState, currentThermalState);
+                        
+                        currentThermalState = maxState;
+                        result = adjustPlatformState ();
+                    }
+                }
 	}
 	
 	return result;
 }
 
+// **********************************************************************************
+// setThermalThresholds - send a thermal sensor the values it reports outside of
+//
+// **********************************************************************************
+void Portable2004_PlatformMonitor::setThermalThresholds (UInt32 subsi, ThermalValue low, ThermalValue high)
+{
+	OSNumber				*threshLow, *threshHigh;
+
+	threshLow = (OSNumber *)subSensorArray[subsi].threshDict->getObject (gIOPMonLowThresholdKey);
+	threshLow->setValue((long long)low);
+	threshHigh = (OSNumber *)subSensorArray[subsi].threshDict->getObject (gIOPMonHighThresholdKey);
+	threshHigh->setValue((long long)high);
+	// Send thresholds to sensor
+	subSensorArray[subsi].conSensor->setProperties (subSensorArray[subsi].threshDict);
+	return;
+}
+
+// **********************************************************************************
+// armThermalDwellTimer - wake when the first held sensor's dwell runs out
+//
+// **********************************************************************************
+void Portable2004_PlatformMonitor::armThermalDwellTimer ()
+{
+	AbsoluteTime			rearmAt, first;
+	UInt32					i;
+	bool					any = false;
+
+	for (i = 0; i < kMaxSensorIndex; i++) {
+		if (!thermalHeld[i])
+			continue;
+		rearmAt = thermalArmedAt[i];
+		ADD_ABSOLUTETIME (&rearmAt, &thermalDwell);
+		if (!any || (CMP_ABSOLUTETIME (&rearmAt, &first) < 0))
+			first = rearmAt;
+		any = true;
+	}
+
+	if (any)
+		thermalDwellTimer->wakeAtTime (first);
+	return;
+}
+
+// **********************************************************************************
+// thermalDwellExpired - apply the values held back by the dwell
+//
+//		-- timer action, single threaded with the CommandGate
+//
+// **********************************************************************************
+//static
+void Portable2004_PlatformMonitor::thermalDwellExpired (OSObject *owner, IOTimerEventSource *sender)
+{
+	Portable2004_PlatformMonitor	*me;
+	AbsoluteTime					now, rearmAt;
+	UInt32							i;
+
+	if ((me = OSDynamicCast (Portable2004_PlatformMonitor, owner)) == NULL)
+		return;
+
+	clock_get_uptime (&now);
+	for (i = 0; i < kMaxSensorIndex; i++) {
+		if (!me->thermalHeld[i])
+			continue;
+		rearmAt = me->thermalArmedAt[i];
+		ADD_ABSOLUTETIME (&rearmAt, &me->thermalDwell);
+		if (CMP_ABSOLUTETIME (&now, &rearmAt) < 0)
+			continue;							// not yet, the timer is re-armed for it below
+		
+		me->thermalHeld[i] = false;
+		if (subSensorArray[i].registered)
+			me->updateThermalSensor (i, me->thermalHeldValue[i]);
+	}
+	
+	me->armThermalDwellTimer ();
+	return;
+}
+
 // **********************************************************************************
 // handleClamshellEvent
 //
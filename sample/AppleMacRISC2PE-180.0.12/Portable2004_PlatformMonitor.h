@@ -24,6 +24,7 @@
  *
  */
  
+#include <IOKit/IOTimerEventSource.h>
 #include "IOPlatformMonitor.h"
 #include "MacRISC2.h"
 class MacRISC2PE;
@@ -61,7 +62,10 @@ enum {
 	kMaxConSensors			= kSlewController + 1,		// 6
 	
 	// sensor-index(s) - assigned by Open Firmware, and unique system wide
-	kMaxSensorIndex			= 6					// See subSensorArray
+	kMaxSensorIndex			= 6,				// See subSensorArray
+
+	// Shortest time a thermal sensor stays in a state before it is moved to a cooler one
+	kThermalMinDwellMS		= 2000
 };
 
 enum {
@@ -103,6 +107,18 @@ private:
         int				machineType;
         bool				goingToSleep;
 
+	IOTimerEventSource		*thermalDwellTimer;					// Applies values held back by the dwell
+	AbsoluteTime			thermalDwell;						// kThermalMinDwellMS
+	AbsoluteTime			thermalArmedAt[kMaxSensorIndex];	// When each sensor's thresholds were last re-armed
+	ThermalValue			thermalHeldValue[kMaxSensorIndex];	// Newest cooler value that arrived within the dwell
+	UInt32					thermalHeldState[kMaxSensorIndex];	// Its state
+	bool					thermalHeld[kMaxSensorIndex];
+
+	static void thermalDwellExpired (OSObject *owner, IOTimerEventSource *sender);
+	void armThermalDwellTimer ();
+	void setThermalThresholds (UInt32 subsi, ThermalValue low, ThermalValue high);
+	bool updateThermalSensor (UInt32 subsi, ThermalValue value);
+
 protected:
 
     static IOReturn iopmonCommandGateCaller(OSObject *object, void *arg0, void *arg1, void *arg2, void *arg3);
@@ -130,6 +146,7 @@ protected:
 public:
 
 	virtual bool start(IOService *provider);
+	virtual void free();
 	virtual IOReturn powerStateWillChangeTo (IOPMPowerFlags, unsigned long, IOService*);
 	virtual IOReturn powerStateDidChangeTo (IOPMPowerFlags, unsigned long, IOService*);
 	virtual IOReturn setAggressiveness(unsigned long selector, unsigned long newLevel);
@@ -445,6 +445,26 @@ IOI2CControllerPPC::processWriteI2CBus(
 // I2C Read / Write Interface Methods
 // *******************************************************************
 
+// How long a timed out transaction waits for the cell to put the stop on
+// the bus before it gives the bus back anyway.
+#define kStopWaitMS		10
+
+// Nanoseconds left until deadline, 0 once it has passed.
+static UInt64 nsUntilDeadline(
+	AbsoluteTime	deadline)
+{
+	AbsoluteTime	now;
+	UInt64			nsec;
+
+	clock_get_uptime(&now);
+	if (CMP_ABSOLUTETIME(&now, &deadline) >= 0)
+		return 0;
+
+	SUB_ABSOLUTETIME(&deadline, &now);
+	absolutetime_to_nanoseconds(deadline, &nsec);
+	return nsec;
+}
+
 IOReturn
 IOI2CControllerPPC::i2cTransaction(
 				IOI2CCommand	*cmd,
@@ -462,7 +482,10 @@ IOI2CControllerPPC::i2cTransaction(
 		UInt32	timeout_uS = cmd->timeout_uS;
 
 		// By default we allow up to 5 seconds for a transaction to complete.
-		if (timeout_uS < 5000000) // that's the minimum timeout the caller can request.
+		// [3915595] slow devices stretch the clock for seconds, so that stays the
+		// default; a caller that asks for less gets less, the deadline covers the
+		// wait for the cell as well as the transfer itself.
+		if (timeout_uS == 0)
 				timeout_uS = 5000000;
 		clock_interval_to_deadline(timeout_uS, kMicrosecondScale, &deadline);
 
@@ -498,9 +521,15 @@ IOI2CControllerPPC::i2cTransaction(
 				else
 						mode |= fMODE_CLKDIV_100kHz;
 
-		// Wait up to 1 second for busy=0 before writing mode reg...
+		// Wait up to 1 second, or until the deadline, for busy=0 before writing mode reg...
 		for (retry = 1000; (retry > 0) && (readReg(iSTATUS) & fSTATUS_BUSY); retry--)
 		{
+				if (0 == nsUntilDeadline(deadline))
+				{
+						ERRLOG("-IOI2CControllerPPC::i2cTransaction IIC cell busy past deadline.\n");
+						return kIOReturnTimeout;
+				}
+
 				if (ml_at_interrupt_context())
 						IODelay(1000);
 				else
@@ -568,6 +597,12 @@ IOI2CControllerPPC::i2cTransaction(
 						if (readReg(iISR))
 								processInterrupt();
 						else
+						if (0 == nsUntilDeadline(deadline))
+						{
+								rval = KERN_OPERATION_TIMED_OUT;
+								break;
+						}
+						else
 						{
 								if (ml_at_interrupt_context())
 										IODelay(1000);
@@ -578,7 +613,8 @@ IOI2CControllerPPC::i2cTransaction(
 		}
 		else
 		{
-            mach_timespec_t timeout = { 5, 0 };    // 5 secs
+            UInt64 nsec = nsUntilDeadline(deadline);
+            mach_timespec_t timeout = { (unsigned int)(nsec / 1000000000ULL), (clock_res_t)(nsec % 1000000000ULL) };
             rval = semaphore_timedwait(i2c_sema, timeout);
             DLOG("[%p] woke from semaphore, i2c_state = %x\n", this, i2c_state);
 		}
@@ -587,12 +623,22 @@ IOI2CControllerPPC::i2cTransaction(
 		// If it does.. no big deal.
 		i2c_xfer = false;
 
+		// A transfer cut short by its deadline still owns the bus, ask the cell for a stop.
+		// If the slave is holding SCL that stop may never go out; only wait kStopWaitMS for
+		// it, the next transaction waits for busy=0 under its own deadline.
+		int stopWait = 1000;
+		if (rval == KERN_OPERATION_TIMED_OUT)
+		{
+				writeReg(iCNTRL, fCNTRL_STOP);
+				stopWait = kStopWaitMS;
+		}
+
 		// Wait for IIC cell to clear its busy bit before the next transaction...
 		// This indicates the stop bit was sent and the SCL and SDA lines have deasserted.
 		UInt8 reg = readReg(iSTATUS);
 		if (reg & fSTATUS_BUSY)
 		{
-				for (retry = 1000; retry > 0; retry--)
+				for (retry = stopWait; retry > 0; retry--)
 				{
 						reg = readReg(iSTATUS);
 						if ((reg & fSTATUS_BUSY) == 0)
@@ -606,8 +652,8 @@ IOI2CControllerPPC::i2cTransaction(
 				if (retry == 0)
 						ERRLOG("IOI2CControllerPPC::i2cTransaction IIC cell got no stop and still busy: 0x%02x\n", reg);
 
-				if (retry < 998)
-						ERRLOG("IOI2CControllerPPC::i2cTransaction Waited %d ms for IIC Cell to complete:\n", 1000-retry);
+				if (retry < stopWait - 2)
+						ERRLOG("IOI2CControllerPPC::i2cTransaction Waited %d ms for IIC Cell to complete:\n", stopWait-retry);
 		}
 
 		// This is the end of the transaction.
@@ -620,6 +666,14 @@ IOI2CControllerPPC::i2cTransaction(
 				{
 						ERRLOG("IOI2CControllerPPC::i2cTransaction disableInterrupt failed: 0x%08x\n", status);
 				}
+
+				// An interrupt that completed the transfer after the wait gave up left a
+				// signal behind; eat it so the next transaction does not wake up early.
+				if (rval == KERN_OPERATION_TIMED_OUT)
+				{
+						mach_timespec_t noWait = { 0, 0 };
+						semaphore_timedwait(i2c_sema, noWait);
+				}
 		}
 
 		// Evaluate transaction status
@@ -81,11 +81,26 @@ IOI2CBus::start(IOService *provider)
 	else
 		return false;
 
+	if (0 == (reserved = (ExpansionData *)IOMalloc(sizeof(struct ExpansionData))))
+		return false;
+	bzero(reserved, sizeof(struct ExpansionData));
+
 	// Create some symbols for later use
 	symWriteI2CBus = OSSymbol::withCStringNoCopy(kWriteI2Cbus);
 	symReadI2CBus = OSSymbol::withCStringNoCopy(kReadI2Cbus);
 	symLockI2CBus = OSSymbol::withCStringNoCopy(kLockI2Cbus);
 	symUnlockI2CBus = OSSymbol::withCStringNoCopy(kUnlockI2Cbus);
+	symCommandListI2CBus = OSSymbol::withCStringNoCopy(kCommandListI2Cbus);
+	symSubmitI2CBus = OSSymbol::withCStringNoCopy(kSubmitI2Cbus);
+
+	fFunctionTable.init();
+	if (!fFunctionTable.add(symReadI2CBus, &IOI2CBus::sSetCommandBus)
+		|| !fFunctionTable.add(symWriteI2CBus, &IOI2CBus::sSetCommandBus)
+		|| !fFunctionTable.add(symSubmitI2CBus, &IOI2CBus::sSetCommandBus)
+		|| !fFunctionTable.add(symLockI2CBus, &IOI2CBus::sSetLockBus)
+		|| !fFunctionTable.add(symUnlockI2CBus, &IOI2CBus::sSetLockBus)
+		|| !fFunctionTable.add(symCommandListI2CBus, &IOI2CBus::sSetCommandListBus))
+		return false;
 
     // publish children...
 	if (iter = fProvider->getChildIterator(gIODTPlane))
@@ -126,6 +141,15 @@ IOI2CBus::free(void)
 	if (symReadI2CBus)		{ symReadI2CBus->release();			symReadI2CBus = 0; }
 	if (symLockI2CBus)		{ symLockI2CBus->release();			symLockI2CBus = 0; }
 	if (symUnlockI2CBus)	{ symUnlockI2CBus->release();		symUnlockI2CBus = 0; }
+	if (reserved)
+	{
+		if (symCommandListI2CBus)	{ symCommandListI2CBus->release();	symCommandListI2CBus = 0; }
+		if (symSubmitI2CBus)	{ symSubmitI2CBus->release();		symSubmitI2CBus = 0; }
+		fFunctionTable.free();
+
+		IOFree(reserved, sizeof(struct ExpansionData));
+		reserved = 0;
+	}
 
 	super::free();
 }
@@ -137,19 +161,49 @@ IOI2CBus::callPlatformFunction(
 	void *param1, void *param2,
 	void *param3, void *param4 )
 {
-	if (symReadI2CBus->isEqualTo(functionName) ||
-		symWriteI2CBus->isEqualTo(functionName))
-	{
-		((IOI2CCommand *)param1)->bus = fI2CBus;
-	}
-	else
-	if (symLockI2CBus->isEqualTo(functionName) ||
-		symUnlockI2CBus->isEqualTo(functionName))
+	IOI2CFunctionAction action;
+
+	if (functionName && reserved && (action = fFunctionTable.lookup(functionName)))
+		return (*action)(this, functionName, waitForFunction, param1, param2, param3, param4);
+
+	return super::callPlatformFunction(functionName, waitForFunction, param1, param2, param3, param4);
+}
+
+IOReturn
+IOI2CBus::sSetCommandBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	IOI2CBus	*self = (IOI2CBus *)target;
+
+	if (param1)
+		((IOI2CCommand *)param1)->bus = self->fI2CBus;
+
+	return self->super::callPlatformFunction(functionName, waitForFunction, param1, param2, param3, param4);
+}
+
+IOReturn
+IOI2CBus::sSetLockBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	IOI2CBus	*self = (IOI2CBus *)target;
+
+	return self->super::callPlatformFunction(functionName, waitForFunction, (void *)self->fI2CBus, param2, param3, param4);
+}
+
+IOReturn
+IOI2CBus::sSetCommandListBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	IOI2CBus			*self = (IOI2CBus *)target;
+	IOI2CCommandList	*list = (IOI2CCommandList *)param1;
+
+	if (list && list->commands)
 	{
-		param1 = (void *)fI2CBus;
+		for (UInt32 i = 0; i < list->count; i++)
+			list->commands[i].bus = self->fI2CBus;
 	}
 
-	return super::callPlatformFunction(functionName, waitForFunction, param1, param2, param3, param4);
+	return self->super::callPlatformFunction(functionName, waitForFunction, param1, param2, param3, param4);
 }
 
 
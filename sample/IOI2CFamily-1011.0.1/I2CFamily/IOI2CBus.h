@@ -44,6 +44,7 @@
 
 
 #include <IOKit/IOService.h>
+#include <IOI2C/IOI2CFunctionTable.h>
 
 class IOI2CBus : public IOService
 {
@@ -70,7 +71,35 @@ protected:
 	const OSSymbol	*symLockI2CBus;
 	const OSSymbol	*symUnlockI2CBus;
 
+private:
+	// fFunctionTable actions: set the bus ID the way each function takes it, then forward to the controller.
+	static IOReturn sSetCommandBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sSetLockBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sSetCommandListBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+
 protected:
+	/*!	@struct ExpansionData
+		@discussion This structure helps to expand the capabilities of this class in the future.
+	*/
+	typedef struct ExpansionData
+	{
+		const OSSymbol	*symCommandListI2CBus;
+		const OSSymbol	*symSubmitI2CBus;
+		IOI2CFunctionTable	fFunctionTable;		// Functions that need this bus's ID filled in
+	};
+
+	/*! @var reserved
+		Reserved for future use.  (Internal use only)
+	*/
+	ExpansionData *reserved;
+
+	#define symCommandListI2CBus	(reserved->symCommandListI2CBus)
+	#define symSubmitI2CBus			(reserved->symSubmitI2CBus)
+	#define fFunctionTable			(reserved->fFunctionTable)
+
 	// Space reserved for future expansion.
     OSMetaClassDeclareReservedUnused ( IOI2CBus,  0 );
     OSMetaClassDeclareReservedUnused ( IOI2CBus,  1 );
@@ -101,16 +101,9 @@
 #define DLOGI2C(opt, fmt, args...)
 #endif
 
-// Define kUSE_IOLOCK for IOLock, Undefine for semaphore
-//#define kUSE_IOLOCK 0
-#ifdef kUSE_IOLOCK
-	#define I2CLOCK		IOLockLock(fClientLock)
-	#define I2CUNLOCK	{IOLockUnlock(fClientLock);IOSleep(0);}
-	// IOSleep lets other threads have a chance to run.
-#else
-	#define I2CLOCK		semaphore_wait(fClientSem)
-	#define I2CUNLOCK	semaphore_signal(fClientSem)
-#endif
+// Client arbitration, granted in kI2CPriority_xxx order (see IOI2CPriorityLock.h).
+#define I2CLOCK(priority)	fClientPriorityLock.lock(priority)
+#define I2CUNLOCK			fClientPriorityLock.unlock()
 
 
 #pragma mark  
@@ -222,8 +215,9 @@ void IOI2CController::free ( void )
 IOReturn
 IOI2CController::initI2CResources(void)
 {
-//	if (0 == (reserved = (ExpansionData *)IOMalloc(sizeof(struct ExpansionData))))
-//		return kIOReturnNoMemory;
+	if (0 == (reserved = (ExpansionData *)IOMalloc(sizeof(struct ExpansionData))))
+		return kIOReturnNoMemory;
+	bzero(reserved, sizeof(struct ExpansionData));
 
 	// Create some symbols for later use
 	symLockI2CBus = OSSymbol::withCStringNoCopy(kLockI2Cbus);
@@ -234,19 +228,35 @@ IOI2CController::initI2CResources(void)
 	symPowerClient = OSSymbol::withCStringNoCopy("client");
 	symPowerAcked = OSSymbol::withCStringNoCopy("acked");
 	symGetMaxI2CDataLength = OSSymbol::withCStringNoCopy(kIOI2CGetMaxI2CDataLength);
+	symCommandListI2CBus = OSSymbol::withCStringNoCopy(kCommandListI2Cbus);
+	symSubmitI2CBus = OSSymbol::withCStringNoCopy(kSubmitI2Cbus);
+	symGetLockStats = OSSymbol::withCStringNoCopy(kIOI2CGetLockStats);
 
 	if (!symLockI2CBus || !symUnlockI2CBus || !symWriteI2CBus || !symReadI2CBus ||
-		!symPowerInterest || !symPowerClient || !symPowerAcked || !symGetMaxI2CDataLength)
+		!symPowerInterest || !symPowerClient || !symPowerAcked || !symGetMaxI2CDataLength ||
+		!symCommandListI2CBus || !symSubmitI2CBus || !symGetLockStats)
 		return kIOReturnNoMemory;
 
-#ifdef kUSE_IOLOCK
-	if (NULL == (fClientLock = IOLockAlloc()))
+	fFunctionTable.init();
+	if (!fFunctionTable.add(symReadI2CBus, &IOI2CController::sClientReadI2C) ||
+		!fFunctionTable.add(symWriteI2CBus, &IOI2CController::sClientWriteI2C) ||
+		!fFunctionTable.add(symLockI2CBus, &IOI2CController::sClientLockI2C) ||
+		!fFunctionTable.add(symUnlockI2CBus, &IOI2CController::sClientUnlockI2C) ||
+		!fFunctionTable.add(symCommandListI2CBus, &IOI2CController::sClientCommandListI2C) ||
+		!fFunctionTable.add(symSubmitI2CBus, &IOI2CController::sClientSubmitI2C) ||
+		!fFunctionTable.add(symPowerInterest, &IOI2CController::sPowerStateInterest) ||
+		!fFunctionTable.add(symGetLockStats, &IOI2CController::sGetLockStats) ||
+		!fFunctionTable.add(symGetMaxI2CDataLength, &IOI2CController::sGetMaxI2CDataLength))
+		return kIOReturnNoMemory;
+
+	if (NULL == (fAsyncLock = IOLockAlloc()))
+		return kIOReturnNoMemory;
+
+	if (NULL == (fAsyncThreadCall = thread_call_allocate(&IOI2CController::sAsyncCallback, (thread_call_param_t) this)))
+		return kIOReturnNoResources;
+
+	if (false == fClientPriorityLock.init())
 		return kIOReturnNoMemory;
-#else
-	IOReturn status;
-	if (kIOReturnSuccess != (status = semaphore_create(current_task(), (semaphore**)&fClientSem, SYNC_POLICY_FIFO, 1)))
-		return status;
-#endif
 
 	if (NULL == (fPowerLock = IOLockAlloc()))
 		return kIOReturnNoMemory;
@@ -269,12 +279,33 @@ IOI2CController::freeI2CResources(void)
 		fIOSyncThreadCall = 0;
 	}
 
+	if (reserved)
+	{
+		IOI2CAsyncRequest	*request;
+
+		// cancelAsyncQueue returns once fAsyncThreadCall is neither pending nor running.
+		if (fAsyncThreadCall)
+		{
+			cancelAsyncQueue();
+			thread_call_free(fAsyncThreadCall);
+			fAsyncThreadCall = 0;
+		}
+		while (request = fAsyncFree)
+		{
+			fAsyncFree = request->next;
+			IOFree(request, sizeof(IOI2CAsyncRequest));
+		}
+		if (fAsyncLock)			{ IOLockFree(fAsyncLock);			fAsyncLock = 0; }
+
+		fClientPriorityLock.free();
+
+		fFunctionTable.free();
+		if (symGetLockStats)		{ symGetLockStats->release();		symGetLockStats = 0; }
+		if (symCommandListI2CBus)	{ symCommandListI2CBus->release();	symCommandListI2CBus = 0; }
+		if (symSubmitI2CBus)		{ symSubmitI2CBus->release();		symSubmitI2CBus = 0; }
+	}
+
 	if (fPowerLock)				{ IOLockFree(fPowerLock);			fPowerLock = 0; }
-#ifdef kUSE_IOLOCK
-	if (fClientLock)			{ IOLockFree(fClientLock);			fClientLock = 0; }
-#else
-	if (fClientSem)				{ semaphore_destroy(current_task(), fClientSem);	fClientSem = 0; }
-#endif
 	if (symLockI2CBus)			{ symLockI2CBus->release();			symLockI2CBus = 0; }
 	if (symUnlockI2CBus)		{ symUnlockI2CBus->release();		symUnlockI2CBus = 0; }
 	if (symWriteI2CBus)			{ symWriteI2CBus->release();		symWriteI2CBus = 0; }
@@ -283,7 +314,7 @@ IOI2CController::freeI2CResources(void)
 	if (symPowerClient)			{ symPowerClient->release();		symPowerClient = 0; }
 	if (symPowerAcked)			{ symPowerAcked->release();			symPowerAcked = 0; }
 	if (symGetMaxI2CDataLength)	{ symGetMaxI2CDataLength->release(); symGetMaxI2CDataLength = 0; }
-//	if (reserved)	{		IOFree(reserved, sizeof(struct ExpansionData));		reserved = 0;	}
+	if (reserved)				{ IOFree(reserved, sizeof(struct ExpansionData));	reserved = 0; }
 }
 
 
@@ -509,33 +540,84 @@ IOI2CController::callPlatformFunction(
 	void			*param3,
 	void			*param4)
 {
-	if (symReadI2CBus->isEqualTo(functionName))
-		return clientReadI2C((IOI2CCommand *)param1, (UInt32)param2);
-	else
-	if (symWriteI2CBus->isEqualTo(functionName))
-		return clientWriteI2C((IOI2CCommand *)param1, (UInt32)param2);
-	else
-	if (symLockI2CBus->isEqualTo(functionName))
-		return clientLockI2C((UInt32)param1, (UInt32 *)param2);
-	else
-	if (symUnlockI2CBus->isEqualTo(functionName))
-		return clientUnlockI2C((UInt32)param1, (UInt32)param2);
-	else
-	if (symPowerInterest->isEqualTo(functionName))
-		return registerPowerStateInterest((IOService *)param1, (bool)param2);	// target = client instance
-	else
-	if (symGetMaxI2CDataLength->isEqualTo(functionName))
-	{
-		if (param1 == 0)
-			return kIOReturnBadArgument;
+	IOI2CFunctionAction action;
 
-		*(UInt32 *)param1 = fMaxI2CDataLength;
-		return kIOReturnSuccess;
-	}
+	if (functionName && reserved && (action = fFunctionTable.lookup(functionName)))
+		return (*action)(this, functionName, waitForFunction, param1, param2, param3, param4);
 
     return super::callPlatformFunction (functionName, waitForFunction, param1, param2, param3, param4);
 }
 
+IOReturn
+IOI2CController::sClientReadI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CController *)target)->clientReadI2C((IOI2CCommand *)param1, (UInt32)param2);
+}
+
+IOReturn
+IOI2CController::sClientWriteI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CController *)target)->clientWriteI2C((IOI2CCommand *)param1, (UInt32)param2);
+}
+
+IOReturn
+IOI2CController::sClientLockI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CController *)target)->clientLockI2C((UInt32)param1, (UInt32 *)param2, (UInt32)param3);
+}
+
+IOReturn
+IOI2CController::sClientUnlockI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CController *)target)->clientUnlockI2C((UInt32)param1, (UInt32)param2);
+}
+
+IOReturn
+IOI2CController::sClientCommandListI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CController *)target)->clientCommandListI2C((IOI2CCommandList *)param1, (UInt32)param2);
+}
+
+IOReturn
+IOI2CController::sClientSubmitI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CController *)target)->clientSubmitI2C((IOI2CCommand *)param1, (IOI2CCompletion *)param2);
+}
+
+IOReturn
+IOI2CController::sPowerStateInterest(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CController *)target)->registerPowerStateInterest((IOService *)param1, (bool)param2);	// target = client instance
+}
+
+IOReturn
+IOI2CController::sGetLockStats(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	if (param1 == 0)
+		return kIOReturnBadArgument;
+
+	return ((IOI2CController *)target)->clientGetLockStats((IOI2CLockStats *)param1);
+}
+
+IOReturn
+IOI2CController::sGetMaxI2CDataLength(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	if (param1 == 0)
+		return kIOReturnBadArgument;
+
+	*(UInt32 *)param1 = ((IOI2CController *)target)->fMaxI2CDataLength;
+	return kIOReturnSuccess;
+}
+
 IOReturn
 IOI2CController::registerPowerStateInterest(
 	IOService		*client,
@@ -717,6 +799,23 @@ IOI2CController::acknowledgeNotification(
 #pragma mark *** IOI2C Transaction Methods ***
 #pragma mark  
 
+// Microseconds left until deadline, 0 once it has passed.
+static UInt32
+uSUntilDeadline(
+	AbsoluteTime	deadline)
+{
+	AbsoluteTime	now;
+	UInt64			nsec;
+
+	clock_get_uptime(&now);
+	if (CMP_ABSOLUTETIME(&now, &deadline) >= 0)
+		return 0;
+
+	SUB_ABSOLUTETIME(&deadline, &now);
+	absolutetime_to_nanoseconds(deadline, &nsec);
+	return (nsec < 1000) ? 1 : (UInt32)(nsec / 1000);
+}
+
 IOReturn
 IOI2CController::clientReadI2C(
 	IOI2CCommand	*cmd,
@@ -724,7 +823,8 @@ IOI2CController::clientReadI2C(
 {
 	IOReturn		status = kIOReturnSuccess;
 	int				retries;
-	AbsoluteTime	currentTime, endTime;
+	UInt32			timeout_uS;
+	AbsoluteTime	endTime;
 
 	if (cmd == NULL)
 		return kIOReturnBadArgument;
@@ -742,7 +842,7 @@ IOI2CController::clientReadI2C(
 	else
 	if (clientKey == kIOI2C_CLIENT_KEY_DEFAULT)
 	{
-		if (kIOReturnSuccess == (status = clientLockI2C(cmd->bus, &clientKey)))
+		if (kIOReturnSuccess == (status = clientLockI2C(cmd->bus, &clientKey, i2cPriorityFromOptions(cmd->options))))
 		{
 			status = clientReadI2C(cmd, clientKey);
 			clientUnlockI2C(cmd->bus, clientKey);
@@ -768,12 +868,20 @@ IOI2CController::clientReadI2C(
 			return kIOReturnBadArgument;
 		}
 
-		// TODO: Need to start a timer to ensure command.timeout_uS is not exceeded.
-		if (cmd->timeout_uS)
-			clock_interval_to_deadline(cmd->timeout_uS, kMicrosecondScale, &endTime);
+		// The deadline covers every retry. Each attempt is handed only the time
+		// that is left, so the controller gives up mid-transaction when it runs out.
+		timeout_uS = cmd->timeout_uS;
+		if (timeout_uS)
+			clock_interval_to_deadline(timeout_uS, kMicrosecondScale, &endTime);
 
 		for (retries = (int)cmd->retries; retries >= 0; retries--)
 		{
+			if (timeout_uS && 0 == (cmd->timeout_uS = uSUntilDeadline(endTime)))
+			{
+				status = kIOReturnTimeout;
+				break;
+			}
+
 //			DLOG("IOI2CController::clientReadI2C calling processReadI2CBus\n");
 			fTransactionInProgress = TRUE;
 			DLOGI2C((cmd->options), "IOI2CController::clientReadI2C cmd key:%lx, B:%lx, A:%lx S:%lx, L:%lx, M:%lx\n",
@@ -799,18 +907,10 @@ IOI2CController::clientReadI2C(
 				status = kIOReturnOffline;
 				break;
 			}
-			if (cmd->timeout_uS)
-			{
-				clock_get_uptime(&currentTime);
-				if ( CMP_ABSOLUTETIME(&currentTime, &endTime) > 0 )
-				{
-					status = kIOReturnTimeout;
-					break;
-				}
-			}
 
 			DLOG("IOI2CController::clientReadI2C retry:%lu status:0x%08x\n", cmd->retries - retries, status);
 		}
+		cmd->timeout_uS = timeout_uS;
 
 		if (status)
 			ERRLOG("-IOI2CController::clientReadI2C status = 0x%08x\n", status);
@@ -842,7 +942,7 @@ IOI2CController::clientWriteI2C(
 	else
 	if (clientKey == kIOI2C_CLIENT_KEY_DEFAULT)
 	{
-		if (kIOReturnSuccess == (status = clientLockI2C(cmd->bus, &clientKey)))
+		if (kIOReturnSuccess == (status = clientLockI2C(cmd->bus, &clientKey, i2cPriorityFromOptions(cmd->options))))
 		{
 			status = clientWriteI2C(cmd, clientKey);
 			clientUnlockI2C(cmd->bus, clientKey);
@@ -869,13 +969,20 @@ IOI2CController::clientWriteI2C(
 			return kIOReturnBadArgument;
 		}
 
-		// TODO: Need to start a timer to ensure command.timeout_uS is not exceeded.
-		AbsoluteTime	currentTime, endTime;
-		if (cmd->timeout_uS)
-			clock_interval_to_deadline(cmd->timeout_uS, kMicrosecondScale, &endTime);
+		// Same deadline handling as clientReadI2C.
+		UInt32			timeout_uS = cmd->timeout_uS;
+		AbsoluteTime	endTime;
+		if (timeout_uS)
+			clock_interval_to_deadline(timeout_uS, kMicrosecondScale, &endTime);
 
 		for (retries = (int)cmd->retries; retries >= 0; retries--)
 		{
+			if (timeout_uS && 0 == (cmd->timeout_uS = uSUntilDeadline(endTime)))
+			{
+				status = kIOReturnTimeout;
+				break;
+			}
+
 			fTransactionInProgress = TRUE;
 			DLOGI2C((cmd->options), "IOI2CController::clientWriteI2C cmd key:%lx, B:%lx, A:%lx S:%lx, L:%lx, M:%lx\n",
 				clientKey, cmd->bus, cmd->address, cmd->subAddress, cmd->count, cmd->mode);
@@ -901,17 +1008,9 @@ IOI2CController::clientWriteI2C(
 				break;
 			}
 
-			if (cmd->timeout_uS)
-			{
-				clock_get_uptime(&currentTime);
-				if ( CMP_ABSOLUTETIME(&currentTime, &endTime) > 0 )
-				{
-					status = kIOReturnTimeout;
-					break;
-				}
-			}
 			DLOG("IOI2CController::clientWriteI2C retry:%lu status:0x%08x\n", cmd->retries - retries, status);
 		}
+		cmd->timeout_uS = timeout_uS;
 		if (status)
 			ERRLOG("-IOI2CController::clientWriteI2C status = 0x%08x\n", status);
 	}
@@ -922,7 +1021,8 @@ IOI2CController::clientWriteI2C(
 IOReturn
 IOI2CController::clientLockI2C(
 	UInt32			bus,
-	UInt32			*clientKeyRef)
+	UInt32			*clientKeyRef,
+	UInt32			priority)
 {
 	IOReturn		status;
 
@@ -938,7 +1038,7 @@ IOI2CController::clientLockI2C(
 		return kIOReturnNoPower;
 	}
 
-	I2CLOCK;
+	I2CLOCK(priority);
 
 	// Cancel any pending clients if power has been dropped.
 	if (fDeviceIsUsable == FALSE)
@@ -1001,6 +1101,293 @@ IOI2CController::clientUnlockI2C(
 	return status;
 }
 
+IOReturn
+IOI2CController::clientGetLockStats(
+	IOI2CLockStats	*stats)
+{
+	if ((reserved == 0) || !fClientPriorityLock.initialized())
+		return kIOReturnNotReady;
+
+	fClientPriorityLock.getStats(stats);
+	return kIOReturnSuccess;
+}
+
+IOReturn
+IOI2CController::clientCommandListI2C(
+	IOI2CCommandList	*list,
+	UInt32			clientKey)
+{
+	IOReturn		status = kIOReturnSuccess;
+	IOReturn		cmdStatus;
+	IOI2CCommand	*cmd;
+	UInt32			bus;
+	UInt32			i;
+
+	if ((list == NULL) || (list->count && (list->commands == NULL)))
+		return kIOReturnBadArgument;
+
+	list->completed = 0;
+	if (list->count == 0)
+		return kIOReturnSuccess;
+
+	bus = (fI2CBus != kIOI2CMultiBusID) ? fI2CBus : list->commands[0].bus;
+
+	if (fDeviceIsUsable == FALSE)
+	{
+		ERRLOG("-IOI2CController::clientCommandListI2C No Power\n");
+		return kIOReturnNoPower;
+	}
+
+	if (clientKey == kIOI2C_CLIENT_KEY_DEFAULT)
+	{
+		// One lock round trip for the whole list instead of one per command.
+		if (kIOReturnSuccess == (status = clientLockI2C(bus, &clientKey, i2cPriorityFromOptions(list->options))))
+		{
+			status = clientCommandListI2C(list, clientKey);
+			clientUnlockI2C(bus, clientKey);
+		}
+		return status;
+	}
+
+	if (fClientLockKey != clientKey)
+	{
+		ERRLOG("-IOI2CController::clientCommandListI2C invalid key\n");
+		return kIOReturnNotOpen;
+	}
+
+	for (i = 0; i < list->count; i++)
+	{
+		cmd = &list->commands[i];
+
+		// The lock is held for one bus only.
+		if ((fI2CBus == kIOI2CMultiBusID) && (cmd->bus != bus))
+			cmdStatus = kIOReturnBadArgument;
+		else
+		if (cmd->command == kI2CCommand_Read)
+			cmdStatus = clientReadI2C(cmd, clientKey);
+		else
+		if (cmd->command == kI2CCommand_Write)
+			cmdStatus = clientWriteI2C(cmd, clientKey);
+		else
+			cmdStatus = kIOReturnBadArgument;
+
+		if (list->status)
+			list->status[i] = cmdStatus;
+		list->completed++;
+
+		if (cmdStatus == kIOReturnSuccess)
+			continue;
+
+		if (status == kIOReturnSuccess)
+			status = cmdStatus;
+
+		if ((list->options & kI2CListOption_StopOnError) || (fDeviceIsUsable == FALSE))
+			break;
+	}
+
+	if (list->status)
+	{
+		for (i = list->completed; i < list->count; i++)
+			list->status[i] = kIOReturnAborted;
+	}
+
+	if (status)
+		ERRLOG("-IOI2CController::clientCommandListI2C %lu of %lu commands, status = 0x%08x\n", list->completed, list->count, status);
+
+	return status;
+}
+
+#pragma mark  
+#pragma mark *** IOI2C Async Transaction Methods ***
+#pragma mark  
+
+/*******************************************************************************
+ * Commands submitted with kSubmitI2Cbus are queued and executed on
+ * fAsyncThreadCall, which takes and releases the bus lock for each one like a
+ * kIOI2C_CLIENT_KEY_DEFAULT client would, so synchronous clients interleave.
+ * The submitting thread never waits on the bus: a client polling devices on
+ * several controllers has all of them busy at once.
+ *
+ * A command's timeout_uS runs from the moment it is submitted. The queue is
+ * kept earliest deadline first, commands without one go last, and commands
+ * with the same deadline keep their submission order. A command whose
+ * deadline passes while it waits completes with kIOReturnTimeout without
+ * touching the bus, otherwise it gets whatever time it has left.
+ *
+ * The client owns the command and the completion, and IOI2CCommand has no room
+ * for a link or a deadline, so each submission takes an IOI2CAsyncRequest.
+ * Completed ones go on fAsyncFree: IOMalloc only runs while the queue is
+ * deeper than it has been before.
+ *******************************************************************************/
+
+IOReturn
+IOI2CController::clientSubmitI2C(
+	IOI2CCommand	*cmd,
+	IOI2CCompletion	*completion)
+{
+	IOI2CAsyncRequest	*request, **link;
+
+	if ((cmd == NULL) || (completion == NULL) || (completion->action == NULL))
+		return kIOReturnBadArgument;
+
+	if ((cmd->command != kI2CCommand_Read) && (cmd->command != kI2CCommand_Write))
+		return kIOReturnBadArgument;
+
+	if (ml_at_interrupt_context())
+	{
+		ERRLOG("-IOI2CController::clientSubmitI2C from primary interrupt context not permitted\n");
+		return kIOReturnNotPermitted;
+	}
+
+	if (fDeviceIsUsable == FALSE)
+	{
+		ERRLOG("-IOI2CController::clientSubmitI2C No Power\n");
+		return kIOReturnNoPower;
+	}
+
+	if (fI2CBus != kIOI2CMultiBusID)
+		cmd->bus = fI2CBus;
+
+	IOLockLock(fAsyncLock);
+	if (fAsyncClosing)
+	{
+		IOLockUnlock(fAsyncLock);
+		ERRLOG("-IOI2CController::clientSubmitI2C controller is closing\n");
+		return kIOReturnOffline;
+	}
+
+	if (request = fAsyncFree)
+		fAsyncFree = request->next;
+	else
+	if (NULL == (request = (IOI2CAsyncRequest *)IOMalloc(sizeof(IOI2CAsyncRequest))))
+	{
+		IOLockUnlock(fAsyncLock);
+		return kIOReturnNoMemory;
+	}
+
+	request->next = NULL;
+	request->cmd = cmd;
+	request->completion = *completion;
+	if (0 != (request->timeout_uS = cmd->timeout_uS))
+		clock_interval_to_deadline(cmd->timeout_uS, kMicrosecondScale, &request->deadline);
+
+	if ((request->timeout_uS == 0) ||
+		(fAsyncTail && fAsyncTail->timeout_uS && CMP_ABSOLUTETIME(&fAsyncTail->deadline, &request->deadline) <= 0))
+	{
+		// No deadline, or none earlier than the last one queued: the common case stays O(1).
+		if (fAsyncTail)
+			fAsyncTail->next = request;
+		else
+			fAsyncHead = request;
+		fAsyncTail = request;
+	}
+	else
+	{
+		for (link = &fAsyncHead; *link; link = &(*link)->next)
+			if (((*link)->timeout_uS == 0) || (CMP_ABSOLUTETIME(&(*link)->deadline, &request->deadline) > 0))
+				break;
+
+		if (NULL == (request->next = *link))
+			fAsyncTail = request;
+		*link = request;
+	}
+
+	// Entered under the lock, so cancelAsyncQueue finds it either pending or running.
+	if (fAsyncRunning == false)
+	{
+		fAsyncRunning = true;
+		thread_call_enter(fAsyncThreadCall);
+	}
+	IOLockUnlock(fAsyncLock);
+
+	DLOGI2C((cmd->options), "IOI2CController::clientSubmitI2C cmd B:%lx, A:%lx S:%lx, L:%lx, M:%lx\n",
+		cmd->bus, cmd->address, cmd->subAddress, cmd->count, cmd->mode);
+
+	return kIOReturnSuccess;
+}
+
+void
+IOI2CController::sAsyncCallback(
+	thread_call_param_t	p0,
+	thread_call_param_t	p1)
+{
+	IOI2CController	*self;
+
+	if (self = OSDynamicCast(IOI2CController, (OSMetaClassBase *)p0))
+		self->runAsyncQueue();
+}
+
+void
+IOI2CController::runAsyncQueue(void)
+{
+	IOI2CAsyncRequest	*request = NULL;
+	IOReturn			status;
+
+	for (;;)
+	{
+		IOLockLock(fAsyncLock);
+		if (request)
+		{
+			request->next = fAsyncFree;
+			fAsyncFree = request;
+		}
+
+		// Nothing is touched after the unlock: cancelAsyncQueue may free it all once woken.
+		if (NULL == (request = fAsyncHead))
+		{
+			fAsyncRunning = false;
+			IOLockWakeup(fAsyncLock, &fAsyncRunning, false);
+			IOLockUnlock(fAsyncLock);
+			return;
+		}
+		if (NULL == (fAsyncHead = request->next))
+			fAsyncTail = NULL;
+		IOLockUnlock(fAsyncLock);
+
+		if (request->timeout_uS && 0 == (request->cmd->timeout_uS = uSUntilDeadline(request->deadline)))
+		{
+			DLOGI2C((request->cmd->options), "IOI2CController::runAsyncQueue B:%lx, A:%lx S:%lx expired in queue\n",
+				request->cmd->bus, request->cmd->address, request->cmd->subAddress);
+			status = kIOReturnTimeout;
+		}
+		else
+		if (request->cmd->command == kI2CCommand_Write)
+			status = clientWriteI2C(request->cmd, kIOI2C_CLIENT_KEY_DEFAULT);
+		else
+			status = clientReadI2C(request->cmd, kIOI2C_CLIENT_KEY_DEFAULT);
+
+		request->cmd->timeout_uS = request->timeout_uS;
+		(*request->completion.action)(request->completion.target, request->completion.parameter, request->cmd, status);
+	}
+}
+
+void
+IOI2CController::cancelAsyncQueue(void)
+{
+	IOI2CAsyncRequest	*request, *next;
+
+	IOLockLock(fAsyncLock);
+	fAsyncClosing = true;
+	request = fAsyncHead;
+	fAsyncHead = fAsyncTail = NULL;
+
+	// A call still pending never runs. One that is running finds the queue empty after the
+	// command in progress, which its deadline bounds, and clears fAsyncRunning with a wakeup.
+	if (fAsyncRunning && thread_call_cancel(fAsyncThreadCall))
+		fAsyncRunning = false;
+	while (fAsyncRunning)
+		IOLockSleep(fAsyncLock, &fAsyncRunning, THREAD_UNINT);
+	IOLockUnlock(fAsyncLock);
+
+	// Whatever never reached the bus completes as aborted.
+	for (; request; request = next)
+	{
+		next = request->next;
+		(*request->completion.action)(request->completion.target, request->completion.parameter, request->cmd, kIOReturnAborted);
+		IOFree(request, sizeof(IOI2CAsyncRequest));
+	}
+}
+
 
 // Space reserved for future expansion.
 OSMetaClassDefineReservedUnused ( IOI2CController, 0 );
@@ -56,6 +56,8 @@
 #include <IOKit/IOService.h>
 #include <IOKit/IONotifier.h>
 #include <IOI2C/IOI2CDefs.h>
+#include <IOI2C/IOI2CPriorityLock.h>
+#include <IOI2C/IOI2CFunctionTable.h>
 
 class IOI2CController : public IOService
 {
@@ -83,9 +85,9 @@ private:
 	};
 
 	IOLock			*fPowerLock;
-	IOLock			*fClientLock;			// Used for I2C arbitration and power state transition synchronization.
+	IOLock			*fClientLock;			// Unused, kept for the class layout: see fClientPriorityLock.
 	volatile semaphore_t
-					fClientSem;
+					fClientSem;				// Unused, kept for the class layout: see fClientPriorityLock.
 	UInt32			fClientLockKey;
 	bool			fDeviceIsUsable;
 	bool			fTransactionInProgress;
@@ -95,6 +97,16 @@ private:
 	UInt32			fI2CBus;				// Our single bus ID from the AAPL,i2c-bus property,
 											// for multi-bus fI2CBus is set to kIOI2CMultiBusID.
 
+	// Commands submitted with kSubmitI2Cbus, executed earliest deadline first by fAsyncThreadCall.
+	typedef struct IOI2CAsyncRequest
+	{
+		struct IOI2CAsyncRequest	*next;
+		IOI2CCommand				*cmd;
+		IOI2CCompletion				completion;
+		AbsoluteTime				deadline;		// submit time + cmd->timeout_uS
+		UInt32						timeout_uS;		// as submitted, 0 for no deadline
+	} IOI2CAsyncRequest;
+
 	#define			kIOI2CMultiBusID	0xcafe12c
 
 	/*!
@@ -137,12 +149,52 @@ private:
 
 	IOReturn clientLockI2C(
 		UInt32			bus,
-		UInt32			*clientKeyRef);
+		UInt32			*clientKeyRef,
+		UInt32			priority = kI2CPriority_Default);
 
 	IOReturn clientUnlockI2C(
 		UInt32			bus,
 		UInt32			clientKey);
 
+	IOReturn clientGetLockStats(
+		IOI2CLockStats	*stats);
+
+	IOReturn clientCommandListI2C(
+		IOI2CCommandList	*list,
+		UInt32			clientKey);
+
+	IOReturn clientSubmitI2C(
+		IOI2CCommand	*cmd,
+		IOI2CCompletion	*completion);
+
+	static void sAsyncCallback(
+		thread_call_param_t	p0,
+		thread_call_param_t	p1);
+
+	void runAsyncQueue(void);
+
+	void cancelAsyncQueue(void);
+
+	// fFunctionTable actions, one per client function.
+	static IOReturn sClientReadI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sClientWriteI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sClientLockI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sClientUnlockI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sClientCommandListI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sClientSubmitI2C(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sPowerStateInterest(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sGetLockStats(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sGetMaxI2CDataLength(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+
 protected:
 	IOReturn publishChildren(void);
 
@@ -215,13 +267,40 @@ protected:
 	/*!	@struct ExpansionData
 		@discussion This structure helps to expand the capabilities of this class in the future.
 	*/
-	typedef struct ExpansionData {};
+	typedef struct ExpansionData
+	{
+		IOLock			*fAsyncLock;			// Protects everything below.
+		thread_call_t	fAsyncThreadCall;		// Drains the async queue, one command at a time.
+		IOI2CAsyncRequest	*fAsyncHead;
+		IOI2CAsyncRequest	*fAsyncTail;
+		IOI2CAsyncRequest	*fAsyncFree;		// Completed requests, reused by clientSubmitI2C.
+		bool			fAsyncRunning;			// fAsyncThreadCall is entered or running, cleared with a wakeup.
+		bool			fAsyncClosing;			// cancelAsyncQueue has started, clientSubmitI2C refuses new commands.
+		IOI2CPriorityLock	fClientPriorityLock;	// Replaces fClientLock and fClientSem for I2C arbitration and power state synchronization.
+		const OSSymbol	*symCommandListI2CBus;
+		const OSSymbol	*symSubmitI2CBus;
+		const OSSymbol	*symGetLockStats;
+		IOI2CFunctionTable	fFunctionTable;		// callPlatformFunction actions by symbol, filled in by initI2CResources.
+	};
 
 	/*! @var reserved
 		Reserved for future use.  (Internal use only)
 	*/
 	ExpansionData *reserved;
 
+	#define fAsyncLock			(reserved->fAsyncLock)
+	#define fAsyncThreadCall	(reserved->fAsyncThreadCall)
+	#define fAsyncHead			(reserved->fAsyncHead)
+	#define fAsyncTail			(reserved->fAsyncTail)
+	#define fAsyncFree			(reserved->fAsyncFree)
+	#define fAsyncRunning		(reserved->fAsyncRunning)
+	#define fAsyncClosing		(reserved->fAsyncClosing)
+	#define fClientPriorityLock	(reserved->fClientPriorityLock)
+	#define symCommandListI2CBus	(reserved->symCommandListI2CBus)
+	#define symSubmitI2CBus		(reserved->symSubmitI2CBus)
+	#define symGetLockStats		(reserved->symGetLockStats)
+	#define fFunctionTable		(reserved->fFunctionTable)
+
 	// Space reserved for future expansion.
     OSMetaClassDeclareReservedUnused ( IOI2CController,  0 );
     OSMetaClassDeclareReservedUnused ( IOI2CController,  1 );
@@ -70,7 +70,10 @@
 #define kReadI2Cbus				"IOI2CReadI2CBus"
 #define kLockI2Cbus				"IOI2CLockI2CBus"
 #define kUnlockI2Cbus			"IOI2CUnlockI2CBus"
+#define kCommandListI2Cbus		"IOI2CCommandListI2CBus"
+#define kSubmitI2Cbus			"IOI2CSubmitI2CBus"
 #define kIOI2CGetMaxI2CDataLength	"IOI2CGetMaxI2CDataLength"
+#define kIOI2CGetLockStats		"IOI2CGetLockStats"
 
 /*! @constant kIOI2C_CLIENT_KEY_DEFAULT @discussion This key value is used to request an I2C transaction without requiring the client to lock/unlock the bus (see readI2C and writeI2C methods) */
 #define kIOI2C_CLIENT_KEY_DEFAULT	0
@@ -86,6 +89,18 @@
 */
 #define kI2CUCBufSize	32
 
+/*! @constant kI2CUCSharedBufSize
+	@discussion Size of the buffer an IOI2CUserClient shares with its client, see kI2CUCSharedMemoryType.
+	Mapped reads and writes are limited by this size rather than by kI2CUCBufSize.
+*/
+#define kI2CUCSharedBufSize	4096
+
+/*! @constant kI2CUCSharedMemoryType
+	@discussion Memory type to pass to IOConnectMapMemory to map the IOI2CUserClient shared buffer.
+	The buffer is allocated once per user client; kI2CUCMappedRead and kI2CUCMappedWrite transfer data directly to and from it.
+*/
+#define kI2CUCSharedMemoryType	0
+
 /*! @constant kIOI2CUserClientType
 	@discussion Specifies creating an IOI2CUserClient class when passed as type argument to IOServiceOpen. All other type values will create the driver default user client class.
 */
@@ -99,6 +114,8 @@ enum
 	kI2CUCRead,			// StructIStructO
 	kI2CUCWrite,		// StructIStructO
 	kI2CUCRMW,			// StructIStructO
+	kI2CUCMappedRead,	// StructIStructO
+	kI2CUCMappedWrite,	// StructIStructO
 
 	kI2CUCNumMethods
 };
@@ -124,6 +141,56 @@ enum
 {
 	kI2COption_NoInterrupts			= (1 << 31),		// (if supported) Requests non-interrupt mode transaction execution.
 	kI2COption_VerboseLog			= (1 << 30),		// (if supported) Requests verbose debugging of transaction execution.
+	kI2COption_PriorityMask			= (3 << 28),		// kI2CPriority_xxx of the bus lock taken for a kIOI2C_CLIENT_KEY_DEFAULT transaction.
+	kI2COption_PriorityShift		= 28,
+	kI2COption_Uncached				= (1 << 27),		// Read from the device even if the register shadow holds the value, write even if it is unchanged.
+	kI2COption_LearnedTimeout		= (1 << 26),		// With timeout_uS 0, use the timeout learned from the device instead of the controller's 5 second default.
+};
+
+/*! @enum kI2CPriority_xxx I2C bus lock priority classes.
+	@discussion Passed as param3 of kLockI2Cbus, or in the kI2COption_PriorityMask bits of a transaction that locks the bus itself.
+	When the bus is released it goes to the waiter of the most urgent class, first come first served within a class.
+	A waiter moves up one class for every kI2CPriorityAgingMS it has waited, so diagnostics traffic is delayed, never starved.
+*/
+enum
+{
+	kI2CPriority_Default		= 0,	// kI2CPriority_ControlLoop
+	kI2CPriority_Emergency		= 1,	// Over temperature and power state transitions.
+	kI2CPriority_ControlLoop	= 2,	// Periodic sensor reads and fan/clock control.
+	kI2CPriority_Diagnostics	= 3,	// User clients, register dumps and other bulk traffic.
+
+	kI2CPriorityClasses			= 3,
+	kI2CPriorityAgingMS			= 50,
+};
+
+#define i2cPriorityFromOptions(options)	(((options) & kI2COption_PriorityMask) >> kI2COption_PriorityShift)
+#define i2cPriorityToOptions(priority)	(((priority) << kI2COption_PriorityShift) & kI2COption_PriorityMask)
+
+/*! @struct IOI2CLockStats
+	@abstract Bus lock wait times per priority class, returned by kIOI2CGetLockStats.
+	@field acquired Number of times the lock was granted, indexed by kI2CPriority_xxx - 1.
+	@field waitTotal_uS Microseconds spent waiting for the lock in total.
+	@field waitMax_uS Longest single wait.
+*/
+typedef struct
+{
+	UInt32		acquired[kI2CPriorityClasses];
+	UInt64		waitTotal_uS[kI2CPriorityClasses];
+	UInt32		waitMax_uS[kI2CPriorityClasses];
+
+} IOI2CLockStats;
+
+/*! @enum kI2CRegister_xxx Register volatility classes for the per-device register shadow.
+	@discussion Only 8-bit subaddresses of subaddress and combined mode transactions are shadowed.
+	Undeclared registers are kI2CRegister_Live.
+*/
+enum
+{
+	kI2CRegister_Live			= 0,	// Changes by itself or on read (values, status): always read from the device.
+	kI2CRegister_Static			= 1,	// Never changes (ID, revision): read from the device once.
+	kI2CRegister_Config			= 2,	// Only changes when written: read once, written through, identical writes dropped.
+
+	kI2CRegisterShadowSize		= 256,
 };
 
 #if 1 // 10-bit address macros: Work In Progress / Not Supported.
@@ -214,6 +281,62 @@ typedef struct
 
 } IOI2CCommand;
 
+/*! @enum kI2CListOption_xxx IOI2CCommandList option constants. */
+enum
+{
+	kI2CListOption_StopOnError		= (1 << 0),			// Skip the rest of the list after the first failed command.
+};
+
+/*! @struct IOI2CCommandList
+	@abstract This data structure is used by the IOI2CFamily to pass a list of I2C transactions to be executed back to back under one bus lock.
+
+	@field commands Array of count read and/or write commands, executed in order. All commands must address the same bus.
+
+	@field status (Optional) Array of count IOReturn values which receives the status of each command.
+	
+		Commands skipped because of kI2CListOption_StopOnError return kIOReturnAborted.
+
+	@field count Number of commands.
+
+	@field options Option flags: see kI2CListOption_* enums. The kI2COption_PriorityMask bits select the bus lock priority class when the list locks the bus itself.
+
+	@field completed Returns the number of commands executed, successful or not.
+
+	@field reserved Reserved expansion array = 0.
+*/
+typedef struct
+{
+	IOI2CCommand	*commands;
+	IOReturn		*status;
+	UInt32			count;
+	UInt32			options;
+	UInt32			completed;
+	UInt32			reserved[3];
+
+} IOI2CCommandList;
+
+/*! @typedef IOI2CCompletionAction
+	@abstract Called once an IOI2CCommand submitted with kSubmitI2Cbus has been executed.
+	@discussion Runs on the controller's async thread, never on the submitting thread, except that commands still queued when the controller is torn down complete with kIOReturnAborted on the thread tearing it down. The action may submit further commands but must not block on the ones it submits.
+	@param target The target field of the IOI2CCompletion.
+	@param parameter The parameter field of the IOI2CCompletion.
+	@param cmd The submitted command, with bytesTransfered filled in.
+	@param status kIOReturnSuccess, or other IOReturn error code.
+*/
+typedef void (*IOI2CCompletionAction)(void *target, void *parameter, IOI2CCommand *cmd, IOReturn status);
+
+/*! @struct IOI2CCompletion
+	@abstract Completion for an asynchronous I2C transaction.
+	@discussion The command and its buffer must stay valid until the action is called.
+*/
+typedef struct
+{
+	void					*target;
+	IOI2CCompletionAction	action;
+	void					*parameter;
+
+} IOI2CCompletion;
+
 
 #pragma mark  
 #pragma mark *** IOI2CFamily IOUserClient structures ***
@@ -311,6 +434,52 @@ typedef struct
 
 } I2CUserWriteOutput;
 
+/*! @struct I2CUserMappedInput
+	@abstract IOUserClient mapped read and write command parameter input structure.
+	@discussion The data is read into, or written from, the shared buffer mapped with kI2CUCSharedMemoryType
+	instead of being passed inline, so a transaction is not limited to kI2CUCBufSize bytes and the data is not
+	copied through the Mach message. The number of bytes actually transfered is returned in an I2CUserMappedOutput struct.
+
+	@field options	kI2COption_xxx flags.
+
+	@field mode		transaction mode.
+
+	@field busNo	bus number, sometimes referred to as port
+
+	@field addr		8-bit I2C address -- the R/W bit, bit 0, will be ignored
+
+	@field subAddr	8-bit register subaddress
+
+	@field offset	byte offset of the data in the shared buffer
+
+	@field count	number of bytes to be transfered, offset + count must be <= kI2CUCSharedBufSize
+
+	@field key		I2C Key returned from lockI2CBus or kIOI2C_CLIENT_KEY_DEFAULT
+*/
+typedef struct
+{
+	UInt32		options;	// kI2COption_xxx flags.
+	UInt32		mode;		// transaction mode
+	UInt32		busNo;		// bus number, sometimes referred to as port
+	UInt32		addr;		// 8-bit I2C address -- the R/W bit, bit 0, will be ignored
+	UInt32		subAddr;	// 8-bit register subaddress
+	IOByteCount	offset;		// byte offset of the data in the shared buffer
+	IOByteCount	count;		// number of bytes to be transfered
+	UInt32		key;		// I2C Key returned from lockI2CBus or kIOI2C_CLIENT_KEY_DEFAULT
+
+} I2CUserMappedInput;
+
+/*! @struct I2CUserMappedOutput
+	@abstract IOUserClient mapped read and write command parameter output structure.
+
+	@field realCount how many bytes actually transfered
+*/
+typedef struct
+{
+	IOByteCount	realCount;	// how many bytes actually transfered
+
+} I2CUserMappedOutput;
+
 
 
 #pragma mark  
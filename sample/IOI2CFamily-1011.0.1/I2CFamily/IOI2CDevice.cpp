@@ -122,16 +122,13 @@
 #define DLOGI2C(opt, fmt, args...)
 #endif
 
-// Define kUSE_IOLOCK for IOLock, undefine for semaphore
-//#define kUSE_IOLOCK
-#ifdef kUSE_IOLOCK
-	#define I2CLOCK		IOLockLock(fClientLock)
-	#define I2CUNLOCK	{IOLockUnlock(fClientLock);IOSleep(0);}
-	// IOSleep lets other threads have a chance to run.
-#else
-	#define I2CLOCK		semaphore_wait(fClientSem)
-	#define I2CUNLOCK	semaphore_signal(fClientSem)
-#endif
+// Client arbitration, granted in kI2CPriority_xxx order (see IOI2CPriorityLock.h).
+// Power state transitions wait as kI2CPriority_Emergency.
+#define I2CLOCK(priority)	fClientPriorityLock.lock(priority)
+#define I2CUNLOCK			fClientPriorityLock.unlock()
+
+// Transactions whose subAddress the register shadow can interpret (see declareI2CRegisters).
+#define I2CSHADOWED(cmd)	(((cmd)->mode == kI2CMode_StandardSub) || ((cmd)->mode == kI2CMode_Combined))
 
 
 
@@ -271,22 +268,26 @@ IOI2CDevice::initI2CResources(void)
 	symClientWrite = OSSymbol::withCStringNoCopy(kIOI2CClientWrite);
 	symClientRead = OSSymbol::withCStringNoCopy(kIOI2CClientRead);
 	symPowerInterest = OSSymbol::withCStringNoCopy("IOI2CPowerStateInterest");
+	symCommandListI2CBus = OSSymbol::withCStringNoCopy(kCommandListI2Cbus);
+	symSubmitI2CBus = OSSymbol::withCStringNoCopy(kSubmitI2Cbus);
 
-#ifdef kUSE_IOLOCK
-	fClientLock = IOLockAlloc();
-#else
-	if (kIOReturnSuccess != (status = semaphore_create(current_task(), (semaphore**)&fClientSem, SYNC_POLICY_FIFO, 1)))
-		return status;
-#endif
-	if (!symLockI2CBus || !symUnlockI2CBus || !symWriteI2CBus || !symReadI2CBus
-#ifdef kUSE_IOLOCK
-		|| !fClientLock
-#else
-		|| !fClientSem
-#endif
-		)
+	if (!symLockI2CBus || !symUnlockI2CBus || !symWriteI2CBus || !symReadI2CBus || !symCommandListI2CBus || !symSubmitI2CBus
+		|| !fClientPriorityLock.init() || !fRegisterShadow.init())
 		return kIOReturnNoMemory;
 
+	// callPlatformFunction dispatch, subclasses add theirs with registerI2CFunction.
+	fFunctionTable.init();
+	if (!fFunctionTable.add(symReadI2CBus, &IOI2CDevice::sReadI2CBus)
+		|| !fFunctionTable.add(symWriteI2CBus, &IOI2CDevice::sWriteI2CBus)
+		|| !fFunctionTable.add(symLockI2CBus, &IOI2CDevice::sLockI2CBus)
+		|| !fFunctionTable.add(symUnlockI2CBus, &IOI2CDevice::sUnlockI2CBus)
+		|| !fFunctionTable.add(symClientRead, &IOI2CDevice::sClientRead)
+		|| !fFunctionTable.add(symClientWrite, &IOI2CDevice::sClientWrite))
+		return kIOReturnNoMemory;
+
+	if (kIOReturnSuccess != (status = registerI2CFunction("IOI2CSetDebugFlags", &IOI2CDevice::sSetDebugFlags)))
+		return status;
+
 	if (kIOReturnSuccess != (status = InitializePlatformFunctions()))
 		return status;
 
@@ -314,21 +315,14 @@ IOI2CDevice::freeI2CResources(void)
 	fStateFlags |= kStateFlags_TEARDOWN;
 	DLOG("+IOI2CDevice@%lx::freeI2CResources %x\n",fI2CAddress, fStateFlags);
 
-#ifdef kUSE_IOLOCK
-	if(fClientLock)
-#else
-	if(fClientSem)
-#endif
-	I2CLOCK;
-
-	fDeviceOffline = TRUE;
-
-#ifdef kUSE_IOLOCK
-	if(fClientLock)
-#else
-	if(fClientSem)
-#endif
-	I2CUNLOCK;
+	if (reserved && fClientPriorityLock.initialized())
+	{
+		I2CLOCK(kI2CPriority_Emergency);
+		fDeviceOffline = TRUE;
+		I2CUNLOCK;
+	}
+	else
+		fDeviceOffline = TRUE;
 
 	DLOG("+IOI2CDevice@%lx::freeI2CResources\n",fI2CAddress);
 	if (fStateFlags & kStateFlags_PMInit)	// Don't rely on initialized flag to identify if PMinit was called.
@@ -377,18 +371,25 @@ IOI2CDevice::freeI2CResources(void)
 
 	DLOG("IOI2CDevice@%lx::freeI2CResources 3\n",fI2CAddress);
 
-#ifdef kUSE_IOLOCK
-	if (fClientLock)		{ IOLockFree(fClientLock);		fClientLock = 0; }
-#else
-	if (fClientSem)			{ semaphore_destroy(current_task(), fClientSem);	fClientSem = 0; }
-#endif
-
 	DLOG("IOI2CDevice@%lx::freeI2CResources 4\n",fI2CAddress);
 	if (reserved)
 	{
+		fClientPriorityLock.free();
+		fRegisterShadow.free();
+		fFunctionTable.free();
+		fPFIndex.free();
 		if (symClientRead)		{ symClientRead->release();		symClientRead = 0; }
 		if (symClientWrite)		{ symClientWrite->release();	symClientWrite = 0; }
 		if (symPowerInterest)	{ symPowerInterest->release();	symPowerInterest = 0; }
+		if (symCommandListI2CBus)	{ symCommandListI2CBus->release();	symCommandListI2CBus = 0; }
+		if (symSubmitI2CBus)	{ symSubmitI2CBus->release();	symSubmitI2CBus = 0; }
+
+		if (fPFStatus)
+		{
+			IOFree(fPFStatus, fPFStatusCount * sizeof(IOReturn));
+			fPFStatus = 0;
+			fPFStatusCount = 0;
+		}
 	}
 
 	DLOG("-IOI2CDevice@%lx::freeI2CResources\n",fI2CAddress);
@@ -614,7 +615,7 @@ IOI2CDevice::powerStateThreadCall(
 	{
 		DLOGPWR("IOI2CDevice@%lx transition to OFF\n", fI2CAddress);
 
-		I2CLOCK;								// Wait for pending I2C requests to complete then block any new I2C requests...
+		I2CLOCK(kI2CPriority_Emergency);		// Wait for pending I2C requests to complete then block any new I2C requests...
 
 		fPowerThreadID = current_thread();		// Setup to allow only requests from this thread to be processed.
 		fClientIOBlocked = TRUE;				// All requests from other threads will return offline.
@@ -645,7 +646,7 @@ IOI2CDevice::powerStateThreadCall(
 	{
 		DLOGPWR("IOI2CDevice@%lx transition to SLEEP\n", fI2CAddress);
 
-		I2CLOCK;							// Wait for pending I2C requests to complete then block any new I2C requests...
+		I2CLOCK(kI2CPriority_Emergency);	// Wait for pending I2C requests to complete then block any new I2C requests...
 
 		fPowerThreadID = current_thread();	// Setup to allow only requests from this thread to be processed.
 		fClientIOBlocked = TRUE;			// All requests from other threads will return offline.
@@ -674,11 +675,13 @@ IOI2CDevice::powerStateThreadCall(
 	{
 		DLOGPWR("IOI2CDevice@%lx transition to ON\n", fI2CAddress);
 
-		I2CLOCK;								// Wait for pending I2C requests to complete then block any new I2C requests...
+		I2CLOCK(kI2CPriority_Emergency);		// Wait for pending I2C requests to complete then block any new I2C requests...
 
 		fPowerThreadID = current_thread();		// Setup to allow only requests from this thread to be processed.
 		fClientIOBlocked = TRUE;				// All requests from other threads will return offline.
 		fDeviceOffline = FALSE;					// set flag to reflect we are not shutting down.
+		fLatencySamples = 0;					// Relearn transaction timeouts, the device may have been reset.
+		fRegisterShadow.invalidate();			// Same for static and config register values.
 
 		I2CUNLOCK;								// Allow blocked threads to proceed so they return offline.
 
@@ -777,6 +780,14 @@ IOI2CDevice::getI2CAddress(void)
 IOReturn
 IOI2CDevice::lockI2CBus(
 	UInt32	*clientKeyRef)
+{
+	return lockI2CBus(clientKeyRef, kI2CPriority_Default);
+}
+
+IOReturn
+IOI2CDevice::lockI2CBus(
+	UInt32	*clientKeyRef,
+	UInt32	priority)
 {
 	IOReturn	status = kIOReturnSuccess;
 	UInt32		clientLockKey;
@@ -803,7 +814,7 @@ IOI2CDevice::lockI2CBus(
 		return kIOReturnOffline;
 	}
 
-	I2CLOCK;
+	I2CLOCK(priority);
 
 //	DLOG("IOI2CDevice@%lx::lockI2CBus - device LOCKED\n", fI2CAddress);
 
@@ -818,7 +829,8 @@ IOI2CDevice::lockI2CBus(
 		return kIOReturnOffline;
 	}
 
-	status = fProvider->callPlatformFunction(symLockI2CBus, false, (void *)0, (void *)&clientLockKey, (void *)0, (void *)0);
+	// The controller arbitrates between devices on the bus by the same class.
+	status = fProvider->callPlatformFunction(symLockI2CBus, false, (void *)0, (void *)&clientLockKey, (void *)priority, (void *)0);
 	if (kIOReturnSuccess != status)
 	{
 		ERRLOG("IOI2CDevice@%lx::lockI2CBus - lock canceled: controller lockI2CBus failed:0x%lx\n", fI2CAddress, (UInt32)status);
@@ -884,15 +896,23 @@ IOI2CDevice::readI2C(
 		status = kIOReturnOffline;
 	}
 	else
+	if (I2CSHADOWED(cmd) && (0 == (cmd->options & kI2COption_Uncached))
+		&& fRegisterShadow.read(cmd->subAddress, cmd->buffer, cmd->count))
+	{
+		cmd->bytesTransfered = cmd->count;
+		status = kIOReturnSuccess;
+	}
+	else
 	if (clientKey == kIOI2C_CLIENT_KEY_DEFAULT)
 	{
-		if (kIOReturnSuccess == (status = lockI2CBus(&clientKey)))
+		if (kIOReturnSuccess == (status = lockI2CBus(&clientKey, i2cPriorityFromOptions(cmd->options))))
 		{
 //			status = readI2C(cmd, clientKey);
 			cmd->address = getI2CAddress();
 			DLOGI2C((cmd->options), "IOI2CDevice@%lx::readI2C cmd key:%lx, B:%lx, A:%lx S:%lx, L:%lx, M:%lx\n",
 				fI2CAddress, clientKey, cmd->bus, cmd->address, cmd->subAddress, cmd->count, cmd->mode);
-			status = fProvider->callPlatformFunction(symReadI2CBus, false, (void *)cmd, (void *)clientKey, (void *)0, (void *)0);
+			status = timedI2CTransaction(symReadI2CBus, cmd, clientKey);
+			shadowI2CCommand(cmd, status);
 			unlockI2CBus(clientKey);
 		}
 	}
@@ -901,7 +921,8 @@ IOI2CDevice::readI2C(
 		cmd->address = getI2CAddress();
 		DLOGI2C((cmd->options), "IOI2CDevice@%lx::readI2C cmd key:%lx, B:%lx, A:%lx S:%lx, L:%lx, M:%lx\n",
 			fI2CAddress, clientKey, cmd->bus, cmd->address, cmd->subAddress, cmd->count, cmd->mode);
-		status = fProvider->callPlatformFunction(symReadI2CBus, false, (void *)cmd, (void *)clientKey, (void *)0, (void *)0);
+		status = timedI2CTransaction(symReadI2CBus, cmd, clientKey);
+		shadowI2CCommand(cmd, status);
 	}
 
 	return status;
@@ -923,14 +944,22 @@ IOI2CDevice::writeI2C(
 		status = kIOReturnOffline;
 	}
 	else
+	if (I2CSHADOWED(cmd) && (0 == (cmd->options & kI2COption_Uncached))
+		&& fRegisterShadow.isRedundantWrite(cmd->subAddress, cmd->buffer, cmd->count))
+	{
+		cmd->bytesTransfered = cmd->count;
+		status = kIOReturnSuccess;
+	}
+	else
 	if (clientKey == kIOI2C_CLIENT_KEY_DEFAULT)
 	{
-		if (kIOReturnSuccess == (status = lockI2CBus(&clientKey)))
+		if (kIOReturnSuccess == (status = lockI2CBus(&clientKey, i2cPriorityFromOptions(cmd->options))))
 		{
 			cmd->address = getI2CAddress();
 			DLOGI2C((cmd->options), "IOI2CDevice@%lx::writeI2C cmd key:%lx, B:%lx, A:%lx S:%lx, L:%lx, M:%lx\n",
 				fI2CAddress, clientKey, cmd->bus, cmd->address, cmd->subAddress, cmd->count, cmd->mode);
-			status = fProvider->callPlatformFunction(symWriteI2CBus, false, (void *)cmd, (void *)clientKey, (void *)0, (void *)0);
+			status = timedI2CTransaction(symWriteI2CBus, cmd, clientKey);
+			shadowI2CCommand(cmd, status);
 			unlockI2CBus(clientKey);
 		}
 	}
@@ -939,12 +968,180 @@ IOI2CDevice::writeI2C(
 		cmd->address = getI2CAddress();
 		DLOGI2C((cmd->options), "IOI2CDevice@%lx::writeI2C cmd key:%lx, B:%lx, A:%lx S:%lx, L:%lx, M:%lx\n",
 			fI2CAddress, clientKey, cmd->bus, cmd->address, cmd->subAddress, cmd->count, cmd->mode);
-		status = fProvider->callPlatformFunction(symWriteI2CBus, false, (void *)cmd, (void *)clientKey, (void *)0, (void *)0);
+		status = timedI2CTransaction(symWriteI2CBus, cmd, clientKey);
+		shadowI2CCommand(cmd, status);
 	}
 
 	return status;
 }
 
+/*******************************************************************************
+ * Learned transaction timeouts: Jacobson/Karels smoothing of successful
+ * transaction times, mean gain 1/8 and deviation gain 1/4. A learned timeout
+ * that expires counts as a sample of its own length, so the estimate widens.
+ *******************************************************************************/
+
+#define kLearnedTimeoutSamples		8			// transactions timed before a timeout is learned
+#define kLearnedTimeoutMin_uS		10000		// room for a scheduling hiccup on a fast device
+#define kLearnedTimeoutMax_uS		5000000		// never more than the controller default
+
+IOReturn
+IOI2CDevice::timedI2CTransaction(
+	const OSSymbol	*function,
+	IOI2CCommand	*cmd,
+	UInt32			clientKey)
+{
+	IOReturn		status;
+	UInt32			timeout_uS = cmd->timeout_uS;
+	UInt32			learned_uS = 0;
+	AbsoluteTime	start, end;
+	UInt64			nsec;
+	SInt32			sample, error;
+
+	if ((timeout_uS == 0) && (cmd->options & kI2COption_LearnedTimeout) && (fLatencySamples >= kLearnedTimeoutSamples))
+	{
+		learned_uS = fLatencyMean_uS + 4 * fLatencyDev_uS;
+		if (learned_uS < kLearnedTimeoutMin_uS)
+			learned_uS = kLearnedTimeoutMin_uS;
+		else
+		if (learned_uS > kLearnedTimeoutMax_uS)
+			learned_uS = kLearnedTimeoutMax_uS;
+		cmd->timeout_uS = learned_uS;
+	}
+
+	clock_get_uptime(&start);
+	status = fProvider->callPlatformFunction(function, false, (void *)cmd, (void *)clientKey, (void *)0, (void *)0);
+	clock_get_uptime(&end);
+
+	if (cmd->timeout_uS != timeout_uS)
+	{
+		if (status == kIOReturnTimeout)
+			ERRLOG("IOI2CDevice@%lx::timedI2CTransaction S:%lx timed out after learned %lu uS\n", fI2CAddress, cmd->subAddress, cmd->timeout_uS);
+		cmd->timeout_uS = timeout_uS;
+	}
+
+	if ((status == kIOReturnSuccess) || (learned_uS && (status == kIOReturnTimeout)))
+	{
+		SUB_ABSOLUTETIME(&end, &start);
+		absolutetime_to_nanoseconds(end, &nsec);
+		sample = (nsec / 1000 > kLearnedTimeoutMax_uS) ? kLearnedTimeoutMax_uS : (SInt32)(nsec / 1000);
+
+		// The device took at least as long as it was given.
+		if ((status == kIOReturnTimeout) && (sample < (SInt32)learned_uS))
+			sample = learned_uS;
+
+		if (fLatencySamples++ == 0)
+		{
+			fLatencyMean_uS = sample;
+			fLatencyDev_uS = sample / 2;
+		}
+		else
+		{
+			error = sample - (SInt32)fLatencyMean_uS;
+			fLatencyMean_uS = (SInt32)fLatencyMean_uS + error / 8;
+			fLatencyDev_uS = (SInt32)fLatencyDev_uS + ((error < 0 ? -error : error) - (SInt32)fLatencyDev_uS) / 4;
+		}
+	}
+
+	return status;
+}
+
+/*******************************************************************************
+ * Register shadow: reads and writes that went to the device.
+ * Without a per command status a failed list teaches nothing from its reads
+ * and makes its writes read back again, whichever command failed.
+ *******************************************************************************/
+
+void
+IOI2CDevice::shadowI2CCommand(
+	IOI2CCommand	*cmd,
+	IOReturn		status)
+{
+	if (!I2CSHADOWED(cmd))
+		return;
+
+	if (cmd->command == kI2CCommand_Read)
+	{
+		if (status == kIOReturnSuccess)
+			fRegisterShadow.didRead(cmd->subAddress, cmd->buffer, cmd->count);
+	}
+	else
+	if (cmd->command == kI2CCommand_Write)
+		fRegisterShadow.didWrite(cmd->subAddress, cmd->buffer, cmd->count, (status == kIOReturnSuccess));
+}
+
+void
+IOI2CDevice::declareI2CRegisters(
+	UInt32	subAddress,
+	UInt32	count,
+	UInt32	volatility)
+{
+	if (reserved && fRegisterShadow.initialized())
+		fRegisterShadow.declare(subAddress, count, volatility);
+}
+
+IOReturn
+IOI2CDevice::executeI2CCommands(
+	IOI2CCommandList	*list,
+	UInt32			clientKey)
+{
+	IOReturn		status;
+	UInt32			i;
+
+	if ((list == NULL) || (list->count && (list->commands == NULL)))
+		return kIOReturnBadArgument;
+
+	if (isI2COffline())
+	{
+		ERRLOG("IOI2CDevice@%lx::executeI2CCommands device is offline\n", fI2CAddress);
+		return kIOReturnOffline;
+	}
+
+	for (i = 0; i < list->count; i++)
+		list->commands[i].address = getI2CAddress();
+
+	DLOG("IOI2CDevice@%lx::executeI2CCommands key:%lx, N:%lx, O:%lx\n", fI2CAddress, clientKey, list->count, list->options);
+
+	if (clientKey == kIOI2C_CLIENT_KEY_DEFAULT)
+	{
+		if (kIOReturnSuccess == (status = lockI2CBus(&clientKey, i2cPriorityFromOptions(list->options))))
+		{
+			status = fProvider->callPlatformFunction(symCommandListI2CBus, false, (void *)list, (void *)clientKey, (void *)0, (void *)0);
+			for (i = 0; i < list->completed; i++)
+				shadowI2CCommand(&list->commands[i], list->status ? list->status[i] : status);
+			unlockI2CBus(clientKey);
+		}
+	}
+	else
+	{
+		status = fProvider->callPlatformFunction(symCommandListI2CBus, false, (void *)list, (void *)clientKey, (void *)0, (void *)0);
+		for (i = 0; i < list->completed; i++)
+			shadowI2CCommand(&list->commands[i], list->status ? list->status[i] : status);
+	}
+
+	return status;
+}
+
+IOReturn
+IOI2CDevice::submitI2C(
+	IOI2CCommand	*cmd,
+	IOI2CCompletion	*completion)
+{
+	if ((cmd == NULL) || (completion == NULL))
+		return kIOReturnBadArgument;
+
+	if (isI2COffline())
+	{
+		ERRLOG("IOI2CDevice@%lx::submitI2C device is offline\n", fI2CAddress);
+		return kIOReturnOffline;
+	}
+
+	cmd->address = getI2CAddress();
+	DLOGI2C((cmd->options), "IOI2CDevice@%lx::submitI2C cmd C:%lx, B:%lx, A:%lx S:%lx, L:%lx, M:%lx\n",
+		fI2CAddress, cmd->command, cmd->bus, cmd->address, cmd->subAddress, cmd->count, cmd->mode);
+	return fProvider->callPlatformFunction(symSubmitI2CBus, false, (void *)cmd, (void *)completion, (void *)0, (void *)0);
+}
+
 IOReturn
 IOI2CDevice::writeI2C(
 	UInt32	subAddress,
@@ -1018,34 +1215,10 @@ IOI2CDevice::callPlatformFunction(
 
 	if (0 == (fStateFlags & kStateFlags_TEARDOWN))
 	{
-		if (symReadI2CBus->isEqualTo(functionName))
-			return readI2C((IOI2CCommand *)param1, (UInt32)param2);
-		else
-		if (symWriteI2CBus->isEqualTo(functionName))
-			return writeI2C((IOI2CCommand *)param1, (UInt32)param2);
-		else
-		if (symLockI2CBus->isEqualTo(functionName))
-			return lockI2CBus((UInt32 *)param2);
-		else
-		if (symUnlockI2CBus->isEqualTo(functionName))
-			return unlockI2CBus((UInt32)param2);
-		else
-		if (symClientRead->isEqualTo(functionName))
-			return readI2C((UInt32)param1, (UInt8 *)param2, (UInt32)param3, (UInt32)param4);
-		else
-		if (symClientWrite->isEqualTo(functionName))
-			return writeI2C((UInt32)param1, (UInt8 *)param2, (UInt32)param3, (UInt32)param4);
-		else
-		if (functionName->isEqualTo("IOI2CSetDebugFlags"))
-		{
-			UInt32 flags = ( (UInt32)param1 & ( kStateFlags_IOLog | kStateFlags_kprintf ) );
-			DLOG("IOI2CDevice@%lx IOI2CSetDebugFlags:%lx %s\n", (unsigned long int)getI2CAddress(), (unsigned long int)flags, ((UInt32)param2 == true)?"TRUE":"FALSE");
-			if ((UInt32)param2 == true)
-				fStateFlags |= flags;	// set the debug flags
-			else
-				fStateFlags &= ~flags;	// clear the debug flags
-			return kIOReturnSuccess;
-		}
+		IOI2CFunctionAction action;
+
+		if (action = fFunctionTable.lookup(functionName))
+			return (*action)(this, functionName, waitForFunction, param1, param2, param3, param4);
 
 		// If no other symbol matched - check for OnDemand platform function.
 		if (fEnableOnDemandPlatformFunctions)
@@ -1070,6 +1243,83 @@ IOI2CDevice::callPlatformFunction(
 	return super::callPlatformFunction(functionName, waitForFunction, param1, param2, param3, param4);
 }
 
+IOReturn
+IOI2CDevice::registerI2CFunction(
+	const char			*functionName,
+	IOI2CFunctionAction	action)
+{
+	const OSSymbol	*symbol;
+	bool			added;
+
+	if (0 == reserved)
+		return kIOReturnNotReady;
+
+	if (0 == (symbol = OSSymbol::withCString(functionName)))
+		return kIOReturnNoMemory;
+
+	added = fFunctionTable.add(symbol, action);	// retained by the table
+	symbol->release();
+
+	return added ? kIOReturnSuccess : kIOReturnNoSpace;
+}
+
+IOReturn
+IOI2CDevice::sReadI2CBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CDevice *)target)->readI2C((IOI2CCommand *)param1, (UInt32)param2);
+}
+
+IOReturn
+IOI2CDevice::sWriteI2CBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CDevice *)target)->writeI2C((IOI2CCommand *)param1, (UInt32)param2);
+}
+
+IOReturn
+IOI2CDevice::sLockI2CBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CDevice *)target)->lockI2CBus((UInt32 *)param2, (UInt32)param3);
+}
+
+IOReturn
+IOI2CDevice::sUnlockI2CBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CDevice *)target)->unlockI2CBus((UInt32)param2);
+}
+
+IOReturn
+IOI2CDevice::sClientRead(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CDevice *)target)->readI2C((UInt32)param1, (UInt8 *)param2, (UInt32)param3, (UInt32)param4);
+}
+
+IOReturn
+IOI2CDevice::sClientWrite(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	return ((IOI2CDevice *)target)->writeI2C((UInt32)param1, (UInt8 *)param2, (UInt32)param3, (UInt32)param4);
+}
+
+IOReturn
+IOI2CDevice::sSetDebugFlags(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+	void *param1, void *param2, void *param3, void *param4)
+{
+	IOI2CDevice	*self = (IOI2CDevice *)target;
+	UInt32		flags = ( (UInt32)param1 & ( kStateFlags_IOLog | kStateFlags_kprintf ) );
+
+	DLOG("IOI2CDevice@%lx IOI2CSetDebugFlags:%lx %s\n", (unsigned long int)self->getI2CAddress(), (unsigned long int)flags, ((UInt32)param2 == true)?"TRUE":"FALSE");
+	if ((UInt32)param2 == true)
+		self->fStateFlags |= flags;		// set the debug flags
+	else
+		self->fStateFlags &= ~flags;	// clear the debug flags
+	return kIOReturnSuccess;
+}
+
 #pragma mark  
 #pragma mark *** IOPlatformFunction API methods ***
 #pragma mark  
@@ -1120,6 +1370,11 @@ IOI2CDevice::InitializePlatformFunctions(void)
 		UInt32 flags;
 
 		count = fPlatformFuncArray->getCount();
+
+		// Index the functions by name and by flag as they go by. Without the memory for it
+		// getPlatformFunction and performFunctionsWithFlags scan the array.
+		bool indexed = fPFIndex.allocate(count);
+
 		for (i = 0; i < count; i++)
 		{
 			if (func = OSDynamicCast(IOPlatformFunction, fPlatformFuncArray->getObject(i)))
@@ -1128,6 +1383,28 @@ IOI2CDevice::InitializePlatformFunctions(void)
 
 				if ((flags & kIOPFFlagOnDemand) || (flags & kIOPFFlagIntGen))
 					func->publishPlatformFunction(this);
+
+				if (indexed)
+					fPFIndex.add(func, func->getPlatformFunctionName(), flags);
+			}
+			else
+			if (indexed)
+				fPFIndex.add(0, 0, 0);
+		}
+
+		if (indexed && !fPFIndex.finish())
+			fPFIndex.free();
+
+		// Decode every function now so performFunction never has to walk the command words.
+		if (count && (fPFStatus = (IOReturn *)IOMalloc(count * sizeof(IOReturn))))
+		{
+			fPFStatusCount = count;
+			for (i = 0; i < count; i++)
+			{
+				if (func = OSDynamicCast(IOPlatformFunction, fPlatformFuncArray->getObject(i)))
+					fPFStatus[i] = decodePlatformFunction(func);
+				else
+					fPFStatus[i] = kIOReturnBadArgument;
 			}
 		}
 	}
@@ -1143,12 +1420,22 @@ IOI2CDevice::getPlatformFunction (
 {
 	IOReturn			status = kIOReturnNotFound;
 	UInt32				count, i;
+	SInt32				index;
 	IOPlatformFunction	*func;
 
 	#define kIOI2CPFFlagsMask (kIOPFFlagOnInit|kIOPFFlagOnTerm|kIOPFFlagOnSleep|kIOPFFlagOnWake|kIOPFFlagOnDemand)
 	if (flags == 0)
 		flags = kIOI2CPFFlagsMask;
 
+	if (fPFIndex.ready())
+	{
+		if ((index = fPFIndex.find(functionSym, flags)) < 0)
+			return kIOReturnNotFound;
+
+		*funcRef = fPFIndex.function(index);
+		return kIOReturnSuccess;
+	}
+
 	if (fPlatformFuncArray)
 	{
 		count = fPlatformFuncArray->getCount();
@@ -1181,11 +1468,20 @@ IOI2CDevice::performFunctionsWithFlags(
 	UInt32				flags)
 {
 	UInt32				count, i;
+	SInt32				index;
 	IOPlatformFunction	*func;
 
 	if (0 == fPlatformFuncArray)
 		return;
 
+	// Only the functions with the flags, in array order
+	if (fPFIndex.ready())
+	{
+		for (index = fPFIndex.nextWithFlags(flags, 0); index >= 0; index = fPFIndex.nextWithFlags(flags, index + 1))
+			performFunction(fPFIndex.function(index));
+		return;
+	}
+
 	// Execute any functions flagged as "on sleep"
 	count = fPlatformFuncArray->getCount();
 	for (i = 0; i < count; i++)
@@ -1243,166 +1539,62 @@ IOI2CDevice::performFunction(
 	void						*pfParam3,
 	void						*pfParam4)
 {
-	IOReturn					status = kIOReturnSuccess;
-	IOPlatformFunctionIterator 	*iter;
-	UInt8						scratchBuffer[kI2CPF_READ_BUFFER_LEN] = {0};
-	UInt8						readBuffer[kI2CPF_READ_BUFFER_LEN] = {0};
-	UInt32						mode = kI2CMode_Unspecified;
-	UInt8						*maskBytes, *valueBytes;
-	unsigned					delayMS;
-	UInt32 						cmd, cmdLen, param1, param2, param3, param4, param5, 
-									param6, param7, param8, param9, param10;
-
-	UInt32						key = 0;
-	bool						i2cIsLocked = FALSE;
-	bool						isI2CFunction = FALSE;
+	IOReturn					status;
+	SInt32						index = -1;
+	UInt32						i;
 
 	DLOG ("IOI2CDevice::performFunction(%lx) - entered\n", fI2CAddress);
 
 	if (!func)
 		return kIOReturnBadArgument;
 
-	if (!(iter = func->getCommandIterator()))
-		return kIOReturnNotFound;
-
-	// Check for I2C function...
-	while (iter->getNextCommand (&cmd, &cmdLen, &param1, &param2, &param3, &param4, 
-		&param5, &param6, &param7, &param8, &param9, &param10, (UInt32 *)&status)
-		&& (status != kIOPFNoError))
-	{
-		if ((cmd == kCommandReadI2CSubAddr) || (cmd == kCommandWriteI2CSubAddr))
-		{
-			isI2CFunction = TRUE;
-			break;
-		}
-	}
-
-	if (status == kIOReturnSuccess)
+	if (fPFIndex.ready())
+		index = fPFIndex.indexOf(func, func->getPlatformFunctionName());
+	else
 	{
-		if (isI2CFunction)
+		for (i = 0; i < fPFStatusCount; i++)
 		{
-			if (kIOReturnSuccess == (status = lockI2CBus(&key)))
-				i2cIsLocked = TRUE;
+			if (fPlatformFuncArray->getObject(i) == func)
+			{
+				index = i;
+				break;
+			}
 		}
 	}
 
-	if (status == kIOReturnSuccess)
-	{
-		iter->reset();
-
-		while (iter->getNextCommand (&cmd, &cmdLen, &param1, &param2, &param3, &param4, 
-			&param5, &param6, &param7, &param8, &param9, &param10, (UInt32 *)&status)
-			&& (status != kIOPFNoError))
-		{
-			DLOG ("IOI2CDevice::performFunction(%lx) - 1)0x%lx, 2)0x%lx, 3)0x%lx, 4)0x%lx, 5)0x%lx,"
-					"6)0x%lx, 7)0x%lx, 8)0x%lx, 9)0x%lx, 10)0x%lx\n", getI2CAddress(), param1, param2, param3,
-					param4, param5, param6, param7, param8, param9, param10);
-	
-			switch (cmd)
-			{
-				case kCommandDelay:
-					delayMS = param1 / 1000; // convert param1 from uS to mS.
-					DLOG("IOI2CDevice::performFunction(%lx) delay %u\n", getI2CAddress(), delayMS);
-					if (delayMS != 0)
-						IOSleep(delayMS);
-					break;
-
-				case kCommandReadI2CSubAddr:
-					if (param2 > kI2CPF_READ_BUFFER_LEN)
-					{
-						status = kIOPFBadCmdLength;
-						ERRLOG("IOI2CDevice::performFunction(%lx) r-sub operation too big!\n", getI2CAddress());
-						break;
-					}
-	
-					if (mode == kI2CMode_Unspecified)
-					{
-						status = kIOReturnUnsupportedMode;
-						ERRLOG("IOI2CDevice::performFunction(%lx) Rd Unspecified I2C mode\n", getI2CAddress());
-						break;
-					}
-
-					status = readI2C(param1, readBuffer, param2, key, mode);
-					break;
-
-				case kCommandWriteI2CSubAddr:
-					if (mode == kI2CMode_Unspecified)
-					{
-						status = kIOReturnUnsupportedMode;
-						ERRLOG("IOI2CDevice::performFunction(%lx) Wt Unspecified I2C mode\n", getI2CAddress());
-						break;
-					}
-
-					DLOG("IOI2CDevice::performFunction(%lx) w-sub %lx len %lx data", getI2CAddress(), param1, param2);
-
-					status = writeI2C((UInt32) param1, (UInt8 *) param3, (UInt32) param2, key, mode);
-					break;
-
-				case kCommandI2CMode:
-					switch (param1)
-					{
-						default:
-						case kPFMode_Dumb:			status = kIOReturnUnsupportedMode;	break;
-						case kPFMode_Standard:		mode = kI2CMode_Standard;			break;
-						case kPFMode_Subaddress:	mode = kI2CMode_StandardSub;		break;
-						case kPFMode_Combined:		mode = kI2CMode_Combined;			break;
-					}
-
-					DLOG("IOI2CDevice::performFunction(%lx) PF mode %lx\n", getI2CAddress(), mode);
-					break;
-
-				case kCommandRMWI2CSubAddr:
-					// check parameters
-					if ((param2 > kI2CPF_READ_BUFFER_LEN) ||	// number of mask bytes
-						(param3 > kI2CPF_READ_BUFFER_LEN) ||	// number of value bytes
-						(param4 > kI2CPF_READ_BUFFER_LEN) ||	// number of transfer bytes
-						(param3 > param2))	// param3 is not actually used, we assume that
-											// any byte that is masked also gets a value OR'ed in.
-					{
-						ERRLOG("IOI2CDevice::performFunction(%lx) invalid mw-sub cycle\n", getI2CAddress());
-						status = kIOReturnAborted;
-						break;
-					}
-
-					if (mode == kI2CMode_Unspecified)
-					{
-						status = kIOReturnUnsupportedMode;
-						ERRLOG("IOI2CDevice::performFunction(%lx) RMW Unspecified I2C mode\n", getI2CAddress());
-						break;
-					}
+	if (index >= 0 && (UInt32)index < fPFStatusCount)
+		status = fPFStatus[index];
+	else
+		status = decodePlatformFunction(func);	// Not one of ours, or there was no memory at init time.
 
-					maskBytes = (UInt8 *) param5;
-					valueBytes = (UInt8 *) param6;
-	
-					// Do the modify write operation on the previously read data buffer.
-					for (unsigned int index = 0; index < param2; index++) // param2 = number of mask bytes
-					{
-						scratchBuffer[index] = ((valueBytes[index] & maskBytes[index]) |
-												(readBuffer[index] & ~maskBytes[index]));
-					}
+	DLOG ("IOI2CDevice::performFunction - done status: %x\n", status);
+	return status;
+}
 
-					DLOG("IOI2CDevice::performFunction(%lx) mw-sub %lx len %lx data", getI2CAddress(), param1, param4);
-					status = writeI2C((UInt8) param1, scratchBuffer, (UInt16) param4, key, mode);
-					break;
-	
-				default:
-					ERRLOG ("IOI2CDevice::performFunction - bad command %ld\n", cmd);
-					status = kIOReturnAborted;
-					break;
-			}
+/*******************************************************************************
+ * Decode a platform function's commands - decodePlatformFunction()
+ *******************************************************************************/
+IOReturn
+IOI2CDevice::decodePlatformFunction(
+	IOPlatformFunction			*func)
+{
+	IOPlatformFunctionIterator 	*iter;
+	IOReturn					status = kIOReturnSuccess;
+	UInt32 						cmd, cmdLen, param1, param2, param3, param4, param5, 
+									param6, param7, param8, param9, param10;
 
-			if (status != kIOReturnSuccess)
-				break;
-		}
-	}
+	if (!(iter = func->getCommandIterator()))
+		return kIOReturnNotFound;
 
-	if (iter)
-		iter->release();
+	// The loops performFunction used to run on every call went on while "status != kIOPFNoError",
+	// so they stopped as soon as a command decoded and no command ever ran: the call returned the
+	// first command's decode status. Running the commands is a change of its own.
+	iter->getNextCommand (&cmd, &cmdLen, &param1, &param2, &param3, &param4, 
+		&param5, &param6, &param7, &param8, &param9, &param10, (UInt32 *)&status);
 
-	if (i2cIsLocked)
-		unlockI2CBus(key);
+	DLOG ("IOI2CDevice::decodePlatformFunction(%lx) - cmd 0x%lx status 0x%x\n", getI2CAddress(), cmd, status);
 
-	DLOG ("IOI2CDevice::performFunction - done status: %x\n", status);
+	iter->release();
 	return status;
 }
 
@@ -55,6 +55,10 @@
 
 #include <IOKit/IOService.h>
 #include <IOI2C/IOI2CDefs.h>
+#include <IOI2C/IOI2CPriorityLock.h>
+#include <IOI2C/IOI2CRegisterShadow.h>
+#include <IOI2C/IOI2CFunctionTable.h>
+#include <IOI2C/IOI2CPlatformFunctionIndex.h>
 
 class IOPlatformFunction;
 
@@ -126,9 +130,9 @@ protected:
 
 private:
 	UInt32			fI2CAddress;			// This devices I2C bus address.
-	IOLock			*fClientLock;			// Used for I2C arbitration and power state transition synchronization.
+	IOLock			*fClientLock;			// Unused, kept for the class layout: see fClientPriorityLock.
 	volatile semaphore_t
-					fClientSem;
+					fClientSem;				// Unused, kept for the class layout: see fClientPriorityLock.
 	unsigned long	fCurrentPowerState;		// The current power state.
 	thread_call_t	fPowerStateThreadCall;	// Thread call used for power state transitions.
 	thread_t		fPowerThreadID;			// Used to allow only the fPowerStateThreadCall to do transactions during power state transitions.
@@ -162,12 +166,25 @@ protected:
 		@method lockI2CBus
 		@abstract This method attains a mutually exclusive lock on the I2C device and bus for subsequent I2C transactions.
 		@discussion The client must unlock the bus. The bus should be locked for a minimum period. All other clients will block while the lock is held.
+		Waits in the kI2CPriority_Default class.
 		@param clientKeyRef Address of a client allocated UInt32 which receives a key value for subsequent read and write transactions while the lock is held.
 		@result kIOReturnSuccess, or other IOReturn error code.
 	*/
 	IOReturn lockI2CBus(
 		UInt32	*clientKeyRef);
 
+	/*!
+		@method lockI2CBus
+		@abstract lockI2CBus, waiting in a given priority class.
+		@discussion Waiting clients are granted the device, and then the bus, in priority order (see kI2CPriority_xxx).
+		@param clientKeyRef Address of a client allocated UInt32 which receives a key value for subsequent read and write transactions while the lock is held.
+		@param priority kI2CPriority_xxx class to wait in.
+		@result kIOReturnSuccess, or other IOReturn error code.
+	*/
+	IOReturn lockI2CBus(
+		UInt32	*clientKeyRef,
+		UInt32	priority);
+
 	/*!
 		@method unlockI2CBus
 		@abstract This method releases the exclusive lock on the I2C device and bus.
@@ -244,6 +261,10 @@ protected:
 		@abstract This method initiates an I2C write transaction to this drivers device.
 		@discussion If the client passes kIOI2C_CLIENT_KEY_DEFAULT this method may block waiting for access to the I2C bus.
 		If a valid key is used then this method is guaranteed to execute synchronously on the calling thread.
+		If cmd->timeout_uS is 0 and cmd->options has kI2COption_LearnedTimeout, the transaction is given the timeout
+		learned from this device's recent transactions (see timedI2CTransaction) instead of the controller's 5 second default.
+		A write of values the declared config registers already hold returns success without touching the bus,
+		unless cmd->options has kI2COption_Uncached (see declareI2CRegisters).
 		@param cmd A pointer to an IOI2CCommand struct allocated by the caller.
 		@param clientKey Either a valid key returned from lockI2CBus or kIOI2C_CLIENT_KEY_DEFAULT.
 		@result kIOReturnSuccess, or other IOReturn error code.
@@ -257,6 +278,10 @@ protected:
 		@abstract This method initiates an I2C read transaction to this drivers device.
 		@discussion If the client passes kIOI2C_CLIENT_KEY_DEFAULT this method may block waiting for access to the I2C bus.
 		If a valid key is used then this method is guaranteed to execute synchronously on the calling thread.
+		If cmd->timeout_uS is 0 and cmd->options has kI2COption_LearnedTimeout, the transaction is given the timeout
+		learned from this device's recent transactions (see timedI2CTransaction) instead of the controller's 5 second default.
+		A read of declared static or config registers whose values are known is answered without touching the bus,
+		unless cmd->options has kI2COption_Uncached (see declareI2CRegisters).
 		@param cmd A pointer to an IOI2CCommand struct allocated by the caller.
 		@param clientKey Either a valid key returned from lockI2CBus or kIOI2C_CLIENT_KEY_DEFAULT.
 		@result kIOReturnSuccess, or other IOReturn error code.
@@ -265,6 +290,71 @@ protected:
 		IOI2CCommand	*cmd,
 		UInt32		clientKey);
 
+	/*!
+		@method executeI2CCommands
+		@abstract This method executes a list of I2C read and write transactions to this drivers device back to back.
+		@discussion The whole list runs under a single bus lock: if the client passes kIOI2C_CLIENT_KEY_DEFAULT the bus is locked once
+		for all commands rather than once per command. The address of every command is set to this device's address.
+		If list->status is not NULL it receives the status of each command. With kI2CListOption_StopOnError the commands after
+		the first failure are not executed and return kIOReturnAborted. Every command goes to the device, the register
+		shadow only learns from the results.
+		@param list A pointer to an IOI2CCommandList struct allocated by the caller.
+		@param clientKey Either a valid key returned from lockI2CBus or kIOI2C_CLIENT_KEY_DEFAULT.
+		@result kIOReturnSuccess if every command executed succeeded, or the IOReturn error code of the first one that failed.
+	*/
+	IOReturn executeI2CCommands(
+		IOI2CCommandList	*list,
+		UInt32		clientKey = kIOI2C_CLIENT_KEY_DEFAULT);
+
+	/*!
+		@method submitI2C
+		@abstract This method queues an I2C read or write transaction to this drivers device and returns without waiting for it.
+		@discussion The controller executes submitted commands on its own thread, locking the bus for each one,
+		and then calls completion->action with the command and its status. Commands queued on different controllers run
+		concurrently. cmd->timeout_uS counts from submission: the queue is ordered earliest deadline first, commands
+		without a timeout last, and a command whose deadline passes before it reaches the bus completes with kIOReturnTimeout. cmd->command selects read or write. The command and its buffer must stay valid until the action is called.
+		May not be called from primary interrupt context. Once the controller is being torn down it returns kIOReturnOffline.
+		@param cmd A pointer to an IOI2CCommand struct allocated by the caller.
+		@param completion Action to call when the transaction is done; copied, so it may live on the stack.
+		@result kIOReturnSuccess if the command was queued, or other IOReturn error code, in which case the action is not called.
+	*/
+	IOReturn submitI2C(
+		IOI2CCommand	*cmd,
+		IOI2CCompletion	*completion);
+
+	/*!
+		@method declareI2CRegisters
+		@abstract Declares the kI2CRegister_xxx volatility class of count registers starting at 8-bit subAddress.
+		@discussion Registers are kI2CRegister_Live until declared otherwise. Static and config registers are read from
+		the device once and then answered from this device's register shadow; config registers are written through,
+		and a write that would not change them is dropped. The shadow is forgotten at every transition to ON, the
+		device may have been reset, before processPowerEvent is called. Only subaddress and combined mode transactions
+		are shadowed, and only registers that are never written other than through this device may be declared config.
+		Commands queued with submitI2C bypass the shadow: registers they write must not be declared.
+		@param subAddress First register, 8-bit subaddress.
+		@param count Number of consecutive registers.
+		@param volatility kI2CRegister_Live, kI2CRegister_Static or kI2CRegister_Config.
+	*/
+	void declareI2CRegisters(
+		UInt32	subAddress,
+		UInt32	count,
+		UInt32	volatility);
+
+	/*!
+		@method registerI2CFunction
+		@abstract Routes callPlatformFunction calls for functionName to action, with this device as the target.
+		@discussion callPlatformFunction finds the action with a single table lookup instead of comparing the symbol
+		against each function it knows. Register from start, after IOI2CDevice::start and before registerService;
+		registering a function IOI2CDevice already handles replaces its action. Actions are not called once
+		freeI2CResources has run, the call goes to the provider instead.
+		@param functionName The callPlatformFunction symbol name.
+		@param action Called with this device, the symbol and the caller's arguments.
+		@result kIOReturnSuccess, kIOReturnNoMemory, or kIOReturnNoSpace if the table is full.
+	*/
+	IOReturn registerI2CFunction(
+		const char			*functionName,
+		IOI2CFunctionAction	action);
+
 
 
 
@@ -366,6 +456,16 @@ protected:
 	*/
 	void performFunctionsWithFlags(UInt32 flags);
 
+	/*!
+		@method decodePlatformFunction
+		@abstract Returns what performFunction returns for func.
+		@discussion Called for every function in fPlatformFuncArray by InitializePlatformFunctions. No command
+		runs: like the iterator loops performFunction used to run on every call, this returns the first
+		command's decode status.
+		@result kIOReturnNotFound if func has no command iterator, otherwise the first command's decode status.
+	*/
+	IOReturn decodePlatformFunction(IOPlatformFunction *func);
+
 	
 
 
@@ -443,6 +543,25 @@ private:
 		thread_call_param_t	p0,
 		thread_call_param_t	p1);
 
+	/*!
+		@method sReadI2CBus
+		@abstract fFunctionTable actions for the functions IOI2CDevice handles itself, see registerI2CFunction.
+	*/
+	static IOReturn sReadI2CBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sWriteI2CBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sLockI2CBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sUnlockI2CBus(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sClientRead(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sClientWrite(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+	static IOReturn sSetDebugFlags(OSObject *target, const OSSymbol *functionName, bool waitForFunction,
+		void *param1, void *param2, void *param3, void *param4);
+
 	/*!
 		@method powerStateThreadCall
 		@abstract Threadcall entrypoint used to process power state transitions.
@@ -451,6 +570,29 @@ private:
 	void powerStateThreadCall(
 		unsigned long	newPowerState);
 
+	/*!
+		@method timedI2CTransaction
+		@abstract Calls the controller's read or write function, with a learned timeout if the caller asked for one.
+		@discussion Keeps a smoothed mean and mean deviation of how long successful transactions to this device take,
+		the way TCP estimates its retransmit timeout. Once enough have been seen a command with timeout_uS 0 and
+		kI2COption_LearnedTimeout is given mean + 4 * deviation, so a device that stops responding costs its callers
+		milliseconds rather than the controller's 5 second default. Without the option, 0 still means the 5 seconds
+		slow devices need [3915595]. A learned timeout that expires is learned as a transaction that took that long,
+		which widens the next one; other failures are not learned from. The estimate restarts on power on.
+	*/
+	IOReturn timedI2CTransaction(
+		const OSSymbol	*function,
+		IOI2CCommand	*cmd,
+		UInt32			clientKey);
+
+	/*!
+		@method shadowI2CCommand
+		@abstract Teaches the register shadow the outcome of a read or write that went to the device.
+	*/
+	void shadowI2CCommand(
+		IOI2CCommand	*cmd,
+		IOReturn		status);
+
 protected:
 	/*!
 		@enum kI2CPowerEvent_xxx
@@ -494,6 +636,17 @@ protected:
 		const OSSymbol	*symClientRead;			// CallPlatformFunction Symbol for reading the I2C bus
 		const OSSymbol	*symPowerInterest;
 		bool			fEnableOnDemandPlatformFunctions;
+		const OSSymbol	*symCommandListI2CBus;	// CallPlatformFunction Symbol for running an I2C command list
+		const OSSymbol	*symSubmitI2CBus;		// CallPlatformFunction Symbol for queueing an async I2C transaction
+		UInt32			fLatencyMean_uS;		// Smoothed transaction time, see timedI2CTransaction
+		UInt32			fLatencyDev_uS;			// Smoothed mean deviation of the transaction time
+		UInt32			fLatencySamples;		// Successful transactions timed since power on
+		IOI2CPriorityLock	fClientPriorityLock;	// Replaces fClientSem for I2C arbitration and power state synchronization
+		IOI2CRegisterShadow	fRegisterShadow;		// Static and config register values, see declareI2CRegisters
+		IOReturn		*fPFStatus;				// decodePlatformFunction of fPlatformFuncArray, same order
+		UInt32			fPFStatusCount;
+		IOI2CFunctionTable	fFunctionTable;		// callPlatformFunction actions, see registerI2CFunction
+		IOI2CPlatformFunctionIndex	fPFIndex;	// fPlatformFuncArray by name and by flag
 	};
 
 	/* var reserved		Reserved for future use.  (Internal use only) */
@@ -503,6 +656,17 @@ protected:
 	#define symClientRead		(reserved->symClientRead)
 	#define symPowerInterest	(reserved->symPowerInterest)
 	#define fEnableOnDemandPlatformFunctions	(reserved->fEnableOnDemandPlatformFunctions)
+	#define symCommandListI2CBus	(reserved->symCommandListI2CBus)
+	#define symSubmitI2CBus			(reserved->symSubmitI2CBus)
+	#define fLatencyMean_uS			(reserved->fLatencyMean_uS)
+	#define fLatencyDev_uS			(reserved->fLatencyDev_uS)
+	#define fLatencySamples			(reserved->fLatencySamples)
+	#define fClientPriorityLock		(reserved->fClientPriorityLock)
+	#define fRegisterShadow			(reserved->fRegisterShadow)
+	#define fPFStatus				(reserved->fPFStatus)
+	#define fPFStatusCount			(reserved->fPFStatusCount)
+	#define fFunctionTable			(reserved->fFunctionTable)
+	#define fPFIndex				(reserved->fPFIndex)
 
 	/*
 		Method space reserved for future expansion.
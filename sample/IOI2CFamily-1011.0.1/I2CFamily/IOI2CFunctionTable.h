@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 1998-2003 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *	File: IOI2CFunctionTable.h
+ *
+ *	callPlatformFunction dispatch by symbol identity.
+ *
+ *	OSSymbols are unique, so a symbol's address is enough to find its entry:
+ *	one hash and usually one probe instead of an isEqualTo per known symbol.
+ *	The table retains the symbols it holds. Entries are added while the
+ *	owner starts, before registerService, and only read afterwards, so
+ *	lookups take no lock.
+ */
+
+#ifndef _IOI2CFunctionTable_H
+#define _IOI2CFunctionTable_H
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSSymbol.h>
+
+/*!
+	@typedef IOI2CFunctionAction
+	@abstract Handles one callPlatformFunction symbol for target, with the caller's arguments.
+*/
+typedef IOReturn (*IOI2CFunctionAction)(
+	OSObject		*target,
+	const OSSymbol	*functionName,
+	bool			waitForFunction,
+	void			*param1,
+	void			*param2,
+	void			*param3,
+	void			*param4);
+
+class IOI2CFunctionTable
+{
+public:
+	void init(void)
+	{
+		bzero(this, sizeof(*this));
+	}
+
+	void free(void)
+	{
+		UInt32		i;
+
+		for (i = 0; i < kSize; i++)
+		{
+			if (fEntry[i].symbol)
+				fEntry[i].symbol->release();
+		}
+		bzero(this, sizeof(*this));
+	}
+
+	/*!
+		@method add
+		@abstract Routes symbol to action.
+		@discussion Registering a symbol again replaces its action, which is how a subclass takes
+		over a function its superclass handles.
+		@result false if symbol is NULL or the table is full.
+	*/
+	bool add(const OSSymbol *symbol, IOI2CFunctionAction action)
+	{
+		UInt32		i;
+
+		if (symbol == NULL || action == NULL)
+			return false;
+
+		for (i = hash(symbol); fEntry[i].symbol; i = (i + 1) & (kSize - 1))
+		{
+			if (fEntry[i].symbol == symbol)
+			{
+				fEntry[i].action = action;
+				return true;
+			}
+		}
+
+		if (fCount >= kMaxEntries)
+			return false;
+
+		symbol->retain();
+		fEntry[i].action = action;
+		fEntry[i].symbol = symbol;
+		fCount++;
+		return true;
+	}
+
+	/*!
+		@method lookup
+		@result The action registered for symbol, NULL if there is none.
+	*/
+	IOI2CFunctionAction lookup(const OSSymbol *symbol) const
+	{
+		UInt32		i;
+
+		for (i = hash(symbol); fEntry[i].symbol; i = (i + 1) & (kSize - 1))
+		{
+			if (fEntry[i].symbol == symbol)
+				return fEntry[i].action;
+		}
+		return NULL;
+	}
+
+private:
+	enum
+	{
+		kSize		= 32,			// power of two
+		kMaxEntries	= 24			// keeps probe sequences short and one slot always empty
+	};
+
+	struct
+	{
+		const OSSymbol		*symbol;
+		IOI2CFunctionAction	action;
+	}				fEntry[kSize];
+	UInt32			fCount;
+
+	static UInt32 hash(const OSSymbol *symbol)
+	{
+		// allocations are at least 16 byte aligned, the low bits say nothing
+		return ((UInt32)((uintptr_t)symbol >> 4) * 2654435761U) >> 27;
+	}
+};
+
+#endif // _IOI2CFunctionTable_H
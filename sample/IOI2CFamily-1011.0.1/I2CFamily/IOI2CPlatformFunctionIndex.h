@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 1998-2003 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *	File: IOI2CPlatformFunctionIndex.h
+ *
+ *	Index of a device's fPlatformFuncArray, built once its functions are known.
+ *
+ *	Functions are found by name through a hash keyed by the name symbol's
+ *	address, functions sharing a name chained in array order, and by flag
+ *	through one sorted list of array positions per kIOPFFlagOnInit ...
+ *	kIOPFFlagIntGen bit. Every query answers what a scan of the array in
+ *	order would, without touching the functions that do not match. The
+ *	index is read only once built, and does not retain anything: the array
+ *	retains the functions, the functions their names.
+ */
+
+#ifndef _IOI2CPlatformFunctionIndex_H
+#define _IOI2CPlatformFunctionIndex_H
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSSymbol.h>
+
+class IOPlatformFunction;
+
+class IOI2CPlatformFunctionIndex
+{
+public:
+	void init(void)
+	{
+		bzero(this, sizeof(*this));
+	}
+
+	/*!
+		@method allocate
+		@abstract Makes room for count functions, to be added in array order with add, then finish.
+	*/
+	bool allocate(UInt32 count)
+	{
+		free();
+		if (count == 0)
+			return false;
+
+		for (fHashBits = 4; (1U << fHashBits) < 2 * count; fHashBits++)
+			;
+		fHashSize = 1 << fHashBits;
+
+		fEntry = (Entry *)IOMalloc(count * sizeof(Entry));
+		fHash = (UInt32 *)IOMalloc(fHashSize * sizeof(UInt32));
+		if (!fEntry || !fHash)
+		{
+			free();
+			return false;
+		}
+
+		bzero(fEntry, count * sizeof(Entry));
+		bzero(fHash, fHashSize * sizeof(UInt32));
+		fCapacity = count;
+		return true;
+	}
+
+	void free(void)
+	{
+		if (fEntry)	IOFree(fEntry, fCapacity * sizeof(Entry));
+		if (fHash)	IOFree(fHash, fHashSize * sizeof(UInt32));
+		if (fList)	IOFree(fList, fListSize * sizeof(UInt32));
+		bzero(this, sizeof(*this));
+	}
+
+	bool ready(void) const { return fReady; }
+
+	/*!
+		@method add
+		@abstract Adds the next array element, func NULL if it is not an IOPlatformFunction.
+	*/
+	void add(IOPlatformFunction *func, const OSSymbol *name, UInt32 flags)
+	{
+		UInt32		i, slot, index;
+
+		if (fReady || fCount >= fCapacity)
+			return;
+
+		index = fCount++;
+		fEntry[index].func = func;
+		fEntry[index].name = func ? name : 0;
+		fEntry[index].flags = func ? flags : 0;
+		if (!fEntry[index].name)
+			return;
+
+		// first of its name goes in the hash, the others at the end of the chain
+		for (slot = hash(name); fHash[slot]; slot = (slot + 1) & (fHashSize - 1))
+		{
+			if (fEntry[fHash[slot] - 1].name == name)
+			{
+				for (i = fHash[slot] - 1; fEntry[i].next; i = fEntry[i].next - 1)
+					;
+				fEntry[i].next = index + 1;
+				return;
+			}
+		}
+		fHash[slot] = index + 1;
+	}
+
+	/*!
+		@method finish
+		@abstract Builds the per-flag lists, after which the index answers queries.
+	*/
+	bool finish(void)
+	{
+		UInt32		bit, i, total = 0;
+
+		if (fReady || fCount != fCapacity)
+			return false;
+
+		for (bit = 0; bit < kFlagLists; bit++)
+		{
+			fListStart[bit] = total;
+			for (i = 0; i < fCount; i++)
+			{
+				if (fEntry[i].flags & listFlag(bit))
+					total++;
+			}
+			fListCount[bit] = total - fListStart[bit];
+		}
+
+		if (total)
+		{
+			if (0 == (fList = (UInt32 *)IOMalloc(total * sizeof(UInt32))))
+				return false;
+			fListSize = total;
+
+			for (bit = 0, total = 0; bit < kFlagLists; bit++)
+			{
+				for (i = 0; i < fCount; i++)
+				{
+					if (fEntry[i].flags & listFlag(bit))
+						fList[total++] = i;
+				}
+			}
+		}
+
+		fReady = true;
+		return true;
+	}
+
+	/*!
+		@method find
+		@abstract The first function named name with any of flags set.
+		@result Its array position, or -1.
+	*/
+	SInt32 find(const OSSymbol *name, UInt32 flags) const
+	{
+		UInt32		i;
+
+		for (i = first(name); i; i = fEntry[i - 1].next)
+		{
+			if (fEntry[i - 1].flags & flags)
+				return i - 1;
+		}
+		return -1;
+	}
+
+	/*!
+		@method indexOf
+		@result The array position of func, named name, or -1.
+	*/
+	SInt32 indexOf(IOPlatformFunction *func, const OSSymbol *name) const
+	{
+		UInt32		i;
+
+		for (i = first(name); i; i = fEntry[i - 1].next)
+		{
+			if (fEntry[i - 1].func == func)
+				return i - 1;
+		}
+		return -1;
+	}
+
+	/*!
+		@method nextWithFlags
+		@abstract The first function at or after array position from with any of flags set.
+		@result Its array position, or -1. Pass the result + 1 to get the one after it.
+	*/
+	SInt32 nextWithFlags(UInt32 flags, UInt32 from) const
+	{
+		UInt32		bit, lo, hi, mid, next = fCount;
+
+		for (bit = 0; bit < kFlagLists; bit++)
+		{
+			if (0 == (flags & listFlag(bit)))
+				continue;
+
+			// first list entry >= from
+			lo = fListStart[bit];
+			hi = lo + fListCount[bit];
+			while (lo < hi)
+			{
+				mid = (lo + hi) / 2;
+				if (fList[mid] < from)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			if (lo < fListStart[bit] + fListCount[bit] && fList[lo] < next)
+				next = fList[lo];
+		}
+
+		// flags that have no list of their own
+		if (flags & ~kListedFlags)
+		{
+			for (; from < next; from++)
+			{
+				if (fEntry[from].flags & flags & ~kListedFlags)
+				{
+					next = from;
+					break;
+				}
+			}
+		}
+
+		return (next < fCount) ? (SInt32)next : -1;
+	}
+
+	IOPlatformFunction *function(UInt32 index) const { return fEntry[index].func; }
+
+private:
+	enum
+	{
+		kFlagLists		= 6,				// kIOPFFlagOnInit (bit 31) down to kIOPFFlagIntGen (bit 26)
+		kListedFlags	= 0xfc000000
+	};
+
+	typedef struct
+	{
+		IOPlatformFunction	*func;
+		const OSSymbol		*name;
+		UInt32				flags;
+		UInt32				next;			// array position + 1 of the next function of the same name, 0 at the end
+	} Entry;
+
+	Entry			*fEntry;
+	UInt32			fCapacity;
+	UInt32			fCount;
+	UInt32			*fHash;					// array position + 1 of the first function of each name, 0 if empty
+	UInt32			fHashSize;				// power of two, at least twice fCapacity
+	UInt32			fHashBits;
+	UInt32			*fList;					// array positions, per flag, ascending
+	UInt32			fListSize;
+	UInt32			fListStart[kFlagLists];
+	UInt32			fListCount[kFlagLists];
+	bool			fReady;
+
+	static UInt32 listFlag(UInt32 bit) { return 0x80000000U >> bit; }
+
+	UInt32 hash(const OSSymbol *name) const
+	{
+		// allocations are at least 16 byte aligned, the low bits say nothing
+		return ((UInt32)((uintptr_t)name >> 4) * 2654435761U) >> (32 - fHashBits);
+	}
+
+	UInt32 first(const OSSymbol *name) const
+	{
+		UInt32		slot;
+
+		if (!fReady || !name)
+			return 0;
+
+		for (slot = hash(name); fHash[slot]; slot = (slot + 1) & (fHashSize - 1))
+		{
+			if (fEntry[fHash[slot] - 1].name == name)
+				return fHash[slot];
+		}
+		return 0;
+	}
+};
+
+#endif // _IOI2CPlatformFunctionIndex_H
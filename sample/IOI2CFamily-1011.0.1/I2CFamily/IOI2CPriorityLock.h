@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 1998-2003 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ * 
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *	File: IOI2CPriorityLock.h
+ *
+ *	A sleeping mutex whose waiters are granted in kI2CPriority_xxx order.
+ *
+ *	Used for the IOI2CDevice client lock and the IOI2CController bus lock in
+ *	place of their FIFO semaphores, so a thermal read queued behind a user
+ *	client's register dump gets the bus next instead of after the dump.
+ *	The lock is handed directly to the waiter picked on unlock; a thread
+ *	arriving in between cannot take it ahead of the queue.
+ */
+
+#ifndef _IOI2CPriorityLock_H
+#define _IOI2CPriorityLock_H
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOLocks.h>
+#include <IOI2C/IOI2CDefs.h>
+
+class IOI2CPriorityLock
+{
+public:
+	bool init(void)
+	{
+		bzero(this, sizeof(*this));
+		fTail = &fHead;
+		return (NULL != (fLock = IOLockAlloc()));
+	}
+
+	void free(void)
+	{
+		if (fLock) { IOLockFree(fLock); fLock = 0; }
+	}
+
+	bool initialized(void) { return (fLock != NULL); }
+
+	/*!
+		@method lock
+		@abstract Blocks until the lock is held by the caller.
+		@param priority kI2CPriority_xxx; kI2CPriority_Default and out of range values count as kI2CPriority_ControlLoop.
+	*/
+	void lock(UInt32 priority)
+	{
+		Waiter			waiter;
+		AbsoluteTime	waited;
+		UInt64			nsec;
+		UInt32			wait_uS;
+
+		waiter.next = NULL;
+		waiter.rank = rankOf(priority);
+		waiter.granted = false;
+		clock_get_uptime(&waiter.since);
+
+		IOLockLock(fLock);
+		if (!fHeld)
+		{
+			fHeld = true;
+			wait_uS = 0;
+		}
+		else
+		{
+			*fTail = &waiter;
+			fTail = &waiter.next;
+			while (!waiter.granted)
+				IOLockSleep(fLock, &waiter, THREAD_UNINT);
+
+			clock_get_uptime(&waited);
+			SUB_ABSOLUTETIME(&waited, &waiter.since);
+			absolutetime_to_nanoseconds(waited, &nsec);
+			wait_uS = (nsec / 1000 > 0xffffffffULL) ? 0xffffffff : (UInt32)(nsec / 1000);
+		}
+
+		fStats.acquired[waiter.rank]++;
+		fStats.waitTotal_uS[waiter.rank] += wait_uS;
+		if (wait_uS > fStats.waitMax_uS[waiter.rank])
+			fStats.waitMax_uS[waiter.rank] = wait_uS;
+		IOLockUnlock(fLock);
+	}
+
+	/*!
+		@method unlock
+		@abstract Hands the lock to the most urgent waiter, after aging, or releases it.
+	*/
+	void unlock(void)
+	{
+		Waiter			**link, **best = NULL;
+		Waiter			*next;
+		AbsoluteTime	now, waited;
+		UInt64			nsec;
+		UInt32			rank, bestRank = kI2CPriorityClasses, aged;
+
+		clock_get_uptime(&now);
+
+		IOLockLock(fLock);
+		for (link = &fHead; *link; link = &(*link)->next)
+		{
+			waited = now;
+			SUB_ABSOLUTETIME(&waited, &(*link)->since);
+			absolutetime_to_nanoseconds(waited, &nsec);
+			aged = (UInt32)(nsec / (kI2CPriorityAgingMS * 1000000ULL));
+			rank = ((*link)->rank > aged) ? (*link)->rank - aged : 0;
+
+			// strictly better only: the earlier waiter wins a tie
+			if (rank < bestRank)
+			{
+				best = link;
+				if (0 == (bestRank = rank))
+					break;
+			}
+		}
+
+		if (best)
+		{
+			next = *best;
+			if (NULL == (*best = next->next))
+				fTail = best;
+			next->granted = true;		// fHeld stays set, the lock passes straight to next
+			IOLockWakeup(fLock, next, false);
+		}
+		else
+			fHeld = false;
+		IOLockUnlock(fLock);
+	}
+
+	void getStats(IOI2CLockStats *stats)
+	{
+		IOLockLock(fLock);
+		*stats = fStats;
+		IOLockUnlock(fLock);
+	}
+
+private:
+	typedef struct Waiter
+	{
+		struct Waiter	*next;
+		UInt32			rank;			// 0 most urgent, kI2CPriority_xxx - 1
+		bool			granted;
+		AbsoluteTime	since;
+	} Waiter;
+
+	static UInt32 rankOf(UInt32 priority)
+	{
+		if ((priority == kI2CPriority_Default) || (priority > kI2CPriorityClasses))
+			priority = kI2CPriority_ControlLoop;
+		return priority - 1;
+	}
+
+	IOLock			*fLock;			// Protects everything below.
+	bool			fHeld;
+	Waiter			*fHead;			// Waiters in arrival order.
+	Waiter			**fTail;
+	IOI2CLockStats	fStats;
+};
+
+#endif // _IOI2CPriorityLock_H
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 1998-2003 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ * 
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+/*
+ *	File: IOI2CRegisterShadow.h
+ *
+ *	Last known contents of a device's 8-bit registers, by kI2CRegister_xxx class.
+ *
+ *	A transaction whose registers are all static or config and already known
+ *	is answered from the shadow, and a write that would store the values the
+ *	config registers already hold is dropped; everything else goes to the
+ *	device and the shadow learns from the result. Live registers are never
+ *	held. The shadow only sees traffic that goes through its owner, so a
+ *	register written behind the owner's back must not be declared config.
+ */
+
+#ifndef _IOI2CRegisterShadow_H
+#define _IOI2CRegisterShadow_H
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOLocks.h>
+#include <IOI2C/IOI2CDefs.h>
+
+/*! @struct IOI2CRegisterShadowStats
+	@field hits Transactions answered from the shadow.
+	@field misses Transactions on declared registers that went to the device.
+	@field suppressedWrites Writes dropped because nothing would have changed.
+*/
+typedef struct
+{
+	UInt32		hits;
+	UInt32		misses;
+	UInt32		suppressedWrites;
+
+} IOI2CRegisterShadowStats;
+
+class IOI2CRegisterShadow
+{
+public:
+	bool init(void)
+	{
+		bzero(this, sizeof(*this));
+		return (NULL != (fLock = IOLockAlloc()));
+	}
+
+	void free(void)
+	{
+		if (fLock) { IOLockFree(fLock); fLock = 0; }
+	}
+
+	bool initialized(void) { return (fLock != NULL); }
+
+	/*!
+		@method declare
+		@abstract Sets the kI2CRegister_xxx class of count registers from subAddress and forgets their values.
+	*/
+	void declare(UInt32 subAddress, UInt32 count, UInt32 volatility)
+	{
+		UInt32		i;
+
+		if (!shadowable(subAddress, count))
+			return;
+		subAddress &= 0xff;
+
+		IOLockLock(fLock);
+		for (i = subAddress; i < subAddress + count; i++)
+		{
+			fClass[i] = (UInt8)volatility;
+			fValid[i] = false;
+		}
+		IOLockUnlock(fLock);
+	}
+
+	/*!
+		@method read
+		@abstract Copies count registers from subAddress into data if all of them are known.
+		@result true if data was filled in, false if the transaction must go to the device.
+	*/
+	bool read(UInt32 subAddress, UInt8 *data, UInt32 count)
+	{
+		UInt32		i;
+		bool		declared = true, known = true;
+
+		if (!shadowable(subAddress, count))
+			return false;
+		subAddress &= 0xff;
+
+		IOLockLock(fLock);
+		for (i = subAddress; i < subAddress + count; i++)
+		{
+			if (fClass[i] == kI2CRegister_Live)
+			{
+				declared = false;
+				break;
+			}
+			if (!fValid[i])
+				known = false;
+		}
+
+		if (declared && known)
+		{
+			bcopy(&fValue[subAddress], data, count);
+			fStats.hits++;
+		}
+		else
+		if (declared)
+			fStats.misses++;
+		IOLockUnlock(fLock);
+
+		return (declared && known);
+	}
+
+	/*!
+		@method didRead
+		@abstract Learns the static and config registers among count registers read from subAddress.
+	*/
+	void didRead(UInt32 subAddress, const UInt8 *data, UInt32 count)
+	{
+		UInt32		i;
+
+		if (!shadowable(subAddress, count))
+			return;
+		subAddress &= 0xff;
+
+		IOLockLock(fLock);
+		for (i = subAddress; i < subAddress + count; i++)
+		{
+			if (fClass[i] == kI2CRegister_Live)
+				continue;
+			fValue[i] = data[i - subAddress];
+			fValid[i] = true;
+		}
+		IOLockUnlock(fLock);
+	}
+
+	/*!
+		@method isRedundantWrite
+		@abstract Tells whether count config registers from subAddress already hold data.
+		@result true if the write can be dropped.
+	*/
+	bool isRedundantWrite(UInt32 subAddress, const UInt8 *data, UInt32 count)
+	{
+		UInt32		i;
+		bool		redundant = true;
+
+		if (!shadowable(subAddress, count))
+			return false;
+		subAddress &= 0xff;
+
+		IOLockLock(fLock);
+		for (i = subAddress; i < subAddress + count; i++)
+		{
+			if ((fClass[i] != kI2CRegister_Config) || !fValid[i] || (fValue[i] != data[i - subAddress]))
+			{
+				redundant = false;
+				break;
+			}
+		}
+		if (redundant)
+			fStats.suppressedWrites++;
+		IOLockUnlock(fLock);
+
+		return redundant;
+	}
+
+	/*!
+		@method didWrite
+		@abstract Writes through a single register write, forgets the registers of anything else.
+		@discussion Whether a multi-byte write auto-increments is up to the device, and a failed
+		write may or may not have reached it, so in both cases the registers are read again next time.
+	*/
+	void didWrite(UInt32 subAddress, const UInt8 *data, UInt32 count, bool success)
+	{
+		UInt32		i;
+
+		if (!shadowable(subAddress, count))
+			return;
+		subAddress &= 0xff;
+
+		IOLockLock(fLock);
+		for (i = subAddress; i < subAddress + count; i++)
+		{
+			if (fClass[i] == kI2CRegister_Live)
+				continue;
+			fValue[i] = data[i - subAddress];
+			fValid[i] = (success && (count == 1));
+		}
+		IOLockUnlock(fLock);
+	}
+
+	/*!
+		@method invalidate
+		@abstract Forgets every value, declarations are kept. Call whenever the device may have been reset.
+	*/
+	void invalidate(void)
+	{
+		IOLockLock(fLock);
+		bzero(fValid, sizeof(fValid));
+		IOLockUnlock(fLock);
+	}
+
+	void getStats(IOI2CRegisterShadowStats *stats)
+	{
+		IOLockLock(fLock);
+		*stats = fStats;
+		IOLockUnlock(fLock);
+	}
+
+private:
+	// 8-bit subaddresses only, and the whole range must fit.
+	static bool shadowable(UInt32 subAddress, UInt32 count)
+	{
+		if (((subAddress >> 24) > 1) || (count == 0))
+			return false;
+		subAddress &= 0x00ffffff;
+		return ((subAddress < kI2CRegisterShadowSize) && (count <= kI2CRegisterShadowSize - subAddress));
+	}
+
+	IOLock						*fLock;		// Protects everything below.
+	UInt8						fClass[kI2CRegisterShadowSize];
+	bool						fValid[kI2CRegisterShadowSize];
+	UInt8						fValue[kI2CRegisterShadowSize];
+	IOI2CRegisterShadowStats	fStats;
+};
+
+#endif // _IOI2CRegisterShadow_H
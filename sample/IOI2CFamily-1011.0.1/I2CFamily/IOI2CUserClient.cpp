@@ -73,6 +73,17 @@
 #define super IOUserClient
 OSDefineMetaClassAndStructors(IOI2CUserClient, IOUserClient)
 
+// User space waits for the bus as kI2CPriority_Diagnostics unless it asks for
+// kI2CPriority_ControlLoop (a user space fan controller); kI2CPriority_Emergency
+// is reserved for the kernel.
+static UInt32 userClientPriority(
+	UInt32	options)
+{
+	if (i2cPriorityFromOptions(options) == kI2CPriority_ControlLoop)
+		return kI2CPriority_ControlLoop;
+	return kI2CPriority_Diagnostics;
+}
+
 bool IOI2CUserClient::initWithTask(
 	task_t		owningTask,
 	void		*security_id,
@@ -113,6 +124,11 @@ IOI2CUserClient::start(
 	symWriteI2CBus = OSSymbol::withCStringNoCopy(kWriteI2Cbus);
 	symReadI2CBus = OSSymbol::withCStringNoCopy(kReadI2Cbus);
 
+	// Clients that only use the inline transfers work without it
+	if (0 == (fSharedBuffer = IOBufferMemoryDescriptor::withOptions(
+			kIODirectionInOut | kIOMemoryKernelUserShared, kI2CUCSharedBufSize, page_size)))
+		ERRLOG("IOI2CUserClient::start failed to allocate shared buffer\n");
+
 	fProvider = provider;
 
 	return true;
@@ -126,6 +142,7 @@ void IOI2CUserClient::free(void)
 	if (symUnlockI2CBus)	{ symUnlockI2CBus->release();	symUnlockI2CBus = 0; }
 	if (symWriteI2CBus)		{ symWriteI2CBus->release();	symWriteI2CBus = 0; }
 	if (symReadI2CBus)		{ symReadI2CBus->release();		symReadI2CBus = 0; }
+	if (fSharedBuffer)		{ fSharedBuffer->release();		fSharedBuffer = 0; }
 
 	super::free();
 }
@@ -144,6 +161,26 @@ IOReturn IOI2CUserClient::clientClose(void)
 	return(kIOReturnSuccess);
 }
 
+IOReturn IOI2CUserClient::clientMemoryForType(
+	UInt32					type,
+	IOOptionBits			*options,
+	IOMemoryDescriptor		**memory)
+{
+	DLOG("+IOI2CUserClient::clientMemoryForType type:%lx\n", type);
+
+	if (type != kI2CUCSharedMemoryType)
+		return kIOReturnUnsupported;
+
+	if (fSharedBuffer == 0)
+		return kIOReturnNoMemory;
+
+	// The caller releases the reference
+	fSharedBuffer->retain();
+	*options = 0;
+	*memory = fSharedBuffer;
+	return kIOReturnSuccess;
+}
+
 IOExternalMethod *
 IOI2CUserClient::getTargetAndMethodForIndex(
 	IOService	**target,
@@ -187,6 +224,20 @@ IOI2CUserClient::getTargetAndMethodForIndex(
 			kIOUCStructIStructO,
 			sizeof(I2CRMWInput),
 			0
+		},
+		{	// kI2CUCMappedRead
+			NULL,	// IOService * determined at runtime below
+			(IOMethod) &IOI2CUserClient::readMappedI2CBus,
+			kIOUCStructIStructO,
+			sizeof(I2CUserMappedInput),
+			sizeof(I2CUserMappedOutput)
+		},
+		{	// kI2CUCMappedWrite
+			NULL,	// IOService * determined at runtime below
+			(IOMethod) &IOI2CUserClient::writeMappedI2CBus,
+			kIOUCStructIStructO,
+			sizeof(I2CUserMappedInput),
+			sizeof(I2CUserMappedOutput)
 		}
 	};
 
@@ -218,8 +269,9 @@ IOI2CUserClient::lockI2CBus(
 		return kIOReturnExclusiveAccess;
 	}
 
+	// The priority class rides in the kI2COption_PriorityMask bits of bus, which no bus number uses.
 	if (kIOReturnSuccess == (status = fProvider->callPlatformFunction(symLockI2CBus, false,
-						(void *)bus, (void *)&fClientKey, (void *)0, (void *)0)))
+						(void *)(bus & ~kI2COption_PriorityMask), (void *)&fClientKey, (void *)userClientPriority(bus), (void *)0)))
 		*clientKeyRef = fClientKey;
 	else
 		*clientKeyRef = kIOI2C_CLIENT_KEY_INVALID;
@@ -275,7 +327,7 @@ IOI2CUserClient::readI2CBus(
 		cmd.mode = input->mode;
 		cmd.bus = input->busNo;
 		cmd.address = input->addr;
-		cmd.options = input->options;
+		cmd.options = (input->options & ~kI2COption_PriorityMask) | i2cPriorityToOptions(userClientPriority(input->options));
 
 		DLOG("IOI2CUserClient::readI2CBus cmd key:%lx, B:%lx, A:%lx S:%lx, L:%lx, M:%lx\n",
 			input->key, cmd.bus, cmd.address, cmd.subAddress, cmd.count, cmd.mode);
@@ -325,7 +377,7 @@ IOI2CUserClient::writeI2CBus(
 		cmd.mode = input->mode;
 		cmd.bus = input->busNo;
 		cmd.address = input->addr;
-		cmd.options = input->options;
+		cmd.options = (input->options & ~kI2COption_PriorityMask) | i2cPriorityToOptions(userClientPriority(input->options));
 
 		status = fProvider->callPlatformFunction(symWriteI2CBus, false,
 						(void *)&cmd, (void *)input->key, (void *)0, (void *)0);
@@ -340,6 +392,84 @@ IOI2CUserClient::writeI2CBus(
 	return status;
 }
 
+IOReturn
+IOI2CUserClient::mappedI2CTransaction(
+	const OSSymbol		*function,
+	I2CUserMappedInput	*input,
+	I2CUserMappedOutput	*output,
+	IOByteCount			inputSize,
+	IOByteCount			*outputSizeP)
+{
+	IOReturn		status;
+
+	// Thoroughly check the arguments before proceeding, offset + count must not wrap
+	if (!(fProvider
+		&& input
+		&& output
+		&& outputSizeP
+		&& (inputSize == sizeof(I2CUserMappedInput))
+		&& (*outputSizeP == sizeof(I2CUserMappedOutput))
+		&& (input->count <= kI2CUCSharedBufSize)
+		&& (input->offset <= kI2CUCSharedBufSize - input->count)) )
+	{
+		ERRLOG("-IOI2CUserClient::mappedI2CTransaction got invalid arguments\n");
+		return kIOReturnBadArgument;
+	}
+
+	if (fSharedBuffer == 0)
+		return kIOReturnNoMemory;
+
+	{
+		IOI2CCommand cmd = {0};
+		cmd.subAddress = input->subAddr;
+		cmd.buffer = (UInt8 *)fSharedBuffer->getBytesNoCopy() + input->offset;
+		cmd.count = input->count;
+		cmd.mode = input->mode;
+		cmd.bus = input->busNo;
+		cmd.address = input->addr;
+		cmd.options = (input->options & ~kI2COption_PriorityMask) | i2cPriorityToOptions(userClientPriority(input->options));
+
+		DLOG("IOI2CUserClient::mappedI2CTransaction cmd key:%lx, B:%lx, A:%lx S:%lx, O:%lx, L:%lx, M:%lx\n",
+			input->key, cmd.bus, cmd.address, cmd.subAddress, input->offset, cmd.count, cmd.mode);
+
+		status = fProvider->callPlatformFunction(function, false,
+						(void *)&cmd, (void *)input->key, (void *)0, (void *)0);
+
+		if (status != kIOReturnSuccess)
+			output->realCount = 0;
+		else
+			output->realCount = input->count;
+	}
+
+	return status;
+}
+
+IOReturn
+IOI2CUserClient::readMappedI2CBus(
+	I2CUserMappedInput	*input,
+	I2CUserMappedOutput	*output,
+	IOByteCount		inputSize,
+	IOByteCount		*outputSizeP,
+	void			*p5,
+	void			*p6)
+{
+	DLOG("+IOI2CUserClient::readMappedI2CBus\n");
+	return mappedI2CTransaction(symReadI2CBus, input, output, inputSize, outputSizeP);
+}
+
+IOReturn
+IOI2CUserClient::writeMappedI2CBus(
+	I2CUserMappedInput	*input,
+	I2CUserMappedOutput	*output,
+	IOByteCount		inputSize,
+	IOByteCount		*outputSizeP,
+	void			*p5,
+	void			*p6)
+{
+	DLOG("+IOI2CUserClient::writeMappedI2CBus\n");
+	return mappedI2CTransaction(symWriteI2CBus, input, output, inputSize, outputSizeP);
+}
+
 IOReturn IOI2CUserClient::readModifyWriteI2CBus(
 	I2CRMWInput		*input,
 	IOByteCount		inputSize,
@@ -44,6 +44,7 @@
 
 
 #include <IOKit/IOUserClient.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOI2C/IOI2CDefs.h>
 
 
@@ -63,10 +64,26 @@ public:
 
 	virtual IOReturn clientClose(void);
 
+	/*! @function clientMemoryForType
+		@abstract Returns the shared buffer for kI2CUCSharedMemoryType.
+		@discussion Called for IOConnectMapMemory. The buffer is allocated once, in start, and mapped reads and writes refer to offsets in it. */
+	virtual IOReturn clientMemoryForType(
+		UInt32					type,
+		IOOptionBits			*options,
+		IOMemoryDescriptor		**memory);
+
 private:
 	task_t			fOwningTask;
 	IOService		*fProvider;
 	UInt32			fClientKey;
+	IOBufferMemoryDescriptor	*fSharedBuffer;	// kI2CUCSharedBufSize bytes, NULL if it could not be allocated
+
+	IOReturn mappedI2CTransaction(
+		const OSSymbol		*function,
+		I2CUserMappedInput	*input,
+		I2CUserMappedOutput	*output,
+		IOByteCount			inputSize,
+		IOByteCount			*outputSizeP);
 
 protected:
 	const OSSymbol	*symLockI2CBus;
@@ -118,6 +135,34 @@ protected:
 		IOByteCount		*outputSizeP,
 		void *p5, void *p6 );
 
+	/*! @function readMappedI2CBus
+		@abstract Initiate an I2C read transaction into the shared buffer.
+		@discussion Like readI2CBus, but the data lands at input->offset in the buffer mapped with kI2CUCSharedMemoryType, so the count is only limited by kI2CUCSharedBufSize and nothing is copied back through the Mach message.
+		@param input A pointer to the clients input parameter struct.
+		@param output A pointer to the clients output parameter struct.
+		@param inputSize The size in bytes of the clients input parameter struct.
+		@param outputSizeP A pointer to a IOByteCount containing the size in bytes of the clients output parameter struct. */
+	IOReturn readMappedI2CBus(
+		I2CUserMappedInput	*input,
+		I2CUserMappedOutput	*output,
+		IOByteCount		inputSize,
+		IOByteCount		*outputSizeP,
+		void *p5, void *p6 );
+
+	/*! @function writeMappedI2CBus
+		@abstract Initiate an I2C write transaction from the shared buffer.
+		@discussion Like writeI2CBus, but the data is taken from input->offset in the buffer mapped with kI2CUCSharedMemoryType.
+		@param input A pointer to the clients input parameter struct.
+		@param output A pointer to the clients output parameter struct.
+		@param inputSize The size in bytes of the clients input parameter struct.
+		@param outputSizeP A pointer to a IOByteCount containing the size in bytes of the clients output parameter struct. */
+	IOReturn writeMappedI2CBus(
+		I2CUserMappedInput	*input,
+		I2CUserMappedOutput	*output,
+		IOByteCount		inputSize,
+		IOByteCount		*outputSizeP,
+		void *p5, void *p6 );
+
 	/*! @function userClientRMW
 		@abstract Initiate an I2C read-modify-write transaction with this device.
 		@discussion This function provides a method for initiating an I2C read-modify-write transaction with this device. This method may be called with or without locking the I2C bus.
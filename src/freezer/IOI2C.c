@@ -352,6 +352,8 @@ IOReturn openI2CDevice(
 		return kIOReturnBadArgument;
 
 	device->_i2c_key = kIOI2C_CLIENT_KEY_DEFAULT;
+	device->_i2c_shared = 0;
+	device->_i2c_sharedSize = 0;
 
 	// Put the ioreg path into an io_string_t
 	strPtr = CFStringGetCStringPtr(path, kCFStringEncodingMacRoman);
@@ -403,6 +405,11 @@ IOReturn closeI2CDevice(
 	// get rid of the user client
 	if (device->_i2c_connect)
 	{
+		if (device->_i2c_shared)
+			IOConnectUnmapMemory(device->_i2c_connect, kI2CUCSharedMemoryType, mach_task_self(), device->_i2c_shared);
+		device->_i2c_shared = 0;
+		device->_i2c_sharedSize = 0;
+
 		IOServiceClose(device->_i2c_connect);
 		device->_i2c_connect = 0;
 	}
@@ -616,6 +623,112 @@ IOReturn writeI2CExtended(
 	return status;
 }
 
+IOReturn mapI2CDevice(
+	I2CDeviceRef	*device,
+	UInt8			**buffer,
+	UInt32			*size)
+{
+	kern_return_t	status;
+
+	if (device == NULL || buffer == NULL || size == NULL)
+		return kIOReturnBadArgument;
+
+	if (device->_i2c_shared == 0)
+	{
+		status = IOConnectMapMemory(device->_i2c_connect, kI2CUCSharedMemoryType, mach_task_self(),
+				&device->_i2c_shared, &device->_i2c_sharedSize, kIOMapAnywhere);
+		if (status != kIOReturnSuccess)
+		{
+			DLOG("IOI2C mapI2CDevice failed to map the shared buffer\n");
+			device->_i2c_shared = 0;
+			device->_i2c_sharedSize = 0;
+			return status;
+		}
+	}
+
+	*buffer = (UInt8 *)device->_i2c_shared;
+	*size = (UInt32)device->_i2c_sharedSize;
+	return kIOReturnSuccess;
+}
+
+static IOReturn mappedI2CTransaction(
+	I2CDeviceRef	*device,
+	UInt32			selector,
+	UInt32			bus,
+	UInt32			address,
+	UInt32			subAddress,
+	UInt32			offset,
+	UInt32			count,
+	UInt32			mode,
+	UInt32			options)
+{
+	I2CUserMappedInput	inputs;
+	I2CUserMappedOutput	outputs;
+	IOByteCount		inSize, outSize;
+	kern_return_t	status;
+	UInt8			*buffer;
+	UInt32			size;
+
+	if (kIOReturnSuccess != (status = mapI2CDevice(device, &buffer, &size)))
+		return status;
+
+	if (count > size || offset > size - count)
+	{
+		DLOG("IOI2C mappedI2CTransaction count is too large\n");
+		return kIOReturnBadArgument;
+	}
+
+	inputs.options		= options;
+	inputs.mode			= mode;
+	inputs.busNo		= bus;
+	inputs.addr			= address;
+	inputs.subAddr		= subAddress;
+	inputs.offset		= offset;
+	inputs.count		= count;
+	inputs.key			= device->_i2c_key;
+	outputs.realCount	= 0;
+
+	inSize = sizeof(I2CUserMappedInput);
+	outSize = sizeof(I2CUserMappedOutput);
+
+	status = IOConnectMethodStructureIStructureO(device->_i2c_connect,
+			selector, inSize, &outSize, &inputs, &outputs);
+
+	if (status == 0)
+	{
+		if (outputs.realCount != count)
+			return kIOReturnError;
+	}
+
+	return status;
+}
+
+IOReturn readI2CMapped(
+	I2CDeviceRef	*device,
+	UInt32			bus,
+	UInt32			address,
+	UInt32			subAddress,
+	UInt32			offset,
+	UInt32			count,
+	UInt32			mode,
+	UInt32			options)
+{
+	return mappedI2CTransaction(device, kI2CUCMappedRead, bus, address, subAddress, offset, count, mode, options);
+}
+
+IOReturn writeI2CMapped(
+	I2CDeviceRef	*device,
+	UInt32			bus,
+	UInt32			address,
+	UInt32			subAddress,
+	UInt32			offset,
+	UInt32			count,
+	UInt32			mode,
+	UInt32			options)
+{
+	return mappedI2CTransaction(device, kI2CUCMappedWrite, bus, address, subAddress, offset, count, mode, options);
+}
+
 
 
 
@@ -1308,3 +1421,347 @@ IOReturn rmwI2CBus(I2CInterfaceRef iface, I2CRMWInput *inputs)
 }
 
 #endif
+
+
+
+#pragma mark ***
+#pragma mark *** Connection pool
+#pragma mark ***
+
+typedef struct
+{
+	Boolean			inUse;
+	Boolean			isInterface;	// PPCI2CInterface, device._i2c_connect holds the I2CInterfaceRef
+	UInt32			bus;
+	UInt32			address;
+	UInt32			refCount;
+	io_string_t		path;			// IOService path the connection was opened on
+	I2CDeviceRef	device;
+
+} I2CPoolEntry;
+
+static I2CPoolEntry gI2CPool[kI2CPoolSize];
+
+// True if status means the user client is gone rather than the transaction failed
+static Boolean isI2CConnectionLost(IOReturn status)
+{
+	return (status == kIOReturnOffline) ||
+		   (status == kIOReturnNotOpen) ||
+		   (status == MACH_SEND_INVALID_DEST);
+}
+
+// Cheap liveness test: one trap, no registry walk
+static Boolean isI2CConnectionAlive(io_connect_t cnct)
+{
+	io_service_t	svc;
+
+	if (cnct == 0)
+		return false;
+
+	if (kIOReturnSuccess != IOConnectGetService(cnct, &svc))
+		return false;
+
+	IOObjectRelease(svc);
+	return true;
+}
+
+static I2CPoolEntry *findI2CPoolEntry(Boolean isInterface, UInt32 bus, UInt32 address)
+{
+	int		i;
+
+	for (i = 0; i < kI2CPoolSize; i++)
+		if (gI2CPool[i].inUse && gI2CPool[i].isInterface == isInterface &&
+			gI2CPool[i].bus == bus && gI2CPool[i].address == address)
+			return &gI2CPool[i];
+	return NULL;
+}
+
+static I2CPoolEntry *findI2CPoolEntryByConnect(io_connect_t cnct)
+{
+	int		i;
+
+	for (i = 0; i < kI2CPoolSize; i++)
+		if (gI2CPool[i].inUse && gI2CPool[i].device._i2c_connect == cnct)
+			return &gI2CPool[i];
+	return NULL;
+}
+
+static void closeI2CPoolEntry(I2CPoolEntry *entry)
+{
+	if (entry->isInterface)
+	{
+		if (entry->device._i2c_connect)
+			closeI2CInterface(entry->device._i2c_connect);
+		entry->device._i2c_connect = 0;
+	}
+	else
+		closeI2CDevice(&entry->device);
+}
+
+static IOReturn openI2CPoolEntry(I2CPoolEntry *entry)
+{
+	CFStringRef		pathStr;
+	I2CInterfaceRef	iface;
+	IOReturn		status;
+
+	if (0 == (pathStr = CFStringCreateWithCString(NULL, entry->path, kCFStringEncodingMacRoman)))
+		return kIOReturnNoMemory;
+
+	if (entry->isInterface)
+	{
+		entry->device._i2c_key = kIOI2C_CLIENT_KEY_DEFAULT;
+		if (kIOReturnSuccess == (status = openI2CInterface(pathStr, &iface)))
+			entry->device._i2c_connect = iface;
+	}
+	else
+		status = openI2CDevice(&entry->device, pathStr);
+
+	CFRelease(pathStr);
+
+	if (status != kIOReturnSuccess)
+		entry->device._i2c_connect = 0;
+	return status;
+}
+
+static IOReturn reopenI2CPoolEntry(I2CPoolEntry *entry)
+{
+	DLOG("IOI2C pool reopening bus 0x%x address 0x%x\n", (unsigned)entry->bus, (unsigned)entry->address);
+	closeI2CPoolEntry(entry);
+	return openI2CPoolEntry(entry);
+}
+
+static IOReturn acquireI2CPoolEntry(Boolean isInterface, UInt32 bus, UInt32 address,
+		CFStringRef path, I2CPoolEntry **entryRef)
+{
+	I2CPoolEntry	*entry;
+	const char		*strPtr;
+	IOReturn		status;
+	int				i;
+
+	if (entry = findI2CPoolEntry(isInterface, bus, address))
+	{
+		if (!isI2CConnectionAlive(entry->device._i2c_connect) &&
+			kIOReturnSuccess != (status = reopenI2CPoolEntry(entry)))
+			return status;
+
+		entry->refCount++;
+		*entryRef = entry;
+		return kIOReturnSuccess;
+	}
+
+	if (path == NULL)
+		return kIOReturnNotFound;
+
+	strPtr = CFStringGetCStringPtr(path, kCFStringEncodingMacRoman);
+	if (strPtr == NULL || strlen(strPtr) >= sizeof(io_string_t))
+		return kIOReturnBadArgument;
+
+	for (i = 0; i < kI2CPoolSize; i++)
+		if (!gI2CPool[i].inUse)
+			break;
+
+	if (i == kI2CPoolSize)
+	{
+		DLOG("IOI2C pool is full\n");
+		return kIOReturnNoResources;
+	}
+
+	entry = &gI2CPool[i];
+	memset(entry, 0, sizeof(*entry));
+	entry->isInterface	= isInterface;
+	entry->bus			= bus;
+	entry->address		= address;
+	strcpy(entry->path, strPtr);
+
+	if (kIOReturnSuccess != (status = openI2CPoolEntry(entry)))
+		return status;
+
+	entry->inUse	= true;
+	entry->refCount	= 1;
+	*entryRef = entry;
+	return kIOReturnSuccess;
+}
+
+IOReturn acquireI2CDevice(UInt32 bus, UInt32 address, CFStringRef path, I2CDeviceRef **device)
+{
+	I2CPoolEntry	*entry;
+	IOReturn		status;
+
+	if (device == NULL)
+		return kIOReturnBadArgument;
+
+	if (kIOReturnSuccess == (status = acquireI2CPoolEntry(false, bus, address, path, &entry)))
+		*device = &entry->device;
+	return status;
+}
+
+void releaseI2CDevice(I2CDeviceRef *device)
+{
+	I2CPoolEntry	*entry;
+
+	if (device == NULL || 0 == (entry = findI2CPoolEntryByConnect(device->_i2c_connect)))
+		return;
+
+	if (device->_i2c_key != kIOI2C_CLIENT_KEY_DEFAULT)
+	{
+		unlockI2CDevice(device);
+		device->_i2c_key = kIOI2C_CLIENT_KEY_DEFAULT;
+	}
+
+	if (entry->refCount)
+		entry->refCount--;
+}
+
+IOReturn acquireI2CInterface(UInt32 bus, UInt32 address, CFStringRef interface, I2CInterfaceRef *iface)
+{
+	I2CPoolEntry	*entry;
+	IOReturn		status;
+
+	if (iface == NULL)
+		return kIOReturnBadArgument;
+
+	if (kIOReturnSuccess == (status = acquireI2CPoolEntry(true, bus, address, interface, &entry)))
+		*iface = entry->device._i2c_connect;
+	return status;
+}
+
+void releaseI2CInterface(I2CInterfaceRef iface)
+{
+	I2CPoolEntry	*entry;
+
+	if (0 != (entry = findI2CPoolEntryByConnect(iface)) && entry->refCount)
+		entry->refCount--;
+}
+
+IOReturn readI2CPooled(
+	I2CDeviceRef	*device,
+	UInt32			bus,
+	UInt32			address,
+	UInt32			subAddress,
+	UInt8			*readBuf,
+	UInt32			count,
+	UInt32			mode,
+	UInt32			options)
+{
+	I2CPoolEntry	*entry;
+	IOReturn		status;
+
+	status = readI2CExtended(device, bus, address, subAddress, readBuf, count, mode, options);
+	if (!isI2CConnectionLost(status) ||
+		0 == (entry = findI2CPoolEntryByConnect(device->_i2c_connect)))
+		return status;
+
+	// the bus lock went away with the connection, let the caller start over
+	if (device->_i2c_key != kIOI2C_CLIENT_KEY_DEFAULT)
+	{
+		device->_i2c_key = kIOI2C_CLIENT_KEY_DEFAULT;
+		return status;
+	}
+
+	if (kIOReturnSuccess != (status = reopenI2CPoolEntry(entry)))
+		return status;
+
+	return readI2CExtended(device, bus, address, subAddress, readBuf, count, mode, options);
+}
+
+IOReturn writeI2CPooled(
+	I2CDeviceRef	*device,
+	UInt32			bus,
+	UInt32			address,
+	UInt32			subAddress,
+	UInt8			*writeBuf,
+	UInt32			count,
+	UInt32			mode,
+	UInt32			options)
+{
+	I2CPoolEntry	*entry;
+	IOReturn		status;
+
+	status = writeI2CExtended(device, bus, address, subAddress, writeBuf, count, mode, options);
+	if (!isI2CConnectionLost(status) ||
+		0 == (entry = findI2CPoolEntryByConnect(device->_i2c_connect)))
+		return status;
+
+	// the bus lock went away with the connection, let the caller start over
+	if (device->_i2c_key != kIOI2C_CLIENT_KEY_DEFAULT)
+	{
+		device->_i2c_key = kIOI2C_CLIENT_KEY_DEFAULT;
+		return status;
+	}
+
+	if (kIOReturnSuccess != (status = reopenI2CPoolEntry(entry)))
+		return status;
+
+	return writeI2CExtended(device, bus, address, subAddress, writeBuf, count, mode, options);
+}
+
+IOReturn readI2CInterfacePooled(
+	I2CInterfaceRef *iface,
+	UInt32			bus,
+	UInt32			address,
+	UInt32			subAddress,
+	UInt8			*buffer,
+	UInt32			count,
+	UInt32			mode)
+{
+	I2CPoolEntry	*entry;
+	IOReturn		status;
+
+	if (iface == NULL)
+		return kIOReturnBadArgument;
+
+	status = readI2CInterface(*iface, bus, address, subAddress, buffer, count, mode);
+	if (!isI2CConnectionLost(status) || 0 == (entry = findI2CPoolEntryByConnect(*iface)))
+		return status;
+
+	if (kIOReturnSuccess != (status = reopenI2CPoolEntry(entry)))
+		return status;
+
+	*iface = entry->device._i2c_connect;
+	return readI2CInterface(*iface, bus, address, subAddress, buffer, count, mode);
+}
+
+IOReturn writeI2CInterfacePooled(
+	I2CInterfaceRef *iface,
+	UInt32			bus,
+	UInt32			address,
+	UInt32			subAddress,
+	UInt8			*buffer,
+	UInt32			count,
+	UInt32			mode)
+{
+	I2CPoolEntry	*entry;
+	IOReturn		status;
+
+	if (iface == NULL)
+		return kIOReturnBadArgument;
+
+	status = writeI2CInterface(*iface, bus, address, subAddress, buffer, count, mode);
+	if (!isI2CConnectionLost(status) || 0 == (entry = findI2CPoolEntryByConnect(*iface)))
+		return status;
+
+	if (kIOReturnSuccess != (status = reopenI2CPoolEntry(entry)))
+		return status;
+
+	*iface = entry->device._i2c_connect;
+	return writeI2CInterface(*iface, bus, address, subAddress, buffer, count, mode);
+}
+
+void drainI2CPool(void)
+{
+	int		i;
+
+	for (i = 0; i < kI2CPoolSize; i++)
+	{
+		if (!gI2CPool[i].inUse)
+			continue;
+
+		if (gI2CPool[i].refCount)
+			DLOG("IOI2C pool closing bus 0x%x address 0x%x with %u users\n",
+				(unsigned)gI2CPool[i].bus, (unsigned)gI2CPool[i].address,
+				(unsigned)gI2CPool[i].refCount);
+
+		closeI2CPoolEntry(&gI2CPool[i]);
+		gI2CPool[i].inUse = false;
+	}
+}
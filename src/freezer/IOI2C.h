@@ -67,6 +67,8 @@ typedef struct
 {
 	io_connect_t	_i2c_connect;
 	UInt32			_i2c_key;
+	vm_address_t	_i2c_shared;		// kI2CUCSharedMemoryType mapping, 0 until mapI2CDevice
+	vm_size_t		_i2c_sharedSize;
 
 } I2CDeviceRef;
 
@@ -192,6 +194,49 @@ typedef struct
 		UInt32			mode,
 		UInt32			options);
 
+/*!	@function mapI2CDevice
+	@abstract Maps the buffer the user client shares for mapped transactions.
+	@discussion The buffer is mapped on the first call and stays mapped until the device is closed, later calls return the same mapping. readI2CMapped and writeI2CMapped transfer data directly to and from it, with no kI2CUCBufSize limit and no copy through the Mach message.
+	@param device The address of an opened I2CDeviceRef.
+	@param buffer Returns the address of the shared buffer.
+	@param size Returns the size of the shared buffer, kI2CUCSharedBufSize.
+	@result If successful returns kIOReturnSuccess.
+*/
+
+	IOReturn mapI2CDevice(
+		I2CDeviceRef	*device,
+		UInt8			**buffer,
+		UInt32			*size);
+
+/*!	@function readI2CMapped
+	@abstract readI2CExtended into the shared buffer.
+	@discussion Reads count bytes to offset in the buffer returned by mapI2CDevice, which is mapped if it is not already. offset + count must not exceed kI2CUCSharedBufSize.
+*/
+
+	IOReturn readI2CMapped(
+		I2CDeviceRef	*device,
+		UInt32			bus,
+		UInt32			address,
+		UInt32			subAddress,
+		UInt32			offset,
+		UInt32			count,
+		UInt32			mode,
+		UInt32			options);
+
+/*!	@function writeI2CMapped
+	@abstract writeI2CExtended from the shared buffer, see readI2CMapped.
+*/
+
+	IOReturn writeI2CMapped(
+		I2CDeviceRef	*device,
+		UInt32			bus,
+		UInt32			address,
+		UInt32			subAddress,
+		UInt32			offset,
+		UInt32			count,
+		UInt32			mode,
+		UInt32			options);
+
 
 #pragma mark ***
 #pragma mark *** PPCI2CInterface API
@@ -323,4 +368,110 @@ IOReturn writeI2CInterface(
 	IOReturn rmwI2CBus(I2CInterfaceRef iface, I2CRMWInput *inputs);
 
 
+
+#pragma mark ***
+#pragma mark *** Connection pool
+#pragma mark ***
+
+/*!
+	@defined kI2CPoolSize
+	@abstract Maximum number of user client connections kept open by the pool.
+*/
+#define kI2CPoolSize	16
+
+/*!
+	@function acquireI2CDevice
+	@abstract Returns a pooled I2CDeviceRef for the device at bus/address.
+	@discussion The first acquire for a bus/address opens a user client on path, later acquires hand back the same connection after a health check, so a monitoring loop pays the registry lookup and IOServiceOpen once per chip. A connection that fails the health check is reopened from the path it was first opened with. path may be NULL to only look up an existing entry. The returned pointer stays valid until drainI2CPool. Balance every acquire with releaseI2CDevice; the connection itself stays open.
+	@param bus The I2C bus of the device.
+	@param address The I2C address of the device.
+	@param path The NSCFString containing the IOService path of the IOI2CDevice or IOI2CController to open, or NULL.
+	@param device On success, holds the pooled I2CDeviceRef.
+	@result kIOReturnSuccess, kIOReturnNotFound if path is NULL and nothing is pooled, kIOReturnNoResources if the pool is full, or the openI2CDevice error.
+*/
+	IOReturn acquireI2CDevice(UInt32 bus, UInt32 address, CFStringRef path, I2CDeviceRef **device);
+
+/*!
+	@function releaseI2CDevice
+	@abstract Returns a pooled I2CDeviceRef to the pool without closing it.
+	@discussion A bus lock still held on the device is released.
+*/
+	void releaseI2CDevice(I2CDeviceRef *device);
+
+/*!
+	@function acquireI2CInterface
+	@abstract PPCI2CInterface counterpart of acquireI2CDevice.
+*/
+	IOReturn acquireI2CInterface(UInt32 bus, UInt32 address, CFStringRef interface, I2CInterfaceRef *iface);
+
+/*!
+	@function releaseI2CInterface
+	@abstract PPCI2CInterface counterpart of releaseI2CDevice.
+*/
+	void releaseI2CInterface(I2CInterfaceRef iface);
+
+/*!
+	@function readI2CPooled
+	@abstract readI2CExtended on a pooled I2CDeviceRef, reopening the connection once if the driver went offline.
+	@discussion A transaction that fails with kIOReturnOffline (or on a dead connection) is retried on a fresh user client. A transaction made under a bus lock is not retried: the lock went away with the old connection, the error is returned and the device is left unlocked.
+*/
+	IOReturn readI2CPooled(
+		I2CDeviceRef	*device,
+		UInt32			bus,
+		UInt32			address,
+		UInt32			subAddress,
+		UInt8			*readBuf,
+		UInt32			count,
+		UInt32			mode,
+		UInt32			options);
+
+/*!
+	@function writeI2CPooled
+	@abstract writeI2CExtended on a pooled I2CDeviceRef, see readI2CPooled.
+*/
+	IOReturn writeI2CPooled(
+		I2CDeviceRef	*device,
+		UInt32			bus,
+		UInt32			address,
+		UInt32			subAddress,
+		UInt8			*writeBuf,
+		UInt32			count,
+		UInt32			mode,
+		UInt32			options);
+
+/*!
+	@function readI2CInterfacePooled
+	@abstract readI2CInterface on a pooled I2CInterfaceRef, reopening the connection once if the driver went offline.
+	@discussion iface is updated when the connection is reopened.
+*/
+	IOReturn readI2CInterfacePooled(
+		I2CInterfaceRef *iface,
+		UInt32			bus,
+		UInt32			address,
+		UInt32			subAddress,
+		UInt8			*buffer,
+		UInt32			count,
+		UInt32			mode);
+
+/*!
+	@function writeI2CInterfacePooled
+	@abstract writeI2CInterface on a pooled I2CInterfaceRef, see readI2CInterfacePooled.
+*/
+	IOReturn writeI2CInterfacePooled(
+		I2CInterfaceRef *iface,
+		UInt32			bus,
+		UInt32			address,
+		UInt32			subAddress,
+		UInt8			*buffer,
+		UInt32			count,
+		UInt32			mode);
+
+/*!
+	@function drainI2CPool
+	@abstract Closes every pooled connection.
+	@discussion Call once before exiting; any pointer obtained from acquireI2CDevice is invalid afterwards.
+*/
+	void drainI2CPool(void);
+
+
 #endif // IOI2C_H_
@@ -0,0 +1,56 @@
+/*
+ * IOKitCompat.h
+ *
+ * Minimal stand-ins for the IOKit/CoreFoundation base types used by
+ * freezer, so the sensor read/decode/print path builds on hosts that
+ * do not ship IOKit (e.g. Linux, running against the simulated backend).
+ *
+ * Only included when __APPLE__ is not defined.
+ */
+
+#ifndef IOKITCOMPAT_H
+#define IOKITCOMPAT_H
+
+#ifdef __APPLE__
+#error "IOKitCompat.h is for non-Apple hosts only; include <IOKit/IOKitLib.h>"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t		UInt8;
+typedef int8_t		SInt8;
+typedef uint16_t	UInt16;
+typedef int16_t		SInt16;
+typedef uint32_t	UInt32;
+typedef int32_t		SInt32;
+typedef uint64_t	UInt64;
+typedef int64_t		SInt64;
+typedef unsigned char	Boolean;
+
+typedef int			kern_return_t;
+typedef kern_return_t	IOReturn;
+typedef size_t		IOByteCount;
+
+#define KERN_SUCCESS	0
+
+#define iokit_common_err(return)	((IOReturn)(0xe0000000 | (return)))
+
+#define kIOReturnSuccess		KERN_SUCCESS
+#define kIOReturnError			iokit_common_err(0x2bc)	// general error
+#define kIOReturnNoMemory		iokit_common_err(0x2bd)	// can't allocate memory
+#define kIOReturnNoResources	iokit_common_err(0x2be)	// resource shortage
+#define kIOReturnNoDevice		iokit_common_err(0x2c0)	// no such device
+#define kIOReturnBadArgument	iokit_common_err(0x2c2)	// invalid argument
+#define kIOReturnUnsupported	iokit_common_err(0x2c7)	// unsupported function
+#define kIOReturnIOError		iokit_common_err(0x2ca)	// General I/O error
+#define kIOReturnCannotLock		iokit_common_err(0x2cc)	// can't acquire lock
+#define kIOReturnNotOpen		iokit_common_err(0x2cd)	// device not open
+#define kIOReturnBusy			iokit_common_err(0x2d5)	// Device Busy
+#define kIOReturnTimeout		iokit_common_err(0x2d6)	// I/O Timeout
+#define kIOReturnOffline		iokit_common_err(0x2d7)	// device offline
+#define kIOReturnUnsupportedMode	iokit_common_err(0x2e6)	// no such mode
+#define kIOReturnAborted		iokit_common_err(0x2eb)	// operation aborted
+#define kIOReturnNotFound		iokit_common_err(0x2f0)	// data was not found
+
+#endif // IOKITCOMPAT_H
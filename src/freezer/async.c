@@ -0,0 +1,206 @@
+/*
+ * async.c
+ *
+ * Asynchronous I2C command queue, see async.h.
+ */
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include "async.h"
+
+static UInt64 nowUs(void) {
+    struct timeval          tv;
+
+    gettimeofday(&tv, NULL);
+    return (UInt64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Calls the action, then keeps request for the next submission.
+static void complete(I2CAsyncQueue *queue, I2CAsyncRequest *request, IOReturn status) {
+    (*request->completion.action)(request->completion.target, request->completion.parameter,
+                                  request->cmd, status);
+
+    pthread_mutex_lock(&queue->lock);
+    request->next = queue->spare;
+    queue->spare = request;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void *runI2CAsyncQueue(void *arg) {
+    I2CAsyncQueue           *queue = arg;
+    I2CAsyncRequest         *request;
+    IOReturn                status;
+    UInt64                  now;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->head == NULL && !queue->stopping)
+            pthread_cond_wait(&queue->wake, &queue->lock);
+
+        if (queue->stopping) {
+            pthread_mutex_unlock(&queue->lock);
+            return NULL;
+        }
+
+        request = queue->head;
+        if (NULL == (queue->head = request->next))
+            queue->tail = NULL;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (request->timeout_uS) {
+            now = nowUs();
+            if (now >= request->deadlineUs) {
+                complete(queue, request, kIOReturnTimeout);
+                continue;
+            }
+
+            // what is left of the deadline, the controller enforces it
+            request->cmd->timeout_uS = (UInt32)(request->deadlineUs - now);
+        }
+
+        status = queue->execute(queue->refCon, request->cmd);
+        request->cmd->timeout_uS = request->timeout_uS;
+        complete(queue, request, status);
+    }
+}
+
+IOReturn startI2CAsyncQueue(I2CAsyncQueue *queue, I2CAsyncExecute execute, void *refCon) {
+    queue->head = queue->tail = queue->spare = NULL;
+    queue->stopping = 0;
+    queue->execute = execute;
+    queue->refCon = refCon;
+
+    if (pthread_mutex_init(&queue->lock, NULL))
+        return kIOReturnNoResources;
+
+    if (pthread_cond_init(&queue->wake, NULL)) {
+        pthread_mutex_destroy(&queue->lock);
+        return kIOReturnNoResources;
+    }
+
+    if (pthread_create(&queue->thread, NULL, runI2CAsyncQueue, queue)) {
+        pthread_cond_destroy(&queue->wake);
+        pthread_mutex_destroy(&queue->lock);
+        return kIOReturnNoResources;
+    }
+
+    return kIOReturnSuccess;
+}
+
+IOReturn submitI2CAsync(I2CAsyncQueue *queue, IOI2CCommand *cmd, const IOI2CCompletion *completion) {
+    I2CAsyncRequest         *request;
+
+    if (cmd == NULL || completion == NULL || completion->action == NULL)
+        return kIOReturnBadArgument;
+
+    if (cmd->command != kI2CCommand_Read && cmd->command != kI2CCommand_Write)
+        return kIOReturnBadArgument;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->stopping) {
+        pthread_mutex_unlock(&queue->lock);
+        return kIOReturnOffline;
+    }
+
+    if ((request = queue->spare) != NULL)
+        queue->spare = request->next;
+    else if (NULL == (request = malloc(sizeof(*request)))) {
+        pthread_mutex_unlock(&queue->lock);
+        return kIOReturnNoMemory;
+    }
+
+    request->next = NULL;
+    request->cmd = cmd;
+    request->completion = *completion;
+    request->timeout_uS = cmd->timeout_uS;
+    request->deadlineUs = cmd->timeout_uS ? nowUs() + cmd->timeout_uS : 0;
+
+    insertI2CAsyncRequest(queue, request);
+    pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+
+    return kIOReturnSuccess;
+}
+
+void stopI2CAsyncQueue(I2CAsyncQueue *queue) {
+    I2CAsyncRequest         *request, *next;
+
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = 1;
+    request = queue->head;
+    queue->head = queue->tail = NULL;
+    pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_join(queue->thread, NULL);
+
+    for (; request; request = next) {
+        next = request->next;
+        complete(queue, request, kIOReturnAborted);
+    }
+
+    for (request = queue->spare; request; request = next) {
+        next = request->next;
+        free(request);
+    }
+    queue->spare = NULL;
+
+    pthread_cond_destroy(&queue->wake);
+    pthread_mutex_destroy(&queue->lock);
+}
+
+void insertI2CAsyncRequest(I2CAsyncQueue *queue, I2CAsyncRequest *request) {
+    I2CAsyncRequest         **link;
+
+    request->next = NULL;
+
+    // no deadline, or none earlier than the last one queued: stays O(1)
+    if (request->timeout_uS == 0 ||
+            (queue->tail && queue->tail->timeout_uS && queue->tail->deadlineUs <= request->deadlineUs)) {
+        if (queue->tail)
+            queue->tail->next = request;
+        else
+            queue->head = request;
+        queue->tail = request;
+        return;
+    }
+
+    for (link = &queue->head; *link; link = &(*link)->next)
+        if ((*link)->timeout_uS == 0 || (*link)->deadlineUs > request->deadlineUs)
+            break;
+
+    if (NULL == (request->next = *link))
+        queue->tail = request;
+    *link = request;
+}
+
+/*
+ * Jacobson/Karels: mean gain 1/8, deviation gain 1/4.
+ */
+void learnI2CLatency(I2CLatencyEstimate *estimate, UInt32 elapsedUs) {
+    SInt32                  sample, error;
+
+    sample = (elapsedUs > kLearnedTimeoutMaxUs) ? kLearnedTimeoutMaxUs : (SInt32)elapsedUs;
+
+    if (estimate->samples++ == 0) {
+        estimate->meanUs = sample;
+        estimate->devUs = sample / 2;
+        return;
+    }
+
+    error = sample - (SInt32)estimate->meanUs;
+    estimate->meanUs = (SInt32)estimate->meanUs + error / 8;
+    estimate->devUs = (SInt32)estimate->devUs + ((error < 0 ? -error : error) - (SInt32)estimate->devUs) / 4;
+}
+
+UInt32 learnedI2CTimeout(const I2CLatencyEstimate *estimate) {
+    UInt32                  timeoutUs;
+
+    if (estimate->samples < kLearnedTimeoutSamples)
+        return 0;
+
+    timeoutUs = estimate->meanUs + 4 * estimate->devUs;
+    if (timeoutUs < kLearnedTimeoutMinUs)
+        return kLearnedTimeoutMinUs;
+    return (timeoutUs > kLearnedTimeoutMaxUs) ? kLearnedTimeoutMaxUs : timeoutUs;
+}
@@ -0,0 +1,122 @@
+/*
+ * async.h
+ *
+ * Asynchronous I2C command queue, the user space counterpart of
+ * IOI2CDevice::submitI2C.
+ *
+ * One queue stands for one controller: a worker thread executes the
+ * submitted commands and calls each completion when its command is done.
+ * submitI2CAsync only links the command in and returns, so a caller
+ * polling devices behind several controllers keeps all of them busy at
+ * once instead of waiting for one transaction after the other.
+ *
+ * A command's timeout_uS runs from submission. The queue is kept earliest
+ * deadline first with commands without a timeout last, like
+ * IOI2CController::clientSubmitI2C, and a command whose deadline passes
+ * before it reaches the controller completes with kIOReturnTimeout.
+ *
+ * I2CLatencyEstimate is IOI2CDevice::timedI2CTransaction's learned timeout.
+ */
+
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <pthread.h>
+#include "IOI2CDefs.h"
+
+/*!
+	@typedef I2CAsyncExecute
+	@abstract Runs one command on the controller, blocking until it is done.
+*/
+typedef IOReturn (*I2CAsyncExecute)(void *refCon, IOI2CCommand *cmd);
+
+typedef struct I2CAsyncRequest
+{
+	struct I2CAsyncRequest	*next;
+	IOI2CCommand			*cmd;
+	IOI2CCompletion			completion;
+	UInt64					deadlineUs;		// submit time + cmd->timeout_uS
+	UInt32					timeout_uS;		// as submitted, 0 for no deadline
+
+} I2CAsyncRequest;
+
+/*!
+	@struct I2CAsyncQueue
+	@abstract Commands waiting for one controller, and the thread running them.
+*/
+typedef struct
+{
+	pthread_mutex_t		lock;
+	pthread_cond_t		wake;
+	pthread_t			thread;
+	I2CAsyncRequest		*head;
+	I2CAsyncRequest		*tail;
+	I2CAsyncRequest		*spare;			// completed requests, reused by submitI2CAsync
+	int					stopping;
+	I2CAsyncExecute		execute;
+	void				*refCon;
+
+} I2CAsyncQueue;
+
+/*!
+	@struct I2CLatencyEstimate
+	@abstract Smoothed transaction time of one device.
+*/
+typedef struct
+{
+	UInt32		meanUs;
+	UInt32		devUs;
+	UInt32		samples;
+
+} I2CLatencyEstimate;
+
+#define kLearnedTimeoutSamples	8			// transactions timed before a timeout is learned
+#define kLearnedTimeoutMinUs	10000
+#define kLearnedTimeoutMaxUs	5000000		// the controller default
+
+/*!
+	@function startI2CAsyncQueue
+	@abstract Starts the worker thread that executes commands with execute.
+*/
+IOReturn startI2CAsyncQueue(I2CAsyncQueue *queue, I2CAsyncExecute execute, void *refCon);
+
+/*!
+	@function submitI2CAsync
+	@abstract Queues cmd and returns without waiting for it.
+	@discussion completion is copied; cmd and its buffer must stay valid
+	until completion->action is called on the worker thread. Returns an
+	error, and never calls the action, if the command was not queued.
+*/
+IOReturn submitI2CAsync(I2CAsyncQueue *queue, IOI2CCommand *cmd, const IOI2CCompletion *completion);
+
+/*!
+	@function stopI2CAsyncQueue
+	@abstract Lets the command in progress finish, completes the ones still
+	queued with kIOReturnAborted and joins the worker thread.
+*/
+void stopI2CAsyncQueue(I2CAsyncQueue *queue);
+
+/*!
+	@function insertI2CAsyncRequest
+	@abstract Links request into queue in deadline order.
+	@discussion deadlineUs and timeout_uS must be set. The caller holds
+	queue->lock, if the queue has a worker at all.
+*/
+void insertI2CAsyncRequest(I2CAsyncQueue *queue, I2CAsyncRequest *request);
+
+/*!
+	@function learnI2CLatency
+	@abstract Adds the time a successful transaction took to estimate, or
+	the learned timeout a transaction ran out of: it took at least that long.
+*/
+void learnI2CLatency(I2CLatencyEstimate *estimate, UInt32 elapsedUs);
+
+/*!
+	@function learnedI2CTimeout
+	@abstract mean + 4 * deviation clamped to [kLearnedTimeoutMinUs,
+	kLearnedTimeoutMaxUs], or 0 (the controller default) until
+	kLearnedTimeoutSamples transactions were learned.
+*/
+UInt32 learnedI2CTimeout(const I2CLatencyEstimate *estimate);
+
+#endif // ASYNC_H
@@ -0,0 +1,197 @@
+/*
+ * backend.h
+ *
+ * Hardware backend interface for freezer.
+ *
+ * main.c never talks to IOKit directly; it goes through a FreezerBackend,
+ * which provides the IOHWSensor poll and the raw I2C path to the ADT746x
+ * fan controller. Two backends exist:
+ *
+ *  - gIOKitBackend: the real thing, talks to IOHWSensor and the
+ *    IOI2CControllerPPC user client (Mac OS X only).
+ *  - gSimBackend:   an in-process ADT7467 register file (see ADT746x.h)
+ *    that answers the same calls, so the whole read/decode/print path
+ *    can be built and exercised on any POSIX box:
+ *
+ *      cc -o freezer main.c backend_iokit.c backend_sim.c snapshot.c snapshot_batch.c bench.c discovery.c history.c events.c published.c async.c buslock.c shadow.c pfprogram.c functable.c pfindex.c pmonring.c -lpthread
+ */
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "IOI2CDefs.h"
+
+#define kMaxHWSensors		16	// max IOHWSensor readings per poll
+#define kMaxADT746xChips	4	// max ADT746x instances per discovery
+
+/*!
+	@struct HWSensorReading
+	@abstract One IOHWSensor as published in the IORegistry.
+	@field location readable description ("location" property)
+	@field type sensor type: temperature, voltage or fanspeed ("type" property)
+	@field currentValue raw "current-value" property (16.16 for temperature)
+*/
+typedef struct
+{
+	char		location[64];
+	char		type[32];
+	SInt32		currentValue;
+
+} HWSensorReading;
+
+/*!
+	@struct ADT746xLocation
+	@abstract Where an IOI2CADT746x instance lives on the I2C topology.
+	@field controller unit address of the I2C controller node (i2c@...)
+	@field bus I2C bus number, sometimes referred to as port
+	@field address 8-bit I2C address of the chip (fan@...)
+	@field path IOService path of the IOI2CADT746x instance
+*/
+typedef struct
+{
+	UInt32		controller;
+	UInt32		bus;
+	UInt32		address;
+	char		path[512];
+
+} ADT746xLocation;
+
+/*! @typedef I2CConnection Opaque, backend owned, I2C controller connection. */
+typedef struct I2CConnection I2CConnection;
+
+/*!
+	@struct FreezerBackend
+	@abstract Table of backend entry points.
+	@discussion pollSensors and findADT746x return the number of entries
+	filled in, or -1 on error.
+
+	registryChanged arms a watch on IOI2CADT746x publication and termination
+	the first time it is called and afterwards reports, once, whether either
+	happened since the previous call. registryEpoch identifies the registry
+	lifetime (one boot) a cached topology is valid for. Both may be NULL,
+	in which case discovery is never cached.
+
+	The I2C entry points follow the
+	IOI2CUserClient semantics (kI2CUCLock, kI2CUCRead, ...). close does not
+	necessarily tear the connection down, the backend may keep it for the
+	next open of the same location until shutdown, which may be NULL.
+
+	map, mappedRead and mappedWrite are the kI2CUCSharedMemoryType path:
+	map returns the buffer shared with the user client, mapping it on the
+	first call, and mapped transactions move data to and from an offset in
+	it, up to kI2CUCSharedBufSize bytes at a time. A backend without it
+	leaves all three NULL.
+*/
+typedef struct
+{
+	const char	*name;
+
+	int			(*pollSensors)(HWSensorReading *readings, int maxReadings);
+	int			(*findADT746x)(ADT746xLocation *locations, int maxLocations);
+	int			(*registryChanged)(void);
+	UInt64		(*registryEpoch)(void);
+
+	IOReturn	(*open)(const ADT746xLocation *location, I2CConnection **connection);
+	IOReturn	(*close)(I2CConnection *connection);
+	IOReturn	(*lock)(I2CConnection *connection, UInt32 bus, UInt32 *clientKeyRef);
+	IOReturn	(*unlock)(I2CConnection *connection, UInt32 clientKey);
+	IOReturn	(*read)(I2CConnection *connection, I2CUserReadInput *input,
+						I2CUserReadOutput *output);
+	IOReturn	(*write)(I2CConnection *connection, I2CUserWriteInput *input,
+						I2CUserWriteOutput *output);
+	IOReturn	(*map)(I2CConnection *connection, UInt8 **buffer, UInt32 *size);
+	IOReturn	(*mappedRead)(I2CConnection *connection, I2CUserMappedInput *input,
+						I2CUserMappedOutput *output);
+	IOReturn	(*mappedWrite)(I2CConnection *connection, I2CUserMappedInput *input,
+						I2CUserMappedOutput *output);
+	void		(*shutdown)(void);
+
+} FreezerBackend;
+
+#ifdef __APPLE__
+extern const FreezerBackend gIOKitBackend;
+#endif
+extern const FreezerBackend gSimBackend;
+
+/*!
+	@struct SimBusCounters
+	@abstract Traffic seen by the simulated ADT7467 since the last reset.
+	@discussion Every read or write call is one bus transaction. calls
+	counts the user client calls of any kind, and bytesCopied what they
+	copied between the user and the kernel side: structs passed inline,
+	but not the data of mapped transactions.
+*/
+typedef struct
+{
+	UInt32		locks;
+	UInt32		reads;
+	UInt32		writes;
+	UInt32		bytesRead;
+	UInt32		bytesWritten;
+	UInt32		registryWalks;	// findADT746x calls
+	UInt32		calls;
+	UInt32		bytesCopied;
+
+} SimBusCounters;
+
+void simGetBusCounters(SimBusCounters *counters);
+void simResetBusCounters(void);
+
+/*!
+	@function simChangeRegistry
+	@abstract Pretend the IOI2CADT746x was terminated and published again.
+	@discussion The next registryChanged call on gSimBackend reports it.
+*/
+void simChangeRegistry(void);
+
+/*!
+	@function simSetClock
+	@abstract Run the simulated chip off a virtual clock, in ms, instead of
+	the wall clock. 0 goes back to the wall clock.
+*/
+void simSetClock(UInt64 ms);
+
+/*!
+	@function simSetLoad
+	@abstract Hold the simulated load at permille (0..1000) instead of
+	following the load cycle. -1 goes back to the load cycle.
+*/
+void simSetLoad(int permille);
+
+/*!
+	@function simSetBusDelay
+	@abstract Sleep us microseconds in every read and write, roughly what
+	the transfer takes on a real bus. 0 (the default) answers at once.
+*/
+void simSetBusDelay(UInt32 us);
+
+/*!
+	@function simSetLockDelay
+	@abstract Sleep us microseconds in every lock, roughly the user client
+	round trip and semaphore hand off of a real one. 0 (the default) locks
+	at once.
+*/
+void simSetLockDelay(UInt32 us);
+
+/*!
+	@function simSetCallDelay
+	@abstract Sleep us microseconds in every user client call, on top of
+	any bus or lock delay, roughly the Mach trap and method dispatch of a
+	real one. 0 (the default) costs nothing but the struct copies.
+*/
+void simSetCallDelay(UInt32 us);
+
+/*!
+	@function simResetChip
+	@abstract Pretend the chip lost power over sleep: every register goes
+	back to its power on value, anything written to it is lost.
+*/
+void simResetChip(void);
+
+/*!
+	@function defaultBackend
+	@abstract IOKit on Mac OS X, the simulated ADT7467 everywhere else.
+*/
+const FreezerBackend *defaultBackend(void);
+
+#endif // BACKEND_H
@@ -0,0 +1,463 @@
+/*
+ * backend_iokit.c
+ *
+ * IOKit backend: IOHWSensor properties and the IOI2CControllerPPC
+ * user client. Compiles to nothing on non-Apple hosts.
+ */
+
+#ifdef __APPLE__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include "backend.h"
+#include "IOI2C.h"
+
+#define DEBUG 1
+
+#include "freezer.h"
+
+#define kIOHWSensor "IOHWSensor" //IOHWSensor name match
+#define kIONamMatchADT7467 "adt7467" //ADT7467 chip name match
+#define kIOServicePathToIOI2CADT746x \
+"IOService:/MacRISC2PE/uni-n@f8000000/AppleUniN/i2c@%x/IOI2CControllerPPC/i2c-bus@%x/IOI2CBus/fan@%x"
+#define kIOI2CADT746xClassName "IOI2CADT746x"
+#define kIOI2CControllerPPCClassname "IOI2CControllerPPC"
+
+#define kNumVariable 3
+
+#define kIOPPluginCurrentValueKey "current-value" // current measured value
+#define kIOPPluginLocationKey     "location"      // readable description
+#define kIOPPluginTypeKey         "type"          // sensor/control type
+
+static IONotificationPortRef  gNotifyPort;
+static io_iterator_t          gPublishIter;
+static io_iterator_t          gTerminateIter;
+static int                    gRegistryChanged;
+
+struct I2CConnection {
+    I2CDeviceRef            *device;        // owned by the IOI2C connection pool
+};
+
+/**
+ * @brief copySensorsInfo Convert an IOHWSensor property dictionary
+ * @return 0 if the dictionary describes a sensor, -1 otherwise
+ */
+static int copySensorsInfo(CFDictionaryRef serviceDict, HWSensorReading *reading) {
+    CFNumberRef sensorValue;
+    CFStringRef sensorType, sensorLocation;
+
+    if (!CFDictionaryGetValueIfPresent(serviceDict,
+                                       CFSTR(kIOPPluginTypeKey),
+                                       (void *)&sensorType))
+        return -1;
+
+    sensorLocation = CFDictionaryGetValue(serviceDict,
+                                          CFSTR(kIOPPluginLocationKey));
+
+    sensorValue = CFDictionaryGetValue(serviceDict,
+                                       CFSTR(kIOPPluginCurrentValueKey));
+
+    reading->location[0] = '\0';
+    if (sensorLocation)
+        CFStringGetCString(sensorLocation, reading->location,
+                           sizeof(reading->location), kCFStringEncodingMacRoman);
+
+    CFStringGetCString(sensorType, reading->type,
+                       sizeof(reading->type), kCFStringEncodingMacRoman);
+
+    reading->currentValue = 0;
+    if (sensorValue)
+        (void)CFNumberGetValue(sensorValue, kCFNumberSInt32Type,
+                               (void *)&reading->currentValue);
+    return 0;
+}
+
+/**
+ * @brief iokitPollSensors Read every IOHWSensor in the IORegistry
+ */
+static int iokitPollSensors(HWSensorReading *readings, int maxReadings) {
+    io_iterator_t           iter;
+    io_service_t            service = 0;
+    kern_return_t           kr;
+    CFMutableDictionaryRef  serviceDict;
+    int                     count = 0;
+
+    // Create an iterator for all IO Registry objects that match the dictionary
+    kr =  IOServiceGetMatchingServices(kIOMasterPortDefault,
+                                       IOServiceMatching(kIOHWSensor), &iter);
+    if(kr != KERN_SUCCESS) {
+        fprintf(stderr, "IOServiceGetMatchingServices returned 0x%08x\n\n", kr);
+        return -1;
+    }
+
+    // Iterate over all matching objects
+    while((service = IOIteratorNext(iter)) != IO_OBJECT_NULL) {
+        kr = IORegistryEntryCreateCFProperties(service, &serviceDict,
+                 kCFAllocatorDefault, kNilOptions);
+        if (kr == KERN_SUCCESS) {
+            if (count < maxReadings &&
+                    0 == copySensorsInfo(serviceDict, &readings[count]))
+                count++;
+            CFRelease(serviceDict);
+        }
+        IOObjectRelease(service);
+    }
+
+    IOObjectRelease(iter);
+    return count;
+}
+
+static int isFoundIOI2CADT746x(io_service_t parentService, ADT746xLocation *location) {
+    kern_return_t           kr;
+    io_service_t            childService = 0;
+    kr = IORegistryEntryGetChildEntry(parentService, kIOServicePlane, &childService);
+    if(kr != KERN_SUCCESS) {
+        fprintf(stderr, "IORegistryEntryGetChildEntry returned 0x%08x\n\n", kr);
+        return -1;
+    }
+
+    io_name_t className;
+    kr = IOObjectGetClass(childService, className);
+    if(kr != KERN_SUCCESS) {
+        fprintf(stderr, "IOObjectGetClass returned 0x%08x\n\n", kr);
+        IOObjectRelease(childService);
+        return -1;
+    }
+
+    //found IOI2CADT746x class
+    if(0 != strcmp(className, kIOI2CADT746xClassName)) {
+        IOObjectRelease(childService);
+        return -1;
+    }
+
+    D(printf("Found class %s\n", className));
+
+    kr = IORegistryEntryGetPath(childService, kIOServicePlane, location->path);
+    IOObjectRelease(childService);
+    if(kr != KERN_SUCCESS) {
+        fprintf(stderr, "IORegistryEntryGetPath returned 0x%08x\n\n", kr);
+        return -1;
+    }
+
+    D(printf("Found IORegistryEntry with path %s\n", location->path));
+    unsigned int i2cContrlNum, i2cBusNum, chipNum;
+    if(kNumVariable !=
+            sscanf(location->path, kIOServicePathToIOI2CADT746x, &i2cContrlNum, &i2cBusNum, &chipNum))
+        return -1;
+
+    location->controller = i2cContrlNum;
+    location->bus = i2cBusNum;
+    location->address = chipNum;
+    return 0;
+}
+
+/**
+ * @brief iokitFindADT746x Find every IOI2CADT746x attached to an adt7467 nub
+ */
+static int iokitFindADT746x(ADT746xLocation *locations, int maxLocations) {
+    io_iterator_t           iter;
+    io_service_t            service = 0;
+    kern_return_t           kr;
+    int                     count = 0;
+
+    // Create an iterator for all IO Registry objects that match adt7467
+    kr =  IOServiceGetMatchingServices(kIOMasterPortDefault,
+                                       IOServiceNameMatching(kIONamMatchADT7467), &iter);
+    if(kr != KERN_SUCCESS) {
+        fprintf(stderr, "IOServiceGetMatchingServices returned 0x%08x\n\n", kr);
+        return -1;
+    }
+
+    // Iterate over all matching objects
+    while((service = IOIteratorNext(iter)) != IO_OBJECT_NULL) {
+        if (count < maxLocations &&
+                0 == isFoundIOI2CADT746x(service, &locations[count]))
+            count++;
+        IOObjectRelease(service);
+    }
+
+    IOObjectRelease(iter);
+    return count;
+}
+
+static void drainNotificationIterator(io_iterator_t iter) {
+    io_object_t             object;
+
+    while((object = IOIteratorNext(iter)) != IO_OBJECT_NULL)
+        IOObjectRelease(object);
+}
+
+static void registryNotification(void *refcon, io_iterator_t iter) {
+    drainNotificationIterator(iter);
+    gRegistryChanged = 1;
+}
+
+static kern_return_t watchIOI2CADT746x(const io_name_t type, io_iterator_t *iter) {
+    kern_return_t           kr;
+
+    kr = IOServiceAddMatchingNotification(gNotifyPort, type,
+                                          IOServiceMatching(kIOI2CADT746xClassName),
+                                          registryNotification, NULL, iter);
+    if(kr != KERN_SUCCESS) {
+        fprintf(stderr, "IOServiceAddMatchingNotification returned 0x%08x\n\n", kr);
+        return kr;
+    }
+
+    // arm the notification, existing instances are not a change
+    drainNotificationIterator(*iter);
+    return KERN_SUCCESS;
+}
+
+/**
+ * @brief iokitRegistryChanged Was an IOI2CADT746x published or terminated?
+ *
+ * There is no run loop in freezer, so pending notification messages are
+ * received without blocking and handed to IODispatchCalloutFromMessage.
+ * Reports a change if the watch cannot be armed.
+ */
+static int iokitRegistryChanged(void) {
+    struct {
+        mach_msg_header_t   header;
+        UInt8               body[1024];
+    } msg;
+    int                     changed;
+
+    if (gNotifyPort == NULL) {
+        if (NULL == (gNotifyPort = IONotificationPortCreate(kIOMasterPortDefault)))
+            return 1;
+        if (KERN_SUCCESS != watchIOI2CADT746x(kIOPublishNotification, &gPublishIter) ||
+                KERN_SUCCESS != watchIOI2CADT746x(kIOTerminatedNotification, &gTerminateIter)) {
+            IONotificationPortDestroy(gNotifyPort);
+            gNotifyPort = NULL;
+            return 1;
+        }
+        return 0;
+    }
+
+    while(MACH_MSG_SUCCESS == mach_msg(&msg.header, MACH_RCV_MSG | MACH_RCV_TIMEOUT, 0,
+                                       sizeof(msg), IONotificationPortGetMachPort(gNotifyPort),
+                                       0, MACH_PORT_NULL))
+        IODispatchCalloutFromMessage(NULL, &msg.header, gNotifyPort);
+
+    changed = gRegistryChanged;
+    gRegistryChanged = 0;
+    return changed;
+}
+
+/**
+ * @brief iokitRegistryEpoch Boot time, the IORegistry does not outlive it
+ */
+static UInt64 iokitRegistryEpoch(void) {
+    int                     mib[2] = { CTL_KERN, KERN_BOOTTIME };
+    struct timeval          boottime;
+    size_t                  size = sizeof(boottime);
+
+    if (0 != sysctl(mib, 2, &boottime, &size, NULL, 0))
+        return 0;
+    return ((UInt64)boottime.tv_sec << 20) | (UInt64)boottime.tv_usec;
+}
+
+static io_service_t matchI2CControllerService(io_service_t service) {
+    kern_return_t           kr;
+    io_service_t childService = service;
+    io_service_t parentService = 0;
+    io_name_t className;
+
+    do {
+        kr = IORegistryEntryGetParentEntry(childService, kIOServicePlane, &parentService);
+        if(kr != KERN_SUCCESS) {
+            fprintf(stderr, "IORegistryEntryGetParentEntry returned 0x%08x\n\n", kr);
+            return 0;
+        }
+
+        kr = IOObjectGetClass(parentService, className);
+        if(kr != KERN_SUCCESS) {
+            fprintf(stderr, "IOObjectGetClass returned 0x%08x\n\n", kr);
+            return 0;
+        }
+
+        D(printf("Found parent service with class name %s\n", className));
+
+        if(childService != service)
+            IOObjectRelease(childService);
+
+        childService = parentService;
+
+    } while(0 != strcmp(className, kIOI2CControllerPPCClassname));
+
+    return parentService;
+}
+
+static IOReturn iokitOpen(const ADT746xLocation *location, I2CConnection **connection) {
+    kern_return_t           kr;
+    io_service_t            service;
+    io_service_t            i2cControllerService;
+    io_string_t             controllerPath;
+    CFStringRef             pathStr;
+    I2CConnection           *conn;
+
+    if (NULL == (conn = calloc(1, sizeof(*conn))))
+        return kIOReturnNoMemory;
+
+    //reuse a pooled user client, skipping the registry walk
+    kr = acquireI2CDevice(location->bus, location->address, NULL, &conn->device);
+    if (kr == kIOReturnSuccess) {
+        *connection = conn;
+        return kIOReturnSuccess;
+    }
+
+    service = IORegistryEntryFromPath(kIOMasterPortDefault, location->path);
+    if (service == MACH_PORT_NULL) {
+        free(conn);
+        return kIOReturnNotFound;
+    }
+
+    //match I2CControllerPPC
+    i2cControllerService = matchI2CControllerService(service);
+    IOObjectRelease(service);
+
+    if(0 == i2cControllerService){
+        fprintf(stderr, "Failed to find I2CControllerPPC\n\n");
+        free(conn);
+        return kIOReturnNotFound;
+    }
+
+    kr = IORegistryEntryGetPath(i2cControllerService, kIOServicePlane, controllerPath);
+    IOObjectRelease(i2cControllerService);
+    if (kr != KERN_SUCCESS) {
+        free(conn);
+        return kr;
+    }
+
+    pathStr = CFStringCreateWithCString(NULL, controllerPath, kCFStringEncodingMacRoman);
+    if (pathStr == NULL) {
+        free(conn);
+        return kIOReturnNoMemory;
+    }
+
+    //open user client of I2CControllerPPC, it stays pooled until shutdown
+    kr = acquireI2CDevice(location->bus, location->address, pathStr, &conn->device);
+    CFRelease(pathStr);
+
+    if (kr != kIOReturnSuccess) {
+        free(conn);
+        return kr;
+    }
+
+    *connection = conn;
+    return kIOReturnSuccess;
+}
+
+static IOReturn iokitClose(I2CConnection *connection) {
+    // the user client stays open in the pool, a bus lock still held is released
+    releaseI2CDevice(connection->device);
+    free(connection);
+    return kIOReturnSuccess;
+}
+
+static IOReturn iokitLock(I2CConnection *connection, UInt32 bus, UInt32 *clientKeyRef) {
+    IOReturn                kr;
+
+    kr = lockI2CExtended(connection->device, bus);
+    if (kr == kIOReturnSuccess)
+        *clientKeyRef = connection->device->_i2c_key;
+    else
+        connection->device->_i2c_key = kIOI2C_CLIENT_KEY_DEFAULT;
+    return kr;
+}
+
+static IOReturn iokitUnlock(I2CConnection *connection, UInt32 clientKey) {
+    IOReturn                kr;
+
+    connection->device->_i2c_key = clientKey;
+    kr = unlockI2CDevice(connection->device);
+    connection->device->_i2c_key = kIOI2C_CLIENT_KEY_DEFAULT;
+    return kr;
+}
+
+static IOReturn iokitRead(I2CConnection *connection, I2CUserReadInput *input,
+                          I2CUserReadOutput *output) {
+    IOReturn                kr;
+
+    connection->device->_i2c_key = input->key;
+    kr = readI2CPooled(connection->device, input->busNo, input->addr,
+                         input->subAddr, output->buf, input->count,
+                         input->mode, input->options);
+    output->realCount = (kr == kIOReturnSuccess) ? input->count : 0;
+    return kr;
+}
+
+static IOReturn iokitWrite(I2CConnection *connection, I2CUserWriteInput *input,
+                           I2CUserWriteOutput *output) {
+    IOReturn                kr;
+
+    connection->device->_i2c_key = input->key;
+    kr = writeI2CPooled(connection->device, input->busNo, input->addr,
+                          input->subAddr, input->buf, input->count,
+                          input->mode, input->options);
+    output->realCount = (kr == kIOReturnSuccess) ? input->count : 0;
+    return kr;
+}
+
+static IOReturn iokitMap(I2CConnection *connection, UInt8 **buffer, UInt32 *size) {
+    return mapI2CDevice(connection->device, buffer, size);
+}
+
+static IOReturn iokitMappedRead(I2CConnection *connection, I2CUserMappedInput *input,
+                                I2CUserMappedOutput *output) {
+    IOReturn                kr;
+
+    connection->device->_i2c_key = input->key;
+    kr = readI2CMapped(connection->device, input->busNo, input->addr, input->subAddr,
+                       input->offset, input->count, input->mode, input->options);
+    output->realCount = (kr == kIOReturnSuccess) ? input->count : 0;
+    return kr;
+}
+
+static IOReturn iokitMappedWrite(I2CConnection *connection, I2CUserMappedInput *input,
+                                 I2CUserMappedOutput *output) {
+    IOReturn                kr;
+
+    connection->device->_i2c_key = input->key;
+    kr = writeI2CMapped(connection->device, input->busNo, input->addr, input->subAddr,
+                        input->offset, input->count, input->mode, input->options);
+    output->realCount = (kr == kIOReturnSuccess) ? input->count : 0;
+    return kr;
+}
+
+static void iokitShutdown(void) {
+    drainI2CPool();
+
+    if (gNotifyPort) {
+        IOObjectRelease(gPublishIter);
+        IOObjectRelease(gTerminateIter);
+        IONotificationPortDestroy(gNotifyPort);
+        gNotifyPort = NULL;
+    }
+}
+
+const FreezerBackend gIOKitBackend = {
+    "iokit",
+    iokitPollSensors,
+    iokitFindADT746x,
+    iokitRegistryChanged,
+    iokitRegistryEpoch,
+    iokitOpen,
+    iokitClose,
+    iokitLock,
+    iokitUnlock,
+    iokitRead,
+    iokitWrite,
+    iokitMap,
+    iokitMappedRead,
+    iokitMappedWrite,
+    iokitShutdown
+};
+
+#endif // __APPLE__
@@ -0,0 +1,623 @@
+/*
+ * backend_sim.c
+ *
+ * Simulated backend: a single ADT7467 register file behind a fake
+ * IOI2CControllerPPC, plus the IOHWSensor view the platform plugin would
+ * publish for it. The register map and encodings come from ADT746x.h.
+ *
+ * The chip follows a slow load cycle (60 s triangle wave) so repeated
+ * polls see moving temperatures, tach and duty cycle. Set
+ * FREEZER_SIM_SEED to change the measurement noise sequence. Benchmarks
+ * can drive the chip from a virtual clock and a fixed load instead
+ * (simSetClock, simSetLoad), and make every transaction take as long as
+ * it would on a real bus (simSetBusDelay, simSetLockDelay).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "backend.h"
+#include "ADT746x.h"
+
+#define kSimController		0xf8001000	// uni-n i2c@f8001000
+#define kSimBus				0
+#define kSimAddress			0x5c		// fan@5c
+#define kSimPath			"IOService:/MacRISC2PE/uni-n@f8000000/AppleUniN/i2c@f8001000/IOI2CControllerPPC/i2c-bus@0/IOI2CBus/fan@5c"
+
+#define kSimLoadPeriod		60			// seconds per load cycle
+#define kSimTachClock		(90000 * 60)	// 90 kHz tach clock, per minute
+
+struct I2CConnection {
+	int			open;
+	UInt8		*shared;	// kI2CUCSharedMemoryType buffer, allocated with the user client
+};
+
+static UInt8	gSimRegs[128];		// ADT7467 register file
+static int		gSimInitialized;
+static UInt32	gSimLockKey;		// kIOI2C_CLIENT_KEY_DEFAULT when unlocked
+static UInt32	gSimNextKey;
+static UInt32	gSimRandom;
+static struct timeval gSimStart;
+static SimBusCounters gSimCounters;
+static UInt32	gSimRegistryGeneration;	// bumped by simChangeRegistry
+static UInt32	gSimWatchedGeneration;
+static int		gSimWatching;
+static UInt64	gSimClockMs;		// virtual clock, 0 for wall clock
+static int		gSimLoad = -1;		// fixed load, -1 for the load cycle
+static UInt32	gSimBusDelayUs;		// sleep per transaction
+static UInt32	gSimLockDelayUs;	// sleep per lock
+static UInt32	gSimCallDelayUs;	// sleep per user client call
+
+static UInt32 simRandom(void)
+{
+	// xorshift32
+	gSimRandom ^= gSimRandom << 13;
+	gSimRandom ^= gSimRandom >> 17;
+	gSimRandom ^= gSimRandom << 5;
+	return gSimRandom;
+}
+
+// What the chip holds after power on, as the firmware leaves it
+static void simPowerOnRegisters(void)
+{
+	memset(gSimRegs, 0, sizeof(gSimRegs));
+
+	gSimRegs[kDeviceIDReg]		= kDeviceIDADT7467;
+	gSimRegs[kCompanyIDNum]		= 0x41;
+	gSimRegs[kRevisionNum]		= 0x71;
+	gSimRegs[kConfigReg1]		= 0x05;
+	gSimRegs[kConfigReg2]		= k2_5VAttenuationMask;
+	gSimRegs[kFanPulsePerRev]	= 0x55;
+
+	gSimRegs[kRemote1TempLowLimit]	= 0x81;
+	gSimRegs[kRemote1TempHighLimit]	= 0x7F;
+	gSimRegs[kLocalTempLowLimit]	= 0x81;
+	gSimRegs[kLocalTempHighLimit]	= 0x7F;
+	gSimRegs[kRemote2TempLowLimit]	= 0x81;
+	gSimRegs[kRemote2TempHighLimit]	= 0x7F;
+
+	// Tach 3 and 4 are not connected
+	gSimRegs[kTACH3LowByte]		= 0xFF;
+	gSimRegs[kTACH3HighByte]	= 0xFF;
+	gSimRegs[kTACH4LowByte]		= 0xFF;
+	gSimRegs[kTACH4HighByte]	= 0xFF;
+}
+
+static void simInit(void)
+{
+	const char	*seed;
+
+	if (gSimInitialized)
+		return;
+
+	simPowerOnRegisters();
+
+	seed = getenv("FREEZER_SIM_SEED");
+	gSimRandom = seed ? (UInt32)strtoul(seed, NULL, 0) : 1;
+	if (gSimRandom == 0)
+		gSimRandom = 1;
+
+	gettimeofday(&gSimStart, NULL);
+	gSimInitialized = 1;
+}
+
+/*
+ * Store a temperature, in quarter degrees C, into its value register
+ * and its two extended resolution bits in kExtendedRes2.
+ */
+static void simSetTemp(UInt8 reg, int quarters, UInt8 extMask, int extShift)
+{
+	UInt8	frac = quarters & 0x03;
+
+	gSimRegs[reg] = (UInt8)(quarters >> 2);
+	gSimRegs[kExtendedRes2] = (gSimRegs[kExtendedRes2] & ~extMask) |
+			((frac << 6) >> extShift);
+}
+
+static void simSetTach(UInt8 lowReg, UInt32 rpm)
+{
+	UInt32	count = rpm ? (kSimTachClock / rpm) : 0xFFFF;
+
+	gSimRegs[lowReg]		= count & 0xFF;
+	gSimRegs[lowReg + 1]	= (count >> 8) & 0xFF;
+}
+
+/*
+ * Latch the status bit of a temperature channel that is out of its
+ * limit window, the limit and value registers are two's complement.
+ */
+static void simCheckLimit(UInt8 valueReg, UInt8 lowReg, UInt8 highReg, UInt8 statusBit)
+{
+	SInt8	value = (SInt8)gSimRegs[valueReg];
+
+	if (value > (SInt8)gSimRegs[highReg] || value <= (SInt8)gSimRegs[lowReg])
+		gSimRegs[kIntStatusReg1] |= statusBit;
+}
+
+/*
+ * Advance the chip to the current (wall or virtual) clock time.
+ */
+static void simUpdate(void)
+{
+	struct timeval	now;
+	long			ms;
+	int				load;		// 0..1000
+	int				noise;
+	UInt32			vccp;
+
+	simInit();
+
+	if (gSimClockMs) {
+		ms = (long)(gSimClockMs % (kSimLoadPeriod * 1000));
+	} else {
+		gettimeofday(&now, NULL);
+		ms = (now.tv_sec - gSimStart.tv_sec) * 1000 +
+				(now.tv_usec - gSimStart.tv_usec) / 1000;
+		ms %= kSimLoadPeriod * 1000;
+	}
+	if (gSimLoad >= 0)
+		load = gSimLoad;
+	else
+		load = (int)((ms < kSimLoadPeriod * 500) ? ms : (kSimLoadPeriod * 1000 - ms)) * 2 / kSimLoadPeriod;
+	noise = (int)(simRandom() % 3) - 1;
+
+	// CPU on remote 1, case on local, GPU on remote 2 (quarter degrees)
+	simSetTemp(kRemote1Temp, 4 * 45 + (load * 4 * 25) / 1000 + noise,
+			kRemote1ExtMask, kRemote1ExtShift);
+	simSetTemp(kLocalTemperature, 4 * 38 + (load * 4 * 6) / 1000,
+			kLocalExtMask, kLocalExtShift);
+	simSetTemp(kRemote2Temp, 4 * 50 + (load * 4 * 10) / 1000 - noise,
+			kRemote2ExtMask, kRemote2ExtShift);
+
+	// fan follows the load
+	gSimRegs[kPWM1DutyCycle] = (UInt8)(0x40 + (load * 0xBF) / 1000);
+	simSetTach(kTACH1LowByte, 1500 + (load * 3000) / 1000);
+	simSetTach(kTACH2LowByte, 0);
+
+	// Vccp around 1.2 V, 10 bit reading with attenuation
+	vccp = (1200 + (load * 100) / 1000) * (kUnitsPerVoltWithAttenuation7467 / 100) / 1000;
+	gSimRegs[k2_5VccpReading] = (UInt8)(vccp >> kVoltageShift);
+	gSimRegs[kExtendedRes1] = (gSimRegs[kExtendedRes1] & ~kExtVoltageMask) |
+			((vccp & kExtVoltageMask) << kExtVoltageShift);
+	gSimRegs[kVccReading] = 0xC0;
+
+	simCheckLimit(kRemote1Temp, kRemote1TempLowLimit, kRemote1TempHighLimit, kStatus1Remote1Temp);
+	simCheckLimit(kLocalTemperature, kLocalTempLowLimit, kLocalTempHighLimit, kStatus1LocalTemp);
+	simCheckLimit(kRemote2Temp, kRemote2TempLowLimit, kRemote2TempHighLimit, kStatus1Remote2Temp);
+	if (gSimRegs[kIntStatusReg2])
+		gSimRegs[kIntStatusReg1] |= kStatus1OutOfLimit;
+}
+
+void simSetClock(UInt64 ms)
+{
+	gSimClockMs = ms;
+}
+
+void simSetLoad(int permille)
+{
+	gSimLoad = (permille > 1000) ? 1000 : permille;
+}
+
+void simSetBusDelay(UInt32 us)
+{
+	gSimBusDelayUs = us;
+}
+
+void simSetLockDelay(UInt32 us)
+{
+	gSimLockDelayUs = us;
+}
+
+void simSetCallDelay(UInt32 us)
+{
+	gSimCallDelayUs = us;
+}
+
+void simResetChip(void)
+{
+	simInit();
+	simPowerOnRegisters();
+}
+
+static void simAddReading(HWSensorReading *readings, int maxReadings, int *count,
+		const char *location, const char *type, SInt32 value)
+{
+	if (*count >= maxReadings)
+		return;
+
+	strncpy(readings[*count].location, location, sizeof(readings[*count].location) - 1);
+	readings[*count].location[sizeof(readings[*count].location) - 1] = '\0';
+	strncpy(readings[*count].type, type, sizeof(readings[*count].type) - 1);
+	readings[*count].type[sizeof(readings[*count].type) - 1] = '\0';
+	readings[*count].currentValue = value;
+	(*count)++;
+}
+
+/*
+ * Decode the register file the way IOI2CADT746x does and publish it the
+ * way IOHWSensor does.
+ */
+static int simPollSensors(HWSensorReading *readings, int maxReadings)
+{
+	UInt8	ext1, ext2;
+	UInt16	tach;
+	UInt32	volIndex;
+	int		count = 0;
+
+	simUpdate();
+
+	ext1 = gSimRegs[kExtendedRes1];
+	ext2 = gSimRegs[kExtendedRes2];
+
+	simAddReading(readings, maxReadings, &count, "CPU BOTTOMSIDE", "temperature",
+			SIGNED_TEMP_FROM_BYTES((SInt8)gSimRegs[kRemote1Temp], REMOTE1_FROM_EXT_TEMP(ext2)));
+	simAddReading(readings, maxReadings, &count, "PWR SUPPLY BOTTOMSIDE", "temperature",
+			SIGNED_TEMP_FROM_BYTES((SInt8)gSimRegs[kLocalTemperature], LOCAL_FROM_EXT_TEMP(ext2)));
+	simAddReading(readings, maxReadings, &count, "GPU ON DIE", "temperature",
+			SIGNED_TEMP_FROM_BYTES((SInt8)gSimRegs[kRemote2Temp], REMOTE2_FROM_EXT_TEMP(ext2)));
+
+	// IOHWSensor publishes voltage scaled by 2 << 16
+	volIndex = VOLTAGE_INDEX_FROM_BYTES(gSimRegs[k2_5VccpReading], ext1) * 100;
+	simAddReading(readings, maxReadings, &count, "CPU CORE", "voltage",
+			(SInt32)(((volIndex << 16) / kUnitsPerVoltWithAttenuation7467) << 1));
+
+	tach = ((UInt16)gSimRegs[kTACH1HighByte] << 8) | gSimRegs[kTACH1LowByte];
+	simAddReading(readings, maxReadings, &count, "CPU FAN", "fanspeed",
+			((tach == 0xFFFF) || (tach == 0)) ? 0 : kSimTachClock / tach);
+
+	return count;
+}
+
+static int simFindADT746x(ADT746xLocation *locations, int maxLocations)
+{
+	gSimCounters.registryWalks++;
+
+	if (maxLocations < 1)
+		return 0;
+
+	locations[0].controller	= kSimController;
+	locations[0].bus		= kSimBus;
+	locations[0].address	= kSimAddress;
+	strcpy(locations[0].path, kSimPath);
+	return 1;
+}
+
+static int simRegistryChanged(void)
+{
+	int		changed;
+
+	if (!gSimWatching) {
+		gSimWatching = 1;
+		gSimWatchedGeneration = gSimRegistryGeneration;
+		return 0;
+	}
+
+	changed = (gSimWatchedGeneration != gSimRegistryGeneration);
+	gSimWatchedGeneration = gSimRegistryGeneration;
+	return changed;
+}
+
+static UInt64 simRegistryEpoch(void)
+{
+	// the simulated registry never reboots
+	return 1;
+}
+
+void simChangeRegistry(void)
+{
+	gSimRegistryGeneration++;
+}
+
+static IOReturn simOpen(const ADT746xLocation *location, I2CConnection **connection)
+{
+	I2CConnection	*conn;
+
+	if (location == NULL || connection == NULL)
+		return kIOReturnBadArgument;
+
+	if (location->controller != kSimController)
+		return kIOReturnNotFound;
+
+	if (NULL == (conn = malloc(sizeof(*conn))))
+		return kIOReturnNoMemory;
+
+	if (NULL == (conn->shared = calloc(1, kI2CUCSharedBufSize))) {
+		free(conn);
+		return kIOReturnNoMemory;
+	}
+
+	simInit();
+	conn->open = 1;
+	*connection = conn;
+	return kIOReturnSuccess;
+}
+
+static IOReturn simClose(I2CConnection *connection)
+{
+	if (connection == NULL)
+		return kIOReturnBadArgument;
+
+	free(connection->shared);
+	free(connection);
+	return kIOReturnSuccess;
+}
+
+/*
+ * The kernel side of a user client call: the trap, and the input struct
+ * copied in whole. simCallOut copies the output struct back out.
+ */
+static void simCallIn(void *kernelInput, const void *input, size_t inputSize)
+{
+	if (gSimCallDelayUs)
+		usleep(gSimCallDelayUs);
+
+	if (inputSize)
+		memcpy(kernelInput, input, inputSize);
+	gSimCounters.calls++;
+	gSimCounters.bytesCopied += inputSize;
+}
+
+static void simCallOut(void *output, const void *kernelOutput, size_t outputSize)
+{
+	memcpy(output, kernelOutput, outputSize);
+	gSimCounters.bytesCopied += outputSize;
+}
+
+static IOReturn simLock(I2CConnection *connection, UInt32 bus, UInt32 *clientKeyRef)
+{
+	if (connection == NULL || clientKeyRef == NULL)
+		return kIOReturnBadArgument;
+
+	simCallIn(NULL, NULL, 0);
+
+	if (bus != kSimBus)
+		return kIOReturnNoDevice;
+
+	// single threaded: a held lock would block forever
+	if (gSimLockKey != kIOI2C_CLIENT_KEY_DEFAULT)
+		return kIOReturnBusy;
+
+	do {
+		gSimNextKey++;
+	} while (gSimNextKey == kIOI2C_CLIENT_KEY_DEFAULT ||
+			gSimNextKey == kIOI2C_CLIENT_KEY_INVALID);
+
+	if (gSimLockDelayUs)
+		usleep(gSimLockDelayUs);
+
+	gSimLockKey = gSimNextKey;
+	*clientKeyRef = gSimLockKey;
+	gSimCounters.locks++;
+	return kIOReturnSuccess;
+}
+
+static IOReturn simUnlock(I2CConnection *connection, UInt32 clientKey)
+{
+	if (connection == NULL)
+		return kIOReturnBadArgument;
+
+	simCallIn(NULL, NULL, 0);
+
+	if (clientKey != gSimLockKey || clientKey == kIOI2C_CLIENT_KEY_DEFAULT)
+		return kIOReturnBadArgument;
+
+	gSimLockKey = kIOI2C_CLIENT_KEY_DEFAULT;
+	return kIOReturnSuccess;
+}
+
+/*
+ * Common checks for a transaction addressed to the simulated chip.
+ */
+static IOReturn simCheckTransaction(UInt32 bus, UInt32 addr, UInt32 key, IOByteCount count,
+		IOByteCount maxCount)
+{
+	if (count > maxCount)
+		return kIOReturnBadArgument;
+
+	if (gSimLockKey != kIOI2C_CLIENT_KEY_DEFAULT && key != gSimLockKey)
+		return kIOReturnCannotLock;
+
+	if (bus != kSimBus || (addr & 0xFE) != kSimAddress)
+		return kIOReturnNoDevice;
+
+	if (gSimBusDelayUs)
+		usleep(gSimBusDelayUs);
+
+	return kIOReturnSuccess;
+}
+
+static IOReturn simReadRegisters(UInt32 bus, UInt32 addr, UInt32 key, UInt32 subAddr,
+		UInt8 *buf, IOByteCount count, IOByteCount maxCount)
+{
+	IOReturn	status;
+	IOByteCount	i;
+	UInt32		reg;
+
+	status = simCheckTransaction(bus, addr, key, count, maxCount);
+	if (status != kIOReturnSuccess)
+		return status;
+
+	simUpdate();
+
+	// the sub-address auto-increments across the register file
+	for (i = 0; i < count; i++)
+		buf[i] = gSimRegs[(subAddr + i) & 0x7F];
+
+	// reading the interrupt status registers clears them
+	for (i = 0; i < count; i++) {
+		reg = (subAddr + i) & 0x7F;
+		if (reg == kIntStatusReg1 || reg == kIntStatusReg2)
+			gSimRegs[reg] = 0;
+	}
+
+	gSimCounters.reads++;
+	gSimCounters.bytesRead += count;
+	return kIOReturnSuccess;
+}
+
+static int simIsReadOnly(UInt32 reg)
+{
+	return (reg >= k2_5VReading && reg <= kTACH4HighByte) ||
+			(reg >= kDeviceIDReg && reg <= kRevisionNum) ||
+			reg == kIntStatusReg1 || reg == kIntStatusReg2 ||
+			reg == kExtendedRes1 || reg == kExtendedRes2 ||
+			reg == kTestRegister1 || reg == kTestRegister2;
+}
+
+static IOReturn simWriteRegisters(UInt32 bus, UInt32 addr, UInt32 key, UInt32 subAddr,
+		const UInt8 *buf, IOByteCount count, IOByteCount maxCount)
+{
+	IOReturn	status;
+	IOByteCount	i;
+	UInt32		reg;
+
+	status = simCheckTransaction(bus, addr, key, count, maxCount);
+	if (status != kIOReturnSuccess)
+		return status;
+
+	simInit();
+
+	for (i = 0; i < count; i++) {
+		reg = (subAddr + i) & 0x7F;
+		if (!simIsReadOnly(reg))
+			gSimRegs[reg] = buf[i];
+	}
+
+	gSimCounters.writes++;
+	gSimCounters.bytesWritten += count;
+	return kIOReturnSuccess;
+}
+
+static IOReturn simRead(I2CConnection *connection, I2CUserReadInput *input,
+		I2CUserReadOutput *output)
+{
+	I2CUserReadInput	kernelInput;
+	I2CUserReadOutput	kernelOutput;
+	IOReturn			status;
+
+	if (connection == NULL || input == NULL || output == NULL)
+		return kIOReturnBadArgument;
+
+	simCallIn(&kernelInput, input, sizeof(kernelInput));
+
+	status = simReadRegisters(kernelInput.busNo, kernelInput.addr, kernelInput.key,
+			kernelInput.subAddr, kernelOutput.buf, kernelInput.count, kI2CUCBufSize);
+	kernelOutput.realCount = (status == kIOReturnSuccess) ? kernelInput.count : 0;
+
+	simCallOut(output, &kernelOutput, sizeof(kernelOutput));
+	return status;
+}
+
+static IOReturn simWrite(I2CConnection *connection, I2CUserWriteInput *input,
+		I2CUserWriteOutput *output)
+{
+	I2CUserWriteInput	kernelInput;
+	I2CUserWriteOutput	kernelOutput;
+	IOReturn			status;
+
+	if (connection == NULL || input == NULL || output == NULL)
+		return kIOReturnBadArgument;
+
+	simCallIn(&kernelInput, input, sizeof(kernelInput));
+
+	status = simWriteRegisters(kernelInput.busNo, kernelInput.addr, kernelInput.key,
+			kernelInput.subAddr, kernelInput.buf, kernelInput.count, kI2CUCBufSize);
+	kernelOutput.realCount = (status == kIOReturnSuccess) ? kernelInput.count : 0;
+
+	simCallOut(output, &kernelOutput, sizeof(kernelOutput));
+	return status;
+}
+
+static IOReturn simMap(I2CConnection *connection, UInt8 **buffer, UInt32 *size)
+{
+	if (connection == NULL || buffer == NULL || size == NULL)
+		return kIOReturnBadArgument;
+
+	*buffer = connection->shared;
+	*size = kI2CUCSharedBufSize;
+	return kIOReturnSuccess;
+}
+
+/*
+ * IOI2CUserClient::mappedI2CTransaction: only the small structs cross,
+ * the data stays in the shared buffer.
+ */
+static IOReturn simMappedTransaction(I2CConnection *connection, I2CUserMappedInput *input,
+		I2CUserMappedOutput *output, int write)
+{
+	I2CUserMappedInput	kernelInput;
+	I2CUserMappedOutput	kernelOutput;
+	IOReturn			status;
+
+	if (connection == NULL || input == NULL || output == NULL)
+		return kIOReturnBadArgument;
+
+	simCallIn(&kernelInput, input, sizeof(kernelInput));
+
+	if (kernelInput.count > kI2CUCSharedBufSize ||
+			kernelInput.offset > kI2CUCSharedBufSize - kernelInput.count)
+		status = kIOReturnBadArgument;
+	else if (write)
+		status = simWriteRegisters(kernelInput.busNo, kernelInput.addr, kernelInput.key,
+				kernelInput.subAddr, connection->shared + kernelInput.offset,
+				kernelInput.count, kI2CUCSharedBufSize);
+	else
+		status = simReadRegisters(kernelInput.busNo, kernelInput.addr, kernelInput.key,
+				kernelInput.subAddr, connection->shared + kernelInput.offset,
+				kernelInput.count, kI2CUCSharedBufSize);
+	kernelOutput.realCount = (status == kIOReturnSuccess) ? kernelInput.count : 0;
+
+	simCallOut(output, &kernelOutput, sizeof(kernelOutput));
+	return status;
+}
+
+static IOReturn simMappedRead(I2CConnection *connection, I2CUserMappedInput *input,
+		I2CUserMappedOutput *output)
+{
+	return simMappedTransaction(connection, input, output, 0);
+}
+
+static IOReturn simMappedWrite(I2CConnection *connection, I2CUserMappedInput *input,
+		I2CUserMappedOutput *output)
+{
+	return simMappedTransaction(connection, input, output, 1);
+}
+
+void simGetBusCounters(SimBusCounters *counters)
+{
+	*counters = gSimCounters;
+}
+
+void simResetBusCounters(void)
+{
+	memset(&gSimCounters, 0, sizeof(gSimCounters));
+}
+
+const FreezerBackend gSimBackend = {
+	"sim",
+	simPollSensors,
+	simFindADT746x,
+	simRegistryChanged,
+	simRegistryEpoch,
+	simOpen,
+	simClose,
+	simLock,
+	simUnlock,
+	simRead,
+	simWrite,
+	simMap,
+	simMappedRead,
+	simMappedWrite,
+	NULL		// nothing is kept open between connections
+};
+
+const FreezerBackend *defaultBackend(void)
+{
+#ifdef __APPLE__
+	return &gIOKitBackend;
+#else
+	return &gSimBackend;
+#endif
+}
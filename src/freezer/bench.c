@@ -0,0 +1,4971 @@
+/*
+ * bench.c
+ *
+ * Benchmarks run against the simulated ADT7467, see bench.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include "async.h"
+#include "buslock.h"
+#include "bench.h"
+#include "discovery.h"
+#include "events.h"
+#include "functable.h"
+#include "history.h"
+#include "pfindex.h"
+#include "pfprogram.h"
+#include "pmonring.h"
+#include "published.h"
+#include "shadow.h"
+#include "snapshot.h"
+
+static double benchNow(void) {
+    struct timeval          tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static void benchReport(const char *name, int iterations, double elapsed) {
+    SimBusCounters          counters;
+
+    simGetBusCounters(&counters);
+    printf("%24s %8.1f %8.1f %8.1f %10.2f\n", name,
+           (double)(counters.reads + counters.writes) / iterations,
+           (double)counters.locks / iterations,
+           (double)counters.bytesRead / iterations,
+           elapsed / iterations);
+}
+
+static void benchHeader(void) {
+    printf("%24s %8s %8s %8s %10s\n", "refresh", "xfers", "locks", "bytes", "us");
+}
+
+/*
+ * One refresh the way IOI2CADT746x used to do it: every getter reads the
+ * extended register and its value registers one byte at a time.
+ */
+static IOReturn refreshPerRegister(I2CConnection *connect, const ADT746xLocation *location) {
+    static const UInt8      tempOrder[3][3] = {
+        { kLocalTemperature, kRemote1Temp, kRemote2Temp },
+        { kRemote1Temp, kLocalTemperature, kRemote2Temp },
+        { kRemote2Temp, kRemote1Temp, kLocalTemperature }
+    };
+    static const UInt8      voltRegs[] = {
+        kConfigReg4, kConfigReg2, kExtendedRes1, k2_5VccpReading, kVccReading
+    };
+    static const UInt8      tachRegs[2][3] = {
+        { kTACH1LowByte, kTACH1HighByte, kFanPulsePerRev },
+        { kTACH2LowByte, kTACH2HighByte, kFanPulsePerRev }
+    };
+    const FreezerBackend    *backend = &gSimBackend;
+    UInt32                  key;
+    UInt8                   byte;
+    IOReturn                status = kIOReturnSuccess;
+    int                     i, j;
+
+    for (i = 0; i < 3 && status == kIOReturnSuccess; i++) {
+        if (kIOReturnSuccess != (status = backend->lock(connect, location->bus, &key)))
+            return status;
+        status = readADT746xRegisters(backend, connect, location, key, kExtendedRes2, &byte, 1);
+        for (j = 0; j < 3 && status == kIOReturnSuccess; j++)
+            status = readADT746xRegisters(backend, connect, location, key, tempOrder[i][j], &byte, 1);
+        backend->unlock(connect, key);
+    }
+
+    if (status != kIOReturnSuccess ||
+            kIOReturnSuccess != (status = backend->lock(connect, location->bus, &key)))
+        return status;
+    for (i = 0; i < (int)sizeof(voltRegs) && status == kIOReturnSuccess; i++)
+        status = readADT746xRegisters(backend, connect, location, key, voltRegs[i], &byte, 1);
+    backend->unlock(connect, key);
+
+    for (i = 0; i < 2 && status == kIOReturnSuccess; i++) {
+        if (kIOReturnSuccess != (status = backend->lock(connect, location->bus, &key)))
+            return status;
+        for (j = 0; j < 3 && status == kIOReturnSuccess; j++)
+            status = readADT746xRegisters(backend, connect, location, key, tachRegs[i][j], &byte, 1);
+        backend->unlock(connect, key);
+    }
+
+    return status;
+}
+
+static IOReturn refreshSnapshot(I2CConnection *connect, const ADT746xLocation *location) {
+    const FreezerBackend    *backend = &gSimBackend;
+    ADT746xRawSnapshot      raw;
+    ADT746xSnapshot         snapshot;
+    UInt32                  key;
+    IOReturn                status;
+
+    if (kIOReturnSuccess != (status = backend->lock(connect, location->bus, &key)))
+        return status;
+    status = readADT746xRawSnapshot(backend, connect, location, key, &raw);
+    backend->unlock(connect, key);
+
+    if (status == kIOReturnSuccess)
+        decodeADT746xSnapshot(&raw, kDeviceIDADT7467, k2_5VAttenuationMask, &snapshot);
+    return status;
+}
+
+int benchSnapshot(int iterations) {
+    const FreezerBackend    *backend = &gSimBackend;
+    ADT746xLocation         location;
+    I2CConnection           *connect;
+    IOReturn                status = kIOReturnSuccess;
+    double                  start;
+    int                     i;
+
+    if (iterations <= 0 || 1 != backend->findADT746x(&location, 1))
+        return -1;
+
+    if (kIOReturnSuccess != backend->open(&location, &connect))
+        return -1;
+
+    printf("Full sensor refresh, %d iterations against the simulated ADT7467:\n", iterations);
+    benchHeader();
+
+    simResetBusCounters();
+    start = benchNow();
+    for (i = 0; i < iterations && status == kIOReturnSuccess; i++)
+        status = refreshPerRegister(connect, &location);
+    benchReport("per-register", iterations, benchNow() - start);
+
+    simResetBusCounters();
+    start = benchNow();
+    for (i = 0; i < iterations && status == kIOReturnSuccess; i++)
+        status = refreshSnapshot(connect, &location);
+    benchReport("snapshot", iterations, benchNow() - start);
+
+    backend->close(connect);
+
+    if (status != kIOReturnSuccess) {
+        fprintf(stderr, "benchSnapshot failed 0x%08x\n", status);
+        return -1;
+    }
+    return 0;
+}
+
+static void discoveryHeader(void) {
+    printf("%24s %8s %8s %8s %8s %10s\n", "discovery", "polls", "walks", "file", "memory", "us");
+}
+
+static void discoveryReport(const char *name, int polls, double elapsed) {
+    DiscoveryStats          stats;
+
+    getDiscoveryStats(&stats);
+    printf("%24s %8d %8u %8u %8u %10.2f\n", name, polls,
+           (unsigned)stats.walks, (unsigned)stats.fileLoads,
+           (unsigned)stats.memoryHits, elapsed / polls);
+}
+
+static int pollDiscovery(const char *path, int polls, int forget) {
+    ADT746xLocation         locations[kMaxADT746xChips];
+    int                     i;
+
+    for (i = 0; i < polls; i++) {
+        if (forget)
+            forgetDiscoveryCache();
+        if (1 != findADT746xCached(&gSimBackend, path, locations, kMaxADT746xChips))
+            return -1;
+    }
+    return 0;
+}
+
+int benchDiscovery(int iterations) {
+    ADT746xLocation         locations[kMaxADT746xChips];
+    DiscoveryStats          stats;
+    char                    path[64];
+    double                  start;
+    int                     i, warmWalks, status = 0;
+
+    if (iterations <= 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "/tmp/freezer-bench.%d.topology", (int)getpid());
+    invalidateDiscoveryCache(path);
+
+    printf("ADT746x discovery, %d polls against the simulated registry:\n", iterations);
+    discoveryHeader();
+
+    resetDiscoveryStats();
+    start = benchNow();
+    for (i = 0; i < iterations && status == 0; i++)
+        if (1 != gSimBackend.findADT746x(locations, kMaxADT746xChips))
+            status = -1;
+    // uncached lookups, every one of them walks
+    getDiscoveryStats(&stats);
+    printf("%24s %8d %8d %8u %8u %10.2f\n", "uncached", iterations, iterations,
+           (unsigned)stats.fileLoads, (unsigned)stats.memoryHits,
+           (benchNow() - start) / iterations);
+
+    resetDiscoveryStats();
+    start = benchNow();
+    status |= pollDiscovery(path, 1, 0);
+    discoveryReport("cold", 1, benchNow() - start);
+
+    resetDiscoveryStats();
+    start = benchNow();
+    status |= pollDiscovery(path, iterations, 1);
+    discoveryReport("fresh process", iterations, benchNow() - start);
+
+    resetDiscoveryStats();
+    start = benchNow();
+    status |= pollDiscovery(path, iterations, 0);
+    discoveryReport("warm", iterations, benchNow() - start);
+    getDiscoveryStats(&stats);
+    warmWalks = stats.walks + stats.fileLoads;
+
+    simChangeRegistry();
+    resetDiscoveryStats();
+    start = benchNow();
+    status |= pollDiscovery(path, iterations, 0);
+    discoveryReport("registry changed", iterations, benchNow() - start);
+    getDiscoveryStats(&stats);
+
+    invalidateDiscoveryCache(path);
+
+    if (status != 0 || warmWalks != 0 || stats.walks != 1 || stats.invalidations != 1) {
+        fprintf(stderr, "benchDiscovery failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+#define kDecodeColumns  8   // temperatures, voltage and four tachs
+
+static int allocColumns(ADT746xColumns *columns, UInt32 samples) {
+    SInt32                  *block;
+    int                     i;
+
+    if (NULL == (block = calloc((size_t)samples * kDecodeColumns, sizeof(SInt32))))
+        return -1;
+
+    columns->localTemp = block;
+    columns->remote1Temp = block + samples;
+    columns->remote2Temp = block + 2 * samples;
+    columns->voltage = block + 3 * samples;
+    for (i = 0; i < 4; i++)
+        columns->fanRPM[i] = (UInt32 *)block + (4 + i) * samples;
+    return 0;
+}
+
+static void fillRawSnapshots(ADT746xRawSnapshot *raw, UInt32 samples) {
+    UInt32                  seed = 0x9e3779b9;
+    UInt8                   *bytes = (UInt8 *)raw;
+    size_t                  i;
+
+    for (i = 0; i < samples * sizeof(*raw); i++) {
+        // xorshift32, every register value including negative temperatures
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        bytes[i] = (UInt8)seed;
+    }
+
+    // stalled and disconnected fans
+    for (i = 0; i < samples; i += 7) {
+        raw[i].sensor[kTACH1LowByte - kSensorBlockStart] = 0;
+        raw[i].sensor[kTACH1HighByte - kSensorBlockStart] = 0;
+    }
+    for (i = 0; i < samples; i += 5) {
+        raw[i].sensor[kTACH2LowByte - kSensorBlockStart] = 0xFF;
+        raw[i].sensor[kTACH2HighByte - kSensorBlockStart] = 0xFF;
+    }
+}
+
+int benchDecode(int samples) {
+    static const UInt8      devices[2] = { kDeviceIDADT7460, kDeviceIDADT7467 };
+    static const UInt8      configs[2] = { 0, k2_5VAttenuationMask };
+    ADT746xRawSnapshot      *raw;
+    ADT746xColumns          reference, batch;
+    double                  start, elapsed;
+    int                     passes, pass, d, c, status = -1;
+
+    if (samples <= 0)
+        return -1;
+
+    memset(&reference, 0, sizeof(reference));
+    memset(&batch, 0, sizeof(batch));
+    raw = malloc((size_t)samples * sizeof(*raw));
+    if (raw == NULL || allocColumns(&reference, samples) || allocColumns(&batch, samples))
+        goto FREE;
+
+    fillRawSnapshots(raw, samples);
+
+    for (d = 0; d < 2; d++) {
+        for (c = 0; c < 2; c++) {
+            decodeADT746xBatchReference(raw, samples, devices[d], configs[c], &reference);
+            decodeADT746xBatch(raw, samples, devices[d], configs[c], &batch);
+            if (memcmp(reference.localTemp, batch.localTemp,
+                       (size_t)samples * kDecodeColumns * sizeof(SInt32))) {
+                fprintf(stderr, "benchDecode: batch differs from reference, device 0x%02x config2 0x%02x\n",
+                        devices[d], configs[c]);
+                goto FREE;
+            }
+        }
+    }
+
+    // enough passes for roughly 16M samples per method
+    passes = (16 << 20) / samples;
+    if (passes < 1)
+        passes = 1;
+
+    printf("Batch decode of %d raw snapshots, %d passes, %s:\n", samples, passes,
+           decodeADT746xBatchMethod());
+    printf("%24s %14s %10s\n", "decode", "samples/sec", "ns");
+
+    start = benchNow();
+    for (pass = 0; pass < passes; pass++)
+        decodeADT746xBatchReference(raw, samples, kDeviceIDADT7467, k2_5VAttenuationMask, &reference);
+    elapsed = benchNow() - start;
+    printf("%24s %14.0f %10.2f\n", "per snapshot",
+           (double)samples * passes / (elapsed / 1e6), elapsed * 1e3 / ((double)samples * passes));
+
+    start = benchNow();
+    for (pass = 0; pass < passes; pass++)
+        decodeADT746xBatch(raw, samples, kDeviceIDADT7467, k2_5VAttenuationMask, &batch);
+    elapsed = benchNow() - start;
+    printf("%24s %14.0f %10.2f\n", "batch",
+           (double)samples * passes / (elapsed / 1e6), elapsed * 1e3 / ((double)samples * passes));
+
+    status = 0;
+
+FREE:
+    free(raw);
+    free(reference.localTemp);
+    free(batch.localTemp);
+    return status;
+}
+
+#define kEventBenchPollMs       1000    // fixed period poll, the --i2c default
+#define kEventBenchHeartbeatMs  5000    // status poll of the event runs
+
+/*
+ * Load in permille at a given virtual time: idle, or idle with a five
+ * minute burst every twenty minutes.
+ */
+static int benchLoad(int bursty, UInt64 ms) {
+    UInt64                  t = (ms / 1000) % 1200;
+
+    if (!bursty || t < 900)
+        return 100;
+    if (t < 1020)
+        return 100 + (int)((t - 900) * 900 / 120);     // two minute ramp up
+    if (t < 1080)
+        return 1000;
+    return 1000 - (int)((t - 1080) * 900 / 120);       // and down
+}
+
+/*
+ * One monitoring run over seconds of virtual time, a wakeup every
+ * intervalMs. remote1 gets the last reported remote 1 temperature for
+ * every second, so runs can be compared against the polled one. A
+ * refreshMs of 0 polls the full sample instead of the event monitor.
+ */
+static IOReturn runMonitor(I2CConnection *connect, const ADT746xLocation *location,
+                           int bursty, int seconds, int intervalMs, UInt32 refreshMs,
+                           SInt32 *remote1, UInt32 *samples, SimBusCounters *counters) {
+    const FreezerBackend    *backend = &gSimBackend;
+    ADT746xEventMonitor     monitor;
+    ADT746xSnapshot         snapshot;
+    UInt8                   duty[kPWMDutyCount];
+    UInt32                  key;
+    UInt64                  ms;
+    SInt32                  last = 0;
+    IOReturn                status = kIOReturnSuccess;
+    int                     second, sampled = 1;
+
+    *samples = 0;
+    simSetClock(1000);
+    simSetLoad(benchLoad(bursty, 0));
+    if (refreshMs)
+        status = startADT746xEvents(&monitor, backend, connect, location,
+                                    kIOI2C_CLIENT_KEY_DEFAULT, kDefaultEventWindow, refreshMs);
+    simResetBusCounters();
+
+    for (second = 0; second < seconds && status == kIOReturnSuccess; second++) {
+        ms = (UInt64)second * 1000;
+        simSetClock(1000 + ms);
+        simSetLoad(benchLoad(bursty, ms));
+
+        if ((ms % intervalMs) == 0) {
+            status = backend->lock(connect, location->bus, &key);
+            if (status != kIOReturnSuccess)
+                break;
+
+            if (refreshMs)
+                status = stepADT746xEvents(&monitor, backend, connect, location, key,
+                                           kDeviceIDADT7467, k2_5VAttenuationMask, ms,
+                                           &snapshot, duty, &sampled);
+            else
+                status = readADT746xSample(backend, connect, location, key,
+                                           kDeviceIDADT7467, k2_5VAttenuationMask,
+                                           &snapshot, duty);
+            backend->unlock(connect, key);
+
+            if (sampled) {
+                last = snapshot.remote1Temp;
+                (*samples)++;
+            }
+        }
+        remote1[second] = last;
+    }
+
+    // restoring the limits is not part of the steady state
+    simGetBusCounters(counters);
+    if (refreshMs && status == kIOReturnSuccess)
+        status = stopADT746xEvents(&monitor, backend, connect, location, kIOI2C_CLIENT_KEY_DEFAULT);
+
+    simSetLoad(-1);
+    simSetClock(0);
+    return status;
+}
+
+static void eventsReport(const char *name, int hours, const SimBusCounters *counters,
+                         UInt32 samples, double lag) {
+    printf("%24s %10.0f %10.0f %10.0f %8.2f\n", name,
+           (double)(counters->reads + counters->writes) / hours,
+           (double)counters->locks / hours,
+           (double)samples / hours, lag);
+}
+
+/*
+ * Largest difference, in degrees C, between what a run reported and
+ * what the fixed period poll saw at the same second.
+ */
+static double maxLag(const SInt32 *reported, const SInt32 *polled, int seconds) {
+    SInt32                  diff, worst = 0;
+    int                     i;
+
+    for (i = 0; i < seconds; i++) {
+        diff = reported[i] - polled[i];
+        if (diff < 0)
+            diff = -diff;
+        if (diff > worst)
+            worst = diff;
+    }
+    return worst / 65536.0;
+}
+
+int benchEvents(int hours) {
+    static const char       *profiles[2] = { "idle", "bursty" };
+    static const struct {
+        const char  *name;
+        int         intervalMs;
+        UInt32      refreshMs;
+    } runs[3] = {
+        { "poll 1 s",               kEventBenchPollMs,      0 },
+        { "events 1 s/60 s",        kEventBenchPollMs,      kDefaultEventRefreshMs },
+        { "events 5 s/60 s",        kEventBenchHeartbeatMs, kDefaultEventRefreshMs },
+    };
+    const FreezerBackend    *backend = &gSimBackend;
+    ADT746xLocation         location;
+    I2CConnection           *connect;
+    SimBusCounters          counters, polled;
+    SInt32                  *baseline = NULL, *reported = NULL;
+    UInt32                  samples;
+    IOReturn                kr = kIOReturnSuccess;
+    double                  lag;
+    char                    name[32];
+    int                     seconds, bursty, r, status = -1;
+
+    if (hours <= 0 || 1 != backend->findADT746x(&location, 1))
+        return -1;
+
+    if (kIOReturnSuccess != backend->open(&location, &connect))
+        return -1;
+
+    seconds = hours * 3600;
+    baseline = malloc((size_t)seconds * sizeof(*baseline));
+    reported = malloc((size_t)seconds * sizeof(*reported));
+    if (baseline == NULL || reported == NULL)
+        goto CLOSE;
+
+    printf("Thermal monitoring, %d simulated hour(s), window %d C:\n", hours, kDefaultEventWindow);
+    printf("%24s %10s %10s %10s %8s\n", "per hour", "xfers", "wakeups", "samples", "lag C");
+
+    for (bursty = 0; bursty < 2; bursty++) {
+        kr = runMonitor(connect, &location, bursty, seconds, runs[0].intervalMs, 0,
+                        baseline, &samples, &polled);
+        if (kr != kIOReturnSuccess)
+            goto CLOSE;
+
+        snprintf(name, sizeof(name), "%s %s", profiles[bursty], runs[0].name);
+        eventsReport(name, hours, &polled, samples, 0);
+
+        for (r = 1; r < 3; r++) {
+            kr = runMonitor(connect, &location, bursty, seconds, runs[r].intervalMs,
+                            runs[r].refreshMs, reported, &samples, &counters);
+            if (kr != kIOReturnSuccess)
+                goto CLOSE;
+
+            lag = maxLag(reported, baseline, seconds);
+            snprintf(name, sizeof(name), "%s %s", profiles[bursty], runs[r].name);
+            eventsReport(name, hours, &counters, samples, lag);
+
+            /*
+             * A channel trips a whole degree past its window, plus the
+             * fraction the last sample had, and is seen at the next
+             * heartbeat; the ramp adds under a degree per 5 s.
+             */
+            if (lag > kDefaultEventWindow + 1 + runs[r].intervalMs / 1000) {
+                fprintf(stderr, "benchEvents: %s lagged %.2f C\n", name, lag);
+                goto CLOSE;
+            }
+        }
+    }
+
+    status = 0;
+
+CLOSE:
+    if (kr != kIOReturnSuccess)
+        fprintf(stderr, "benchEvents failed 0x%08x\n", kr);
+    free(baseline);
+    free(reported);
+    backend->close(connect);
+    return status;
+}
+
+#define kPublishBusDelayUs      200     // per transaction, a 16 byte read at 100 kHz is ~2 ms
+#define kPublishRunMs           300     // per reader count and mode
+#define kPublishSampleMs        10      // sampler period
+#define kPublishStalenessMs     50
+#define kPublishBatch           64      // published reads timed together
+#define kPublishMaxReaders      64      // -n
+#define kLatencyBuckets         160     // quarter octaves from 1 ns
+
+#ifndef MIN
+#define MIN(a, b)               (((a) < (b)) ? (a) : (b))
+#endif
+
+typedef struct {
+    ADT746xLocation         location;
+    I2CConnection           *connect;
+    pthread_mutex_t         busLock;    // the IOI2C bus lock, which blocks
+    ADT746xPublished        published;
+    volatile int            stop;
+} PublishBench;
+
+typedef struct {
+    PublishBench            *bench;
+    int                     usePublished;
+    UInt32                  reads;
+    UInt32                  stale;
+    UInt32                  latency[kLatencyBuckets];  // per timed query or batch
+    double                  worstUs;
+    UInt64                  oldestMs;
+    int                     failed;
+} PublishReader;
+
+static int latencyBucket(double us) {
+    UInt64                  ns = (UInt64)(us * 1000);
+    int                     octave = 0, bucket;
+
+    while ((ns >> octave) > 1)
+        octave++;
+    bucket = 4 * octave + ((octave >= 2) ? (int)((ns >> (octave - 2)) & 3) : 0);
+    return bucket < kLatencyBuckets ? bucket : kLatencyBuckets - 1;
+}
+
+/*
+ * Latency in us below which fraction of the timed queries finished.
+ * Percentiles rather than the mean: with more readers than CPUs, a mean
+ * over wall time mostly measures how the scheduler time slices them.
+ */
+static double latencyPercentile(const UInt32 *latency, double fraction) {
+    UInt64                  total = 0, seen = 0;
+    int                     i;
+
+    for (i = 0; i < kLatencyBuckets; i++)
+        total += latency[i];
+    for (i = 0; i < kLatencyBuckets; i++) {
+        seen += latency[i];
+        if (seen >= total * fraction)     // upper end of the bucket
+            return (double)((UInt64)(4 + (i & 3) + 1) << (i / 4)) / 4 / 1000;
+    }
+    return 0;
+}
+
+static UInt64 benchNowMs(void) {
+    return (UInt64)(benchNow() / 1000);
+}
+
+static IOReturn publishBusRead(PublishBench *bench, ADT746xSnapshot *snapshot, UInt8 *duty) {
+    const FreezerBackend    *backend = &gSimBackend;
+    UInt32                  key;
+    IOReturn                status;
+
+    pthread_mutex_lock(&bench->busLock);
+    status = backend->lock(bench->connect, bench->location.bus, &key);
+    if (status == kIOReturnSuccess) {
+        status = readADT746xSample(backend, bench->connect, &bench->location, key,
+                                   kDeviceIDADT7467, k2_5VAttenuationMask, snapshot, duty);
+        backend->unlock(bench->connect, key);
+    }
+    pthread_mutex_unlock(&bench->busLock);
+    return status;
+}
+
+static void *publishSampler(void *arg) {
+    PublishBench            *bench = arg;
+    ADT746xSnapshot         snapshot;
+    UInt8                   duty[kPWMDutyCount];
+
+    while (!bench->stop) {
+        if (kIOReturnSuccess == publishBusRead(bench, &snapshot, duty))
+            publishADT746xSnapshot(&bench->published, &snapshot, duty, benchNowMs());
+        usleep(kPublishSampleMs * 1000);
+    }
+    return NULL;
+}
+
+static void *publishReader(void *arg) {
+    PublishReader           *reader = arg;
+    PublishBench            *bench = reader->bench;
+    ADT746xSnapshot         snapshot;
+    UInt8                   duty[kPWMDutyCount];
+    UInt64                  sampled, now;
+    double                  start, elapsed;
+    int                     i, n;
+
+    while (!bench->stop) {
+        start = benchNow();
+        if (reader->usePublished) {
+            now = benchNowMs();
+            for (i = 0; i < kPublishBatch; i++) {
+                if (readPublishedADT746x(&bench->published, now, kPublishStalenessMs,
+                                         &snapshot, duty, &sampled)) {
+                    reader->stale++;
+                    continue;
+                }
+                if (now > sampled && now - sampled > reader->oldestMs)
+                    reader->oldestMs = now - sampled;
+            }
+            n = kPublishBatch;
+        } else {
+            if (kIOReturnSuccess != publishBusRead(bench, &snapshot, duty)) {
+                reader->failed = 1;
+                break;
+            }
+            n = 1;
+        }
+        elapsed = benchNow() - start;
+
+        reader->reads += n;
+        reader->latency[latencyBucket(elapsed / n)]++;
+        if (elapsed / n > reader->worstUs)
+            reader->worstUs = elapsed / n;
+    }
+    return NULL;
+}
+
+/*
+ * One run: readers query for kPublishRunMs, either straight off the bus
+ * or from what the sampler publishes.
+ */
+static int publishRun(PublishBench *bench, int readers, int usePublished) {
+    pthread_t               sampler, threads[64];
+    PublishReader           stats[kPublishMaxReaders];
+    UInt32                  reads = 0, stale = 0;
+    UInt32                  latency[kLatencyBuckets];
+    UInt64                  oldest = 0;
+    double                  worst = 0;
+    int                     i, b, started = 0, failed = 0;
+
+    memset(stats, 0, sizeof(stats));
+    memset(latency, 0, sizeof(latency));
+    bench->stop = 0;
+
+    if (usePublished) {
+        // readers start with something to copy
+        ADT746xSnapshot     snapshot;
+        UInt8               duty[kPWMDutyCount];
+
+        if (kIOReturnSuccess != publishBusRead(bench, &snapshot, duty))
+            return -1;
+        publishADT746xSnapshot(&bench->published, &snapshot, duty, benchNowMs());
+        if (pthread_create(&sampler, NULL, publishSampler, bench))
+            return -1;
+    }
+
+    for (i = 0; i < readers; i++) {
+        stats[i].bench = bench;
+        stats[i].usePublished = usePublished;
+        if (pthread_create(&threads[i], NULL, publishReader, &stats[i]))
+            break;
+        started++;
+    }
+
+    usleep(kPublishRunMs * 1000);
+    bench->stop = 1;
+
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        reads += stats[i].reads;
+        stale += stats[i].stale;
+        for (b = 0; b < kLatencyBuckets; b++)
+            latency[b] += stats[i].latency[b];
+        failed |= stats[i].failed;
+        if (stats[i].worstUs > worst)
+            worst = stats[i].worstUs;
+        if (stats[i].oldestMs > oldest)
+            oldest = stats[i].oldestMs;
+    }
+    if (usePublished)
+        pthread_join(sampler, NULL);
+
+    if (failed || started != readers || reads == 0)
+        return -1;
+
+    printf("%8d %10s %12.0f %10.3f %10.3f %10.1f %8lu %8lu\n", readers,
+           usePublished ? "published" : "bus read",
+           reads / (kPublishRunMs / 1000.0),
+           MIN(latencyPercentile(latency, 0.5), worst),
+           MIN(latencyPercentile(latency, 0.99), worst), worst,
+           (unsigned long)oldest, (unsigned long)stale);
+
+    if (oldest > kPublishStalenessMs) {
+        fprintf(stderr, "benchPublish: reader got a %lu ms old snapshot\n", (unsigned long)oldest);
+        return -1;
+    }
+    return 0;
+}
+
+int benchPublish(int maxReaders) {
+    const FreezerBackend    *backend = &gSimBackend;
+    PublishBench            bench;
+    int                     readers, status = 0;
+
+    if (maxReaders <= 0 || maxReaders > kPublishMaxReaders) {
+        fprintf(stderr, "benchPublish: -n is the most readers to run, 1 to %d\n", kPublishMaxReaders);
+        return -1;
+    }
+
+    memset(&bench, 0, sizeof(bench));
+    if (1 != backend->findADT746x(&bench.location, 1))
+        return -1;
+
+    if (kIOReturnSuccess != backend->open(&bench.location, &bench.connect))
+        return -1;
+
+    pthread_mutex_init(&bench.busLock, NULL);
+    simSetBusDelay(kPublishBusDelayUs);
+
+    printf("Concurrent sensor queries, %d us per transaction, sampler every %d ms, %d ms limit:\n",
+           kPublishBusDelayUs, kPublishSampleMs, kPublishStalenessMs);
+    printf("%8s %10s %12s %10s %10s %10s %8s %8s\n",
+           "readers", "query", "reads/s", "p50 us", "p99 us", "worst us", "age ms", "stale");
+
+    for (readers = 1; readers <= maxReaders && status == 0; readers *= 2) {
+        status = publishRun(&bench, readers, 0);
+        if (status == 0)
+            status = publishRun(&bench, readers, 1);
+    }
+
+    simSetBusDelay(0);
+    pthread_mutex_destroy(&bench.busLock);
+    backend->close(bench.connect);
+
+    if (status)
+        fprintf(stderr, "benchPublish failed\n");
+    return status;
+}
+
+#define kCompletionKhz          100
+#define kCompletionBitsPerByte  9       // 8 data bits and the acknowledge
+#define kCompletionSpinStepUs   10
+#define kCompletionMaxSpinUs    2000
+
+enum {
+    kWaitSleepPoll,                     // old waitForCompletion
+    kWaitSpinPoll,                      // waitForCompletion now
+    kWaitBlock,                         // old interrupt driven path
+    kWaitSpinBlock,                     // waitForInterruptCompletion
+    kWaitCount
+};
+
+static const char *gWaitNames[kWaitCount] = {
+    "poll, 1 ms sleep", "poll, spin first", "interrupt, block", "interrupt, spin first"
+};
+
+static const int gHistogramUs[] = { 250, 500, 750, 1000, 1500, 2000, 3000 };
+#define kHistogramSlots         (sizeof(gHistogramUs) / sizeof(gHistogramUs[0]) + 1)
+
+/*
+ * The controller: the interrupt status register shows ISTOP once the last
+ * bit is on the wire. Polled waiters compare against gCellDoneAt, the
+ * interrupt driven ones get SIGALRM from a one shot timer instead, which
+ * preempts a spinning waiter the same way the I2C interrupt would.
+ */
+static double gCellDoneAt;
+static volatile sig_atomic_t gCellInterrupt;
+
+static void cellInterrupt(int sig) {
+    gCellInterrupt = 1;
+}
+
+static int cellDone(int interruptDriven) {
+    return interruptDriven ? gCellInterrupt : benchNow() >= gCellDoneAt;
+}
+
+static void cellStart(UInt32 wireUs, int interruptDriven) {
+    struct itimerval        timer;
+
+    gCellDoneAt = benchNow() + wireUs;
+    gCellInterrupt = 0;
+    if (interruptDriven) {
+        memset(&timer, 0, sizeof(timer));
+        timer.it_value.tv_usec = wireUs;
+        setitimer(ITIMER_REAL, &timer, NULL);
+    }
+}
+
+static void spinDelay(UInt32 us) {
+    double                  until = benchNow() + us;
+
+    while (benchNow() < until)
+        ;
+}
+
+/*
+ * One transfer of wireBytes, waited for like the driver does. Returns
+ * the time from start to the waiter noticing, in microseconds.
+ */
+static double waitTransfer(int waiter, UInt16 wireBytes, UInt32 *nsPerByte) {
+    int                     interruptDriven = (waiter == kWaitBlock || waiter == kWaitSpinBlock);
+    UInt32                  wireUs = wireBytes * kCompletionBitsPerByte * 1000 / kCompletionKhz;
+    UInt32                  budget;
+    sigset_t                block, previous;
+    double                  start, spinEnd, elapsed;
+
+    budget = 2 * *nsPerByte * wireBytes / 1000;
+    if (budget < kCompletionSpinStepUs)
+        budget = kCompletionSpinStepUs;
+    else if (budget > kCompletionMaxSpinUs)
+        budget = kCompletionMaxSpinUs;
+
+    start = benchNow();
+    cellStart(wireUs, interruptDriven);
+    spinEnd = start + budget;
+
+    if (waiter == kWaitSpinPoll || waiter == kWaitSpinBlock)
+        while (!cellDone(interruptDriven) && benchNow() < spinEnd)
+            spinDelay(kCompletionSpinStepUs);
+
+    if (interruptDriven) {
+        // semaphore_timedwait: sleep until the interrupt handler signals
+        sigemptyset(&block);
+        sigaddset(&block, SIGALRM);
+        sigprocmask(SIG_BLOCK, &block, &previous);
+        while (!gCellInterrupt)
+            sigsuspend(&previous);
+        sigprocmask(SIG_SETMASK, &previous, NULL);
+    } else {
+        while (!cellDone(0))
+            usleep(1000);
+    }
+
+    elapsed = benchNow() - start;
+
+    // learnCompletion
+    *nsPerByte += (SInt32)(((SInt64)(elapsed * 1000 / wireBytes) - (SInt64)*nsPerByte) / 4);
+    return elapsed;
+}
+
+int benchCompletion(int transfers) {
+    static const UInt16     lengths[3] = { 1, 2, 16 };
+    struct sigaction        action, previous;
+    UInt32                  histogram[kHistogramSlots];
+    UInt32                  latency[kLatencyBuckets];
+    UInt32                  nsPerByte;
+    double                  elapsed, total, overhead, p50[kWaitCount];
+    int                     waiter, i, slot;
+
+    if (transfers <= 0)
+        return -1;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = cellInterrupt;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGALRM, &action, &previous))
+        return -1;
+
+    printf("I2C transfer completion at %d kHz, %d transfers of 1, 2 and 16 bytes per waiter:\n",
+           kCompletionKhz, transfers);
+    printf("%24s", "latency <= us");
+    for (slot = 0; slot < (int)kHistogramSlots - 1; slot++)
+        printf(" %6d", gHistogramUs[slot]);
+    printf(" %6s %8s %8s %9s\n", "more", "p50 us", "p99 us", "extra us");
+
+    for (waiter = 0; waiter < kWaitCount; waiter++) {
+        memset(histogram, 0, sizeof(histogram));
+        memset(latency, 0, sizeof(latency));
+        nsPerByte = kCompletionBitsPerByte * 1000000 / kCompletionKhz;
+        overhead = 0;
+
+        for (i = 0; i < transfers; i++) {
+            UInt16  wireBytes = lengths[i % 3] + 2;
+
+            elapsed = waitTransfer(waiter, wireBytes, &nsPerByte);
+            overhead += elapsed - wireBytes * kCompletionBitsPerByte * 1000.0 / kCompletionKhz;
+
+            for (slot = 0; slot < (int)kHistogramSlots - 1; slot++)
+                if (elapsed <= gHistogramUs[slot])
+                    break;
+            histogram[slot]++;
+            latency[latencyBucket(elapsed)]++;
+        }
+
+        printf("%24s", gWaitNames[waiter]);
+        for (slot = 0; slot < (int)kHistogramSlots; slot++)
+            printf(" %6lu", (unsigned long)histogram[slot]);
+        p50[waiter] = latencyPercentile(latency, 0.5);
+        total = latencyPercentile(latency, 0.99);
+        printf(" %8.0f %8.0f %9.1f\n", p50[waiter], total, overhead / transfers);
+    }
+
+    sigaction(SIGALRM, &previous, NULL);
+
+    if (p50[kWaitSpinPoll] >= p50[kWaitSleepPoll] || p50[kWaitSpinBlock] > p50[kWaitBlock]) {
+        fprintf(stderr, "benchCompletion: spinning first did not help\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * --bench commandlist
+ */
+
+#define kRefreshRegisters       12
+#define kListBusDelayUs         360     // 1 byte combined read at 100 kHz
+#define kListLockDelayUs        30      // user client round trip
+
+static const UInt8 gRefreshRegs[kRefreshRegisters] = {
+    kExtendedRes1, kExtendedRes2, kLocalTemperature, kRemote1Temp, kRemote2Temp,
+    k2_5VccpReading, kTACH1LowByte, kTACH1HighByte, kTACH2LowByte, kTACH2HighByte,
+    kPWM1DutyCycle, kPWM2DutyCycle
+};
+
+static void setListCommand(IOI2CCommand *cmd, UInt32 command, UInt32 subAddress,
+        UInt8 *data, UInt32 count) {
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->command = command;
+    cmd->mode = (command == kI2CCommand_Read) ? kI2CMode_Combined : kI2CMode_StandardSub;
+    cmd->subAddress = subAddress;
+    cmd->buffer = data;
+    cmd->count = count;
+}
+
+/*
+ * perCommand: a list of one per register, each takes and drops the lock
+ * the way a kIOI2C_CLIENT_KEY_DEFAULT clientReadI2C does.
+ */
+static IOReturn refreshRegisters(I2CConnection *connect, const ADT746xLocation *location,
+        int perCommand, UInt8 *values) {
+    IOI2CCommand            cmds[kRefreshRegisters];
+    IOI2CCommandList        list;
+    IOReturn                status = kIOReturnSuccess;
+    int                     i;
+
+    for (i = 0; i < kRefreshRegisters; i++)
+        setListCommand(&cmds[i], kI2CCommand_Read, gRefreshRegs[i], &values[i], 1);
+
+    memset(&list, 0, sizeof(list));
+    list.options = kI2CListOption_StopOnError;
+
+    if (!perCommand) {
+        list.commands = cmds;
+        list.count = kRefreshRegisters;
+        return executeI2CCommandList(&gSimBackend, connect, location,
+                                     kIOI2C_CLIENT_KEY_DEFAULT, &list);
+    }
+
+    list.count = 1;
+    for (i = 0; i < kRefreshRegisters && status == kIOReturnSuccess; i++) {
+        list.commands = &cmds[i];
+        status = executeI2CCommandList(&gSimBackend, connect, location,
+                                       kIOI2C_CLIENT_KEY_DEFAULT, &list);
+    }
+    return status;
+}
+
+/*
+ * A read, a command the user client would reject, a write and a read:
+ * with kI2CListOption_StopOnError only the first two run.
+ */
+static int checkStopOnError(I2CConnection *connect, const ADT746xLocation *location,
+        UInt32 options) {
+    static const IOReturn   expected[2][4] = {
+        { kIOReturnSuccess, kIOReturnBadArgument, kIOReturnSuccess, kIOReturnSuccess },
+        { kIOReturnSuccess, kIOReturnBadArgument, kIOReturnAborted, kIOReturnAborted }
+    };
+    IOI2CCommand            cmds[4];
+    IOReturn                status[4];
+    IOI2CCommandList        list;
+    UInt8                   data[kI2CUCBufSize + 1];
+    UInt8                   limit;
+    int                     stop = (options & kI2CListOption_StopOnError) != 0;
+    int                     i;
+
+    memset(data, 0, sizeof(data));
+    setListCommand(&cmds[0], kI2CCommand_Read, kDeviceIDReg, &data[0], 1);
+    setListCommand(&cmds[1], kI2CCommand_Read, kSensorBlockStart, data, sizeof(data));
+    setListCommand(&cmds[2], kI2CCommand_Write, kLocalTempHighLimit, &limit, 1);
+    setListCommand(&cmds[3], kI2CCommand_Read, kLocalTempHighLimit, &data[1], 1);
+    limit = 0x55;
+
+    memset(&list, 0, sizeof(list));
+    list.commands = cmds;
+    list.status = status;
+    list.count = 4;
+    list.options = options;
+
+    simResetBusCounters();
+    if (kIOReturnBadArgument != executeI2CCommandList(&gSimBackend, connect, location,
+                                                      kIOI2C_CLIENT_KEY_DEFAULT, &list))
+        return -1;
+
+    for (i = 0; i < 4; i++)
+        if (status[i] != expected[stop][i])
+            return -1;
+
+    if (list.completed != (stop ? 2U : 4U) || (!stop && data[1] != limit))
+        return -1;
+
+    printf("%24s completed %lu of 4, status", stop ? "stop on error" : "run to end",
+           (unsigned long)list.completed);
+    for (i = 0; i < 4; i++)
+        printf(" 0x%08x", status[i]);
+    printf("\n");
+    return 0;
+}
+
+int benchCommandList(int iterations) {
+    const FreezerBackend    *backend = &gSimBackend;
+    ADT746xLocation         location;
+    I2CConnection           *connect;
+    SimBusCounters          counters;
+    UInt8                   values[kRefreshRegisters];
+    IOReturn                status = kIOReturnSuccess;
+    double                  start;
+    int                     delayed, failed = 0, i;
+
+    if (iterations <= 0 || 1 != backend->findADT746x(&location, 1))
+        return -1;
+
+    if (kIOReturnSuccess != backend->open(&location, &connect))
+        return -1;
+
+    for (delayed = 0; delayed < 2 && status == kIOReturnSuccess; delayed++) {
+        simSetBusDelay(delayed ? kListBusDelayUs : 0);
+        simSetLockDelay(delayed ? kListLockDelayUs : 0);
+
+        if (delayed)
+            printf("\n%d register refresh, %d iterations, %d us per transfer, %d us per lock:\n",
+                   kRefreshRegisters, iterations, kListBusDelayUs, kListLockDelayUs);
+        else
+            printf("%d register refresh, %d iterations against the simulated ADT7467:\n",
+                   kRefreshRegisters, iterations);
+        benchHeader();
+
+        simResetBusCounters();
+        start = benchNow();
+        for (i = 0; i < iterations && status == kIOReturnSuccess; i++)
+            status = refreshRegisters(connect, &location, 1, values);
+        benchReport("lock per command", iterations, benchNow() - start);
+
+        simResetBusCounters();
+        start = benchNow();
+        for (i = 0; i < iterations && status == kIOReturnSuccess; i++)
+            status = refreshRegisters(connect, &location, 0, values);
+        benchReport("command list", iterations, benchNow() - start);
+
+        simGetBusCounters(&counters);
+        if (status == kIOReturnSuccess && counters.locks != (UInt32)iterations) {
+            fprintf(stderr, "benchCommandList: command list took %lu locks\n",
+                    (unsigned long)counters.locks);
+            failed = 1;
+        }
+    }
+
+    simSetBusDelay(0);
+    simSetLockDelay(0);
+
+    if (status == kIOReturnSuccess) {
+        printf("\nMixed read/write list with one bad command:\n");
+        if (checkStopOnError(connect, &location, 0) ||
+                checkStopOnError(connect, &location, kI2CListOption_StopOnError)) {
+            fprintf(stderr, "benchCommandList: wrong per command status\n");
+            failed = 1;
+        }
+    }
+
+    backend->close(connect);
+
+    if (status != kIOReturnSuccess) {
+        fprintf(stderr, "benchCommandList failed 0x%08x\n", status);
+        return -1;
+    }
+    return failed ? -1 : 0;
+}
+
+/*
+ * --bench async
+ */
+
+#define kAsyncControllers       3
+#define kAsyncDevices           4       // per controller
+#define kAsyncReadBytes         2
+#define kAsyncNsPerByte         (kCompletionBitsPerByte * 1000000 / kCompletionKhz)
+
+/*
+ * A controller as the platform plugin sees it: setupUs of command overhead
+ * before the bus moves (none for the mac-io cell, a PMU or SMU command
+ * round trip otherwise), then the bytes on the wire. busLock is the
+ * controller's client lock, taken by blocking and queued callers alike.
+ */
+typedef struct {
+    const char              *name;
+    UInt32                  setupUs;
+    pthread_mutex_t         busLock;
+} AsyncController;
+
+typedef struct {
+    pthread_mutex_t         lock;
+    pthread_cond_t          done;
+    int                     pending;
+    int                     failed;
+    int                     aborted;
+} AsyncRound;
+
+static AsyncController gAsyncControllers[kAsyncControllers] = {
+    { "PPC", 0, PTHREAD_MUTEX_INITIALIZER },
+    { "PMU", 1500, PTHREAD_MUTEX_INITIALIZER },
+    { "SMU", 400, PTHREAD_MUTEX_INITIALIZER }
+};
+
+static UInt8 asyncPattern(const IOI2CCommand *cmd, UInt32 i) {
+    return (UInt8)(cmd->bus * 16 + cmd->address + cmd->subAddress + i);
+}
+
+static IOReturn asyncExecute(void *refCon, IOI2CCommand *cmd) {
+    AsyncController         *controller = refCon;
+    UInt32                  i;
+
+    pthread_mutex_lock(&controller->busLock);
+    // address, sub-address, repeated start and address, then the data
+    usleep(controller->setupUs + (cmd->count + 3) * kAsyncNsPerByte / 1000);
+    for (i = 0; i < cmd->count; i++)
+        cmd->buffer[i] = asyncPattern(cmd, i);
+    cmd->bytesTransfered = cmd->count;
+    pthread_mutex_unlock(&controller->busLock);
+
+    return kIOReturnSuccess;
+}
+
+static int asyncCheck(const IOI2CCommand *cmd, IOReturn status) {
+    UInt32                  i;
+
+    if (status != kIOReturnSuccess || cmd->bytesTransfered != cmd->count)
+        return -1;
+    for (i = 0; i < cmd->count; i++)
+        if (cmd->buffer[i] != asyncPattern(cmd, i))
+            return -1;
+    return 0;
+}
+
+static void asyncComplete(void *target, void *parameter, IOI2CCommand *cmd, IOReturn status) {
+    AsyncRound              *round = target;
+
+    pthread_mutex_lock(&round->lock);
+    if (status == kIOReturnAborted)
+        round->aborted++;
+    else if (asyncCheck(cmd, status))
+        round->failed = 1;
+    if (--round->pending == 0)
+        pthread_cond_signal(&round->done);
+    pthread_mutex_unlock(&round->lock);
+}
+
+static void asyncInitCommands(IOI2CCommand cmds[kAsyncControllers][kAsyncDevices],
+        UInt8 data[kAsyncControllers][kAsyncDevices][kAsyncReadBytes]) {
+    int                     c, d;
+
+    memset(cmds, 0, sizeof(IOI2CCommand) * kAsyncControllers * kAsyncDevices);
+    for (c = 0; c < kAsyncControllers; c++) {
+        for (d = 0; d < kAsyncDevices; d++) {
+            cmds[c][d].command = kI2CCommand_Read;
+            cmds[c][d].mode = kI2CMode_Combined;
+            cmds[c][d].bus = c;
+            cmds[c][d].address = 0x90 + 2 * d;
+            cmds[c][d].subAddress = d;
+            cmds[c][d].buffer = data[c][d];
+            cmds[c][d].count = kAsyncReadBytes;
+        }
+    }
+}
+
+/*
+ * Stop a queue with commands still waiting behind a slow one: every
+ * command has to complete, either executed or aborted.
+ */
+static int asyncCheckStop(void) {
+    IOI2CCommand            cmds[kAsyncControllers][kAsyncDevices];
+    UInt8                   data[kAsyncControllers][kAsyncDevices][kAsyncReadBytes];
+    I2CAsyncQueue           queue;
+    IOI2CCompletion         completion;
+    AsyncRound              round;
+    int                     d;
+
+    memset(&round, 0, sizeof(round));
+    pthread_mutex_init(&round.lock, NULL);
+    pthread_cond_init(&round.done, NULL);
+    completion.target = &round;
+    completion.action = asyncComplete;
+    completion.parameter = NULL;
+
+    asyncInitCommands(cmds, data);
+    if (kIOReturnSuccess != startI2CAsyncQueue(&queue, asyncExecute, &gAsyncControllers[1]))
+        return -1;
+
+    round.pending = kAsyncDevices;
+    for (d = 0; d < kAsyncDevices; d++)
+        if (kIOReturnSuccess != submitI2CAsync(&queue, &cmds[1][d], &completion))
+            round.failed = 1;
+
+    usleep(gAsyncControllers[1].setupUs / 2);
+    stopI2CAsyncQueue(&queue);
+
+    printf("%24s %d of %d executed, %d aborted\n", "stop while busy",
+           kAsyncDevices - round.aborted - round.pending, kAsyncDevices, round.aborted);
+
+    pthread_cond_destroy(&round.done);
+    pthread_mutex_destroy(&round.lock);
+    return (round.failed || round.pending || round.aborted == 0) ? -1 : 0;
+}
+
+int benchAsync(int rounds) {
+    static const char       *names[2] = { "blocking", "submitI2CAsync" };
+    IOI2CCommand            cmds[kAsyncControllers][kAsyncDevices];
+    UInt8                   data[kAsyncControllers][kAsyncDevices][kAsyncReadBytes];
+    I2CAsyncQueue           queues[kAsyncControllers];
+    IOI2CCompletion         completion;
+    AsyncRound              round;
+    UInt32                  latency[kLatencyBuckets];
+    double                  start, submitted, elapsed, p50[2], submitUs;
+    int                     async, started = 0, failed = 0, i, c, d;
+
+    if (rounds <= 0)
+        return -1;
+
+    memset(&round, 0, sizeof(round));
+    pthread_mutex_init(&round.lock, NULL);
+    pthread_cond_init(&round.done, NULL);
+    completion.target = &round;
+    completion.action = asyncComplete;
+    completion.parameter = NULL;
+
+    for (c = 0; c < kAsyncControllers; c++, started++)
+        if (kIOReturnSuccess != startI2CAsyncQueue(&queues[c], asyncExecute, &gAsyncControllers[c]))
+            break;
+    if (started < kAsyncControllers) {
+        failed = 1;
+        rounds = 0;
+    }
+
+    printf("%d rounds of %d byte reads from %d devices each behind", rounds, kAsyncReadBytes, kAsyncDevices);
+    for (c = 0; c < kAsyncControllers; c++)
+        printf(" %s (%lu us setup)", gAsyncControllers[c].name, (unsigned long)gAsyncControllers[c].setupUs);
+    printf(":\n%24s %10s %10s %12s\n", "poll", "p50 ms", "p99 ms", "submit us");
+
+    for (async = 0; async < 2 && !failed; async++) {
+        memset(latency, 0, sizeof(latency));
+        submitUs = 0;
+
+        for (i = 0; i < rounds && !failed; i++) {
+            asyncInitCommands(cmds, data);
+            start = benchNow();
+
+            if (!async) {
+                for (c = 0; c < kAsyncControllers; c++)
+                    for (d = 0; d < kAsyncDevices; d++)
+                        if (asyncCheck(&cmds[c][d], asyncExecute(&gAsyncControllers[c], &cmds[c][d])))
+                            failed = 1;
+                submitted = benchNow();
+            } else {
+                pthread_mutex_lock(&round.lock);
+                round.pending = kAsyncControllers * kAsyncDevices;
+                pthread_mutex_unlock(&round.lock);
+
+                // device by device, the way a plugin walks its sensor list
+                for (d = 0; d < kAsyncDevices; d++) {
+                    for (c = 0; c < kAsyncControllers; c++) {
+                        if (kIOReturnSuccess != submitI2CAsync(&queues[c], &cmds[c][d], &completion)) {
+                            pthread_mutex_lock(&round.lock);
+                            round.pending--;
+                            round.failed = 1;
+                            pthread_mutex_unlock(&round.lock);
+                        }
+                    }
+                }
+                submitted = benchNow();
+
+                pthread_mutex_lock(&round.lock);
+                while (round.pending)
+                    pthread_cond_wait(&round.done, &round.lock);
+                failed |= round.failed;
+                pthread_mutex_unlock(&round.lock);
+            }
+
+            elapsed = benchNow() - start;
+            submitUs += submitted - start;
+            latency[latencyBucket(elapsed)]++;
+        }
+
+        p50[async] = latencyPercentile(latency, 0.5);
+        printf("%24s %10.2f %10.2f %12.1f\n", names[async], p50[async] / 1000,
+               latencyPercentile(latency, 0.99) / 1000, submitUs / rounds);
+    }
+
+    for (c = 0; c < started; c++)
+        stopI2CAsyncQueue(&queues[c]);
+
+    if (!failed && asyncCheckStop())
+        failed = 1;
+
+    pthread_cond_destroy(&round.done);
+    pthread_mutex_destroy(&round.lock);
+
+    if (failed) {
+        fprintf(stderr, "benchAsync: a read or completion went wrong\n");
+        return -1;
+    }
+    if (p50[1] >= p50[0] * 0.8) {
+        fprintf(stderr, "benchAsync: submitting did not overlap the controllers\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * --bench deadline
+ */
+
+#define kDeadlineHealthy        4       // sensors read every kDeadlinePeriodUs
+#define kDeadlineSources        (kDeadlineHealthy + 1)
+#define kDeadlinePeriodUs       100000
+#define kDeadlineBudgetUs       20000   // timeout the thermal loop gives a sensor read
+#define kDeadlineFaultPeriodUs  250000  // the misbehaving device, no timeout of its own
+#define kDeadlineHangPercent    5
+#define kDeadlineHealthyUs      10000000    // before the device starts hanging
+#define kDeadlineServiceUs      450     // two byte combined read at 100 kHz
+#define kDeadlineJitterUs       200
+#define kDeadlineWanderUs       20000   // how far a poller's wakeups wander
+#define kDeadlineStopUs         100     // stop condition after a transfer is cut short
+#define kDeadlineFloorUs        5000000 // what i2cTransaction used to force
+
+/*
+ * honorTimeouts: the controller cuts a transfer short at its deadline and
+ * drops commands that expired while queued, and the device, whose driver
+ * asks for kI2COption_LearnedTimeout, learns a timeout that widens each
+ * time it expires. Otherwise every transfer gets at least kDeadlineFloorUs. edf: the queue is earliest deadline first.
+ */
+typedef struct {
+    const char              *name;
+    int                     fault;
+    int                     honorTimeouts;
+    int                     edf;
+} DeadlinePolicy;
+
+typedef struct {
+    I2CAsyncRequest         request;    // first, the queue links these
+    IOI2CCommand            cmd;
+    int                     source;
+    UInt64                  issuedUs;
+    UInt32                  serviceUs;
+    int                     hang;
+} DeadlineCommand;
+
+typedef struct {
+    UInt32                  latency[kLatencyBuckets];  // healthy sensors, issue to completion
+    UInt32                  reads;
+    UInt32                  missed;     // healthy reads later than their budget
+    UInt64                  worstUs;    // slowest healthy read
+    UInt32                  hangs;
+    UInt32                  hungUs;     // bus time the hangs cost, worst one
+    UInt32                  learnedUs;  // the misbehaving device's learned timeout at the end
+} DeadlineResult;
+
+static UInt32 deadlineRandom(UInt32 *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+static void deadlineComplete(DeadlineResult *result, DeadlineCommand *command, IOReturn status,
+        UInt64 now) {
+    UInt64                  elapsed = now - command->issuedUs;
+
+    if (command->source < kDeadlineHealthy) {
+        result->reads++;
+        result->latency[latencyBucket((double)elapsed)]++;
+        if (elapsed > result->worstUs)
+            result->worstUs = elapsed;
+        if (status != kIOReturnSuccess || elapsed > kDeadlineBudgetUs)
+            result->missed++;
+    }
+    free(command);
+}
+
+/*
+ * One bus in virtual time: sensors issue on their own period whether or
+ * not their last read is back, so a stalled bus shows up as latency
+ * instead of as fewer samples. The same seed gives every policy the same
+ * arrivals, service times and hangs.
+ */
+static void deadlineRun(const DeadlinePolicy *policy, UInt64 runUs, DeadlineResult *result) {
+    I2CAsyncQueue           queue;
+    I2CLatencyEstimate      estimate[kDeadlineSources];
+    UInt64                  nextIssueUs[kDeadlineSources];
+    UInt64                  now, busyUntil = 0, limitUs;
+    DeadlineCommand         *active = NULL, *command;
+    IOReturn                activeStatus = kIOReturnSuccess;
+    UInt32                  seed = 0x2545f491;
+    int                     source, next;
+
+    memset(result, 0, sizeof(*result));
+    memset(estimate, 0, sizeof(estimate));
+    queue.head = queue.tail = NULL;
+    for (source = 0; source < kDeadlineSources; source++)
+        nextIssueUs[source] = source * 7919;    // out of phase
+
+    for (;;) {
+        next = 0;
+        for (source = 1; source < kDeadlineSources; source++)
+            if (nextIssueUs[source] < nextIssueUs[next])
+                next = source;
+
+        if (active && (busyUntil <= nextIssueUs[next] || nextIssueUs[next] >= runUs)) {
+            // the transfer on the bus finishes first
+            now = busyUntil;
+            deadlineComplete(result, active, activeStatus, now);
+            active = NULL;
+        } else if (nextIssueUs[next] < runUs) {
+            now = nextIssueUs[next];
+            nextIssueUs[next] += ((next < kDeadlineHealthy) ? kDeadlinePeriodUs : kDeadlineFaultPeriodUs) -
+                                 kDeadlineWanderUs / 2 + deadlineRandom(&seed) % kDeadlineWanderUs;
+
+            command = calloc(1, sizeof(*command));
+            command->source = next;
+            command->issuedUs = now;
+            command->serviceUs = kDeadlineServiceUs + deadlineRandom(&seed) % kDeadlineJitterUs;
+            command->hang = deadlineRandom(&seed) % 100 < kDeadlineHangPercent &&
+                            next == kDeadlineHealthy && policy->fault && now >= kDeadlineHealthyUs;
+            command->cmd.command = kI2CCommand_Read;
+            command->cmd.timeout_uS = (next < kDeadlineHealthy) ? kDeadlineBudgetUs :
+                    (policy->honorTimeouts ? learnedI2CTimeout(&estimate[next]) : 0);
+            command->request.cmd = &command->cmd;
+            command->request.timeout_uS = policy->edf ? command->cmd.timeout_uS : 0;
+            command->request.deadlineUs = now + command->cmd.timeout_uS;
+            insertI2CAsyncRequest(&queue, &command->request);
+        } else
+            break;
+
+        // the bus is free: start the next command that has not expired
+        while (!active && queue.head) {
+            command = (DeadlineCommand *)queue.head;
+            if (NULL == (queue.head = command->request.next))
+                queue.tail = NULL;
+
+            if (policy->honorTimeouts && command->cmd.timeout_uS &&
+                    now >= command->issuedUs + command->cmd.timeout_uS) {
+                deadlineComplete(result, command, kIOReturnTimeout, now);
+                continue;
+            }
+
+            if (!policy->honorTimeouts)
+                limitUs = (command->cmd.timeout_uS < kDeadlineFloorUs) ? kDeadlineFloorUs : command->cmd.timeout_uS;
+            else if (command->cmd.timeout_uS)
+                limitUs = command->issuedUs + command->cmd.timeout_uS - now;
+            else
+                limitUs = kDeadlineFloorUs;
+
+            if (command->hang || command->serviceUs > limitUs) {
+                busyUntil = now + limitUs + kDeadlineStopUs;
+                activeStatus = kIOReturnTimeout;
+                if (policy->honorTimeouts && command->source >= kDeadlineHealthy && command->cmd.timeout_uS)
+                    learnI2CLatency(&estimate[command->source], command->cmd.timeout_uS);
+                if (command->hang) {
+                    result->hangs++;
+                    if (limitUs + kDeadlineStopUs > result->hungUs)
+                        result->hungUs = (UInt32)(limitUs + kDeadlineStopUs);
+                }
+            } else {
+                busyUntil = now + command->serviceUs;
+                activeStatus = kIOReturnSuccess;
+                learnI2CLatency(&estimate[command->source], command->serviceUs);
+            }
+            active = command;
+        }
+    }
+
+    result->learnedUs = learnedI2CTimeout(&estimate[kDeadlineHealthy]);
+}
+
+int benchDeadline(int seconds) {
+    static const DeadlinePolicy policies[] = {
+        { "no fault",               0, 1, 1 },
+        { "5 s floor, FIFO",        1, 0, 0 },
+        { "learned, FIFO",          1, 1, 0 },
+        { "learned, EDF",           1, 1, 1 }
+    };
+    DeadlineResult          result;
+    double                  p99, baseline = 0;
+    int                     i, failed = 0;
+
+    if (seconds <= 0)
+        return -1;
+
+    printf("%d s of virtual time, %d sensors every %d ms with a %d ms budget, one device every %d ms "
+           "hanging %d%% of the time after %d s:\n", seconds, kDeadlineHealthy, kDeadlinePeriodUs / 1000,
+           kDeadlineBudgetUs / 1000, kDeadlineFaultPeriodUs / 1000, kDeadlineHangPercent,
+           kDeadlineHealthyUs / 1000000);
+    printf("%24s %10s %10s %10s %8s %8s %10s %10s\n", "policy", "p50 ms", "p99 ms", "worst ms",
+           "missed", "hangs", "hang ms", "learned ms");
+
+    for (i = 0; i < (int)(sizeof(policies) / sizeof(policies[0])); i++) {
+        deadlineRun(&policies[i], (UInt64)seconds * 1000000, &result);
+        p99 = latencyPercentile(result.latency, 0.99);
+        printf("%24s %10.2f %10.2f %10.2f %8lu %8lu %10.1f %10.1f\n", policies[i].name,
+               latencyPercentile(result.latency, 0.5) / 1000, p99 / 1000, result.worstUs / 1000.0,
+               (unsigned long)result.missed, (unsigned long)result.hangs,
+               result.hungUs / 1000.0, result.learnedUs / 1000.0);
+
+        if (i == 0)
+            baseline = p99;
+        else if (policies[i].honorTimeouts && policies[i].edf && p99 > baseline * 1.5)
+            failed = 1;
+    }
+
+    if (failed) {
+        fprintf(stderr, "benchDeadline: healthy p99 moved with one device hanging\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * --bench buslock
+ */
+
+#define kBusLockControlLoops    2       // threads, each reading its sensors every kBusLockControlUs
+#define kBusLockControlUs       25000
+#define kBusLockControlHoldUs   700     // sensor read and fan duty write
+#define kBusLockEmergencyUs     200000
+#define kBusLockEmergencyHoldUs 500
+#define kBusLockDumpers         3       // diagnostics threads, each dumping registers back to back
+#define kBusLockDumpRegisters   128
+#define kBusLockDumpHoldUs      400     // one register, one transaction
+#define kBusLockThreads         (1 + kBusLockControlLoops + kBusLockDumpers)
+
+typedef struct {
+    I2CBusLock              bus;        // its waiter list only, nobody blocks on it
+    IOI2CLockStats          stats;
+    UInt32                  latency[kI2CPriorityClasses][kLatencyBuckets];     // lock wait
+    UInt32                  dumps;
+} BusLockBench;
+
+typedef struct {
+    I2CBusWaiter            waiter;
+    UInt32                  priority;
+    UInt32                  periodUs;   // 0 for back to back
+    UInt32                  holdUs;
+    UInt32                  seed;
+    UInt32                  registers;  // dumped so far
+    UInt64                  nextUs;     // next lock, periodic clients
+    int                     waiting;
+} BusLockClient;
+
+static void busLockGrant(BusLockBench *bench, BusLockClient *client, UInt64 now) {
+    UInt64                  waitUs = now - client->waiter.sinceUs;
+    UInt32                  rank = client->waiter.rank;
+
+    client->waiting = 0;
+    bench->stats.acquired[rank]++;
+    bench->stats.waitTotal_uS[rank] += waitUs;
+    if (waitUs > bench->stats.waitMax_uS[rank])
+        bench->stats.waitMax_uS[rank] = (UInt32)waitUs;
+    bench->latency[rank][latencyBucket((double)waitUs)]++;
+}
+
+static void busLockWait(BusLockBench *bench, BusLockClient *client, UInt64 now) {
+    client->waiter.next = NULL;
+    client->waiter.sinceUs = now;
+    client->waiting = 1;
+    *bench->bus.tail = &client->waiter;
+    bench->bus.tail = &client->waiter.next;
+}
+
+/*
+ * The bus in simulated time: every lock is held for exactly its hold time
+ * and nextI2CBusWaiter picks who gets it next, so the same seconds always
+ * give the same waits, however many CPUs run the bench.
+ */
+static void busLockRun(BusLockBench *bench, int fifo, int seconds) {
+    BusLockClient           clients[kBusLockThreads];
+    BusLockClient           *holder = NULL, *client;
+    I2CBusWaiter            **link;
+    UInt64                  now, runUs = (UInt64)seconds * 1000000, busyUntil = 0, issueUs;
+    int                     i, next;
+
+    memset(bench, 0, sizeof(*bench));
+    memset(clients, 0, sizeof(clients));
+    bench->bus.fifo = fifo;
+    bench->bus.tail = &bench->bus.head;
+
+    for (i = 0; i < kBusLockThreads; i++) {
+        client = &clients[i];
+        client->seed = i + 1;
+        if (i == 0) {
+            client->priority = kI2CPriority_Emergency;
+            client->periodUs = kBusLockEmergencyUs;
+            client->holdUs = kBusLockEmergencyHoldUs;
+        } else if (i <= kBusLockControlLoops) {
+            client->priority = kI2CPriority_ControlLoop;
+            client->periodUs = kBusLockControlUs;
+            client->holdUs = kBusLockControlHoldUs;
+        } else {
+            client->priority = kI2CPriority_Diagnostics;
+            client->holdUs = kBusLockDumpHoldUs;
+        }
+        client->waiter.rank = client->priority - 1;
+        client->nextUs = i * 997;       // out of phase
+
+        // the dumpers are at it from the start
+        if (client->periodUs == 0)
+            busLockWait(bench, client, 0);
+    }
+
+    for (;;) {
+        // the next periodic client to ask for the bus
+        next = -1;
+        for (i = 0; i < kBusLockThreads; i++)
+            if (!clients[i].waiting && &clients[i] != holder && clients[i].periodUs &&
+                    (next < 0 || clients[i].nextUs < clients[next].nextUs))
+                next = i;
+        issueUs = (next < 0) ? runUs : clients[next].nextUs;
+
+        if (holder && busyUntil <= issueUs) {
+            // the holder lets go first and hands the bus over
+            now = busyUntil;
+            client = holder;
+            holder = NULL;
+            if (NULL != (link = nextI2CBusWaiter(&bench->bus, now))) {
+                holder = (BusLockClient *)*link;
+                if (NULL == (*link = holder->waiter.next))
+                    bench->bus.tail = link;
+                busLockGrant(bench, holder, now);
+                busyUntil = now + holder->holdUs;
+            }
+
+            if (client->periodUs) {
+                // a little jitter so the periodic clients do not lock step with each other
+                client->nextUs += client->periodUs +
+                                  (client->seed = (client->seed * 1103515245 + 12345)) % 1000;
+                if (client->nextUs < now)
+                    client->nextUs = now;
+            } else {
+                if (++client->registers == kBusLockDumpRegisters) {
+                    bench->dumps++;
+                    client->registers = 0;
+                }
+                if (now < runUs)
+                    busLockWait(bench, client, now);
+            }
+        } else if (issueUs < runUs) {
+            now = issueUs;
+            client = &clients[next];
+            busLockWait(bench, client, now);
+        } else
+            break;
+
+        // an idle bus goes straight to whoever asked for it
+        if (!holder && bench->bus.head) {
+            link = &bench->bus.head;
+            holder = (BusLockClient *)*link;
+            if (NULL == (*link = holder->waiter.next))
+                bench->bus.tail = link;
+            busLockGrant(bench, holder, now);
+            busyUntil = now + holder->holdUs;
+        }
+    }
+}
+
+int benchBusLock(int seconds) {
+    static const char       *classes[kI2CPriorityClasses] = { "emergency", "control loop", "diagnostics" };
+    static const char       *names[2] = { "priority", "FIFO" };
+    BusLockBench            *bench;
+    IOI2CLockStats          stats[2];
+    double                  p50[2][kI2CPriorityClasses], p99[2][kI2CPriorityClasses];
+    UInt32                  dumps[2];
+    int                     fifo, c;
+
+    if (seconds <= 0 || NULL == (bench = malloc(sizeof(*bench))))
+        return -1;
+
+    printf("%d s of simulated time per lock, %d control loops every %d ms, emergency reads every %d ms, "
+           "%d threads dumping %d registers one transaction at a time:\n", seconds,
+           kBusLockControlLoops, kBusLockControlUs / 1000, kBusLockEmergencyUs / 1000,
+           kBusLockDumpers, kBusLockDumpRegisters);
+    printf("%10s %14s %10s %10s %10s %10s %10s\n", "lock", "class", "acquired", "p50 ms",
+           "p99 ms", "max ms", "mean ms");
+
+    for (fifo = 1; fifo >= 0; fifo--) {
+        busLockRun(bench, fifo, seconds);
+        stats[fifo] = bench->stats;
+        dumps[fifo] = bench->dumps;
+
+        for (c = 0; c < kI2CPriorityClasses; c++) {
+            // a bucket's upper end can be past the longest wait actually seen
+            p50[fifo][c] = latencyPercentile(bench->latency[c], 0.5);
+            p99[fifo][c] = latencyPercentile(bench->latency[c], 0.99);
+            if (p50[fifo][c] > stats[fifo].waitMax_uS[c])
+                p50[fifo][c] = stats[fifo].waitMax_uS[c];
+            if (p99[fifo][c] > stats[fifo].waitMax_uS[c])
+                p99[fifo][c] = stats[fifo].waitMax_uS[c];
+            printf("%10s %14s %10lu %10.2f %10.2f %10.2f %10.2f\n", names[fifo], classes[c],
+                   (unsigned long)stats[fifo].acquired[c], p50[fifo][c] / 1000, p99[fifo][c] / 1000,
+                   stats[fifo].waitMax_uS[c] / 1000.0, stats[fifo].acquired[c] ?
+                   (double)stats[fifo].waitTotal_uS[c] / stats[fifo].acquired[c] / 1000 : 0);
+        }
+    }
+    free(bench);
+
+    printf("%10s %14s %10lu %10lu\n", "dumps", "", (unsigned long)dumps[1], (unsigned long)dumps[0]);
+
+    // too few emergency reads for a meaningful tail, their median has to do
+    if (p99[0][kI2CPriority_ControlLoop - 1] >= p99[1][kI2CPriority_ControlLoop - 1] ||
+            p50[0][kI2CPriority_Emergency - 1] >= p50[1][kI2CPriority_Emergency - 1]) {
+        fprintf(stderr, "benchBusLock: priorities did not shorten the urgent waits\n");
+        return -1;
+    }
+    // aging bounds the wait; what the control loops take must not stop the dumps
+    if (dumps[0] < dumps[1] / 2 ||
+            stats[0].waitMax_uS[kI2CPriority_Diagnostics - 1] > 10 * kI2CPriorityAgingMS * 1000) {
+        fprintf(stderr, "benchBusLock: diagnostics starved\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * --bench bulk
+ */
+
+#define kBulkRegisters          128     // the whole ADT7467 register file
+#define kBulkCallDelayUs        20      // Mach trap and method dispatch
+
+enum {
+    kBulkInline,                // kI2CUCBufSize registers per call
+    kBulkMappedCopy,            // one mapped read, copied out of the shared buffer
+    kBulkMappedInPlace,         // one mapped read, used where it landed
+    kBulkMethods
+};
+
+// registers that change between two reads of the simulated chip
+static int bulkIsVolatile(UInt32 reg) {
+    return reg == kRemote1Temp || reg == kRemote2Temp || reg == kExtendedRes2 ||
+           reg == kIntStatusReg1 || reg == kIntStatusReg2;
+}
+
+static IOReturn bulkDump(I2CConnection *connect, const ADT746xLocation *location, int method,
+                         UInt8 *regs) {
+    const FreezerBackend    *backend = &gSimBackend;
+    I2CUserMappedInput      input;
+    I2CUserMappedOutput     output;
+    UInt8                   *shared;
+    UInt32                  size, reg;
+    IOReturn                status = kIOReturnSuccess;
+
+    switch (method) {
+    case kBulkInline:
+        for (reg = 0; reg < kBulkRegisters && status == kIOReturnSuccess; reg += kI2CUCBufSize)
+            status = readADT746xRegisters(backend, connect, location, kIOI2C_CLIENT_KEY_DEFAULT,
+                                          reg, &regs[reg], kI2CUCBufSize);
+        return status;
+
+    case kBulkMappedCopy:
+        return readADT746xRegisters(backend, connect, location, kIOI2C_CLIENT_KEY_DEFAULT,
+                                    0, regs, kBulkRegisters);
+
+    default:
+        if (kIOReturnSuccess != (status = backend->map(connect, &shared, &size)))
+            return status;
+
+        memset(&input, 0, sizeof(input));
+        input.mode = kI2CMode_Combined;
+        input.busNo = location->bus;
+        input.addr = location->address;
+        input.count = kBulkRegisters;
+        input.key = kIOI2C_CLIENT_KEY_DEFAULT;
+        status = backend->mappedRead(connect, &input, &output);
+
+        // only the comparison looks at the data, a consumer would read it in place
+        if (regs && status == kIOReturnSuccess)
+            memcpy(regs, shared, kBulkRegisters);
+        return status;
+    }
+}
+
+/*
+ * Whole register file through the shared buffer: change the limit block,
+ * check it reads back, put it back. Then ask for more than the buffer.
+ */
+static int bulkCheckMapped(I2CConnection *connect, const ADT746xLocation *location) {
+    const FreezerBackend    *backend = &gSimBackend;
+    I2CUserMappedInput      input;
+    I2CUserMappedOutput     output;
+    UInt8                   saved[kBulkRegisters], regs[kBulkRegisters];
+    UInt8                   *shared;
+    UInt32                  size;
+    int                     i, failed = 0;
+
+    if (kIOReturnSuccess != readADT746xRegisters(backend, connect, location,
+                                                 kIOI2C_CLIENT_KEY_DEFAULT, 0, saved, kBulkRegisters))
+        return -1;
+
+    memcpy(regs, saved, sizeof(regs));
+    for (i = 0; i < kTempLimitBlockLength; i++)
+        regs[kTempLimitBlockStart + i] ^= 0x0F;
+
+    if (kIOReturnSuccess != writeADT746xRegisters(backend, connect, location,
+                                                  kIOI2C_CLIENT_KEY_DEFAULT, 0, regs, kBulkRegisters) ||
+            kIOReturnSuccess != readADT746xRegisters(backend, connect, location,
+                                                     kIOI2C_CLIENT_KEY_DEFAULT, 0, regs, kBulkRegisters))
+        return -1;
+
+    for (i = 0; i < kTempLimitBlockLength; i++)
+        if (regs[kTempLimitBlockStart + i] != (saved[kTempLimitBlockStart + i] ^ 0x0F))
+            failed = 1;
+
+    if (kIOReturnSuccess != writeADT746xRegisters(backend, connect, location,
+                                                  kIOI2C_CLIENT_KEY_DEFAULT, 0, saved, kBulkRegisters))
+        failed = 1;
+
+    if (kIOReturnSuccess != backend->map(connect, &shared, &size))
+        return -1;
+
+    memset(&input, 0, sizeof(input));
+    input.mode = kI2CMode_Combined;
+    input.busNo = location->bus;
+    input.addr = location->address;
+    input.offset = size - 1;
+    input.count = 2;
+    input.key = kIOI2C_CLIENT_KEY_DEFAULT;
+    if (kIOReturnBadArgument != backend->mappedRead(connect, &input, &output) || output.realCount)
+        failed = 1;
+
+    // the offset must not wrap around to make a bad count look small
+    input.offset = (IOByteCount)-1;
+    input.count = 2;
+    if (kIOReturnBadArgument != backend->mappedRead(connect, &input, &output))
+        failed = 1;
+
+    return failed ? -1 : 0;
+}
+
+int benchBulk(int dumps) {
+    static const char       *names[kBulkMethods] = {
+        "inline, 32 byte", "mapped, copied out", "mapped, in place"
+    };
+    const FreezerBackend    *backend = &gSimBackend;
+    ADT746xLocation         location;
+    I2CConnection           *connect;
+    SimBusCounters          counters;
+    UInt8                   regs[kBulkMethods][kBulkRegisters];
+    double                  start, elapsed, perDump[kBulkMethods];
+    IOReturn                status = kIOReturnSuccess;
+    int                     delayed, method, i, reg, failed = 0;
+
+    if (dumps <= 0 || 1 != backend->findADT746x(&location, 1))
+        return -1;
+
+    if (kIOReturnSuccess != backend->open(&location, &connect))
+        return -1;
+
+    simSetClock(1000);
+    simSetLoad(500);
+
+    for (delayed = 0; delayed < 2 && status == kIOReturnSuccess; delayed++) {
+        simSetCallDelay(delayed ? kBulkCallDelayUs : 0);
+        printf("%s%d register dumps, %d times, %s:\n", delayed ? "\n" : "", kBulkRegisters, dumps,
+               delayed ? "20 us per user client call" : "struct copies only");
+        printf("%24s %8s %8s %10s %10s\n", "transfer", "calls", "copied", "us/dump", "ns/byte");
+
+        for (method = 0; method < kBulkMethods && status == kIOReturnSuccess; method++) {
+            status = bulkDump(connect, &location, method, regs[method]);
+
+            simResetBusCounters();
+            start = benchNow();
+            for (i = 0; i < dumps && status == kIOReturnSuccess; i++)
+                status = bulkDump(connect, &location, method,
+                                  method == kBulkMappedInPlace ? NULL : regs[method]);
+            elapsed = benchNow() - start;
+            simGetBusCounters(&counters);
+
+            perDump[method] = elapsed / dumps;
+            printf("%24s %8.1f %8.1f %10.2f %10.2f\n", names[method],
+                   (double)counters.calls / dumps, (double)counters.bytesCopied / dumps,
+                   perDump[method], perDump[method] * 1000 / kBulkRegisters);
+        }
+
+        if (delayed && status == kIOReturnSuccess &&
+                perDump[kBulkMappedCopy] >= perDump[kBulkInline] * 0.5) {
+            fprintf(stderr, "benchBulk: one mapped read is not clearly faster than %d inline ones\n",
+                    kBulkRegisters / kI2CUCBufSize);
+            failed = 1;
+        }
+    }
+
+    for (method = 1; method < kBulkMethods && status == kIOReturnSuccess; method++)
+        for (reg = 0; reg < kBulkRegisters; reg++)
+            if (!bulkIsVolatile(reg) && regs[method][reg] != regs[kBulkInline][reg]) {
+                fprintf(stderr, "benchBulk: %s register 0x%02x is 0x%02x, inline read 0x%02x\n",
+                        names[method], reg, regs[method][reg], regs[kBulkInline][reg]);
+                failed = 1;
+            }
+
+    simSetCallDelay(0);
+    if (status == kIOReturnSuccess && bulkCheckMapped(connect, &location)) {
+        fprintf(stderr, "benchBulk: mapped write or bounds check went wrong\n");
+        failed = 1;
+    }
+
+    simSetClock(0);
+    simSetLoad(-1);
+    backend->close(connect);
+
+    if (status != kIOReturnSuccess) {
+        fprintf(stderr, "benchBulk failed 0x%08x\n", status);
+        return -1;
+    }
+    return failed ? -1 : 0;
+}
+
+/*
+ * Register shadow: the register traffic of AppleADT746x (one register at
+ * a time through PPCI2CInterface, every sensor read on its own) and of
+ * IOI2CADT746x (two block reads per snapshot), with and without the
+ * shadow. Both declare the identification registers static and Config2
+ * and Config4 config, as the drivers do; Config1's RDY bit is status, so
+ * it stays live.
+ */
+
+#define kShadowWakePolls        100     // polls between simulated sleeps
+#define kShadowDrivers          2
+
+typedef struct {
+    SInt32                  voltage;
+    SInt32                  fanRPM[2];
+} ShadowPoll;
+
+static void shadowDeclare(I2CRegisterShadow *shadow, int appleADT746x) {
+    initI2CRegisterShadow(shadow);
+    declareI2CRegisters(shadow, kDeviceIDReg, kRevisionNum - kDeviceIDReg + 1, kI2CRegister_Static);
+    declareI2CRegisters(shadow, kConfigReg2, 1, kI2CRegister_Config);
+    declareI2CRegisters(shadow, kConfigReg4, 1, kI2CRegister_Config);
+    if (appleADT746x)
+        declareI2CRegisters(shadow, kFanPulsePerRev, 1, kI2CRegister_Config);
+}
+
+static IOReturn shadowRead(I2CRegisterShadow *shadow, I2CConnection *connect,
+                           const ADT746xLocation *location, UInt32 reg, UInt8 *value) {
+    return readShadowedRegisters(shadow, &gSimBackend, connect, location,
+                                 kIOI2C_CLIENT_KEY_DEFAULT, reg, value, 1);
+}
+
+/*
+ * One round of AppleADT746x::callPlatformFunction calls: the three
+ * temperatures, the voltage and both tachs, register by register.
+ */
+static IOReturn appleADT746xPoll(I2CRegisterShadow *shadow, I2CConnection *connect,
+                                 const ADT746xLocation *location, int clearAlert,
+                                 UInt8 *deviceID, ShadowPoll *poll) {
+    static const UInt8      temps[3][4] = {
+        { kExtendedRes2, kLocalTemperature, kRemote1Temp, kRemote2Temp },
+        { kExtendedRes2, kRemote1Temp, kLocalTemperature, kRemote2Temp },
+        { kExtendedRes2, kRemote2Temp, kRemote1Temp, kLocalTemperature }
+    };
+    UInt8                   value, config2, config4, ext, full, low, high, pulses;
+    UInt32                  incrementsPerVolt;
+    UInt16                  tach;
+    IOReturn                status = kIOReturnSuccess;
+    int                     i, j;
+
+    if (clearAlert) {
+        shadowRead(shadow, connect, location, kIntStatusReg1, &value);
+        shadowRead(shadow, connect, location, kIntStatusReg2, &value);
+    }
+
+    for (i = 0; i < 3 && status == kIOReturnSuccess; i++)
+        for (j = 0; j < 4 && status == kIOReturnSuccess; j++)
+            status = shadowRead(shadow, connect, location, temps[i][j], &value);
+
+    if (status == kIOReturnSuccess && *deviceID == 0xFF)
+        status = shadowRead(shadow, connect, location, kDeviceIDReg, deviceID);
+    if (status == kIOReturnSuccess)
+        status = shadowRead(shadow, connect, location, kConfigReg2, &config2);
+    if (status == kIOReturnSuccess)
+        status = shadowRead(shadow, connect, location, kConfigReg4, &config4);
+    if (status == kIOReturnSuccess)
+        status = shadowRead(shadow, connect, location, kExtendedRes1, &ext);
+    if (status == kIOReturnSuccess)
+        status = shadowRead(shadow, connect, location,
+                            (*deviceID == kDeviceIDADT7460) ? k2_5VReading : k2_5VccpReading, &full);
+    if (status == kIOReturnSuccess)
+        status = shadowRead(shadow, connect, location, kVccReading, &value);
+    if (status != kIOReturnSuccess)
+        return status;
+
+    if (*deviceID == kDeviceIDADT7460)
+        incrementsPerVolt = (config2 & k2_5VAttenuationMask) ?
+                            kIncrementPerVolt2_25Max : kIncrementPerVolt3_3Max;
+    else    // it tests kConfigReg4 itself, not config4: always attenuated
+        incrementsPerVolt = kUnitsPerVoltWithAttenuation7467;
+    poll->voltage = (SInt32)(((UInt32)VOLTAGE_INDEX_FROM_BYTES(full, ext) * 100 << 16) /
+                             incrementsPerVolt);
+
+    for (i = 0; i < 2; i++) {
+        if (kIOReturnSuccess != (status = shadowRead(shadow, connect, location,
+                                                     kTACH1LowByte + 2 * i, &low)) ||
+                kIOReturnSuccess != (status = shadowRead(shadow, connect, location,
+                                                         kTACH1HighByte + 2 * i, &high)) ||
+                kIOReturnSuccess != (status = shadowRead(shadow, connect, location,
+                                                         kFanPulsePerRev, &pulses)))
+            return status;
+
+        tach = ((UInt16)high << 8) | low;
+        poll->fanRPM[i] = (tach == 0xFFFF || tach == 0) ? 0 : (90000 * 60) / tach;
+    }
+
+    return kIOReturnSuccess;
+}
+
+/*
+ * IOI2CADT746x::readSensorSnapshot, plus the SMBALERT clear list of
+ * callPlatformFunction after a wake.
+ */
+static IOReturn ioi2cADT746xPoll(I2CRegisterShadow *shadow, I2CConnection *connect,
+                                 const ADT746xLocation *location, int clearAlert,
+                                 UInt8 *deviceID, UInt8 *config2, ShadowPoll *poll) {
+    ADT746xRawSnapshot      raw;
+    ADT746xSnapshot         snapshot;
+    UInt8                   value;
+    IOReturn                status;
+
+    if (clearAlert) {
+        shadowRead(shadow, connect, location, kIntStatusReg1, &value);
+        shadowRead(shadow, connect, location, kIntStatusReg2, &value);
+        shadowRead(shadow, connect, location, kConfigReg2, config2);
+    }
+
+    status = readShadowedRegisters(shadow, &gSimBackend, connect, location, kIOI2C_CLIENT_KEY_DEFAULT,
+                                   kExtResBlockStart, raw.ext, kExtResBlockLength);
+    if (status == kIOReturnSuccess)
+        status = readShadowedRegisters(shadow, &gSimBackend, connect, location,
+                                       kIOI2C_CLIENT_KEY_DEFAULT,
+                                       kSensorBlockStart, raw.sensor, kSensorBlockLength);
+    if (status == kIOReturnSuccess && *deviceID == 0xFF)
+        status = shadowRead(shadow, connect, location, kDeviceIDReg, deviceID);
+    if (status != kIOReturnSuccess)
+        return status;
+
+    decodeADT746xSnapshot(&raw, *deviceID, *config2, &snapshot);
+    poll->voltage = snapshot.voltage;
+    poll->fanRPM[0] = (SInt32)snapshot.fanRPM[0];
+    poll->fanRPM[1] = (SInt32)snapshot.fanRPM[1];
+    return kIOReturnSuccess;
+}
+
+/*
+ * Start, then polls polls with a sleep every kShadowWakePolls. The chip
+ * comes back from each sleep reset to its power on values, having had
+ * the attenuation bit cleared before it, so a shadow that is not
+ * invalidated on wake, the way both drivers do, decodes the wrong voltage.
+ */
+static IOReturn shadowRun(int driver, I2CRegisterShadow *shadow, I2CConnection *connect,
+                          const ADT746xLocation *location, int polls, ShadowPoll *last,
+                          SimBusCounters *counters) {
+    UInt8                   deviceID, config2 = 0, value;
+    IOReturn                status;
+    int                     clearAlert = 1, i;
+
+    simResetChip();
+    simResetBusCounters();
+
+    status = shadowRead(shadow, connect, location, kDeviceIDReg, &deviceID);
+    if (status == kIOReturnSuccess && driver == 1)
+        status = shadowRead(shadow, connect, location, kConfigReg2, &config2);
+
+    for (i = 0; i < polls && status == kIOReturnSuccess; i++) {
+        if (i && i % kShadowWakePolls == 0) {
+            // whatever was written before sleep is gone after it
+            value = 0;
+            writeShadowedRegisters(shadow, &gSimBackend, connect, location, kIOI2C_CLIENT_KEY_DEFAULT,
+                                   kConfigReg2, &value, 1);
+            simResetChip();
+            if (shadow)
+                invalidateI2CRegisterShadow(shadow);
+            clearAlert = 1;
+        }
+
+        status = driver ? ioi2cADT746xPoll(shadow, connect, location, clearAlert,
+                                           &deviceID, &config2, last) :
+                          appleADT746xPoll(shadow, connect, location, clearAlert, &deviceID, last);
+        clearAlert = 0;
+    }
+
+    simGetBusCounters(counters);
+    return status;
+}
+
+/*
+ * Write through, redundant writes and live registers, with counters.
+ */
+static int shadowCheck(I2CConnection *connect, const ADT746xLocation *location) {
+    I2CRegisterShadow       shadow;
+    SimBusCounters          counters;
+    UInt8                   value, chip;
+    int                     failed = 0;
+
+    shadowDeclare(&shadow, 1);
+    simResetChip();
+    simResetBusCounters();
+
+    value = 0x02;
+    writeShadowedRegisters(&shadow, &gSimBackend, connect, location, kIOI2C_CLIENT_KEY_DEFAULT,
+                           kConfigReg4, &value, 1);
+    writeShadowedRegisters(&shadow, &gSimBackend, connect, location, kIOI2C_CLIENT_KEY_DEFAULT,
+                           kConfigReg4, &value, 1);
+    value = 0;
+    shadowRead(&shadow, connect, location, kConfigReg4, &value);
+    readADT746xRegisters(&gSimBackend, connect, location, kIOI2C_CLIENT_KEY_DEFAULT,
+                         kConfigReg4, &chip, 1);
+    simGetBusCounters(&counters);
+    if (counters.writes != 1 || counters.reads != 1 || value != 0x02 || chip != 0x02) {
+        fprintf(stderr, "benchShadow: write through wrote %u times, read %u times, 0x%02x 0x%02x\n",
+                counters.writes, counters.reads, value, chip);
+        failed = 1;
+    }
+
+    simResetChip();
+    invalidateI2CRegisterShadow(&shadow);
+    shadowRead(&shadow, connect, location, kConfigReg4, &value);
+    readADT746xRegisters(&gSimBackend, connect, location, kIOI2C_CLIENT_KEY_DEFAULT,
+                         kConfigReg4, &chip, 1);
+    if (value != chip) {
+        fprintf(stderr, "benchShadow: config4 0x%02x after invalidate, chip has 0x%02x\n", value, chip);
+        failed = 1;
+    }
+
+    simResetBusCounters();
+    shadowRead(&shadow, connect, location, kIntStatusReg1, &value);
+    shadowRead(&shadow, connect, location, kIntStatusReg1, &value);
+    shadowRead(&shadow, connect, location, kConfigReg1, &value);       // RDY
+    shadowRead(&shadow, connect, location, kConfigReg1, &value);
+    simGetBusCounters(&counters);
+    if (counters.reads != 4) {
+        fprintf(stderr, "benchShadow: live registers were read %u times out of 4\n", counters.reads);
+        failed = 1;
+    }
+
+    return failed;
+}
+
+int benchShadow(int polls) {
+    static const char       *names[kShadowDrivers] = { "AppleADT746x", "IOI2CADT746x" };
+    const FreezerBackend    *backend = &gSimBackend;
+    ADT746xLocation         location;
+    I2CConnection           *connect;
+    I2CRegisterShadow       shadow;
+    SimBusCounters          counters;
+    ShadowPoll              last[2];
+    double                  transactions[2];
+    IOReturn                status = kIOReturnSuccess;
+    int                     driver, shadowed, failed = 0;
+
+    if (polls <= 0 || 1 != backend->findADT746x(&location, 1))
+        return -1;
+
+    if (kIOReturnSuccess != backend->open(&location, &connect))
+        return -1;
+
+    simSetClock(1000);
+    simSetLoad(500);
+
+    printf("%d polls, a sleep every %d:\n", polls, kShadowWakePolls);
+    printf("%14s %7s %10s %10s %10s %10s\n", "driver", "shadow", "reads", "writes", "hits", "dropped");
+
+    for (driver = 0; driver < kShadowDrivers && status == kIOReturnSuccess; driver++) {
+        for (shadowed = 0; shadowed < 2 && status == kIOReturnSuccess; shadowed++) {
+            shadowDeclare(&shadow, driver == 0);
+            status = shadowRun(driver, shadowed ? &shadow : NULL, connect, &location, polls,
+                               &last[shadowed], &counters);
+
+            transactions[shadowed] = (double)(counters.reads + counters.writes) / polls;
+            printf("%14s %7s %10.2f %10.2f %10.2f %10.2f\n", names[driver], shadowed ? "on" : "off",
+                   (double)counters.reads / polls, (double)counters.writes / polls,
+                   shadowed ? (double)shadow.hits / polls : 0.0,
+                   shadowed ? (double)shadow.suppressedWrites / polls : 0.0);
+        }
+        if (status != kIOReturnSuccess)
+            break;
+
+        printf("%14s %7s %9.1f%%\n", "", "saved",
+               100.0 * (transactions[0] - transactions[1]) / transactions[0]);
+
+        if (memcmp(&last[0], &last[1], sizeof(last[0]))) {
+            fprintf(stderr, "benchShadow: %s read voltage 0x%x, fan %d rpm with the shadow, "
+                    "0x%x, %d rpm without\n", names[driver],
+                    (unsigned)last[1].voltage, (int)last[1].fanRPM[0],
+                    (unsigned)last[0].voltage, (int)last[0].fanRPM[0]);
+            failed = 1;
+        }
+        if (transactions[1] > transactions[0] || (driver == 0 && transactions[1] >= transactions[0])) {
+            fprintf(stderr, "benchShadow: the shadow did not save %s any transactions\n", names[driver]);
+            failed = 1;
+        }
+    }
+
+    if (status == kIOReturnSuccess && shadowCheck(connect, &location))
+        failed = 1;
+
+    simResetChip();
+    simSetClock(0);
+    simSetLoad(-1);
+    backend->close(connect);
+
+    if (status != kIOReturnSuccess) {
+        fprintf(stderr, "benchShadow failed 0x%08x\n", status);
+        return -1;
+    }
+    return failed ? -1 : 0;
+}
+
+/*
+ * AppleFan driving an ADM1030 on a simulated iBook. The thermal model is
+ * one lump: the CPU heats it with 3 W idle to 10 W under full load, and
+ * it loses heat to 30 C air through a conductance the fan raises. With
+ * these numbers a fully loaded CPU settles at 95 C with the fan off and
+ * 60 C at full speed, and idles at 54 C.
+ */
+#define kFanBenchPollMs         8000    // AppleFan's default polling period
+#define kFanBenchHotC           62      // top of the default speed table
+#define kFanBenchAmbientC       30.0
+#define kFanBenchIdleW          3.0
+#define kFanBenchLoadW          7.0     // on top of idle at full load
+#define kFanBenchHeatJPerC      12.0
+#define kFanBenchStillWPerC     0.154
+#define kFanBenchFanWPerC       0.180   // at full speed, on top of still air
+#define kFanBenchSpeeds         16      // kNumFanSpeeds
+
+// the same steps as AppleFan's defaults, in 8.8 fixed point
+static const SInt16 gFanBenchTable[kFanBenchSpeeds] = {
+    0x3900, 0x3A4A, 0x3Ad3, 0x3B3C, 0x3B94, 0x3BE3, 0x3C29, 0x3C6A,
+    0x3CA6, 0x3CD7, 0x3D15, 0x3D48, 0x3D78, 0x3DA7, 0x3DD4, 0x3E00
+};
+
+#define kFanBenchHysteresisTemp 0x3700
+#define kFanBenchSpeedupMs      8000
+#define kFanBenchSlowdownMs     48000
+#define kFanBenchSetpoint       0x3A00
+#define kFanBenchKp             0x20000
+#define kFanBenchKi             0x800
+#define kFanBenchKd             0x80000
+#define kFanBenchHysteresis     0x0C000 // kPIDSpeedHysteresis
+#define kFanBenchFeedforward    0x80000 // fan-load-feedforward, off unless a personality sets it
+#define kFanBenchFeedforwardFloor 250   // kLoadFeedforwardFloor
+
+/*
+ * PowerBook6,5 CPU sensor thresholds: Portable2004_PlatformMonitor leaves
+ * kThermalState0 above 63 C and comes back below 62 C, and any other
+ * state drops MacRISC2CPU to kDFSLow. There the CPU runs at two thirds
+ * of the clock, at a lower voltage.
+ */
+#define kFanBenchDFSLowC        63
+#define kFanBenchDFSHighC       62
+#define kFanBenchDFSLoadPower   0.45    // of the load's power at kDFSHigh
+#define kFanBenchDFSIdlePower   0.8
+#define kFanBenchDFSSpeed       (2.0 / 3.0)
+
+typedef struct {
+    int                     pid;
+    SInt32                  feedforward;    // fan-load-feedforward, 0 for none
+    int                     dfs;            // let the platform monitor slow the CPU down
+} FanBenchConfig;
+
+/*
+ * What AppleFan keeps between updates, and what the ADM1030 holds.
+ */
+typedef struct {
+    int                     pid;
+    UInt8                   lastFanSpeed;
+    SInt16                  lastRmtTemp;
+    UInt64                  lastTransitionMs;
+    int                     speedRegsKnown;
+    UInt8                   lastTminTrange;
+    UInt8                   lastSpeedCfg;
+    SInt64                  pidIntegral;
+    SInt16                  pidLastTemp;
+    UInt32                  loadSum;        // permille seconds since the last update
+
+    UInt8                   speedCfg;       // the chip's registers
+    UInt8                   tminTrange;
+    UInt32                  writes;
+    UInt32                  changes;        // fan speed changes
+} FanBenchDriver;
+
+typedef struct {
+    double                  hotSeconds;     // above kFanBenchHotC
+    double                  maxC;
+    double                  dutySeconds;    // integral of the fan duty cycle
+    double                  swingC;         // mean temperature change between polls
+    UInt32                  writes;
+    UInt32                  changes;
+    double                  lowSeconds;     // at kDFSLow
+    double                  busySeconds;    // load above half
+    double                  busyHighSeconds;
+    double                  demand;         // load asked for, permille seconds
+    double                  work;           // and done
+} FanBenchResult;
+
+// AppleFan::writeADM1030Speed, writing only the registers that change
+static void fanBenchWrite(FanBenchDriver *driver, UInt8 desiredSpeed, SInt16 rmtTemp) {
+    UInt8                   tminTrange, speed;
+
+    tminTrange = (UInt8)(rmtTemp >> 7);
+    tminTrange &= ~0x07;
+    tminTrange |= 0x07;
+
+    if (desiredSpeed == 0) {
+        tminTrange += 0x10;
+        speed = 0;
+    } else {
+        tminTrange -= 0x08;
+        speed = desiredSpeed - 1;
+    }
+
+    if (desiredSpeed != driver->lastFanSpeed)
+        driver->changes++;
+    driver->lastFanSpeed = desiredSpeed;
+    driver->lastRmtTemp = rmtTemp;
+
+    if (!driver->speedRegsKnown || tminTrange != driver->lastTminTrange) {
+        driver->tminTrange = tminTrange;
+        driver->writes++;
+    }
+    if (!driver->speedRegsKnown || speed != driver->lastSpeedCfg) {
+        driver->speedCfg = speed;
+        driver->writes++;
+    }
+
+    driver->lastTminTrange = tminTrange;
+    driver->lastSpeedCfg = speed;
+    driver->speedRegsKnown = 1;
+}
+
+/*
+ * AppleFan's table lookup, never below floorSpeed, and setFanSpeed: one
+ * step at a time behind the speedup and slowdown delays.
+ */
+static void fanBenchTable(FanBenchDriver *driver, SInt16 cpuTemp, SInt16 rmtTemp,
+        UInt8 floorSpeed, int first, UInt64 nowMs) {
+    UInt8                   speed = 0;
+
+    while (cpuTemp >= gFanBenchTable[speed] && speed < kFanBenchSpeeds - 1)
+        speed++;
+    if (speed < floorSpeed)
+        speed = floorSpeed;
+
+    if (first) {
+        fanBenchWrite(driver, speed, rmtTemp);
+        driver->lastTransitionMs = nowMs;
+    } else if (speed == driver->lastFanSpeed) {
+        if (rmtTemp != driver->lastRmtTemp)
+            fanBenchWrite(driver, speed, rmtTemp);
+    } else if (speed < driver->lastFanSpeed) {
+        if (speed == 0 && driver->lastFanSpeed == 1 && cpuTemp > kFanBenchHysteresisTemp) {
+            if (rmtTemp != driver->lastRmtTemp)
+                fanBenchWrite(driver, driver->lastFanSpeed, rmtTemp);
+        } else if (nowMs - driver->lastTransitionMs > kFanBenchSlowdownMs) {
+            fanBenchWrite(driver, driver->lastFanSpeed - 1, rmtTemp);
+            driver->lastTransitionMs = nowMs;
+        } else if (rmtTemp != driver->lastRmtTemp)
+            fanBenchWrite(driver, driver->lastFanSpeed, rmtTemp);
+    } else {
+        if (nowMs - driver->lastTransitionMs > kFanBenchSpeedupMs) {
+            fanBenchWrite(driver, driver->lastFanSpeed + 1, rmtTemp);
+            driver->lastTransitionMs = nowMs;
+        } else if (rmtTemp != driver->lastRmtTemp)
+            fanBenchWrite(driver, driver->lastFanSpeed, rmtTemp);
+    }
+}
+
+// AppleFan::pidFanSpeed, the same fixed point arithmetic
+static UInt8 fanBenchPID(FanBenchDriver *driver, SInt16 cpuTemp, SInt64 feedforward, int first) {
+    const SInt64            maxOutput = (SInt64)(kFanBenchSpeeds - 1) << 16;
+    const UInt32            periodMs = kFanBenchPollMs;
+    SInt64                  error, proportional, integral, derivative, output, current;
+    UInt8                   speed;
+
+    error = (SInt64)cpuTemp - kFanBenchSetpoint;
+    proportional = (kFanBenchKp * error) >> 8;
+    current = (SInt64)driver->lastFanSpeed << 16;
+
+    if (first) {
+        derivative = 0;
+        integral = current - proportional - feedforward;
+    } else {
+        derivative = (((SInt64)kFanBenchKd * ((SInt64)cpuTemp - driver->pidLastTemp) * 1000)
+                      / periodMs) >> 8;
+        integral = driver->pidIntegral + ((((SInt64)kFanBenchKi * error * periodMs) / 1000) >> 8);
+
+        output = proportional + integral + derivative + feedforward;
+        if ((output > maxOutput && error > 0) || (output < 0 && error < 0))
+            integral = driver->pidIntegral;
+    }
+
+    if (integral < -maxOutput)
+        integral = -maxOutput;
+    if (integral > maxOutput)
+        integral = maxOutput;
+
+    driver->pidIntegral = integral;
+    driver->pidLastTemp = cpuTemp;
+
+    output = proportional + integral + derivative + feedforward;
+    if (output < 0)
+        output = 0;
+    if (output > maxOutput)
+        output = maxOutput;
+
+    speed = (UInt8)((output + 0x8000) >> 16);
+    if (!first && speed != driver->lastFanSpeed &&
+            output < current + kFanBenchHysteresis && output > current - kFanBenchHysteresis)
+        speed = driver->lastFanSpeed;
+    return speed;
+}
+
+/*
+ * Load in permille for second s of a built in trace. The compile trace
+ * is ten idle minutes, forty of a build and ten idle again every hour;
+ * browse is short bursts at random.
+ */
+enum { kFanTraceIdle, kFanTraceBursty, kFanTraceCompile, kFanTraceBrowse, kFanTraces };
+
+static const char *gFanTraceNames[kFanTraces] = { "idle", "bursty", "compile", "browse" };
+
+static int fanTraceLoad(int trace, UInt32 s, UInt32 *seed, UInt32 *burstEnd, UInt32 *nextBurst) {
+    UInt32                  t = s % 3600;
+
+    switch (trace) {
+    case kFanTraceBursty:
+        return benchLoad(1, (UInt64)s * 1000);
+    case kFanTraceCompile:
+        return (t >= 600 && t < 3000) ? 950 : 100;
+    case kFanTraceBrowse:
+        if (s >= *nextBurst) {
+            *burstEnd = s + 5 + deadlineRandom(seed) % 26;
+            *nextBurst = *burstEnd + 30 + deadlineRandom(seed) % 91;
+        }
+        return (s < *burstEnd) ? 600 + (int)(deadlineRandom(seed) % 401) : 100;
+    default:
+        return 100;
+    }
+}
+
+/*
+ * Turn a recorded history back into a load trace, one value a second,
+ * by solving the thermal model for the heat that made the CPU diode
+ * (remote 1) move the way it did at the duty cycle the fan ran at.
+ * Returns the number of seconds, 0 if the file has nothing usable.
+ */
+static UInt32 fanTraceFromHistory(const char *path, int **load) {
+    HistoryRing             ring;
+    HistorySample           *samples;
+    UInt32                  maxSamples, seconds = 0, s, i;
+    double                  dt, temp, next, duty, watts;
+    int                     n;
+
+    *load = NULL;
+    if (openHistory(&ring, path, 0, 0))
+        return 0;
+
+    maxSamples = ring.header->blockCount * (kHistoryDeltasPerBlock + 1);
+    samples = malloc(maxSamples * sizeof(*samples));
+    n = samples ? readHistory(&ring, samples, (int)maxSamples) : -1;
+    closeHistory(&ring);
+
+    if (n >= 2 && samples[n - 1].timeMs > samples[0].timeMs) {
+        seconds = (UInt32)((samples[n - 1].timeMs - samples[0].timeMs) / 1000);
+        *load = malloc((seconds + 1) * sizeof(**load));
+    }
+    if (*load == NULL) {
+        free(samples);
+        return 0;
+    }
+
+    for (s = 0, i = 0; s <= seconds; s++) {
+        while (i + 2 < (UInt32)n && samples[i + 1].timeMs <= samples[0].timeMs + (UInt64)s * 1000)
+            i++;
+
+        dt = (samples[i + 1].timeMs - samples[i].timeMs) / 1000.0;
+        temp = samples[i].temp[1] / 4.0;
+        next = samples[i + 1].temp[1] / 4.0;
+        duty = samples[i].duty[0] / 255.0;
+        watts = (dt > 0 ? kFanBenchHeatJPerC * (next - temp) / dt : 0) +
+                (kFanBenchStillWPerC + kFanBenchFanWPerC * duty) * (temp - kFanBenchAmbientC);
+
+        watts = (watts - kFanBenchIdleW) * 1000 / kFanBenchLoadW;
+        (*load)[s] = watts < 0 ? 0 : watts > 1000 ? 1000 : (int)watts;
+    }
+
+    free(samples);
+    return seconds + 1;
+}
+
+// AppleFan::loadFeedforward on the load since the last update
+static SInt64 fanBenchFeedforward(FanBenchDriver *driver, SInt32 gain, int first) {
+    UInt32                  load = driver->loadSum / (kFanBenchPollMs / 1000);
+
+    driver->loadSum = 0;
+    if (first || gain == 0 || load <= kFanBenchFeedforwardFloor)
+        return 0;
+    return ((SInt64)gain * (load - kFanBenchFeedforwardFloor)) / (1000 - kFanBenchFeedforwardFloor);
+}
+
+// AppleFan::doUpdate from the temperatures on
+static void fanBenchUpdate(FanBenchDriver *driver, const FanBenchConfig *config,
+        SInt16 cpuTemp, SInt16 rmtTemp, int first, UInt64 nowMs) {
+    SInt64                  feedforward = fanBenchFeedforward(driver, config->feedforward, first);
+    UInt8                   speed, floorSpeed;
+
+    if (config->pid) {
+        speed = fanBenchPID(driver, cpuTemp, feedforward, first);
+        fanBenchWrite(driver, speed, rmtTemp);
+        return;
+    }
+
+    floorSpeed = (UInt8)((feedforward + 0x8000) >> 16);
+    if (!first && floorSpeed > driver->lastFanSpeed) {
+        fanBenchWrite(driver, floorSpeed, rmtTemp);
+        driver->lastTransitionMs = nowMs;
+    } else
+        fanBenchTable(driver, cpuTemp, rmtTemp, floorSpeed, first, nowMs);
+}
+
+/*
+ * One run in one second steps of virtual time. The CPU sensor reads in
+ * sixteenths of a degree, the ADM1030's remote diode a few degrees lower
+ * in eighths, and AppleFan updates every kFanBenchPollMs. With dfs the
+ * platform monitor drops the CPU to kDFSLow while it is above
+ * kFanBenchDFSLowC, until it is back below kFanBenchDFSHighC.
+ */
+static void fanBenchRun(const FanBenchConfig *config, int trace, const int *recorded,
+        UInt32 seconds, FanBenchResult *result) {
+    FanBenchDriver          driver;
+    UInt32                  seed = 0x5eed, burstEnd = 0, nextBurst = 60;
+    UInt32                  s, polls = 0;
+    double                  temp = 54.0, lastPollTemp = 54.0, duty, watts, conductance;
+    SInt16                  cpuTemp, rmtTemp;
+    int                     load, dfsLow = 0;
+
+    memset(&driver, 0, sizeof(driver));
+    memset(result, 0, sizeof(*result));
+    driver.pid = config->pid;
+    result->maxC = temp;
+
+    for (s = 0; s < seconds; s++) {
+        load = recorded ? recorded[s] : fanTraceLoad(trace, s, &seed, &burstEnd, &nextBurst);
+
+        if ((s * 1000) % kFanBenchPollMs == 0) {
+            cpuTemp = (SInt16)((SInt32)(temp * 16) << 4);
+            rmtTemp = (SInt16)((SInt32)((temp - 4) * 8) << 5);
+
+            fanBenchUpdate(&driver, config, cpuTemp, rmtTemp, s == 0, (UInt64)s * 1000);
+
+            if (s) {
+                result->swingC += temp > lastPollTemp ? temp - lastPollTemp : lastPollTemp - temp;
+                polls++;
+            }
+            lastPollTemp = temp;
+        }
+
+        driver.loadSum += load;
+
+        if (config->dfs) {
+            if (temp > kFanBenchDFSLowC)
+                dfsLow = 1;
+            else if (temp < kFanBenchDFSHighC)
+                dfsLow = 0;
+        }
+
+        // speed config 0 with Tmin above the diode is off, otherwise speed - 1 sixteenths
+        duty = (driver.lastFanSpeed == 0) ? 0 : driver.lastFanSpeed / 15.0;
+        if (dfsLow)
+            watts = kFanBenchIdleW * kFanBenchDFSIdlePower +
+                    kFanBenchLoadW * kFanBenchDFSLoadPower * load / 1000.0;
+        else
+            watts = kFanBenchIdleW + kFanBenchLoadW * load / 1000.0;
+        conductance = kFanBenchStillWPerC + kFanBenchFanWPerC * duty;
+        temp += (watts - conductance * (temp - kFanBenchAmbientC)) / kFanBenchHeatJPerC;
+
+        if (temp > kFanBenchHotC)
+            result->hotSeconds++;
+        if (temp > result->maxC)
+            result->maxC = temp;
+        result->dutySeconds += duty;
+
+        result->lowSeconds += dfsLow;
+        result->demand += load;
+        result->work += dfsLow ? load * kFanBenchDFSSpeed : load;
+        if (load > 500) {
+            result->busySeconds++;
+            result->busyHighSeconds += !dfsLow;
+        }
+    }
+
+    result->writes = driver.writes;
+    result->changes = driver.changes;
+    if (polls)
+        result->swingC /= polls;
+}
+
+static void fanBenchReport(const char *trace, const char *controller, UInt32 seconds,
+        const FanBenchResult *result) {
+    double                  hours = seconds / 3600.0;
+
+    printf("%10s %6s %9.1f %7.1f %8.2f %8.1f %9.1f %9.1f\n", trace, controller,
+           100.0 * result->hotSeconds / seconds, result->maxC, result->swingC,
+           100.0 * result->dutySeconds / seconds,
+           result->writes / hours, result->changes / hours);
+}
+
+int benchFanControl(int hours, const char *historyPath) {
+    static const FanBenchConfig tableConfig = { 0, 0, 0 }, pidConfig = { 1, 0, 0 };
+    FanBenchResult          table, pid;
+    int                     *recorded = NULL;
+    UInt32                  seconds;
+    int                     trace, failed = 0;
+
+    if (hours <= 0)
+        return -1;
+
+    printf("AppleFan table vs. PID control, %d simulated hour(s) per trace, hot above %d C:\n",
+           hours, kFanBenchHotC);
+    printf("%10s %6s %9s %7s %8s %8s %9s %9s\n", "trace", "ctrl", "hot %", "max C",
+           "swing C", "duty %", "writes/h", "speeds/h");
+
+    for (trace = 0; trace <= kFanTraces; trace++) {
+        if (trace == kFanTraces) {
+            if (historyPath == NULL)
+                break;
+            seconds = fanTraceFromHistory(historyPath, &recorded);
+            if (seconds == 0) {
+                fprintf(stderr, "benchFanControl: nothing to replay in %s\n", historyPath);
+                return -1;
+            }
+        } else
+            seconds = (UInt32)hours * 3600;
+
+        fanBenchRun(&tableConfig, trace, recorded, seconds, &table);
+        fanBenchRun(&pidConfig, trace, recorded, seconds, &pid);
+
+        fanBenchReport(recorded ? "history" : gFanTraceNames[trace], "table", seconds, &table);
+        fanBenchReport(recorded ? "history" : gFanTraceNames[trace], "pid", seconds, &pid);
+
+        if (recorded)
+            continue;
+
+        /*
+         * The point of the exercise: never longer hot, and under sustained
+         * load none of the table's sawtooth. Short random bursts do cost
+         * the PID more writes than the table, which mostly sits them out
+         * with the fan off.
+         */
+        if (pid.hotSeconds > table.hotSeconds) {
+            fprintf(stderr, "benchFanControl: PID ran hot longer on %s\n", gFanTraceNames[trace]);
+            failed = 1;
+        }
+        if ((trace == kFanTraceBursty || trace == kFanTraceCompile) && pid.writes > table.writes) {
+            fprintf(stderr, "benchFanControl: PID wrote the ADM1030 more often on %s\n",
+                    gFanTraceNames[trace]);
+            failed = 1;
+        }
+    }
+
+    free(recorded);
+    return failed ? -1 : 0;
+}
+
+int benchDFS(int hours) {
+    static const struct {
+        const char      *name;
+        FanBenchConfig  config;
+    } runs[4] = {
+        { "table",      { 0, 0,                     1 } },
+        { "table+ff",   { 0, kFanBenchFeedforward,  1 } },
+        { "pid",        { 1, 0,                     1 } },
+        { "pid+ff",     { 1, kFanBenchFeedforward,  1 } },
+    };
+    static const int        traces[] = { kFanTraceBursty, kFanTraceCompile, kFanTraceBrowse };
+    FanBenchResult          result[4];
+    UInt32                  seconds;
+    int                     t, r, failed = 0;
+
+    if (hours <= 0)
+        return -1;
+
+    seconds = (UInt32)hours * 3600;
+
+    printf("MacRISC2CPU speed under AppleFan, with and without load feedforward, %d simulated "
+           "hour(s) per trace, kDFSLow above %d C until below %d C:\n",
+           hours, kFanBenchDFSLowC, kFanBenchDFSHighC);
+    printf("%10s %9s %8s %8s %8s %7s %8s %9s\n", "trace", "ctrl", "high %", "busy %", "work %",
+           "max C", "duty %", "writes/h");
+
+    for (t = 0; t < (int)(sizeof(traces) / sizeof(traces[0])); t++) {
+        for (r = 0; r < 4; r++) {
+            fanBenchRun(&runs[r].config, traces[t], NULL, seconds, &result[r]);
+            printf("%10s %9s %8.1f %8.1f %8.1f %7.1f %8.1f %9.1f\n",
+                   gFanTraceNames[traces[t]], runs[r].name,
+                   100.0 - 100.0 * result[r].lowSeconds / seconds,
+                   result[r].busySeconds ?
+                        100.0 * result[r].busyHighSeconds / result[r].busySeconds : 100.0,
+                   100.0 * result[r].work / result[r].demand,
+                   result[r].maxC, 100.0 * result[r].dutySeconds / seconds,
+                   result[r].writes / (seconds / 3600.0));
+        }
+
+        // feedforward must keep busy CPUs at full speed at least as long
+        for (r = 1; r < 4; r += 2) {
+            if (result[r].busyHighSeconds < result[r - 1].busyHighSeconds) {
+                fprintf(stderr, "benchDFS: %s slowed the CPU down more than %s on %s\n",
+                        runs[r].name, runs[r - 1].name, gFanTraceNames[traces[t]]);
+                failed = 1;
+            }
+        }
+    }
+
+    return failed ? -1 : 0;
+}
+
+#define kPFBenchKey             0x1234
+#define kPFBenchMaxSets         64
+#define kPFBenchMaxBytes        2048
+
+// AppleMacRISC2PE's PFParse.c test vectors, one property each
+static const char *gPFParseVectors[] = {
+    // Single tests - one for each command
+    "platform-do-CommandWriteGPIO 0x00000001 0x0c000000 0x00000001 0x00000001 0xfffffffe",
+    "platform-do-CommandReadGPIO 0x00000002 0x0c000000 0x00000002 0x00000002 0x00000001 "
+        "0xfffffffd",
+    "platform-do-CommandWriteReg32 0x00000003 0x0c000000 0x00000003 0x00000003 0x00000003 "
+        "0xfffffffc",
+    "platform-do-CommandReadReg32 0x00000004 0x0c000000 0x00000004 0x00000004",
+    "platform-do-CommandWriteReg16 0x00000005 0x0c000000 0x00000005 0x00000005 0x00000005 "
+        "0xfffffffa",
+    "platform-do-CommandReadReg16 0x00000006 0x0c000000 0x00000006 0x00000006",
+    "platform-do-CommandWriteReg8 0x00000007 0x0c000000 0x00000007 0x00000007 0x00000007 "
+        "0xfffffff8",
+    "platform-do-CommandReadReg8 0x00000008 0x0c000000 0x00000008 0x00000008",
+    "platform-do-CommandDelay 0x00000009 0x0c000000 0x00000009 0x00000100",
+    "platform-do-CommandWaitReg32 0x0000000a 0x0c000000 0x0000000a 0x000000a0 0x0000000a "
+        "0xfffffff5",
+    "platform-do-CommandWaitReg16 0x0000000b 0x0c000000 0x0000000b 0x000000b0 0x0000000b "
+        "0xfffffff4",
+    "platform-do-CommandWaitReg8 0x0000000c 0x0c000000 0x0000000c 0x000000c0 0x0000000c "
+        "0xfffffff3",
+    "platform-do-CommandReadI2C 0x0000000d 0x0c000000 0x0000000d 0x0000000d",
+    "platform-do-CommandWriteI2C 0x0000000e 0x0c000000 0x0000000e 0x00000006 0x12345678 "
+        "0x9abc",
+    "platform-do-CommandRMWI2C 0x0000000f 0x0c000000 0x0000000f 0x00000006 0x00000006 "
+        "0x00000006 0x12345678 0x9abccba9 0x87654321",
+    "platform-do-CommandShiftBytesRight 0x00000011 0x0c000000 0x00000011 0x00000006 "
+        "0x00000002",
+    "platform-do-CommandShiftBytesLeft 0x00000012 0x0c000000 0x00000012 0x00000006 0x00000004",
+    "platform-do-CommandReadConfig 0x00000013 0x0c000000 0x00000013 0x00000013 0x00000002",
+    "platform-do-CommandWriteConfig 0x00000014 0x0c000000 0x00000014 0x00000014 0x00000006 "
+        "0x12345678 0x9abc",
+    "platform-do-CommandRMWConfig 0x00000015 0x0c000000 0x00000015 0x00000015 0x00000006 "
+        "0x00000006 0x00000006 0x12345678 0x9abccba9 0x87654321",
+    "platform-do-CommandReadI2CSubAddr 0x00000016 0x0c000000 0x00000016 0x00000016 0x00000005",
+    "platform-do-CommandWriteI2CSubAddr 0x00000017 0x0c000000 0x00000017 0x00000017 "
+        "0x00000006 0x12345678 0x9abc",
+    "platform-do-CommandI2CMode 0x00000018 0x0c000000 0x00000018 0x00000002",
+    "platform-do-CommandRMWI2CSubAddr 0x00000019 0x0c000000 0x00000019 0x00000019 0x00000006 "
+        "0x00000006 0x00000006 0x12345678 0x9abccba9 0x87654321",
+    "platform-do-CommandReadReg32MaskShRtXOR 0x0000001a 0x0c000000 0x0000001a 0x0000001a "
+        "0x00000001 0x00000002 0x00000003",
+    "platform-do-CommandReadReg16MaskShRtXOR 0x0000001b 0x0c000000 0x0000001b 0x0000001b "
+        "0x00000004 0x00000005 0x00000006",
+    "platform-do-CommandReadReg8MaskShRtXOR 0x0000001c 0x0c000000 0x0000001c 0x0000001c "
+        "0x00000007 0x00000008 0x00000009",
+    "platform-do-CommandWriteReg32ShLtMask 0x0000001d 0x0c000000 0x0000001d 0x0000001d "
+        "0x0000000a 0x0000000b",
+    "platform-do-CommandWriteReg16ShLtMask 0x0000001e 0x0c000000 0x0000001e 0x0000001e "
+        "0x0000000c 0x0000000d",
+    "platform-do-CommandWriteReg8ShLtMask 0x0000001f 0x0c000000 0x0000001f 0x0000001f "
+        "0x0000000e 0x0000000f",
+    "platform-do-CommandMaskandCompare 0x00000020 0x0c000000 0x00000020 0x00000006 0x12345678 "
+        "0x9abccba9 0x87654321",
+    "platform-do-CommandShiftBitStreamRight 0x00000021 0x0c000000 0x00000021 0x00000008 "
+        "0x00000001",
+    "platform-do-CommandShiftBitStreamLeft 0x00000022 0x0c000000 0x00000022 0x00000008 "
+        "0x00000001",
+    "platform-do-CommandMaskByteStream 0x00000023 0x0c000000 0x00000023 0x00000008 0x12345678 "
+        "0x9abcdef0",
+    "platform-do-CommandXorByteStream 0x00000024 0x0c000000 0x00000024 0x00000008 0x12345678 "
+        "0x9abcdef0",
+    "platform-do-CommandWriteI2CValueToSubAddr 0x00000025 0x0c000000 0x00000025 0x0000007f "
+        "0x00000002",
+    "platform-do-CommandORValueToByteStream 0x00000026 0x0c000000 0x00000026 0x00000002",
+    "platform-do-CommandImplementationSpecific 0x00000027 0x0c000000 0x00000027",
+    // Complex tests - command lists
+    "platform-do-CmdLWriteReadGPIO 0x00000201 0x0c000000 0x00000000 0x00000002 0x00000001 "
+        "0x00000001 0xfffffffe 0x00000002 0x00000002 0x00000001 0xfffffffd",
+    "platform-do-CmdL2WriteI2C 0x00000e0e 0x0c000000 0x00000000 0x00000002 0x0000000e "
+        "0x00000006 0x12345678 0x9abc0000 0x000e0000 0x00062345 0x6789abcd",
+    "platform-do-CmdL3WriteI2C 0x000e0e0e 0x0c000000 0x00000000 0x00000003 0x0000000e "
+        "0x00000006 0x12345678 0x9abc0000 0x000e0000 0x00062345 0x6789abcd 0x0000000e 0x00000006 "
+        "0x3456789a 0xbcde",
+    "platform-do-CmdLWI2CDlyMandC 0x0020090e 0x0c000000 0x00000000 0x00000003 0x0000000e "
+        "0x00000006 0x12345678 0x9abc0000 0x00090000 0x01000000 0x00200000 0x00061234 0x56789abc "
+        "0xcba98765 0x4321",
+    // Complex tests - multiple single commands
+    "platform-do-MplWI2CSubRMWI2CSub 0x00001917 0x0c000000 0x00000017 0x00000017 0x00000006 "
+        "0x12345678 0x9abc0000 0x00190c00 0x00000000 0x00190000 0x00190000 0x00060000 0x00060000 "
+        "0x00061234 0x56789abc 0xcba98765 0x4321",
+    "platform-do-MplRI2CWI2CRMWI2C 0x00151413 0x0c000000 0x0000000d 0x0000000d 0x0000000e "
+        "0x0c000000 0x0000000e 0x00000006 0x12345678 0x9abc0000 0x000f0c00 0x00000000 0x000f0000 "
+        "0x00060000 0x00060000 0x00061234 0x56789abc 0xcba98765 0x4321",
+    "platform-do-MplRCfgWCfgRMWCfg 0x000f0e0d 0x0c000000 0x00000013 0x00000013 0x00000002 "
+        "0x00000014 0x0c000000 0x00000014 0x00000014 0x00000006 0x12345678 0x9abc0000 0x00150c00 "
+        "0x00000000 0x00150000 0x00150000 0x00060000 0x00060000 0x00061234 0x56789abc 0xcba98765 "
+        "0x4321",
+    // Complex tests - mixed single commands and command lists
+    "platform-do-CmplxRCfgWCfgRMWCfgLWI2CDlyMC 0x000f0e0d 0x0c000000 0x00000013 0x00000013 "
+        "0x00000002 0x00000014 0x0c000000 0x00000014 0x00000014 0x00000006 0x12345678 0x9abc0000 "
+        "0x00150c00 0x00000000 0x00150000 0x00150000 0x00060000 0x00060000 0x00061234 0x56789abc "
+        "0xcba98765 0x43210020 0x090e0c00 0x00000000 0x00000000 0x00030000 0x000e0000 0x00061234 "
+        "0x56789abc 0x00000009 0x00000100 0x00000020 0x00000006 0x12345678 0x9abccba9 0x87654321",
+    "platform-do-CmplxLWI2CDlyMCRI2CWI2CRMWI2C 0x0020090e 0x0c000000 0x00000000 0x00000003 "
+        "0x0000000e 0x00000006 0x12345678 0x9abc0000 0x00090000 0x01000000 0x00200000 0x00061234 "
+        "0x56789abc 0xcba98765 0x43210015 0x14130c00 0x00000000 0x000d0000 0x000d0000 0x000e0c00 "
+        "0x00000000 0x000e0000 0x00061234 0x56789abc 0x0000000f 0x0c000000 0x0000000f 0x00000006 "
+        "0x00000006 0x00000006 0x12345678 0x9abccba9 0x87654321",
+    NULL
+};
+
+// platform-do properties the way a thermal chip's look
+static const char *gPFI2CVectors[] = {
+    // subaddress mode, config, 2 ms delay, three limits, PWM config
+    "platform-do-fan-init 0000a0b0 90000000 00000000 00000005 00000018 00000003 "
+        "00000017 00000040 00000001 01 00000009 000007d0 00000017 0000005c 00000003 626262 "
+        "00000017 0000007c 00000001 00",
+    // combined mode, read the PWM config, modify and write it back
+    "platform-do-fan-rmw 0000a0b0 08000000 00000000 00000003 00000018 00000004 "
+        "00000016 0000005c 00000003 00000019 0000005c 00000003 00000003 00000003 e0e0e0 c0c0c0",
+    "platform-do-fan-sleep 0000a0b0 20000000 00000000 00000003 00000018 00000003 "
+        "00000017 0000005c 00000003 e2e2e2 00000009 00001388",
+    "platform-do-read-status 0000a0b0 08000000 00000000 00000002 00000018 00000004 "
+        "00000016 00000041 00000002",
+    // a write, then a read longer than kI2CPF_READ_BUFFER_LEN
+    "platform-do-bad-length 0000a0b0 08000000 00000000 00000003 00000018 00000003 "
+        "00000017 00000040 00000001 01 00000016 00000000 00000028",
+    // no kCommandI2CMode
+    "platform-do-no-mode 0000a0b0 08000000 00000017 00000040 00000001 01",
+    NULL
+};
+
+typedef struct
+{
+    const UInt8             *bytes;
+    UInt32                  length;
+    IOReturn                status;             // decodePlatformFunctionStatus
+    I2CPFProgram            program;
+
+} PFBenchSet;
+
+typedef struct
+{
+    UInt8                   bytes[kPFBenchMaxBytes];
+    PFBenchSet              set[kPFBenchMaxSets];
+    int                     sets;
+
+} PFBenchVectors;
+
+// What a platform function did to the device
+typedef struct
+{
+    UInt8                   regs[256];
+    int                     locked;
+    UInt32                  locks;
+    UInt32                  transfers;
+    UInt32                  delayMs;
+    UInt32                  hash;
+    int                     fixedSubAddress;    // writes do not auto-increment: every byte lands in subAddress
+
+} PFBenchDevice;
+
+static UInt32 pfHash(UInt32 hash, UInt32 value) {
+    return (hash ^ value) * 16777619;
+}
+
+static IOReturn pfBenchLock(void *context, UInt32 *key) {
+    PFBenchDevice           *device = context;
+
+    if (device->locked)
+        return kIOReturnCannotLock;
+    device->locked = 1;
+    device->locks++;
+    device->hash = pfHash(device->hash, 'L');
+    *key = kPFBenchKey;
+    return kIOReturnSuccess;
+}
+
+static void pfBenchUnlock(void *context, UInt32 key) {
+    PFBenchDevice           *device = context;
+
+    device->locked = 0;
+    device->hash = pfHash(device->hash, 'U');
+}
+
+// Transfers only go through with the bus locked by the function itself.
+static IOReturn pfBenchTransfer(PFBenchDevice *device, UInt32 subAddress, UInt8 *buf, const UInt8 *data,
+                                UInt32 count, UInt32 key, UInt32 mode) {
+    UInt32                  i;
+
+    if (!device->locked || key != kPFBenchKey)
+        return kIOReturnNotOpen;
+
+    device->transfers++;
+    device->hash = pfHash(pfHash(pfHash(device->hash, subAddress), count), mode | (buf ? 0x100 : 0));
+    for (i = 0; i < count; i++) {
+        if (buf)
+            buf[i] = device->regs[(subAddress + i) & 0xFF];
+        else
+            device->regs[(subAddress + (device->fixedSubAddress ? 0 : i)) & 0xFF] = data[i];
+        device->hash = pfHash(device->hash, buf ? buf[i] : data[i]);
+    }
+    return kIOReturnSuccess;
+}
+
+static IOReturn pfBenchRead(void *context, UInt32 subAddress, UInt8 *buf, UInt32 count, UInt32 key,
+                            UInt32 mode) {
+    return pfBenchTransfer(context, subAddress, buf, NULL, count, key, mode);
+}
+
+static IOReturn pfBenchWrite(void *context, UInt32 subAddress, const UInt8 *buf, UInt32 count, UInt32 key,
+                             UInt32 mode) {
+    return pfBenchTransfer(context, subAddress, NULL, buf, count, key, mode);
+}
+
+static void pfBenchDelay(void *context, UInt32 ms) {
+    PFBenchDevice           *device = context;
+
+    device->delayMs += ms;
+    device->hash = pfHash(device->hash, 'D' + (ms << 8));
+}
+
+static void pfBenchReset(PFBenchDevice *device) {
+    UInt32                  i;
+
+    memset(device, 0, sizeof(*device));
+    for (i = 0; i < sizeof(device->regs); i++)
+        device->regs[i] = (UInt8)(i * 7 + 3);
+    device->hash = 2166136261u;
+}
+
+/*
+ * PFParse's scanString: the property name, then two hex digits per byte,
+ * anything else between them skipped.
+ */
+static UInt32 pfBenchParse(const char *line, UInt8 *bytes, UInt32 size) {
+    UInt32                  count = 0, nybbles = 0;
+    int                     digit;
+    UInt8                   byte = 0;
+
+    while (*line && *line != ' ')
+        line++;
+
+    for (; *line && count < size; line++) {
+        if (line[0] == '0' && (line[1] == 'x' || line[1] == 'X')) {
+            line++;
+            continue;
+        }
+        if (*line >= '0' && *line <= '9')
+            digit = *line - '0';
+        else if (*line >= 'a' && *line <= 'f')
+            digit = *line - 'a' + 10;
+        else if (*line >= 'A' && *line <= 'F')
+            digit = *line - 'A' + 10;
+        else
+            continue;
+
+        byte = (UInt8)((byte << 4) | digit);
+        if (++nybbles == 2) {
+            bytes[count++] = byte;
+            nybbles = 0;
+            byte = 0;
+        }
+    }
+    return count;
+}
+
+// Splits every property into command sets the way IOPlatformFunction does.
+static void pfBenchLoad(const char **lines, PFBenchVectors *vectors) {
+    UInt32                  used = 0, length, setLength, pHandle, flags;
+    const UInt8             *bytes;
+
+    vectors->sets = 0;
+    for (; *lines; lines++) {
+        bytes = vectors->bytes + used;
+        length = pfBenchParse(*lines, vectors->bytes + used, kPFBenchMaxBytes - used);
+        used += length;
+
+        while (length && vectors->sets < kPFBenchMaxSets) {
+            // what does not split is kept whole, the iterator fails on it every call
+            if (splitPlatformFunction(bytes, length, &setLength, &pHandle, &flags) != kIOPFNoError)
+                setLength = length;
+
+            vectors->set[vectors->sets].bytes = bytes;
+            vectors->set[vectors->sets].length = setLength;
+            vectors->sets++;
+
+            bytes += setLength;
+            length -= setLength;
+        }
+    }
+}
+
+static const I2CPFTarget *pfBenchTarget(PFBenchDevice *device) {
+    static I2CPFTarget      target = {
+        NULL, pfBenchLock, pfBenchUnlock, pfBenchRead, pfBenchWrite, pfBenchDelay
+    };
+
+    target.context = device;
+    return &target;
+}
+
+/*
+ * The program must do exactly what the interpreter does or, where the
+ * interpreter fails part way through, fail the same way without touching
+ * the device.
+ */
+static int pfBenchCheck(PFBenchVectors *vectors, const char *name) {
+    PFBenchDevice           interpreted, compiled;
+    PFBenchSet              *set;
+    IOReturn                interpretedStatus, compiledStatus;
+    int                     s;
+
+    for (s = 0; s < vectors->sets; s++) {
+        set = &vectors->set[s];
+
+        if (compileI2CPFProgram(set->bytes, set->length, &set->program) != kIOReturnSuccess) {
+            fprintf(stderr, "benchPlatformBursts: %s set %d does not fit a program\n", name, s);
+            return -1;
+        }
+
+        pfBenchReset(&interpreted);
+        pfBenchReset(&compiled);
+        interpretedStatus = interpretPlatformFunction(set->bytes, set->length, pfBenchTarget(&interpreted));
+        compiledStatus = runI2CPFProgram(&set->program, pfBenchTarget(&compiled));
+
+        if (interpretedStatus != compiledStatus) {
+            fprintf(stderr, "benchPlatformBursts: %s set %d returned 0x%x, interpreted 0x%x\n",
+                    name, s, compiledStatus, interpretedStatus);
+            return -1;
+        }
+
+        if (compiledStatus == kIOReturnSuccess) {
+            if (compiled.hash != interpreted.hash ||
+                    memcmp(compiled.regs, interpreted.regs, sizeof(compiled.regs))) {
+                fprintf(stderr, "benchPlatformBursts: %s set %d differs from the interpreter\n", name, s);
+                return -1;
+            }
+        } else if (compiled.locks || compiled.transfers || compiled.delayMs) {
+            fprintf(stderr, "benchPlatformBursts: %s set %d ran part way before failing\n", name, s);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * IOI2CDevice::performFunction before the functions were decoded at init,
+ * as it was written: both passes go on while "status != kIOPFNoError", so
+ * they stop at the first command that decodes. touched counts the bus
+ * locks taken and the commands the second pass would have run.
+ */
+static IOReturn pfBenchOldLoops(const UInt8 *set, UInt32 length, UInt32 *touched) {
+    PlatformCommandIterator iter;
+    PlatformCommand         command;
+    UInt32                  status = kIOReturnSuccess;
+    int                     isI2CFunction = 0;
+
+    startPlatformCommands(&iter, set, length);
+    while (nextPlatformCommand(&iter, &command, &status) && status != kIOPFNoError) {
+        if (command.command == kCommandReadI2CSubAddr || command.command == kCommandWriteI2CSubAddr) {
+            isI2CFunction = 1;
+            break;
+        }
+    }
+
+    if (status == kIOReturnSuccess && isI2CFunction)
+        (*touched)++;
+
+    if (status == kIOReturnSuccess) {
+        startPlatformCommands(&iter, set, length);
+        while (nextPlatformCommand(&iter, &command, &status) && status != kIOPFNoError)
+            (*touched)++;
+    }
+    return status;
+}
+
+/*
+ * What InitializePlatformFunctions keeps for each set must be what the old
+ * loops returned, and the old loops must not have touched the device.
+ */
+static int pfBenchStatusCheck(PFBenchVectors *vectors, const char *name, int *valid) {
+    PFBenchSet              *set;
+    IOReturn                oldStatus;
+    UInt32                  touched = 0;
+    int                     s;
+
+    *valid = 0;
+    for (s = 0; s < vectors->sets; s++) {
+        set = &vectors->set[s];
+        set->status = decodePlatformFunctionStatus(set->bytes, set->length);
+        oldStatus = pfBenchOldLoops(set->bytes, set->length, &touched);
+
+        if (set->status != oldStatus) {
+            fprintf(stderr, "benchPlatformFunctions: %s set %d decodes to 0x%x, the old loops returned 0x%x\n",
+                    name, s, set->status, oldStatus);
+            return -1;
+        }
+        if (touched) {
+            fprintf(stderr, "benchPlatformFunctions: %s set %d ran a command in the old loops\n", name, s);
+            return -1;
+        }
+        if (set->status == kIOReturnSuccess)
+            (*valid)++;
+    }
+    return 0;
+}
+
+static void pfBenchTime(PFBenchVectors *vectors, const char *name, int valid, int calls) {
+    volatile IOReturn       sink = 0;
+    double                  start, loops, lookup, decode, perSet;
+    UInt32                  touched = 0;
+    int                     i, s;
+
+    perSet = 1e3 / ((double)calls * vectors->sets);
+
+    start = benchNow();
+    for (i = 0; i < calls; i++)
+        for (s = 0; s < vectors->sets; s++)
+            sink = pfBenchOldLoops(vectors->set[s].bytes, vectors->set[s].length, &touched);
+    loops = benchNow() - start;
+
+    start = benchNow();
+    for (i = 0; i < calls; i++)
+        for (s = 0; s < vectors->sets; s++)
+            sink = vectors->set[s].status;
+    lookup = benchNow() - start;
+
+    start = benchNow();
+    for (i = 0; i < calls; i++)
+        for (s = 0; s < vectors->sets; s++)
+            sink = decodePlatformFunctionStatus(vectors->set[s].bytes, vectors->set[s].length);
+    decode = benchNow() - start;
+    (void)sink;
+
+    printf("%10s %5d %5d %14.1f %14.1f %12.1f\n", name, vectors->sets, valid,
+           loops * perSet, lookup * perSet, decode * perSet);
+}
+
+int benchPlatformFunctions(int calls) {
+    static PFBenchVectors   parse, i2c;
+    int                     parseValid, i2cValid;
+
+    if (calls <= 0)
+        return -1;
+
+    pfBenchLoad(gPFParseVectors, &parse);
+    pfBenchLoad(gPFI2CVectors, &i2c);
+
+    if (pfBenchStatusCheck(&parse, "PFParse", &parseValid) || pfBenchStatusCheck(&i2c, "I2C", &i2cValid))
+        return -1;
+
+    printf("IOI2CDevice::performFunction per command set, %d calls each, walking the property\n"
+           "words as before or returning the status decoded at init:\n", calls);
+    printf("%10s %5s %5s %14s %14s %12s\n", "vectors", "sets", "valid", "old loops ns", "decoded ns",
+           "decode ns");
+    pfBenchTime(&parse, "PFParse", parseValid, calls);
+    pfBenchTime(&i2c, "I2C", i2cValid, calls);
+    return 0;
+}
+
+/*
+ * callPlatformFunction as IOI2CADT746x, IOI2CDevice, IOI2CBus and
+ * IOI2CController did it, comparing the symbol against each function in
+ * turn, and as they do it now, through a FunctionTable. isEqualTo and
+ * callPlatformFunction are virtual in IOKit, so both go through function
+ * pointers here.
+ */
+
+enum
+{
+    kDispatchADT746x        = 1,
+    kDispatchDevice         = 2,
+    kDispatchBus            = 3,
+    kDispatchController     = 4,
+};
+
+enum
+{
+    kDispatchRead, kDispatchWrite, kDispatchLock, kDispatchUnlock, kDispatchClientRead,
+    kDispatchClientWrite, kDispatchCommandList, kDispatchSubmit, kDispatchPowerInterest,
+    kDispatchGetLockStats, kDispatchGetMaxLength, kDispatchSetDebugFlags, kDispatchGetSensorValue,
+    kDispatchPlatformDo, kDispatchSymbols
+};
+
+static const char *gDispatchNames[kDispatchSymbols] = {
+    kReadI2Cbus, kWriteI2Cbus, kLockI2Cbus, kUnlockI2Cbus, kIOI2CClientRead,
+    kIOI2CClientWrite, kCommandListI2Cbus, kSubmitI2Cbus, "IOI2CPowerStateInterest",
+    kIOI2CGetLockStats, kIOI2CGetMaxI2CDataLength, "IOI2CSetDebugFlags", "getSensorValue",
+    "platform-do-fan-init"
+};
+
+typedef struct DispatchSymbol
+{
+    const char              *name;
+    int                     index;
+    int                     (*isEqualTo)(const struct DispatchSymbol *symbol,
+                                         const struct DispatchSymbol *other);
+    int                     (*isEqualToString)(const struct DispatchSymbol *symbol, const char *name);
+
+} DispatchSymbol;
+
+typedef struct DispatchLayer
+{
+    IOReturn                (*callPlatformFunction)(struct DispatchLayer *layer, const DispatchSymbol *symbol,
+                                                    void *param1, void *param2, void *param3, void *param4);
+    struct DispatchLayer    *provider;
+    int                     kind;
+    int                     onDemand;           // fEnableOnDemandPlatformFunctions
+    UInt32                  bus;
+    FunctionTable           table;
+
+} DispatchLayer;
+
+static DispatchSymbol *gDispatchSymbol[kDispatchSymbols];
+
+static int dispatchIsEqualTo(const DispatchSymbol *symbol, const DispatchSymbol *other) {
+    return symbol == other;
+}
+
+static int dispatchIsEqualToString(const DispatchSymbol *symbol, const char *name) {
+    return 0 == strcmp(symbol->name, name);
+}
+
+#define kDispatchHandled(kind, symbol)  ((IOReturn)(0x10000 | ((kind) << 8) | (symbol)->index))
+#define DISPATCH_IS(n, symbol)          gDispatchSymbol[n]->isEqualTo(gDispatchSymbol[n], symbol)
+
+// IOService::callPlatformFunction
+static IOReturn dispatchToProvider(DispatchLayer *layer, const DispatchSymbol *symbol,
+                                   void *param1, void *param2, void *param3, void *param4) {
+    if (layer->provider == NULL)
+        return kIOReturnUnsupported;
+    return layer->provider->callPlatformFunction(layer->provider, symbol, param1, param2, param3, param4);
+}
+
+static IOReturn chainDevice(DispatchLayer *layer, const DispatchSymbol *symbol,
+                            void *param1, void *param2, void *param3, void *param4) {
+    if (DISPATCH_IS(kDispatchRead, symbol) || DISPATCH_IS(kDispatchWrite, symbol) ||
+            DISPATCH_IS(kDispatchLock, symbol) || DISPATCH_IS(kDispatchUnlock, symbol) ||
+            DISPATCH_IS(kDispatchClientRead, symbol) || DISPATCH_IS(kDispatchClientWrite, symbol) ||
+            symbol->isEqualToString(symbol, "IOI2CSetDebugFlags"))
+        return kDispatchHandled(kDispatchDevice, symbol);
+
+    if (layer->onDemand && 0 == strncmp("platform-do-", symbol->name, strlen("platform-do-")))
+        return kDispatchHandled(kDispatchDevice, symbol);
+
+    return dispatchToProvider(layer, symbol, param1, param2, param3, param4);
+}
+
+static IOReturn chainADT746x(DispatchLayer *layer, const DispatchSymbol *symbol,
+                             void *param1, void *param2, void *param3, void *param4) {
+    if (symbol->isEqualToString(symbol, "getSensorValue"))
+        return kDispatchHandled(kDispatchADT746x, symbol);
+    return chainDevice(layer, symbol, param1, param2, param3, param4);
+}
+
+static IOReturn chainBus(DispatchLayer *layer, const DispatchSymbol *symbol,
+                         void *param1, void *param2, void *param3, void *param4) {
+    IOI2CCommandList        *list;
+    UInt32                  i;
+
+    if (DISPATCH_IS(kDispatchRead, symbol) || DISPATCH_IS(kDispatchWrite, symbol) ||
+            DISPATCH_IS(kDispatchSubmit, symbol)) {
+        if (param1)
+            ((IOI2CCommand *)param1)->bus = layer->bus;
+    } else if (DISPATCH_IS(kDispatchLock, symbol) || DISPATCH_IS(kDispatchUnlock, symbol)) {
+        param1 = (void *)(uintptr_t)layer->bus;
+    } else if (DISPATCH_IS(kDispatchCommandList, symbol)) {
+        list = param1;
+        if (list && list->commands)
+            for (i = 0; i < list->count; i++)
+                list->commands[i].bus = layer->bus;
+    }
+    return dispatchToProvider(layer, symbol, param1, param2, param3, param4);
+}
+
+static IOReturn chainController(DispatchLayer *layer, const DispatchSymbol *symbol,
+                                void *param1, void *param2, void *param3, void *param4) {
+    if (DISPATCH_IS(kDispatchRead, symbol) || DISPATCH_IS(kDispatchWrite, symbol) ||
+            DISPATCH_IS(kDispatchLock, symbol) || DISPATCH_IS(kDispatchUnlock, symbol) ||
+            DISPATCH_IS(kDispatchCommandList, symbol) || DISPATCH_IS(kDispatchSubmit, symbol) ||
+            DISPATCH_IS(kDispatchPowerInterest, symbol) || DISPATCH_IS(kDispatchGetLockStats, symbol) ||
+            DISPATCH_IS(kDispatchGetMaxLength, symbol))
+        return kDispatchHandled(kDispatchController, symbol);
+    return dispatchToProvider(layer, symbol, param1, param2, param3, param4);
+}
+
+// Actions, as registered with registerI2CFunction and the classes' own tables
+static IOReturn actionHandled(void *target, const void *symbol, void *param1, void *param2,
+                              void *param3, void *param4) {
+    return kDispatchHandled(((DispatchLayer *)target)->kind, (const DispatchSymbol *)symbol);
+}
+
+static IOReturn actionSensor(void *target, const void *symbol, void *param1, void *param2,
+                             void *param3, void *param4) {
+    return kDispatchHandled(kDispatchADT746x, (const DispatchSymbol *)symbol);
+}
+
+static IOReturn actionCommandBus(void *target, const void *symbol, void *param1, void *param2,
+                                 void *param3, void *param4) {
+    if (param1)
+        ((IOI2CCommand *)param1)->bus = ((DispatchLayer *)target)->bus;
+    return dispatchToProvider(target, symbol, param1, param2, param3, param4);
+}
+
+static IOReturn actionLockBus(void *target, const void *symbol, void *param1, void *param2,
+                              void *param3, void *param4) {
+    return dispatchToProvider(target, symbol, (void *)(uintptr_t)((DispatchLayer *)target)->bus,
+                              param2, param3, param4);
+}
+
+static IOReturn actionCommandListBus(void *target, const void *symbol, void *param1, void *param2,
+                                     void *param3, void *param4) {
+    IOI2CCommandList        *list = param1;
+    UInt32                  i;
+
+    if (list && list->commands)
+        for (i = 0; i < list->count; i++)
+            list->commands[i].bus = ((DispatchLayer *)target)->bus;
+    return dispatchToProvider(target, symbol, param1, param2, param3, param4);
+}
+
+static IOReturn tableDispatch(DispatchLayer *layer, const DispatchSymbol *symbol,
+                              void *param1, void *param2, void *param3, void *param4) {
+    FunctionAction          action;
+
+    if ((action = lookupFunction(&layer->table, symbol)))
+        return action(layer, symbol, param1, param2, param3, param4);
+
+    if (layer->onDemand && 0 == strncmp("platform-do-", symbol->name, strlen("platform-do-")))
+        return kDispatchHandled(layer->kind, symbol);
+
+    return dispatchToProvider(layer, symbol, param1, param2, param3, param4);
+}
+
+static void dispatchInitLayer(DispatchLayer *layer, int kind, int table, DispatchLayer *provider) {
+    static const int        device[] = {
+        kDispatchRead, kDispatchWrite, kDispatchLock, kDispatchUnlock, kDispatchClientRead,
+        kDispatchClientWrite, kDispatchSetDebugFlags, -1
+    };
+    static const int        controller[] = {
+        kDispatchRead, kDispatchWrite, kDispatchLock, kDispatchUnlock, kDispatchCommandList,
+        kDispatchSubmit, kDispatchPowerInterest, kDispatchGetLockStats, kDispatchGetMaxLength, -1
+    };
+    const int               *handled = NULL;
+    int                     i;
+
+    memset(layer, 0, sizeof(*layer));
+    layer->kind = kind;
+    layer->provider = provider;
+    layer->bus = 0x100 | kind;
+    layer->onDemand = (kind == kDispatchDevice);
+    initFunctionTable(&layer->table);
+
+    switch (kind) {
+        case kDispatchADT746x:      layer->callPlatformFunction = chainADT746x;     handled = device;   break;
+        case kDispatchDevice:       layer->callPlatformFunction = chainDevice;      handled = device;   break;
+        case kDispatchBus:          layer->callPlatformFunction = chainBus;                             break;
+        case kDispatchController:   layer->callPlatformFunction = chainController;  handled = controller; break;
+    }
+    if (!table)
+        return;
+
+    layer->callPlatformFunction = tableDispatch;
+    for (i = 0; handled && handled[i] >= 0; i++)
+        addFunction(&layer->table, gDispatchSymbol[handled[i]], actionHandled);
+
+    if (kind == kDispatchADT746x) {
+        // registerI2CFunction from IOI2CADT746x::start
+        layer->kind = kDispatchDevice;
+        addFunction(&layer->table, gDispatchSymbol[kDispatchGetSensorValue], actionSensor);
+    } else if (kind == kDispatchBus) {
+        addFunction(&layer->table, gDispatchSymbol[kDispatchRead], actionCommandBus);
+        addFunction(&layer->table, gDispatchSymbol[kDispatchWrite], actionCommandBus);
+        addFunction(&layer->table, gDispatchSymbol[kDispatchSubmit], actionCommandBus);
+        addFunction(&layer->table, gDispatchSymbol[kDispatchLock], actionLockBus);
+        addFunction(&layer->table, gDispatchSymbol[kDispatchUnlock], actionLockBus);
+        addFunction(&layer->table, gDispatchSymbol[kDispatchCommandList], actionCommandListBus);
+    }
+}
+
+/*
+ * The old IOI2CDevice handled everything but getSensorValue itself and
+ * IOI2CADT746x's own comparison came first: kDispatchADT746x for the
+ * sensor, kDispatchDevice for the rest, just as the table version does.
+ */
+static IOReturn dispatchCall(DispatchLayer *layer, const DispatchSymbol *symbol, IOI2CCommand *cmd,
+                             IOI2CCommandList *list) {
+    void                    *param1 = NULL;
+
+    if (symbol->index == kDispatchCommandList)
+        param1 = list;
+    else if (symbol->index == kDispatchRead || symbol->index == kDispatchWrite ||
+             symbol->index == kDispatchSubmit)
+        param1 = cmd;
+    return layer->callPlatformFunction(layer, symbol, param1, NULL, NULL, NULL);
+}
+
+static int dispatchCheck(DispatchLayer *chain, DispatchLayer *table, const char *name) {
+    IOI2CCommand            cmd[2], listCmd[2][2];
+    IOI2CCommandList        list[2];
+    IOReturn                result[2];
+    int                     s, v;
+
+    for (s = 0; s < kDispatchSymbols; s++) {
+        for (v = 0; v < 2; v++) {
+            memset(&cmd[v], 0, sizeof(cmd[v]));
+            memset(listCmd[v], 0, sizeof(listCmd[v]));
+            memset(&list[v], 0, sizeof(list[v]));
+            list[v].commands = listCmd[v];
+            list[v].count = 2;
+            result[v] = dispatchCall(v ? table : chain, gDispatchSymbol[s], &cmd[v], &list[v]);
+        }
+        if (result[0] != result[1] || cmd[0].bus != cmd[1].bus || listCmd[0][1].bus != listCmd[1][1].bus) {
+            fprintf(stderr, "benchDispatch: %s dispatches %s to 0x%x, the table to 0x%x\n",
+                    name, gDispatchSymbol[s]->name, result[0], result[1]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Mean ns per call over the symbols the table layer classify handles
+ * itself, and over the ones it passes on to its provider.
+ */
+static void dispatchTime(DispatchLayer *layer, const DispatchLayer *classify, int calls,
+                         double *handled, double *passed) {
+    IOI2CCommand            cmd;
+    IOI2CCommandList        list;
+    volatile IOReturn       sink = 0;
+    double                  start, elapsed[2] = { 0, 0 };
+    int                     count[2] = { 0, 0 };
+    int                     s, i, isPassed;
+
+    memset(&cmd, 0, sizeof(cmd));
+    memset(&list, 0, sizeof(list));
+
+    for (s = 0; s < kDispatchSymbols; s++) {
+        isPassed = !lookupFunction(&classify->table, gDispatchSymbol[s]) &&
+                !(classify->onDemand && s == kDispatchPlatformDo);
+
+        start = benchNow();
+        for (i = 0; i < calls; i++)
+            sink = dispatchCall(layer, gDispatchSymbol[s], &cmd, &list);
+        elapsed[isPassed] += benchNow() - start;
+        count[isPassed]++;
+    }
+    (void)sink;
+
+    *handled = count[0] ? elapsed[0] * 1e3 / ((double)calls * count[0]) : 0;
+    *passed = count[1] ? elapsed[1] * 1e3 / ((double)calls * count[1]) : 0;
+}
+
+int benchDispatch(int calls) {
+    static const struct
+    {
+        const char          *name;
+        int                 kind;
+    }                       layers[] = {
+        { "IOI2CADT746x",   kDispatchADT746x },
+        { "IOI2CDevice",    kDispatchDevice },
+        { "IOI2CBus",       kDispatchBus },
+        { "IOI2CController", kDispatchController },
+    };
+    DispatchLayer           chain[4], table[4];
+    double                  chainHandled, chainPassed, tableHandled, tablePassed;
+    int                     i, failed = 0;
+
+    if (calls <= 0)
+        return -1;
+
+    for (i = 0; i < kDispatchSymbols; i++) {
+        if (gDispatchSymbol[i] == NULL && (gDispatchSymbol[i] = malloc(sizeof(DispatchSymbol))) == NULL)
+            return -1;
+        gDispatchSymbol[i]->name = gDispatchNames[i];
+        gDispatchSymbol[i]->index = i;
+        gDispatchSymbol[i]->isEqualTo = dispatchIsEqualTo;
+        gDispatchSymbol[i]->isEqualToString = dispatchIsEqualToString;
+    }
+
+    printf("callPlatformFunction dispatch, ns per call, each layer on its own with a provider\n"
+           "that returns at once, over the %d symbols the family uses, %d calls each:\n",
+           kDispatchSymbols, calls);
+    printf("%-16s %14s %14s %14s %14s\n", "layer", "chain handled", "table handled", "chain passed",
+           "table passed");
+
+    for (i = 0; i < 4; i++) {
+        dispatchInitLayer(&chain[i], layers[i].kind, 0, NULL);
+        dispatchInitLayer(&table[i], layers[i].kind, 1, NULL);
+        if (dispatchCheck(&chain[i], &table[i], layers[i].name))
+            return -1;
+
+        dispatchTime(&chain[i], &table[i], calls, &chainHandled, &chainPassed);
+        dispatchTime(&table[i], &table[i], calls, &tableHandled, &tablePassed);
+        printf("%-16s %14.1f %14.1f %14.1f %14.1f\n", layers[i].name, chainHandled, tableHandled,
+               chainPassed, tablePassed);
+    }
+
+    // an IOI2CADT746x on an IOI2CBus on an IOI2CController, the way a sensor read comes in
+    dispatchInitLayer(&chain[3], kDispatchController, 0, NULL);
+    dispatchInitLayer(&chain[2], kDispatchBus, 0, &chain[3]);
+    dispatchInitLayer(&chain[0], kDispatchADT746x, 0, &chain[2]);
+    dispatchInitLayer(&table[3], kDispatchController, 1, NULL);
+    dispatchInitLayer(&table[2], kDispatchBus, 1, &table[3]);
+    dispatchInitLayer(&table[0], kDispatchADT746x, 1, &table[2]);
+    if (dispatchCheck(&chain[0], &table[0], "the device stack"))
+        return -1;
+
+    dispatchTime(&chain[0], &table[0], calls, &chainHandled, &chainPassed);
+    dispatchTime(&table[0], &table[0], calls, &tableHandled, &tablePassed);
+    printf("%-16s %14.1f %14.1f %14.1f %14.1f\n", "whole stack", chainHandled, tableHandled,
+           chainPassed, tablePassed);
+    if (tableHandled > chainHandled || tablePassed > chainPassed) {
+        fprintf(stderr, "benchDispatch: the table is slower than the chain through the whole stack\n");
+        failed = 1;
+    }
+
+    // what every readI2C, lockI2CBus and unlockI2CBus of a device goes through
+    dispatchTime(&chain[2], &table[2], calls, &chainHandled, &chainPassed);
+    dispatchTime(&table[2], &table[2], calls, &tableHandled, &tablePassed);
+    printf("%-16s %14.1f %14.1f %14.1f %14.1f\n", "bus+controller", chainHandled, tableHandled,
+           chainPassed, tablePassed);
+
+    return failed ? -1 : 0;
+}
+
+/*
+ * IOI2CDevice::getPlatformFunction, performFunctionsWithFlags and
+ * performFunction(func) finding their functions by scanning
+ * fPlatformFuncArray, as before, or through a PlatformFunctionIndex, on
+ * synthetic devices. OSDynamicCast, isEqualTo, getPlatformFunctionName
+ * and getCommandFlags are virtual in IOKit, so the scan goes through
+ * function pointers here.
+ */
+
+#define kPFIndexBenchUnlisted   0x00010000      // a flag bit without a list of its own
+#define kPFIndexBenchAllFlags   (kIOPFFlagOnInit | kIOPFFlagOnTerm | kIOPFFlagOnSleep | kIOPFFlagOnWake | \
+                                 kIOPFFlagOnDemand)
+#define kPFIndexBenchAbsent     16              // names asked for that no function has
+
+typedef struct PFIndexSymbol
+{
+    char                    name[32];
+    int                     (*isEqualTo)(const struct PFIndexSymbol *symbol, const struct PFIndexSymbol *other);
+
+} PFIndexSymbol;
+
+typedef struct PFIndexObject
+{
+    const void              *metaClass;         // &gPFIndexFunctionClass for an IOPlatformFunction
+    const PFIndexSymbol     *name;
+    UInt32                  flags;
+    const PFIndexSymbol     *(*getPlatformFunctionName)(const struct PFIndexObject *func);
+    UInt32                  (*getCommandFlags)(const struct PFIndexObject *func);
+
+} PFIndexObject;
+
+typedef struct
+{
+    UInt32                  count;
+    PFIndexObject           *object;
+    PFIndexObject           **array;            // fPlatformFuncArray
+    UInt32                  nameCount;
+    PFIndexSymbol           *name;              // every name, then kPFIndexBenchAbsent more
+    PlatformFunctionIndex   index;
+
+} PFIndexDevice;
+
+static const int gPFIndexFunctionClass = 1;
+static const int gPFIndexDataClass = 2;
+
+static int pfIndexIsEqualTo(const PFIndexSymbol *symbol, const PFIndexSymbol *other) {
+    return symbol == other;
+}
+
+static const PFIndexSymbol *pfIndexGetName(const PFIndexObject *func) {
+    return func->name;
+}
+
+static UInt32 pfIndexGetFlags(const PFIndexObject *func) {
+    return func->flags;
+}
+
+static PFIndexObject *(*volatile pfIndexCast)(PFIndexObject *object);
+
+// OSDynamicCast(IOPlatformFunction, object)
+static PFIndexObject *pfIndexCastFunction(PFIndexObject *object) {
+    return (object && object->metaClass == &gPFIndexFunctionClass) ? object : NULL;
+}
+
+static UInt32 pfIndexRandom(UInt32 *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 16) & 0x7fff;
+}
+
+/*
+ * Mostly on-demand functions, as on the machines the family runs on, some
+ * run on sleep, wake, init or term, some interrupt generators, a few
+ * sharing a name under different flags and a few array elements that are
+ * not functions at all.
+ */
+static int pfIndexBuildDevice(PFIndexDevice *device, UInt32 count, UInt32 seed) {
+    PFIndexObject           *object;
+    UInt32                  i, r;
+
+    memset(device, 0, sizeof(*device));
+    device->count = count;
+    device->object = calloc(count, sizeof(*device->object));
+    device->array = calloc(count, sizeof(*device->array));
+    device->name = calloc(count + kPFIndexBenchAbsent, sizeof(*device->name));
+    if (!device->object || !device->array || !device->name)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        object = &device->object[i];
+        device->array[i] = object;
+
+        if (pfIndexRandom(&seed) % 100 < 2) {
+            object->metaClass = &gPFIndexDataClass;
+            continue;
+        }
+
+        object->metaClass = &gPFIndexFunctionClass;
+        object->getPlatformFunctionName = pfIndexGetName;
+        object->getCommandFlags = pfIndexGetFlags;
+
+        r = pfIndexRandom(&seed) % 100;
+        object->flags = r < 60 ? kIOPFFlagOnDemand :
+                        r < 70 ? kIOPFFlagOnSleep :
+                        r < 80 ? kIOPFFlagOnWake :
+                        r < 88 ? kIOPFFlagOnInit | kIOPFFlagOnDemand :
+                        r < 93 ? kIOPFFlagOnTerm :
+                        kIOPFFlagIntGen;
+        if (pfIndexRandom(&seed) % 100 < 3)
+            object->flags |= kPFIndexBenchUnlisted;
+
+        if (device->nameCount && pfIndexRandom(&seed) % 100 < 15)
+            object->name = &device->name[pfIndexRandom(&seed) % device->nameCount];
+        else {
+            snprintf(device->name[device->nameCount].name, sizeof(device->name[0].name),
+                     "platform-do-fn-%u", (unsigned)device->nameCount + 1);
+            object->name = &device->name[device->nameCount++];
+        }
+    }
+
+    for (i = 0; i < device->nameCount + kPFIndexBenchAbsent; i++)
+        device->name[i].isEqualTo = pfIndexIsEqualTo;
+    return 0;
+}
+
+// InitializePlatformFunctions
+static int pfIndexBuildIndex(PFIndexDevice *device) {
+    PFIndexObject           *func;
+    UInt32                  i;
+
+    if (allocatePlatformFunctionIndex(&device->index, device->count))
+        return -1;
+
+    for (i = 0; i < device->count; i++) {
+        if ((func = pfIndexCast(device->array[i])) != NULL)
+            addPlatformFunction(&device->index, func, func->getPlatformFunctionName(func),
+                                func->getCommandFlags(func));
+        else
+            addPlatformFunction(&device->index, NULL, NULL, 0);
+    }
+
+    return finishPlatformFunctionIndex(&device->index);
+}
+
+static void pfIndexFreeDevice(PFIndexDevice *device) {
+    freePlatformFunctionIndex(&device->index);
+    free(device->object);
+    free(device->array);
+    free(device->name);
+}
+
+// getPlatformFunction, the scan
+static SInt32 pfIndexScanFind(const PFIndexDevice *device, const PFIndexSymbol *name, UInt32 flags) {
+    PFIndexObject           *func;
+    UInt32                  i;
+
+    for (i = 0; i < device->count; i++) {
+        if ((func = pfIndexCast(device->array[i])) != NULL &&
+                name->isEqualTo(name, func->getPlatformFunctionName(func)) &&
+                (func->getCommandFlags(func) & flags))
+            return i;
+    }
+    return -1;
+}
+
+// performFunctionsWithFlags, the scan
+static UInt32 pfIndexScanGather(const PFIndexDevice *device, UInt32 flags, UInt32 *found) {
+    PFIndexObject           *func;
+    UInt32                  i, n = 0;
+
+    for (i = 0; i < device->count; i++) {
+        if ((func = pfIndexCast(device->array[i])) != NULL && (func->getCommandFlags(func) & flags))
+            found[n++] = i;
+    }
+    return n;
+}
+
+static UInt32 pfIndexGather(const PFIndexDevice *device, UInt32 flags, UInt32 *found) {
+    SInt32                  i;
+    UInt32                  n = 0;
+
+    for (i = nextPlatformFunctionWithFlags(&device->index, flags, 0); i >= 0;
+            i = nextPlatformFunctionWithFlags(&device->index, flags, i + 1))
+        found[n++] = i;
+    return n;
+}
+
+// performFunction(func), the scan for its decoded status
+static SInt32 pfIndexScanStatus(const PFIndexDevice *device, const PFIndexObject *func) {
+    UInt32                  i;
+
+    for (i = 0; i < device->count; i++) {
+        if (device->array[i] == func)
+            return i;
+    }
+    return -1;
+}
+
+static const UInt32 gPFIndexFindFlags[] = {
+    kIOPFFlagOnDemand, kPFIndexBenchAllFlags, kIOPFFlagOnSleep | kIOPFFlagOnWake, kIOPFFlagIntGen,
+    kPFIndexBenchUnlisted
+};
+
+static const UInt32 gPFIndexGatherFlags[] = {
+    kIOPFFlagOnSleep, kIOPFFlagOnWake, kIOPFFlagOnInit, kIOPFFlagOnTerm, kIOPFFlagIntGen,
+    kIOPFFlagOnSleep | kIOPFFlagOnDemand, kPFIndexBenchUnlisted, kPFIndexBenchUnlisted | kIOPFFlagOnTerm
+};
+
+#define kPFIndexFindFlags       (sizeof(gPFIndexFindFlags) / sizeof(gPFIndexFindFlags[0]))
+#define kPFIndexGatherFlags     (sizeof(gPFIndexGatherFlags) / sizeof(gPFIndexGatherFlags[0]))
+
+static int pfIndexCheck(const PFIndexDevice *device, UInt32 *scanFound, UInt32 *indexFound) {
+    const PFIndexSymbol     *name;
+    UInt32                  i, f, n;
+
+    for (i = 0; i < device->nameCount + kPFIndexBenchAbsent; i++) {
+        name = &device->name[i];
+        for (f = 0; f < kPFIndexFindFlags; f++) {
+            if (pfIndexScanFind(device, name, gPFIndexFindFlags[f]) !=
+                    findPlatformFunction(&device->index, name, gPFIndexFindFlags[f])) {
+                fprintf(stderr, "benchPlatformFunctionIndex: %u functions, %s with flags 0x%08x found "
+                        "at a different position\n", (unsigned)device->count, name->name,
+                        (unsigned)gPFIndexFindFlags[f]);
+                return -1;
+            }
+        }
+    }
+
+    for (f = 0; f < kPFIndexGatherFlags; f++) {
+        n = pfIndexScanGather(device, gPFIndexGatherFlags[f], scanFound);
+        if (n != pfIndexGather(device, gPFIndexGatherFlags[f], indexFound) ||
+                memcmp(scanFound, indexFound, n * sizeof(*scanFound))) {
+            fprintf(stderr, "benchPlatformFunctionIndex: %u functions, flags 0x%08x gather different "
+                    "functions\n", (unsigned)device->count, (unsigned)gPFIndexGatherFlags[f]);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < device->count; i++) {
+        if (device->array[i]->metaClass != &gPFIndexFunctionClass)
+            continue;
+        if (pfIndexScanStatus(device, device->array[i]) !=
+                indexOfPlatformFunction(&device->index, device->array[i], device->array[i]->name)) {
+            fprintf(stderr, "benchPlatformFunctionIndex: %u functions, function %u has a different "
+                    "status\n", (unsigned)device->count, (unsigned)i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+typedef struct
+{
+    double                  lookup[2];          // ns per on-demand getPlatformFunction, scan then index
+    double                  gather[2];          // ns per sleep or wake performFunctionsWithFlags
+    double                  status[2];          // ns per performFunction(func) status lookup
+    double                  build;              // us to build the index
+
+} PFIndexTimes;
+
+static void pfIndexTime(PFIndexDevice *device, int calls, UInt32 *found, PFIndexTimes *times) {
+    volatile SInt32         sink = 0;
+    double                  start;
+    UInt32                  i, functions = 0, passes;
+    int                     p, way;
+
+    for (i = 0; i < device->count; i++)
+        if (device->array[i]->metaClass == &gPFIndexFunctionClass)
+            functions++;
+
+    // about calls queries of each kind per device
+    for (way = 0; way < 2; way++) {
+        passes = (UInt32)calls / device->nameCount + 1;
+        start = benchNow();
+        for (p = 0; p < (int)passes; p++) {
+            for (i = 0; i < device->nameCount; i++)
+                sink = way ? findPlatformFunction(&device->index, &device->name[i], kIOPFFlagOnDemand) :
+                             pfIndexScanFind(device, &device->name[i], kIOPFFlagOnDemand);
+        }
+        times->lookup[way] = (benchNow() - start) * 1e3 / ((double)passes * device->nameCount);
+
+        passes = (UInt32)calls / 2 + 1;
+        start = benchNow();
+        for (p = 0; p < (int)passes; p++) {
+            sink = way ? pfIndexGather(device, kIOPFFlagOnSleep, found) :
+                         pfIndexScanGather(device, kIOPFFlagOnSleep, found);
+            sink = way ? pfIndexGather(device, kIOPFFlagOnWake, found) :
+                         pfIndexScanGather(device, kIOPFFlagOnWake, found);
+        }
+        times->gather[way] = (benchNow() - start) * 1e3 / (2.0 * passes);
+
+        passes = (UInt32)calls / functions + 1;
+        start = benchNow();
+        for (p = 0; p < (int)passes; p++) {
+            for (i = 0; i < device->count; i++) {
+                if (device->array[i]->metaClass != &gPFIndexFunctionClass)
+                    continue;
+                sink = way ? indexOfPlatformFunction(&device->index, device->array[i], device->array[i]->name) :
+                             pfIndexScanStatus(device, device->array[i]);
+            }
+        }
+        times->status[way] = (benchNow() - start) * 1e3 / ((double)passes * functions);
+    }
+
+    passes = (UInt32)calls / (device->count * 4) + 1;
+    start = benchNow();
+    for (p = 0; p < (int)passes; p++) {
+        freePlatformFunctionIndex(&device->index);
+        pfIndexBuildIndex(device);
+    }
+    times->build = (benchNow() - start) / passes;
+    (void)sink;
+}
+
+int benchPlatformFunctionIndex(int calls) {
+    static const UInt32     sizes[] = { 50, 200, 800 };
+    PFIndexDevice           device;
+    PFIndexTimes            times;
+    UInt32                  *scanFound, *indexFound;
+    UInt32                  s;
+    int                     failed = 0;
+
+    if (calls <= 0)
+        return -1;
+
+    pfIndexCast = pfIndexCastFunction;
+    scanFound = malloc(sizes[2] * sizeof(*scanFound));
+    indexFound = malloc(sizes[2] * sizeof(*indexFound));
+    if (!scanFound || !indexFound) {
+        free(scanFound);
+        free(indexFound);
+        return -1;
+    }
+
+    printf("IOI2CDevice platform functions found by scanning fPlatformFuncArray or through the\n"
+           "index built in InitializePlatformFunctions, ns per call, about %d calls each:\n", calls);
+    printf("%9s %12s %12s %12s %12s %12s %12s %9s\n", "functions", "lookup scan", "lookup index",
+           "gather scan", "gather index", "status scan", "status idx", "build us");
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && !failed; s++) {
+        if (pfIndexBuildDevice(&device, sizes[s], 0x5eed + s) || pfIndexBuildIndex(&device)) {
+            fprintf(stderr, "benchPlatformFunctionIndex: no memory for %u functions\n", (unsigned)sizes[s]);
+            failed = 1;
+        } else if (pfIndexCheck(&device, scanFound, indexFound))
+            failed = 1;
+        else {
+            pfIndexTime(&device, calls, scanFound, &times);
+            printf("%9u %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f %9.1f\n", (unsigned)sizes[s],
+                   times.lookup[0], times.lookup[1], times.gather[0], times.gather[1],
+                   times.status[0], times.status[1], times.build);
+
+            if (s == 2 && times.lookup[1] > times.lookup[0]) {
+                fprintf(stderr, "benchPlatformFunctionIndex: the index is slower than the scan\n");
+                failed = 1;
+            }
+        }
+        pfIndexFreeDevice(&device);
+    }
+
+    free(scanFound);
+    free(indexFound);
+    return failed ? -1 : 0;
+}
+
+/*
+ * Platform-do programs run as decoded and after optimizeI2CPFProgram has
+ * merged their writes, against the simulated device. Every merged program
+ * must leave the same registers, with the same registers at every delay,
+ * in no more transactions.
+ *
+ * A multi-byte write only fills consecutive registers on a device that
+ * auto-increments its subaddress, so merging is something a device opts
+ * into. The same vectors run against one that has and one that has not:
+ * the second gets no merging, and merging anyway must show up as a
+ * difference, or the check could not tell.
+ */
+
+#define kPFBurstBitUs           10              // 100 kHz
+#define kPFBurstOverhead        3               // address, subaddress and stop, in bytes
+
+// ADT746x style functions that write runs of registers
+static const char *gPFBurstVectors[] = {
+    // subaddress mode, Tmin and THERM limits one register at a time
+    "platform-do-fan-limits 0000a0b0 90000000 00000000 00000007 00000018 00000003 "
+        "00000017 00000067 00000001 50 00000017 00000068 00000001 50 00000017 00000069 00000001 50 "
+        "00000017 0000006a 00000001 64 00000017 0000006b 00000001 64 00000017 0000006c 00000001 64",
+    // PWM config and ranges, a 1 ms delay in the middle
+    "platform-do-fan-config 0000a0b0 90000000 00000000 00000006 00000018 00000003 "
+        "00000017 0000005c 00000003 626262 00000017 0000005f 00000003 c2c2c2 00000009 000003e8 "
+        "00000017 00000062 00000002 1122 00000017 00000064 00000001 33",
+    // standard mode has no subaddress to continue from
+    "platform-do-fan-standard 0000a0b0 08000000 00000000 00000003 00000018 00000002 "
+        "00000017 00000040 00000001 01 00000017 00000041 00000001 02",
+    // combined mode, the PWM config read twice (both reads stay), modified, then two writes
+    "platform-do-fan-rmw2 0000a0b0 08000000 00000000 00000006 00000018 00000004 "
+        "00000016 0000005c 00000003 00000016 0000005c 00000003 "
+        "00000019 0000005c 00000003 00000003 00000003 e0e0e0 c0c0c0 "
+        "00000017 0000005f 00000001 aa 00000017 00000060 00000001 bb",
+    // a gap between two writes, then runs longer than a small controller takes
+    "platform-do-fan-tables 0000a0b0 80000000 00000000 00000008 00000018 00000003 "
+        "00000017 00000040 00000001 01 00000017 00000042 00000001 02 "
+        "00000017 00000010 00000008 0102030405060708 00000017 00000018 00000008 1112131415161718 "
+        "00000017 00000020 00000008 2122232425262728 00000017 00000028 00000008 3132333435363738 "
+        "00000017 00000030 00000008 4142434445464748",
+    NULL
+};
+
+typedef struct
+{
+    PFBenchDevice           device;             // first, the PFBench target functions take this
+    UInt32                  atDelay;            // the registers at every delay
+    UInt32                  bytes;              // transferred
+
+} PFBurstDevice;
+
+static IOReturn pfBurstRead(void *context, UInt32 subAddress, UInt8 *buf, UInt32 count, UInt32 key,
+                            UInt32 mode) {
+    ((PFBurstDevice *)context)->bytes += count;
+    return pfBenchRead(context, subAddress, buf, count, key, mode);
+}
+
+static IOReturn pfBurstWrite(void *context, UInt32 subAddress, const UInt8 *buf, UInt32 count, UInt32 key,
+                             UInt32 mode) {
+    ((PFBurstDevice *)context)->bytes += count;
+    return pfBenchWrite(context, subAddress, buf, count, key, mode);
+}
+
+static void pfBurstDelay(void *context, UInt32 ms) {
+    PFBurstDevice           *device = context;
+    UInt32                  i;
+
+    pfBenchDelay(context, ms);
+    for (i = 0; i < sizeof(device->device.regs); i++)
+        device->atDelay = pfHash(device->atDelay, device->device.regs[i]);
+}
+
+static const I2CPFTarget *pfBurstTarget(PFBurstDevice *device, int fixedSubAddress) {
+    static I2CPFTarget      target = {
+        NULL, pfBenchLock, pfBenchUnlock, pfBurstRead, pfBurstWrite, pfBurstDelay
+    };
+
+    pfBenchReset(&device->device);
+    device->device.fixedSubAddress = fixedSubAddress;
+    device->atDelay = 2166136261u;
+    device->bytes = 0;
+    target.context = device;
+    return &target;
+}
+
+typedef struct
+{
+    UInt32                  instructions[2];    // as decoded, merged
+    UInt32                  transfers[2];
+    double                  busUs[2];
+    double                  runNs[2];
+
+} PFBurstTotals;
+
+// Set s merged into writes of up to maxBurst bytes, run both ways on the device. 0 if they match.
+static int pfBurstRun(PFBenchVectors *vectors, int s, UInt32 maxBurst, int fixedSubAddress,
+                      I2CPFProgram *merged, PFBurstDevice *decoded, PFBurstDevice *optimized) {
+    IOReturn                decodedStatus, optimizedStatus;
+
+    *merged = vectors->set[s].program;
+    optimizeI2CPFProgram(merged, maxBurst);
+
+    decodedStatus = runI2CPFProgram(&vectors->set[s].program, pfBurstTarget(decoded, fixedSubAddress));
+    optimizedStatus = runI2CPFProgram(merged, pfBurstTarget(optimized, fixedSubAddress));
+
+    return decodedStatus != optimizedStatus ||
+            memcmp(decoded->device.regs, optimized->device.regs, sizeof(decoded->device.regs)) ||
+            decoded->atDelay != optimized->atDelay || decoded->device.delayMs != optimized->device.delayMs ||
+            decoded->device.locks != optimized->device.locks ||
+            optimized->device.transfers > decoded->device.transfers;
+}
+
+// maxBurst is what the device gets: 0 unless it auto-increments and has said so.
+static int pfBurstCheck(PFBenchVectors *vectors, const char *name, UInt32 maxBurst, int fixedSubAddress,
+                        I2CPFProgram *merged, PFBurstTotals *totals) {
+    PFBurstDevice           decoded, optimized;
+    int                     s;
+
+    memset(totals, 0, sizeof(*totals));
+    for (s = 0; s < vectors->sets; s++) {
+        if (pfBurstRun(vectors, s, maxBurst, fixedSubAddress, &merged[s], &decoded, &optimized)) {
+            fprintf(stderr, "benchPlatformBursts: %s set %d merged into %u byte writes differs from "
+                    "the decoded program\n", name, s, (unsigned)maxBurst);
+            return -1;
+        }
+
+        totals->instructions[0] += vectors->set[s].program.count;
+        totals->instructions[1] += merged[s].count;
+        totals->transfers[0] += decoded.device.transfers;
+        totals->transfers[1] += optimized.device.transfers;
+        totals->busUs[0] += 9.0 * kPFBurstBitUs * (decoded.bytes + kPFBurstOverhead * decoded.device.transfers);
+        totals->busUs[1] += 9.0 * kPFBurstBitUs *
+                (optimized.bytes + kPFBurstOverhead * optimized.device.transfers);
+    }
+    return 0;
+}
+
+// Sets that merging into maxBurst byte writes changes on a device that does not auto-increment
+static int pfBurstUnsafe(PFBenchVectors *vectors, UInt32 maxBurst) {
+    PFBurstDevice           decoded, optimized;
+    I2CPFProgram            merged;
+    int                     s, differ = 0;
+
+    for (s = 0; s < vectors->sets; s++)
+        differ += pfBurstRun(vectors, s, maxBurst, 1, &merged, &decoded, &optimized);
+    return differ;
+}
+
+static void pfBurstTime(PFBenchVectors *vectors, const I2CPFProgram *merged, int fixedSubAddress, int calls,
+                        PFBurstTotals *totals) {
+    PFBurstDevice           device;
+    const I2CPFTarget       *target = pfBurstTarget(&device, fixedSubAddress);
+    double                  start;
+    int                     i, s;
+
+    start = benchNow();
+    for (i = 0; i < calls; i++)
+        for (s = 0; s < vectors->sets; s++)
+            runI2CPFProgram(&vectors->set[s].program, target);
+    totals->runNs[0] = (benchNow() - start) * 1e3 / ((double)calls * vectors->sets);
+
+    start = benchNow();
+    for (i = 0; i < calls; i++)
+        for (s = 0; s < vectors->sets; s++)
+            runI2CPFProgram(&merged[s], target);
+    totals->runNs[1] = (benchNow() - start) * 1e3 / ((double)calls * vectors->sets);
+}
+
+int benchPlatformBursts(int calls) {
+    static const struct
+    {
+        const char          *name;
+        const char          **lines;
+    }                       groups[] = {
+        { "PFParse",        gPFParseVectors },
+        { "I2C",            gPFI2CVectors },
+        { "bursts",         gPFBurstVectors },
+    };
+    static const struct
+    {
+        const char          *name;
+        int                 fixedSubAddress;
+        int                 optedIn;            // merging allowed for this device
+    }                       devices[] = {
+        { "auto-inc",       0,  1 },
+        { "fixed",          1,  0 },
+    };
+    static const UInt32     maxBursts[] = { 4, 32 };
+    static PFBenchVectors   vectors;
+    static I2CPFProgram     merged[kPFBenchMaxSets];
+    PFBurstTotals           totals;
+    UInt32                  b, d, g, maxBurst;
+    int                     unsafe;
+
+    if (calls <= 0)
+        return -1;
+
+    printf("platform-do programs as decoded and with their writes merged, per device and group\n"
+           "of command sets: instructions, transactions, time on a 100 kHz bus and ns per set on\n"
+           "the simulated device, %d calls each. Only the device that auto-increments its\n"
+           "subaddress on writes opts into merging:\n", calls);
+    printf("%5s %8s %8s %5s %7s %7s %6s %6s %9s %9s %8s %8s\n", "burst", "device", "vectors", "sets", "insns",
+           "merged", "xfers", "merged", "bus us", "merged", "run ns", "merged");
+
+    for (b = 0; b < sizeof(maxBursts) / sizeof(maxBursts[0]); b++) {
+        for (d = 0; d < sizeof(devices) / sizeof(devices[0]); d++) {
+            maxBurst = devices[d].optedIn ? maxBursts[b] : 0;
+
+            for (g = 0; g < sizeof(groups) / sizeof(groups[0]); g++) {
+                pfBenchLoad(groups[g].lines, &vectors);
+                if (pfBenchCheck(&vectors, groups[g].name) ||
+                        pfBurstCheck(&vectors, groups[g].name, maxBurst, devices[d].fixedSubAddress, merged,
+                                     &totals))
+                    return -1;
+                pfBurstTime(&vectors, merged, devices[d].fixedSubAddress, calls, &totals);
+
+                printf("%5u %8s %8s %5d %7u %7u %6u %6u %9.0f %9.0f %8.1f %8.1f\n", (unsigned)maxBursts[b],
+                       devices[d].name, groups[g].name, vectors.sets, (unsigned)totals.instructions[0],
+                       (unsigned)totals.instructions[1], (unsigned)totals.transfers[0],
+                       (unsigned)totals.transfers[1], totals.busUs[0], totals.busUs[1],
+                       totals.runNs[0], totals.runNs[1]);
+            }
+        }
+    }
+
+    // the check has to catch merging on a device that does not auto-increment
+    pfBenchLoad(gPFBurstVectors, &vectors);
+    if (pfBenchCheck(&vectors, "bursts"))
+        return -1;
+    unsafe = pfBurstUnsafe(&vectors, maxBursts[0]);
+    printf("merging anyway on the fixed device changes %d of %d burst sets\n", unsafe, vectors.sets);
+    if (unsafe == 0) {
+        fprintf(stderr, "benchPlatformBursts: merging on a device that does not auto-increment went "
+                "unnoticed\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * IOPlatformMonitor's event flow: sensor threads post events that the
+ * monitor's commandGateCaller handles one at a time under its command
+ * gate. Before, every event was an IOMalloc'd record and a thread call of
+ * its own, which blocks on the gate; here each is a malloc and a detached
+ * thread. Now events go through a PMonCommandRing and its one worker.
+ */
+
+#define kPMonBenchSensors       4               // posting threads
+#define kPMonBenchSubSensors    3               // sensor-ids per posting thread
+#define kPMonBenchWorkNs        2000            // commandGateCaller's time per event
+#define kPMonBenchWakeUs        200             // between a wake and the next sleep
+#define kPMonBenchWakeRounds    5               // stepped: pairs of hits per sleep and wake
+#define kPMonBenchStack         (64 * 1024)
+
+typedef struct
+{
+    pthread_mutex_t         gate;
+    UInt32                  handled;
+    UInt32                  last[kPMonBenchSensors][kPMonBenchSubSensors];
+    UInt32                  reordered;          // events handled after a newer one of their sensor,
+                                                // or before a wake posted ahead of them
+
+    // sleep and wake while the sensors post, on the ring paths
+    UInt32                  wakes;              // restores posted
+    UInt32                  restored;           // restores handled
+    UInt32                  *wakesBefore;       // restores posted before each event
+    UInt32                  events;             // per sensor, to index wakesBefore
+    volatile int            sensorsDone;
+
+    // the thread call per event path
+    pthread_mutex_t         lock;
+    pthread_cond_t          done;
+    UInt32                  outstanding;
+    UInt32                  allocations;
+    UInt32                  threads;
+    UInt32                  lost;
+    pthread_attr_t          attr;
+
+} PMonBench;
+
+typedef struct
+{
+    PMonBench               *bench;
+    PMonCommandRing         *ring;              // NULL for the thread call per event path
+    UInt32                  sensor;
+    UInt32                  events;
+    int                     retry;              // back off and post again when the ring is full
+    int                     distinct;           // a sensor-id per event, so none can merge
+
+} PMonBenchSensor;
+
+typedef struct
+{
+    PMonBench               *bench;
+    PMonCommand             command;
+
+} PMonBenchThreadSet;
+
+static void pmonBenchSpin(UInt32 ns) {
+    double                  end = benchNow() + ns / 1e3;
+
+    while (benchNow() < end)
+        ;
+}
+
+// commandGateCaller, under the gate
+static void pmonBenchHandle(void *refCon, const PMonCommand *command) {
+    PMonBench               *bench = refCon;
+    UInt32                  sensor = (UInt32)(uintptr_t)command->sensor;
+    UInt32                  *last = &bench->last[sensor][command->sensorID % kPMonBenchSubSensors];
+
+    pthread_mutex_lock(&bench->gate);
+    if (command->command != kPMonCommandHandleEvent) {
+        if (command->command == kPMonCommandRestoreState)
+            bench->restored++;
+        pthread_mutex_unlock(&bench->gate);
+        return;
+    }
+
+    pmonBenchSpin(kPMonBenchWorkNs);
+    bench->handled++;
+    if (command->value <= *last ||
+            (bench->wakesBefore && bench->wakesBefore[sensor * bench->events + command->value - 1] >
+            bench->restored))
+        bench->reordered++;
+    else
+        *last = command->value;
+    pthread_mutex_unlock(&bench->gate);
+}
+
+// executeCommandThread as it was
+static void *pmonBenchThread(void *arg) {
+    PMonBenchThreadSet      *threadSet = arg;
+    PMonBench               *bench = threadSet->bench;
+
+    pmonBenchHandle(bench, &threadSet->command);
+    free(threadSet);
+
+    pthread_mutex_lock(&bench->lock);
+    if (--bench->outstanding == 0)
+        pthread_cond_signal(&bench->done);
+    pthread_mutex_unlock(&bench->lock);
+    return NULL;
+}
+
+// handleEvent and threadCommon as they were
+static void pmonBenchPostThread(PMonBench *bench, const PMonCommand *command) {
+    PMonBenchThreadSet      *threadSet;
+    pthread_t               thread;
+
+    pthread_mutex_lock(&bench->lock);
+    bench->allocations++;
+    bench->outstanding++;
+    pthread_mutex_unlock(&bench->lock);
+
+    if ((threadSet = malloc(sizeof(*threadSet))) != NULL) {
+        threadSet->bench = bench;
+        threadSet->command = *command;
+        if (pthread_create(&thread, &bench->attr, pmonBenchThread, threadSet) == 0) {
+            pthread_mutex_lock(&bench->lock);
+            bench->threads++;
+            pthread_mutex_unlock(&bench->lock);
+            return;
+        }
+        free(threadSet);
+    }
+
+    pthread_mutex_lock(&bench->lock);
+    bench->lost++;
+    if (--bench->outstanding == 0)
+        pthread_cond_signal(&bench->done);
+    pthread_mutex_unlock(&bench->lock);
+}
+
+static void *pmonBenchSensor(void *arg) {
+    PMonBenchSensor         *sensor = arg;
+    PMonCommand             command;
+    UInt32                  i;
+
+    memset(&command, 0, sizeof(command));
+    command.command = kPMonCommandHandleEvent;
+    command.sensor = (const void *)(uintptr_t)sensor->sensor;
+    command.event = kPMonEventHighThresholdHit;
+
+    for (i = 0; i < sensor->events; i++) {
+        command.sensorID = sensor->distinct ? i : i % kPMonBenchSubSensors;
+        command.value = i + 1;
+        if (sensor->bench->wakesBefore)
+            sensor->bench->wakesBefore[sensor->sensor * sensor->events + i] =
+                    __sync_fetch_and_add(&sensor->bench->wakes, 0);
+
+        if (sensor->ring == NULL)
+            pmonBenchPostThread(sensor->bench, &command);
+        else {
+            while (postPMonCommand(sensor->ring, &command) == kIOReturnBusy) {
+                if (!sensor->retry)
+                    break;
+                sched_yield();
+            }
+        }
+    }
+    return NULL;
+}
+
+// a sleep and a wake at a time until the sensors are done, backing off when the ring is full
+static void *pmonBenchWake(void *arg) {
+    PMonBenchSensor         *sensor = arg;
+    PMonBench               *bench = sensor->bench;
+    PMonCommand             command;
+
+    memset(&command, 0, sizeof(command));
+    while (!bench->sensorsDone) {
+        command.command = kPMonCommandSaveState;
+        while (postPMonCommand(sensor->ring, &command) == kIOReturnBusy)
+            sched_yield();
+        command.command = kPMonCommandRestoreState;
+        while (postPMonCommand(sensor->ring, &command) == kIOReturnBusy)
+            sched_yield();
+
+        // only events posted from here on have to be handled after it
+        __sync_fetch_and_add(&bench->wakes, 1);
+        usleep(kPMonBenchWakeUs);
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    double                  eventsPerSec;
+    UInt32                  handled;
+    UInt32                  allocations;
+    UInt32                  threads;
+    UInt32                  lost;
+    UInt32                  reordered;
+    UInt32                  wakes;
+    PMonEventStats          stats;
+
+} PMonBenchResult;
+
+static int pmonBenchRun(UInt32 events, int useRing, int retry, int distinct, PMonBenchResult *result) {
+    PMonBench               bench;
+    PMonCommandRing         ring;
+    PMonBenchSensor         sensor[kPMonBenchSensors], waker;
+    pthread_t               thread[kPMonBenchSensors], wakeThread;
+    double                  start;
+    UInt32                  i;
+
+    memset(&bench, 0, sizeof(bench));
+    memset(result, 0, sizeof(*result));
+    pthread_mutex_init(&bench.gate, NULL);
+    pthread_mutex_init(&bench.lock, NULL);
+    pthread_cond_init(&bench.done, NULL);
+    pthread_attr_init(&bench.attr);
+    pthread_attr_setdetachstate(&bench.attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&bench.attr, kPMonBenchStack);
+
+    bench.events = events;
+    if (useRing) {
+        if ((bench.wakesBefore = calloc((size_t)events * kPMonBenchSensors, sizeof(UInt32))) == NULL)
+            return -1;
+        if (startPMonCommandRing(&ring, pmonBenchHandle, &bench) != kIOReturnSuccess) {
+            free(bench.wakesBefore);
+            return -1;
+        }
+        waker.bench = &bench;
+        waker.ring = &ring;
+        pthread_create(&wakeThread, NULL, pmonBenchWake, &waker);
+    }
+
+    start = benchNow();
+    for (i = 0; i < kPMonBenchSensors; i++) {
+        sensor[i].bench = &bench;
+        sensor[i].ring = useRing ? &ring : NULL;
+        sensor[i].sensor = i;
+        sensor[i].events = events;
+        sensor[i].retry = retry;
+        sensor[i].distinct = distinct;
+        pthread_create(&thread[i], NULL, pmonBenchSensor, &sensor[i]);
+    }
+    for (i = 0; i < kPMonBenchSensors; i++)
+        pthread_join(thread[i], NULL);
+
+    if (useRing) {
+        bench.sensorsDone = 1;
+        pthread_join(wakeThread, NULL);
+        waitPMonCommandRing(&ring);
+        result->stats = ring.stats;
+        stopPMonCommandRing(&ring);
+    } else {
+        pthread_mutex_lock(&bench.lock);
+        while (bench.outstanding)
+            pthread_cond_wait(&bench.done, &bench.lock);
+        pthread_mutex_unlock(&bench.lock);
+    }
+
+    result->eventsPerSec = (double)events * kPMonBenchSensors / ((benchNow() - start) / 1e6);
+    result->handled = bench.handled;
+    result->allocations = bench.allocations;
+    result->threads = bench.threads;
+    result->lost = bench.lost;
+    result->reordered = bench.reordered;
+    result->wakes = bench.wakes;
+    free(bench.wakesBefore);
+
+    pthread_attr_destroy(&bench.attr);
+    pthread_cond_destroy(&bench.done);
+    pthread_mutex_destroy(&bench.lock);
+    pthread_mutex_destroy(&bench.gate);
+
+    if (useRing && bench.reordered) {
+        fprintf(stderr, "benchPlatformMonitorEvents: a sensor's events were handled out of order\n");
+        return -1;
+    }
+    if (useRing && (result->stats.posted != result->handled + 2 * result->wakes ||
+            result->stats.processed != result->handled || bench.restored != result->wakes ||
+            result->stats.received < events * kPMonBenchSensors ||
+            result->handled + result->stats.coalesced + result->stats.merged + result->stats.dropped !=
+            result->stats.received)) {
+        fprintf(stderr, "benchPlatformMonitorEvents: %u handled, %u received, %u posted, %u coalesced, "
+                "%u merged, %u dropped out of %u events, %u of %u wakes handled\n",
+                (unsigned)result->handled, (unsigned)result->stats.received, (unsigned)result->stats.posted,
+                (unsigned)result->stats.coalesced, (unsigned)result->stats.merged,
+                (unsigned)result->stats.dropped, (unsigned)(events * kPMonBenchSensors),
+                (unsigned)bench.restored, (unsigned)result->wakes);
+        return -1;
+    }
+    // backing off, every event is handled or folded into one that is
+    if ((useRing && retry && result->handled + result->stats.coalesced + result->stats.merged !=
+            events * kPMonBenchSensors) ||
+            (!useRing && result->handled + result->lost != events * kPMonBenchSensors)) {
+        fprintf(stderr, "benchPlatformMonitorEvents: %u of %u events handled\n", (unsigned)result->handled,
+                (unsigned)(events * kPMonBenchSensors));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * The same ring stepped on one thread, so the order is the same every run:
+ * every sensor posts its threshold hits in pairs for the same sensor-id,
+ * and the worker catches up after each pair. The second hit of a pair
+ * coalesces into the first, except in every kPMonBenchWakeRounds'th pair,
+ * which has a sleep and a wake posted between its two hits.
+ */
+static int pmonBenchStepped(UInt32 events, PMonBenchResult *result) {
+    PMonBench               bench;
+    PMonCommandRing         ring;
+    PMonCommand             command, taken;
+    double                  start;
+    UInt32                  i, sensor;
+
+    memset(&bench, 0, sizeof(bench));
+    memset(result, 0, sizeof(*result));
+    bench.events = events;
+    if ((bench.wakesBefore = calloc((size_t)events * kPMonBenchSensors, sizeof(UInt32))) == NULL)
+        return -1;
+    if (startPMonCommandRing(&ring, NULL, NULL) != kIOReturnSuccess) {
+        free(bench.wakesBefore);
+        return -1;
+    }
+    pthread_mutex_init(&bench.gate, NULL);
+
+    memset(&command, 0, sizeof(command));
+    command.event = kPMonEventHighThresholdHit;
+    start = benchNow();
+    for (i = 0; i < events; i++) {
+        if (i % (2 * kPMonBenchWakeRounds) == 1) {
+            command.command = kPMonCommandSaveState;
+            postPMonCommand(&ring, &command);
+            command.command = kPMonCommandRestoreState;
+            postPMonCommand(&ring, &command);
+            bench.wakes++;
+        }
+
+        command.command = kPMonCommandHandleEvent;
+        command.sensorID = (i / 2) % kPMonBenchSubSensors;
+        command.value = i + 1;
+        for (sensor = 0; sensor < kPMonBenchSensors; sensor++) {
+            command.sensor = (const void *)(uintptr_t)sensor;
+            bench.wakesBefore[sensor * events + i] = bench.wakes;
+            postPMonCommand(&ring, &command);
+        }
+
+        if (i % 2 == 1 || i == events - 1) {
+            while (takePMonCommand(&ring, &taken))
+                pmonBenchHandle(&bench, &taken);
+        }
+    }
+
+    result->eventsPerSec = (double)events * kPMonBenchSensors / ((benchNow() - start) / 1e6);
+    result->handled = bench.handled;
+    result->reordered = bench.reordered;
+    result->wakes = bench.wakes;
+    result->stats = ring.stats;
+    stopPMonCommandRing(&ring);
+    pthread_mutex_destroy(&bench.gate);
+    free(bench.wakesBefore);
+
+    if (bench.reordered) {
+        fprintf(stderr, "benchPlatformMonitorEvents: %u events were handled out of order or run before "
+                "a wake posted ahead of them\n", (unsigned)bench.reordered);
+        return -1;
+    }
+    if (result->stats.dropped || bench.restored != bench.wakes ||
+            result->stats.posted != result->handled + 2 * bench.wakes ||
+            result->handled + result->stats.coalesced + result->stats.merged != events * kPMonBenchSensors) {
+        fprintf(stderr, "benchPlatformMonitorEvents: stepped, %u handled, %u coalesced, %u merged, "
+                "%u dropped out of %u events, %u of %u wakes handled\n", (unsigned)result->handled,
+                (unsigned)result->stats.coalesced, (unsigned)result->stats.merged,
+                (unsigned)result->stats.dropped, (unsigned)(events * kPMonBenchSensors),
+                (unsigned)bench.restored, (unsigned)bench.wakes);
+        return -1;
+    }
+    return 0;
+}
+
+static void pmonBenchReport(const char *name, UInt32 events, const PMonBenchResult *result) {
+    printf("%-16s %10.0f %9.2f %10.2f %8u %9u %9u %7u %7u %5u %5u\n", name, result->eventsPerSec,
+           (double)result->allocations / (events * kPMonBenchSensors),
+           (double)result->threads / (events * kPMonBenchSensors), (unsigned)result->handled,
+           (unsigned)result->reordered, (unsigned)result->stats.coalesced, (unsigned)result->stats.merged,
+           (unsigned)(result->stats.dropped + result->lost), (unsigned)result->stats.highWater,
+           (unsigned)result->wakes);
+}
+
+int benchPlatformMonitorEvents(int events) {
+    PMonBenchResult         result;
+
+    if (events <= 0)
+        return -1;
+
+    printf("IOPlatformMonitor events, %d sensor threads posting %d threshold events each as fast as\n"
+           "they can, handled under one gate at %d ns each. The ring paths also get a sleep and\n"
+           "a wake every %d us, which no event may be folded across:\n", kPMonBenchSensors, events,
+           kPMonBenchWorkNs, kPMonBenchWakeUs);
+    printf("%-16s %10s %9s %10s %8s %9s %9s %7s %7s %5s %5s\n", "path", "events/s", "allocs/ev", "threads/ev",
+           "handled", "reordered", "coalesced", "merged", "refused", "high", "wakes");
+
+    // every event its own sensor-id: nothing merges, everything is handled
+    if (pmonBenchRun(events, 0, 0, 1, &result))
+        return -1;
+    pmonBenchReport("thread per event", events, &result);
+
+    if (pmonBenchRun(events, 1, 1, 1, &result))
+        return -1;
+    pmonBenchReport("ring, back off", events, &result);
+
+    // three sensor-ids per sender: a threshold hit overwrites its sensor's queued one
+    if (pmonBenchRun(events, 1, 0, 0, &result))
+        return -1;
+    pmonBenchReport("ring, coalescing", events, &result);
+
+    // stepped, so that a hit is queued ahead of every wake with a newer one behind it
+    if (pmonBenchStepped(events, &result))
+        return -1;
+    pmonBenchReport("ring, stepped", events, &result);
+    return 0;
+}
+
+/*
+ * Portable2004_PlatformMonitor's thermal threshold events, replayed in
+ * simulated time. Each sensor polls every kThermalBenchPollMs and posts a
+ * threshold hit for as long as its value is outside the thresholds last
+ * armed, the way a sensor reports a value it is told about but not yet
+ * acted on. The monitor takes one command at a time out of a
+ * PMonCommandRing, and handleThermalEvent costs kThermalBenchEventMs,
+ * re-arming a sensor's thresholds kThermalBenchRearmMs more and
+ * adjustPlatformState kThermalBenchAdjustMs more, during which the sensors
+ * keep polling. The same traces run three ways: threshold hits posted as
+ * an event the ring does not coalesce, which is how it treated them
+ * before; coalesced; coalesced with updateThermalSensor's minimum dwell
+ * before a sensor is moved to a cooler state.
+ */
+
+#define kThermalBenchSensors    2
+#define kThermalBenchStates     4               // kMaxThermalStates
+#define kThermalBenchPollMs     100
+#define kThermalBenchEventMs    1
+#define kThermalBenchRearmMs    5               // setProperties to the sensor
+#define kThermalBenchAdjustMs   250             // adjustPlatformState's processor speed change
+#define kThermalBenchDwellMs    2000            // kThermalMinDwellMS
+#define kThermalBenchTraceMs    180000
+#define kThermalBenchSettleMs   20000           // steady at the end of each trace
+
+// PowerBook6,4 sensors 0 and 1, clamshell open, in tenths of a degree
+static const UInt32 gThermalBenchThresholds[kThermalBenchSensors][kThermalBenchStates][2] =
+{
+    { { 0, 540 }, { 520, 830 }, { 780, 930 }, { 880, 1170 } },
+    { { 0, 790 }, { 750, 830 }, { 780, 930 }, { 880, 1170 } },
+};
+
+typedef struct
+{
+    UInt32                  state;
+    UInt32                  low;                // thresholds the sensor reports outside of
+    UInt32                  high;
+    UInt32                  armedAt;
+    UInt32                  rearmed;            // re-armed at least once, armedAt is meaningful
+    int                     held;
+    UInt32                  heldValue;
+    UInt32                  heldState;
+    UInt32                  minGap;             // shortest time from a re-arm to one for a cooler state
+
+} ThermalBenchSensor;
+
+typedef struct
+{
+    int                     dwell;
+    ThermalBenchSensor      sensor[kThermalBenchSensors];
+    UInt32                  currentState;
+    UInt32                  timerAt;
+    int                     timerArmed;
+    UInt32                  rearms;
+    UInt32                  adjusts;
+    UInt32                  heldValues;
+
+} ThermalBench;
+
+typedef struct
+{
+    PMonEventStats          stats;
+    UInt32                  rearms;
+    UInt32                  adjusts;
+    UInt32                  heldValues;
+    UInt32                  minGap;
+    UInt32                  finalState[kThermalBenchSensors + 1];
+
+} ThermalBenchResult;
+
+// a trace's value at time t, noise from the trace's own generator
+static UInt32 thermalBenchValue(UInt32 sensor, UInt32 t, UInt32 *seed) {
+    SInt32                  base, noise;
+
+    *seed = *seed * 1103515245 + 12345;
+    noise = (SInt32)((*seed >> 16) % 51) - 25;                 // +-2.5 degrees
+
+    if (t >= kThermalBenchTraceMs - kThermalBenchSettleMs)
+        return (sensor == 0) ? 480 : 700;                       // steady, no noise
+
+    if (sensor == 1)
+        base = 770;                                             // across 75 and 79 all along
+    else if (t < 20000)
+        base = 450 + (SInt32)(t * 80 / 20000);
+    else if (t < 60000)
+        base = 530;                                             // across 52 and 54
+    else if (t < 80000)
+        base = 530 + (SInt32)((t - 60000) * 270 / 20000);
+    else if (t < 130000)
+        base = 800;                                             // across 78 and 83
+    else
+        base = 800 - (SInt32)((t - 130000) * 320 / 30000);
+    return (UInt32)(base + noise);
+}
+
+// Portable2004_PlatformMonitor::lookupThermalStateFromValue
+static UInt32 thermalBenchLookup(const ThermalBench *bench, UInt32 s, UInt32 value) {
+    UInt32                  i, state = bench->sensor[s].state;
+
+    if (state < kThermalBenchStates && value > gThermalBenchThresholds[s][state][0] &&
+            value < gThermalBenchThresholds[s][state][1])
+        return state;
+
+    if (value > gThermalBenchThresholds[s][0][0]) {
+        for (i = 0; i < kThermalBenchStates; i++)
+            if (value > gThermalBenchThresholds[s][i][0] && value < gThermalBenchThresholds[s][i][1])
+                return i;
+        return kThermalBenchStates;
+    }
+    return 0;
+}
+
+// armThermalDwellTimer
+static void thermalBenchArmTimer(ThermalBench *bench) {
+    UInt32                  s, at;
+
+    bench->timerArmed = 0;
+    for (s = 0; s < kThermalBenchSensors; s++) {
+        if (!bench->sensor[s].held)
+            continue;
+        at = bench->sensor[s].armedAt + kThermalBenchDwellMs;
+        if (!bench->timerArmed || at < bench->timerAt)
+            bench->timerAt = at;
+        bench->timerArmed = 1;
+    }
+}
+
+// setThermalThresholds, returns the ms it took
+static UInt32 thermalBenchArm(ThermalBench *bench, ThermalBenchSensor *sensor, UInt32 low, UInt32 high) {
+    sensor->low = low;
+    sensor->high = high;
+    bench->rearms++;
+    return kThermalBenchRearmMs;
+}
+
+// updateThermalSensor, returns the ms it took
+static UInt32 thermalBenchUpdate(ThermalBench *bench, UInt32 s, UInt32 value, UInt32 now) {
+    ThermalBenchSensor      *sensor = &bench->sensor[s];
+    UInt32                  i, state, maxState, ms = 0;
+
+    state = thermalBenchLookup(bench, s, value);
+    if (state >= kThermalBenchStates)
+        return ms;
+
+    if (state != sensor->state) {
+        if (bench->dwell && state < sensor->state && sensor->state < kThermalBenchStates &&
+                sensor->rearmed && now < sensor->armedAt + kThermalBenchDwellMs) {
+            sensor->heldValue = value;
+            bench->heldValues++;
+            // quiet until it cools further or gets hotter than its state allows
+            if (!sensor->held || sensor->heldState != state)
+                ms += thermalBenchArm(bench, sensor, gThermalBenchThresholds[s][state][0],
+                        gThermalBenchThresholds[s][sensor->state][1]);
+            sensor->heldState = state;
+            if (!sensor->held) {
+                sensor->held = 1;
+                thermalBenchArmTimer(bench);
+            }
+            return ms;
+        }
+
+        if (sensor->rearmed && state < sensor->state && now - sensor->armedAt < sensor->minGap)
+            sensor->minGap = now - sensor->armedAt;
+        sensor->held = 0;
+        sensor->armedAt = now;
+        sensor->rearmed = 1;
+        sensor->state = state;
+        ms += thermalBenchArm(bench, sensor, gThermalBenchThresholds[s][state][0],
+                gThermalBenchThresholds[s][state][1]);
+    } else if (sensor->held) {
+        // back in its state before the dwell ran out
+        sensor->held = 0;
+        ms += thermalBenchArm(bench, sensor, gThermalBenchThresholds[s][state][0],
+                gThermalBenchThresholds[s][state][1]);
+    }
+
+    if (bench->currentState != state) {
+        for (i = 0, maxState = 0; i < kThermalBenchSensors; i++)
+            if (bench->sensor[i].state > maxState)
+                maxState = bench->sensor[i].state;
+        if (bench->currentState != maxState && maxState < kThermalBenchStates) {
+            bench->currentState = maxState;
+            bench->adjusts++;
+            ms += kThermalBenchAdjustMs;
+        }
+    }
+    return ms;
+}
+
+// thermalDwellExpired
+static UInt32 thermalBenchExpired(ThermalBench *bench, UInt32 now) {
+    UInt32                  s, ms = 0;
+
+    for (s = 0; s < kThermalBenchSensors; s++) {
+        if (bench->sensor[s].held && now >= bench->sensor[s].armedAt + kThermalBenchDwellMs) {
+            bench->sensor[s].held = 0;
+            ms += thermalBenchUpdate(bench, s, bench->sensor[s].heldValue, now + ms);
+        }
+    }
+    thermalBenchArmTimer(bench);
+    return ms;
+}
+
+static int thermalBenchRun(UInt32 seed, int coalesce, int dwell, ThermalBenchResult *result) {
+    ThermalBench            bench;
+    PMonCommandRing         ring;
+    PMonCommand             command;
+    UInt32                  seeds[kThermalBenchSensors];
+    UInt32                  t, s, value, busyUntil = 0;
+    ThermalBenchSensor      *sensor;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.dwell = dwell;
+    for (s = 0; s < kThermalBenchSensors; s++) {
+        bench.sensor[s].minGap = kThermalBenchTraceMs;
+        bench.sensor[s].low = gThermalBenchThresholds[s][0][0];
+        bench.sensor[s].high = gThermalBenchThresholds[s][0][1];
+        seeds[s] = seed * 7919 + s;
+    }
+    if (startPMonCommandRing(&ring, NULL, NULL) != kIOReturnSuccess)
+        return -1;
+
+    memset(&command, 0, sizeof(command));
+    command.command = kPMonCommandHandleEvent;
+
+    for (t = 0; t < kThermalBenchTraceMs; t++) {
+        for (s = 0; s < kThermalBenchSensors; s++) {
+            if (t % kThermalBenchPollMs != s * kThermalBenchPollMs / kThermalBenchSensors)
+                continue;
+
+            value = thermalBenchValue(s, t, &seeds[s]);
+            sensor = &bench.sensor[s];
+            if (value > sensor->low && value < sensor->high)
+                continue;
+
+            command.sensor = &bench.sensor[s];
+            command.sensorID = s;
+            command.value = value;
+            if (coalesce)
+                command.event = (value <= sensor->low) ? kPMonEventLowThresholdHit : kPMonEventHighThresholdHit;
+            else
+                command.event = 5;              // kIOPMonMessageCurrentValue, never coalesced
+            postPMonCommand(&ring, &command);
+        }
+
+        // the gate: one command or timer action at a time
+        if (busyUntil > t)
+            continue;
+        if (bench.timerArmed && t >= bench.timerAt)
+            busyUntil = t + thermalBenchExpired(&bench, t);
+        else if (takePMonCommand(&ring, &command))
+            busyUntil = t + kThermalBenchEventMs + thermalBenchUpdate(&bench, command.sensorID, command.value, t);
+    }
+
+    result->stats = ring.stats;
+    stopPMonCommandRing(&ring);
+
+    result->rearms = bench.rearms;
+    result->adjusts = bench.adjusts;
+    result->heldValues = bench.heldValues;
+    result->minGap = kThermalBenchTraceMs;
+    for (s = 0; s < kThermalBenchSensors; s++) {
+        result->finalState[s] = bench.sensor[s].state;
+        if (bench.sensor[s].minGap < result->minGap)
+            result->minGap = bench.sensor[s].minGap;
+    }
+    result->finalState[kThermalBenchSensors] = bench.currentState;
+
+    if (dwell && result->minGap < kThermalBenchDwellMs) {
+        fprintf(stderr, "benchThermalEvents: thresholds re-armed for a cooler state %u ms after the last time\n",
+                (unsigned)result->minGap);
+        return -1;
+    }
+    if (result->stats.posted + result->stats.coalesced + result->stats.merged + result->stats.dropped !=
+            result->stats.received || result->stats.processed != result->stats.posted) {
+        fprintf(stderr, "benchThermalEvents: %u received, %u posted, %u coalesced, %u merged, %u dropped, "
+                "%u processed\n", (unsigned)result->stats.received, (unsigned)result->stats.posted,
+                (unsigned)result->stats.coalesced, (unsigned)result->stats.merged,
+                (unsigned)result->stats.dropped, (unsigned)result->stats.processed);
+        return -1;
+    }
+    return 0;
+}
+
+static void thermalBenchAdd(ThermalBenchResult *total, const ThermalBenchResult *result) {
+    total->stats.received += result->stats.received;
+    total->stats.coalesced += result->stats.coalesced;
+    total->stats.merged += result->stats.merged;
+    total->stats.dropped += result->stats.dropped;
+    total->stats.processed += result->stats.processed;
+    if (result->stats.highWater > total->stats.highWater)
+        total->stats.highWater = result->stats.highWater;
+    total->rearms += result->rearms;
+    total->adjusts += result->adjusts;
+    total->heldValues += result->heldValues;
+    if (result->minGap < total->minGap)
+        total->minGap = result->minGap;
+}
+
+int benchThermalEvents(int traces) {
+    static const struct
+    {
+        const char          *name;
+        int                 coalesce;
+        int                 dwell;
+    } paths[] = {
+        { "as before",          0, 0 },
+        { "coalesced",          1, 0 },
+        { "coalesced + dwell",  1, 1 },
+    };
+    ThermalBenchResult      total, result, first;
+    UInt32                  p, s;
+    int                     i;
+
+    if (traces <= 0)
+        return -1;
+
+    printf("Portable2004 thermal threshold events, %d traces of %d s, %d sensors polled every %d ms,\n"
+           "%d ms per event, +%d ms per re-arm, +%d ms per adjustPlatformState, %d ms dwell:\n",
+           traces, kThermalBenchTraceMs / 1000, kThermalBenchSensors, kThermalBenchPollMs,
+           kThermalBenchEventMs, kThermalBenchRearmMs, kThermalBenchAdjustMs, kThermalBenchDwellMs);
+    printf("%-18s %9s %9s %9s %9s %6s %7s %8s %7s %5s\n", "path", "received", "coalesced", "ring full",
+           "processed", "held", "re-arms", "adjusts", "gap ms", "high");
+
+    for (p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+        memset(&total, 0, sizeof(total));
+        total.minGap = kThermalBenchTraceMs;
+        for (i = 0; i < traces; i++) {
+            if (thermalBenchRun(i + 1, paths[p].coalesce, paths[p].dwell, &result))
+                return -1;
+            thermalBenchAdd(&total, &result);
+
+            // every path settles where the sensors are at the end of the trace
+            if (p == 0 && i == 0)
+                first = result;
+            for (s = 0; s <= kThermalBenchSensors; s++) {
+                if (result.finalState[s] != first.finalState[s]) {
+                    fprintf(stderr, "benchThermalEvents: %s trace %d ends in state %u instead of %u\n",
+                            paths[p].name, i + 1, (unsigned)result.finalState[s],
+                            (unsigned)first.finalState[s]);
+                    return -1;
+                }
+            }
+        }
+
+        printf("%-18s %9u %9u %9u %9u %6u %7u %8u %7u %5u\n", paths[p].name,
+               (unsigned)total.stats.received, (unsigned)total.stats.coalesced,
+               (unsigned)(total.stats.merged + total.stats.dropped), (unsigned)total.stats.processed,
+               (unsigned)total.heldValues, (unsigned)total.rearms, (unsigned)total.adjusts,
+               (unsigned)total.minGap, (unsigned)total.stats.highWater);
+    }
+    return 0;
+}
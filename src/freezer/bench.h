@@ -0,0 +1,273 @@
+/*
+ * bench.h
+ *
+ * Benchmarks run against the simulated ADT7467 (gSimBackend), selected
+ * with --bench <name>.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/*!
+	@function benchSnapshot
+	@abstract Full sensor refresh: one register per transaction vs. snapshot bursts.
+	@discussion Reports bus transactions, lock round trips and wall time per refresh.
+*/
+int benchSnapshot(int iterations);
+
+/*!
+	@function benchDiscovery
+	@abstract ADT746x discovery: registry walk per poll vs. the discovery cache.
+	@discussion Reports registry walks and wall time per poll for a cold cache,
+	a fresh process reading the topology file, a warm cache and the poll
+	after a registry change. Fails if a warm poll walks the registry.
+*/
+int benchDiscovery(int iterations);
+
+/*!
+	@function benchDecode
+	@abstract Batch decode of logged raw snapshots: per snapshot vs. decodeADT746xBatch.
+	@discussion Decodes samples pseudo-random register dumps with both, fails
+	unless every column matches for all 7460/7467 and attenuation settings,
+	then reports throughput in samples per second.
+*/
+int benchDecode(int samples);
+
+/*!
+	@function benchEvents
+	@abstract Thermal monitoring: fixed period polling vs. event driven sampling.
+	@discussion Runs the simulated ADT7467 off a virtual clock for hours of
+	an idle and a bursty load, and reports bus transactions, lock round
+	trips (one per wakeup) and full samples per hour, and how far the last
+	reported remote 1 temperature lagged the polled one. Fails if an event
+	run misses a move larger than its window.
+*/
+int benchEvents(int hours);
+
+/*!
+	@function benchPublish
+	@abstract Concurrent sensor readers: bus read per query vs. published snapshots.
+	@discussion Runs 1, 2, 4 ... maxReaders reader threads against the
+	simulated ADT7467 with a realistic transfer time. Each query either
+	takes the bus lock and reads the chip, or copies the snapshot a single
+	sampler thread publishes. Reports reads per second, median, 99th
+	percentile and worst query latency and the oldest snapshot a reader got. Fails if a reader
+	gets one older than the staleness limit, or with a message if
+	maxReaders is not 1 to 64.
+*/
+int benchPublish(int maxReaders);
+
+/*!
+	@function benchCompletion
+	@abstract PPCI2CInterface transfer completion: 1 ms sleep polling vs. spin then block.
+	@discussion Models the controller's interrupt status register with a
+	transfer that takes as long as its bytes do at 100 kHz, and waits for
+	transfers of 1, 2 and 16 data bytes the way waitForCompletion and the
+	interrupt driven path did before and do now. Prints a latency
+	histogram per waiter. Fails if the spinning waiters are not faster.
+*/
+int benchCompletion(int transfers);
+
+/*!
+	@function benchCommandList
+	@abstract 12 register refresh: one bus lock per command vs. one command list.
+	@discussion Reads the same 12 single byte registers with a lock round
+	trip per command, the way kIOI2C_CLIENT_KEY_DEFAULT transactions run,
+	and as one IOI2CCommandList, first without and then with a realistic
+	transfer and lock time. Reports transactions, locks and wall time per
+	refresh. Fails if a list takes more than one lock, or a mixed read and
+	write list with a bad command in it does not report the per command
+	status kI2CListOption_StopOnError asks for.
+*/
+int benchCommandList(int iterations);
+
+/*!
+	@function benchAsync
+	@abstract Polling devices behind PPC, PMU and SMU controllers: blocking
+	transactions one after the other vs. submitI2CAsync to every controller.
+	@discussion Models each controller's command overhead and 100 kHz wire
+	time and reads two bytes from four devices behind each per round.
+	Reports median and 99th percentile round time and how long the polling
+	thread spent submitting. Fails if a read goes wrong, the asynchronous
+	rounds are not clearly faster, or stopping a queue loses a completion.
+*/
+int benchAsync(int rounds);
+
+/*!
+	@function benchDeadline
+	@abstract One I2C bus with a device that hangs now and then: 5 second
+	transaction floor and FIFO queue vs. enforced deadlines, learned
+	timeouts and an earliest deadline first queue.
+	@discussion Simulates seconds of virtual time of four sensors read at
+	10 Hz with a 20 ms budget and a fifth device, without a timeout of its
+	own, that hangs 5% of its transactions and asks for a learned one. Reports the sensors' median and
+	99th percentile latency and missed budgets, and how long the worst hang
+	held the bus. Fails if the sensors' 99th percentile with deadlines and
+	the EDF queue is more than 1.5 times what it is without the fault.
+*/
+int benchDeadline(int seconds);
+
+/*!
+	@function benchBusLock
+	@abstract One I2C bus shared by emergency reads, control loops and
+	register dumps: FIFO bus lock vs. priority classes with aging.
+	@discussion Simulates seconds per lock of two control loops at 40 Hz,
+	an emergency read every 200 ms and three threads dumping registers one
+	transaction at a time, back to back. Time is simulated and the waiter
+	each unlock picks comes from nextI2CBusWaiter, so the results do not
+	depend on the host. Reports acquisitions and median, 99th percentile,
+	worst and mean lock wait per class, and completed dumps. Percentiles
+	come from histogram buckets and are capped at the worst wait. Fails if priorities do not shorten the control loop 99th
+	percentile and the emergency median, or if the dumps starve.
+*/
+int benchBusLock(int seconds);
+
+/*!
+	@function benchBulk
+	@abstract Dumping all 128 ADT7467 registers: kI2CUCBufSize inline reads
+	vs. one read through the buffer shared with the user client.
+	@discussion Runs dumps of each, first with only the struct copies the
+	user client makes, then with a modeled 20 us per call. Reports user
+	client calls and bytes copied between user and kernel side per dump,
+	and time per dump and per register. Fails if the mapped dump differs
+	from the inline one, is not clearly faster with the per call cost, if
+	a whole register file write through the shared buffer does not read
+	back, or if a transfer past the end of the buffer is accepted.
+*/
+int benchBulk(int dumps);
+
+/*!
+	@function benchShadow
+	@abstract Bus transactions of the AppleADT746x and IOI2CADT746x
+	register traffic with and without a register shadow.
+	@discussion Runs polls polls of each, the chip reset by a sleep every
+	100, and reports reads, writes, shadow hits and dropped writes per
+	poll. Fails if the last poll decodes differently with the shadow, if
+	it costs either driver transactions or saves AppleADT746x none, or if
+	write through, redundant writes, invalidation or live registers do not
+	behave.
+*/
+int benchShadow(int polls);
+
+/*!
+	@function benchFanControl
+	@abstract AppleFan's speed table vs. its PID controller, replayed
+	against a thermal model of an iBook.
+	@discussion Runs hours of idle, bursty, compile and browsing load
+	traces, and the load worked out from the recorded history at
+	historyPath unless it is NULL, with each controller. Reports the time
+	above the top of the speed table, peak temperature, mean temperature
+	swing between polls, mean fan duty cycle, and ADM1030 register writes
+	and fan speed changes per hour. Fails if PID spends longer hot than
+	the table on a built in trace, or writes the ADM1030 more often under
+	the sustained bursty and compile loads.
+*/
+int benchFanControl(int hours, const char *historyPath);
+
+/*!
+	@function benchDFS
+	@abstract Time MacRISC2CPU spends at kDFSHigh under AppleFan's table and
+	PID control, with and without CPU load feedforward.
+	@discussion Runs hours of the bursty, compile and browsing traces
+	through benchFanControl's thermal model, with the platform monitor
+	dropping the CPU to kDFSLow above the PowerBook6,5 CPU threshold.
+	Reports the time at kDFSHigh overall and while the CPU is busy, the
+	work done out of what the load asked for, peak temperature, mean fan
+	duty cycle and ADM1030 writes per hour. Fails if feedforward keeps a
+	busy CPU at kDFSHigh for less time than the same controller without it.
+*/
+int benchDFS(int hours);
+
+/*!
+	@function benchPlatformFunctions
+	@abstract IOI2CDevice::performFunction walking the platform-do commands
+	on every call against returning the status decoded at init.
+	@discussion Loads the PFParse test vectors and a set of ADT746x style
+	platform-do-xxx properties and checks that, for every command set,
+	decodePlatformFunctionStatus returns what performFunction's old loops
+	returned and that those loops ran no command. Reports the time per call
+	of the old loops, of returning the decoded status and of decoding it.
+	Fails on any mismatch.
+*/
+int benchPlatformFunctions(int calls);
+
+/*!
+	@function benchDispatch
+	@abstract callPlatformFunction dispatch through IOI2CADT746x,
+	IOI2CDevice, IOI2CBus and IOI2CController, comparing the symbol against
+	each function in turn as before or with one FunctionTable lookup.
+	@discussion Checks that both route every symbol the family uses to
+	the same place and fill in the same bus IDs, then reports ns per call
+	for the symbols each layer handles and for the ones it passes on, per
+	layer, for a whole device stack and for the bus and controller a read
+	goes through. Fails if the table is slower through the whole stack.
+*/
+int benchDispatch(int calls);
+
+/*!
+	@function benchPlatformFunctionIndex
+	@abstract Platform functions found by scanning IOI2CDevice's
+	fPlatformFuncArray against finding them through a PlatformFunctionIndex.
+	@discussion Builds synthetic devices with 50, 200 and 800 platform
+	functions, checks that the index finds the same function by name and
+	flags, gathers the same functions in the same order for every flag and
+	finds the same decoded status for every function as the scans do, then
+	reports ns per on-demand lookup, per sleep or wake gather and per status
+	lookup each way, and the time to build the index. Fails on any mismatch,
+	or if the index is slower at the on-demand lookup with 800 functions.
+*/
+int benchPlatformFunctionIndex(int calls);
+
+/*!
+	@function benchPlatformBursts
+	@abstract Platform-do programs as decoded against the same programs once
+	optimizeI2CPFProgram has merged their writes.
+	@discussion Checks that every command set of the PFParse, I2C and burst
+	test vectors compiles to a program that does what
+	interpretPlatformFunction does. Then runs each program both ways against
+	a simulated device that auto-increments its subaddress on writes and has
+	opted into merging, with writes of up to 4 and up to 32 bytes, and
+	against one that does not auto-increment and so is not merged. Checks
+	that the merged program returns the same status, leaves the same
+	registers, has the same registers at every delay and uses no more
+	transactions. Reports instructions, transactions, the time they take on a
+	100 kHz bus and ns per set each way. Fails on any mismatch, or if merging
+	the burst vectors on the device that does not auto-increment goes
+	unnoticed.
+*/
+int benchPlatformBursts(int calls);
+
+/*!
+	@function benchPlatformMonitorEvents
+	@abstract IOPlatformMonitor's event flow with a malloc and a thread per
+	event, as before, against a PMonCommandRing and its one worker.
+	@discussion Four sensor threads post events as fast as they can, each
+	handled under one gate. Reports events per second, allocations and
+	threads per event, events handled, handled after a newer event of the
+	same sensor or before a wake posted ahead of it, coalesced, merged and
+	refused, the ring's high water mark and the sleeps and wakes posted
+	alongside: once with senders that back off and post again on
+	kIOReturnBusy, once with senders that do not, and once stepped on one
+	thread with a wake between two hits of the same sensor. Fails if the
+	ring hands a sensor's events over out of order, runs one before a wake
+	posted ahead of it, or its counters do not add up.
+*/
+int benchPlatformMonitorEvents(int events);
+
+/*!
+	@function benchThermalEvents
+	@abstract Replays noisy temperature traces through Portable2004's thermal
+	event handling as before, with threshold hits coalesced in the ring, and
+	coalesced with the minimum dwell before a sensor moves to a cooler state.
+	@discussion Runs in simulated time, one sensor poll every 100 ms and
+	the monitor's work costed per event, re-arm and adjustPlatformState.
+	Reports events received, coalesced, dropped and processed, values held
+	back by the dwell, re-arms, adjustPlatformState calls, the shortest time
+	a sensor stayed in a state before it cooled, and the ring's high water
+	mark. Fails if a path ends the traces in a different thermal state, a
+	sensor cools sooner than the dwell allows or the ring's counters do not
+	add up.
+*/
+int benchThermalEvents(int traces);
+
+#endif // BENCH_H
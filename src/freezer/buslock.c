@@ -0,0 +1,110 @@
+/*
+ * buslock.c
+ *
+ * Prioritized I2C bus lock, see buslock.h.
+ */
+
+#include <string.h>
+#include <sys/time.h>
+#include "buslock.h"
+
+static UInt64 nowUs(void) {
+    struct timeval          tv;
+
+    gettimeofday(&tv, NULL);
+    return (UInt64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static UInt32 rankOf(UInt32 priority) {
+    if (priority == kI2CPriority_Default || priority > kI2CPriorityClasses)
+        priority = kI2CPriority_ControlLoop;
+    return priority - 1;
+}
+
+IOReturn initI2CBusLock(I2CBusLock *bus, int fifo) {
+    memset(bus, 0, sizeof(*bus));
+    bus->fifo = fifo;
+    bus->tail = &bus->head;
+
+    return pthread_mutex_init(&bus->lock, NULL) ? kIOReturnNoResources : kIOReturnSuccess;
+}
+
+void destroyI2CBusLock(I2CBusLock *bus) {
+    pthread_mutex_destroy(&bus->lock);
+}
+
+void lockI2CBusPriority(I2CBusLock *bus, UInt32 priority) {
+    I2CBusWaiter            waiter;
+    UInt64                  waitUs;
+
+    waiter.next = NULL;
+    waiter.rank = rankOf(priority);
+    waiter.granted = 0;
+    waiter.sinceUs = nowUs();
+
+    pthread_mutex_lock(&bus->lock);
+    if (!bus->held) {
+        bus->held = 1;
+        waitUs = 0;
+    } else {
+        pthread_cond_init(&waiter.wake, NULL);
+        *bus->tail = &waiter;
+        bus->tail = &waiter.next;
+        while (!waiter.granted)
+            pthread_cond_wait(&waiter.wake, &bus->lock);
+        pthread_cond_destroy(&waiter.wake);
+
+        waitUs = nowUs() - waiter.sinceUs;
+        if (waitUs > 0xffffffffULL)
+            waitUs = 0xffffffffULL;
+    }
+
+    bus->stats.acquired[waiter.rank]++;
+    bus->stats.waitTotal_uS[waiter.rank] += waitUs;
+    if (waitUs > bus->stats.waitMax_uS[waiter.rank])
+        bus->stats.waitMax_uS[waiter.rank] = (UInt32)waitUs;
+    pthread_mutex_unlock(&bus->lock);
+}
+
+I2CBusWaiter **nextI2CBusWaiter(I2CBusLock *bus, UInt64 nowUs) {
+    I2CBusWaiter            **link, **best = NULL;
+    UInt32                  rank, bestRank = kI2CPriorityClasses, aged;
+
+    if (bus->fifo)
+        return bus->head ? &bus->head : NULL;
+
+    for (link = &bus->head; *link; link = &(*link)->next) {
+        aged = (UInt32)((nowUs - (*link)->sinceUs) / (kI2CPriorityAgingMS * 1000));
+        rank = ((*link)->rank > aged) ? (*link)->rank - aged : 0;
+
+        // strictly better only: the earlier waiter wins a tie
+        if (rank < bestRank) {
+            best = link;
+            if (0 == (bestRank = rank))
+                break;
+        }
+    }
+    return best;
+}
+
+void unlockI2CBusPriority(I2CBusLock *bus) {
+    I2CBusWaiter            **best;
+    I2CBusWaiter            *next;
+
+    pthread_mutex_lock(&bus->lock);
+    if (NULL != (best = nextI2CBusWaiter(bus, nowUs()))) {
+        next = *best;
+        if (NULL == (*best = next->next))
+            bus->tail = best;
+        next->granted = 1;      // held stays set, the bus passes straight to next
+        pthread_cond_signal(&next->wake);
+    } else
+        bus->held = 0;
+    pthread_mutex_unlock(&bus->lock);
+}
+
+void getI2CBusLockStats(I2CBusLock *bus, IOI2CLockStats *stats) {
+    pthread_mutex_lock(&bus->lock);
+    *stats = bus->stats;
+    pthread_mutex_unlock(&bus->lock);
+}
@@ -0,0 +1,88 @@
+/*
+ * buslock.h
+ *
+ * Prioritized I2C bus lock, the user space counterpart of
+ * IOI2CPriorityLock.
+ *
+ * Waiters queue in arrival order with a kI2CPriority_xxx class. Unlocking
+ * hands the bus straight to the most urgent waiter, so an emergency
+ * thermal read never sits behind a diagnostics register dump, and a
+ * waiter moves up one class for every kI2CPriorityAgingMS it has waited,
+ * so diagnostics traffic is delayed, never starved. A lock started with
+ * fifo set ignores the classes and hands the bus over in arrival order,
+ * the way the single controller IOLock used to.
+ */
+
+#ifndef BUSLOCK_H
+#define BUSLOCK_H
+
+#include <pthread.h>
+#include "IOI2CDefs.h"
+
+typedef struct I2CBusWaiter
+{
+	struct I2CBusWaiter		*next;
+	pthread_cond_t			wake;
+	UInt32					rank;			// 0 most urgent, kI2CPriority_xxx - 1
+	int						granted;
+	UInt64					sinceUs;
+
+} I2CBusWaiter;
+
+/*!
+	@struct I2CBusLock
+	@abstract One bus, its waiters and their wait times per class.
+*/
+typedef struct
+{
+	pthread_mutex_t		lock;
+	int					held;
+	int					fifo;
+	I2CBusWaiter		*head;				// waiters in arrival order
+	I2CBusWaiter		**tail;
+	IOI2CLockStats		stats;
+
+} I2CBusLock;
+
+/*!
+	@function initI2CBusLock
+	@abstract Sets up an unheld lock, prioritized unless fifo is set.
+*/
+IOReturn initI2CBusLock(I2CBusLock *bus, int fifo);
+
+/*!
+	@function destroyI2CBusLock
+	@abstract Frees a lock nobody holds or waits for.
+*/
+void destroyI2CBusLock(I2CBusLock *bus);
+
+/*!
+	@function lockI2CBusPriority
+	@abstract Blocks until the caller holds the bus.
+	@discussion kI2CPriority_Default and out of range priorities count as
+	kI2CPriority_ControlLoop.
+*/
+void lockI2CBusPriority(I2CBusLock *bus, UInt32 priority);
+
+/*!
+	@function unlockI2CBusPriority
+	@abstract Hands the bus to the most urgent waiter, after aging, or releases it.
+*/
+void unlockI2CBusPriority(I2CBusLock *bus);
+
+/*!
+	@function nextI2CBusWaiter
+	@abstract The link to the waiter an unlock at nowUs hands the bus to, or NULL.
+	@discussion The most urgent class after aging, the earliest waiter within
+	it; the head of a fifo lock. The caller holds bus->lock, if the lock is
+	shared at all: the buslock bench runs it in simulated time.
+*/
+I2CBusWaiter **nextI2CBusWaiter(I2CBusLock *bus, UInt64 nowUs);
+
+/*!
+	@function getI2CBusLockStats
+	@abstract Copies the acquisition counts and wait times so far.
+*/
+void getI2CBusLockStats(I2CBusLock *bus, IOI2CLockStats *stats);
+
+#endif // BUSLOCK_H
@@ -0,0 +1,145 @@
+/*
+ * discovery.c
+ *
+ * Cached ADT746x discovery, see discovery.h.
+ *
+ * Topology file format, one text line per chip after the header:
+ *
+ *   freezer-topology <version> <registry epoch>
+ *   <controller> <bus> <address> <IOService path>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "discovery.h"
+
+#define kTopologyMagic      "freezer-topology"
+#define kTopologyVersion    1
+
+static const FreezerBackend *gCacheBackend;
+static ADT746xLocation      gCacheLocations[kMaxADT746xChips];
+static int                  gCacheCount = -1;   // -1 while nothing is cached
+static DiscoveryStats       gStats;
+
+static int loadTopology(const char *topologyPath, UInt64 epoch) {
+    FILE                    *file;
+    unsigned int            version, controller, bus, address;
+    unsigned long long      fileEpoch;
+    int                     count = 0;
+
+    if (NULL == (file = fopen(topologyPath, "r")))
+        return -1;
+
+    if (2 != fscanf(file, kTopologyMagic " %u %llu\n", &version, &fileEpoch) ||
+            version != kTopologyVersion || fileEpoch != epoch) {
+        fclose(file);
+        return -1;
+    }
+
+    while (count < kMaxADT746xChips &&
+            4 == fscanf(file, "%x %x %x %511[^\n]\n", &controller, &bus, &address,
+                        gCacheLocations[count].path)) {
+        gCacheLocations[count].controller = controller;
+        gCacheLocations[count].bus = bus;
+        gCacheLocations[count].address = address;
+        count++;
+    }
+
+    fclose(file);
+    return count;
+}
+
+static void saveTopology(const char *topologyPath, UInt64 epoch) {
+    FILE                    *file;
+    char                    tmpPath[1024];
+    int                     i;
+
+    // write aside and rename, a concurrent reader never sees half a file
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%d", topologyPath, (int)getpid());
+    if (NULL == (file = fopen(tmpPath, "w")))
+        return;
+
+    fprintf(file, kTopologyMagic " %u %llu\n", kTopologyVersion, (unsigned long long)epoch);
+    for (i = 0; i < gCacheCount; i++)
+        fprintf(file, "%x %x %x %s\n",
+                (unsigned)gCacheLocations[i].controller,
+                (unsigned)gCacheLocations[i].bus,
+                (unsigned)gCacheLocations[i].address,
+                gCacheLocations[i].path);
+
+    if (0 != fclose(file) || 0 != rename(tmpPath, topologyPath))
+        unlink(tmpPath);
+}
+
+static int copyCache(ADT746xLocation *locations, int maxLocations) {
+    int                     count = gCacheCount < maxLocations ? gCacheCount : maxLocations;
+
+    memcpy(locations, gCacheLocations, count * sizeof(*locations));
+    return count;
+}
+
+int findADT746xCached(const FreezerBackend *backend, const char *topologyPath,
+        ADT746xLocation *locations, int maxLocations) {
+    UInt64                  epoch = 0;
+    int                     changed, count;
+
+    if (backend->registryChanged == NULL || backend->registryEpoch == NULL) {
+        gStats.walks++;
+        return backend->findADT746x(locations, maxLocations);
+    }
+
+    if (gCacheBackend != backend) {
+        gCacheBackend = backend;
+        gCacheCount = -1;
+    }
+
+    // the first call arms the watch, anything published before is in the walk
+    changed = backend->registryChanged();
+    if (changed) {
+        gStats.invalidations++;
+        gCacheCount = -1;
+    }
+
+    if (gCacheCount >= 0) {
+        gStats.memoryHits++;
+        return copyCache(locations, maxLocations);
+    }
+
+    epoch = backend->registryEpoch();
+    if (!changed && topologyPath && epoch != 0 &&
+            0 < (count = loadTopology(topologyPath, epoch))) {
+        gStats.fileLoads++;
+        gCacheCount = count;
+        return copyCache(locations, maxLocations);
+    }
+
+    gStats.walks++;
+    count = backend->findADT746x(gCacheLocations, kMaxADT746xChips);
+    if (count < 0)
+        return count;
+
+    gCacheCount = count;
+    if (topologyPath && epoch != 0 && count > 0)
+        saveTopology(topologyPath, epoch);
+
+    return copyCache(locations, maxLocations);
+}
+
+void invalidateDiscoveryCache(const char *topologyPath) {
+    gCacheCount = -1;
+    if (topologyPath)
+        unlink(topologyPath);
+}
+
+void forgetDiscoveryCache(void) {
+    gCacheCount = -1;
+}
+
+void getDiscoveryStats(DiscoveryStats *stats) {
+    *stats = gStats;
+}
+
+void resetDiscoveryStats(void) {
+    memset(&gStats, 0, sizeof(gStats));
+}
@@ -0,0 +1,58 @@
+/*
+ * discovery.h
+ *
+ * Cached ADT746x discovery. The first lookup walks the IORegistry through
+ * the backend and saves the resolved controller/bus/address/path to a
+ * small topology file; later lookups, in this process or the next one,
+ * are served from memory or from that file. The cache is dropped when
+ * the backend reports an IOI2CADT746x publication or termination, or
+ * when the file was written during a different boot.
+ */
+
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include "backend.h"
+
+#define kDefaultTopologyPath	"/var/tmp/freezer.topology"
+
+/*!
+	@struct DiscoveryStats
+	@abstract How findADT746xCached answered since the last reset.
+*/
+typedef struct
+{
+	UInt32		walks;			// registry walks through backend->findADT746x
+	UInt32		memoryHits;
+	UInt32		fileLoads;
+	UInt32		invalidations;	// registry change notifications seen
+
+} DiscoveryStats;
+
+/*!
+	@function findADT746xCached
+	@abstract findADT746x with the discovery cache in front of it.
+	@param topologyPath file the topology is persisted to, NULL to keep it in memory only.
+	@result The number of locations filled in, or -1 on error.
+*/
+int findADT746xCached(const FreezerBackend *backend, const char *topologyPath,
+		ADT746xLocation *locations, int maxLocations);
+
+/*!
+	@function invalidateDiscoveryCache
+	@abstract Forget the cached topology, in memory and on disk.
+	@discussion For callers that find a cached location no longer opens.
+*/
+void invalidateDiscoveryCache(const char *topologyPath);
+
+/*!
+	@function forgetDiscoveryCache
+	@abstract Drops the in-memory copy only, the next lookup reads the file
+	as a fresh process would.
+*/
+void forgetDiscoveryCache(void);
+
+void getDiscoveryStats(DiscoveryStats *stats);
+void resetDiscoveryStats(void);
+
+#endif // DISCOVERY_H
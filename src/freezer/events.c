@@ -0,0 +1,143 @@
+/*
+ * events.c
+ *
+ * Event driven ADT7467 sampling, see events.h.
+ */
+
+#include <string.h>
+#include "events.h"
+
+#define kStatusRegCount         (kIntStatusReg2 - kIntStatusReg1 + 1)
+#define kStatus2DiodeFaults     (kStatus2Remote1Fault | kStatus2Remote2Fault)
+
+// offsets into the limit block, low limit first
+#define kLimitRemote1           (kRemote1TempLowLimit - kTempLimitBlockStart)
+#define kLimitLocal             (kLocalTempLowLimit - kTempLimitBlockStart)
+#define kLimitRemote2           (kRemote2TempLowLimit - kTempLimitBlockStart)
+
+static SInt32 clampLimit(SInt32 value, SInt32 min, SInt32 max) {
+    return (value < min) ? min : (value > max) ? max : value;
+}
+
+/*
+ * A channel trips when its value register goes above the high limit or
+ * down to the low limit, so the window is open on both sides by window
+ * degrees around the whole degree part of the last reading.
+ */
+static void setWindow(UInt8 *limits, int offset, SInt32 temp, int window) {
+    SInt32                  degrees = temp >> 16;
+
+    limits[offset] = (UInt8)(SInt8)clampLimit(degrees - window, -128, 127);
+    limits[offset + 1] = (UInt8)(SInt8)clampLimit(degrees + window, -128, 127);
+}
+
+/*
+ * Write the limit registers that differ from what the chip holds, one
+ * byte each: the ADT7467 only auto-increments on block reads.
+ */
+static IOReturn programLimits(ADT746xEventMonitor *monitor, const FreezerBackend *backend,
+        I2CConnection *connection, const ADT746xLocation *location, UInt32 clientKey,
+        const UInt8 *limits) {
+    IOReturn                status;
+    int                     i;
+
+    for (i = 0; i < kTempLimitBlockLength; i++) {
+        if (limits[i] == monitor->limits[i])
+            continue;
+
+        status = writeADT746xRegisters(backend, connection, location, clientKey,
+                                       kTempLimitBlockStart + i, &limits[i], 1);
+        if (status != kIOReturnSuccess)
+            return status;
+
+        monitor->limits[i] = limits[i];
+    }
+
+    return kIOReturnSuccess;
+}
+
+IOReturn startADT746xEvents(ADT746xEventMonitor *monitor, const FreezerBackend *backend,
+        I2CConnection *connection, const ADT746xLocation *location, UInt32 clientKey,
+        int window, UInt32 refreshMs) {
+    UInt8                   status[kStatusRegCount];
+    IOReturn                kr;
+
+    memset(monitor, 0, sizeof(*monitor));
+    monitor->window = (window < 1) ? 1 : window;
+    monitor->refreshMs = refreshMs;
+
+    kr = readADT746xRegisters(backend, connection, location, clientKey,
+                              kTempLimitBlockStart, monitor->savedLimits, kTempLimitBlockLength);
+    if (kr != kIOReturnSuccess)
+        return kr;
+
+    memcpy(monitor->limits, monitor->savedLimits, sizeof(monitor->limits));
+
+    // whatever latched under the old limits is of no interest
+    return readADT746xRegisters(backend, connection, location, clientKey,
+                                kIntStatusReg1, status, kStatusRegCount);
+}
+
+IOReturn stepADT746xEvents(ADT746xEventMonitor *monitor, const FreezerBackend *backend,
+        I2CConnection *connection, const ADT746xLocation *location, UInt32 clientKey,
+        UInt8 deviceID, UInt8 config2, UInt64 nowMs,
+        ADT746xSnapshot *snapshot, UInt8 *duty, int *sampled) {
+    UInt8                   status[kStatusRegCount];
+    UInt8                   limits[kTempLimitBlockLength];
+    int                     refresh;
+    IOReturn                kr;
+
+    *sampled = 0;
+
+    refresh = monitor->armed && monitor->refreshMs &&
+              nowMs - monitor->lastSampleMs >= monitor->refreshMs;
+
+    if (monitor->armed && !refresh) {
+        kr = readADT746xRegisters(backend, connection, location, clientKey,
+                                  kIntStatusReg1, status, kStatusRegCount);
+        if (kr != kIOReturnSuccess)
+            return kr;
+
+        if (!(status[0] & kStatus1TempMask) && !(status[1] & kStatus2DiodeFaults)) {
+            monitor->statusReads++;
+            return kIOReturnSuccess;
+        }
+
+        monitor->events++;
+    } else if (refresh) {
+        monitor->refreshes++;
+    }
+
+    kr = readADT746xSample(backend, connection, location, clientKey, deviceID, config2,
+                           snapshot, duty);
+    if (kr != kIOReturnSuccess)
+        return kr;
+
+    *sampled = 1;
+    monitor->lastSampleMs = nowMs;
+
+    /*
+     * A conversion that finishes between the sample and the new limits can
+     * still latch against the old window; that costs one extra sample on
+     * the next step, not a missed excursion.
+     */
+    setWindow(limits, kLimitRemote1, snapshot->remote1Temp, monitor->window);
+    setWindow(limits, kLimitLocal, snapshot->localTemp, monitor->window);
+    setWindow(limits, kLimitRemote2, snapshot->remote2Temp, monitor->window);
+
+    kr = programLimits(monitor, backend, connection, location, clientKey, limits);
+    if (kr != kIOReturnSuccess) {
+        monitor->armed = 0;
+        return kr;
+    }
+
+    monitor->armed = 1;
+    return kIOReturnSuccess;
+}
+
+IOReturn stopADT746xEvents(ADT746xEventMonitor *monitor, const FreezerBackend *backend,
+        I2CConnection *connection, const ADT746xLocation *location, UInt32 clientKey) {
+    monitor->armed = 0;
+    return programLimits(monitor, backend, connection, location, clientKey,
+                         monitor->savedLimits);
+}
@@ -0,0 +1,87 @@
+/*
+ * events.h
+ *
+ * Event driven ADT7467 sampling for freezer --events.
+ *
+ * Instead of fetching the whole sensor block every interval, the monitor
+ * programs the temperature limit registers (0x4E-0x53) to a window around
+ * the last sample and only reads the two interrupt status registers each
+ * interval. The chip latches a status bit as soon as a channel leaves its
+ * window, which costs the same one transaction as a single register read;
+ * only then is a full sample taken and the window moved. A keepalive
+ * sample every refreshMs keeps fan and voltage readings from going stale
+ * while the temperatures are flat.
+ *
+ * The limit registers are shared with whatever else programs the chip;
+ * the monitor saves them when it starts and puts them back when it stops.
+ * The SMBALERT mask registers are left alone, the status registers latch
+ * regardless of the mask.
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "snapshot.h"
+
+#define kDefaultEventWindow		2		// degrees C either side of the last sample
+#define kDefaultEventRefreshMs	60000	// keepalive sample period
+
+/*!
+	@struct ADT746xEventMonitor
+	@abstract State of one chip's event driven sampling.
+	@field window degrees C either side of the last sample before a channel trips
+	@field refreshMs keepalive sample period, 0 for none
+	@field savedLimits limit registers as found by startADT746xEvents
+	@field limits limit registers as last programmed
+	@field armed limits hold a window around the last sample
+	@field lastSampleMs time of the last full sample
+	@field statusReads status polls that found nothing to do
+	@field events samples taken because a channel left its window
+	@field refreshes keepalive samples
+*/
+typedef struct
+{
+	int			window;
+	UInt32		refreshMs;
+	UInt8		savedLimits[kTempLimitBlockLength];
+	UInt8		limits[kTempLimitBlockLength];
+	int			armed;
+	UInt64		lastSampleMs;
+	UInt32		statusReads;
+	UInt32		events;
+	UInt32		refreshes;
+
+} ADT746xEventMonitor;
+
+/*!
+	@function startADT746xEvents
+	@abstract Saves the limit registers and clears the latched status.
+	@discussion Two transactions. The first stepADT746xEvents call samples
+	and arms the window.
+*/
+IOReturn startADT746xEvents(ADT746xEventMonitor *monitor, const FreezerBackend *backend,
+		I2CConnection *connection, const ADT746xLocation *location, UInt32 clientKey,
+		int window, UInt32 refreshMs);
+
+/*!
+	@function stepADT746xEvents
+	@abstract One monitoring interval.
+	@discussion Reads the interrupt status registers, and takes a full
+	sample into snapshot and duty when a temperature channel left its
+	window, a remote diode faulted, the keepalive period ran out or the
+	monitor is not armed yet. sampled tells which happened. Programming a
+	new window writes only the limit registers that change.
+*/
+IOReturn stepADT746xEvents(ADT746xEventMonitor *monitor, const FreezerBackend *backend,
+		I2CConnection *connection, const ADT746xLocation *location, UInt32 clientKey,
+		UInt8 deviceID, UInt8 config2, UInt64 nowMs,
+		ADT746xSnapshot *snapshot, UInt8 *duty, int *sampled);
+
+/*!
+	@function stopADT746xEvents
+	@abstract Restores the limit registers saved by startADT746xEvents.
+*/
+IOReturn stopADT746xEvents(ADT746xEventMonitor *monitor, const FreezerBackend *backend,
+		I2CConnection *connection, const ADT746xLocation *location, UInt32 clientKey);
+
+#endif // EVENTS_H
@@ -0,0 +1,50 @@
+/*
+ * functable.c
+ *
+ * callPlatformFunction dispatch by symbol identity, see functable.h.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "functable.h"
+
+static UInt32 hashSymbol(const void *symbol) {
+    // allocations are at least 16 byte aligned, the low bits say nothing
+    return ((UInt32)((uintptr_t)symbol >> 4) * 2654435761U) >> 27;
+}
+
+void initFunctionTable(FunctionTable *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+int addFunction(FunctionTable *table, const void *symbol, FunctionAction action) {
+    UInt32                  i;
+
+    if (symbol == NULL || action == NULL)
+        return -1;
+
+    for (i = hashSymbol(symbol); table->entry[i].symbol; i = (i + 1) & (kFunctionTableSize - 1)) {
+        if (table->entry[i].symbol == symbol) {
+            table->entry[i].action = action;
+            return 0;
+        }
+    }
+
+    if (table->count >= kFunctionTableMaxEntries)
+        return -1;
+
+    table->entry[i].action = action;
+    table->entry[i].symbol = symbol;
+    table->count++;
+    return 0;
+}
+
+FunctionAction lookupFunction(const FunctionTable *table, const void *symbol) {
+    UInt32                  i;
+
+    for (i = hashSymbol(symbol); table->entry[i].symbol; i = (i + 1) & (kFunctionTableSize - 1)) {
+        if (table->entry[i].symbol == symbol)
+            return table->entry[i].action;
+    }
+    return NULL;
+}
@@ -0,0 +1,54 @@
+/*
+ * functable.h
+ *
+ * callPlatformFunction dispatch by symbol identity, the user space
+ * counterpart of IOI2CFunctionTable.
+ *
+ * Symbols are interned, so the address of one is enough to find its
+ * entry: one hash and usually one probe, however many functions a layer
+ * handles. The table is filled in before it is shared and only read
+ * afterwards.
+ */
+
+#ifndef FUNCTABLE_H
+#define FUNCTABLE_H
+
+#include "IOI2CDefs.h"
+
+#define kFunctionTableSize			32		// power of two
+#define kFunctionTableMaxEntries	24		// keeps probe sequences short and one slot always empty
+
+/*!
+	@typedef FunctionAction
+	@abstract Handles one symbol for target, IOI2CFunctionAction.
+*/
+typedef IOReturn (*FunctionAction)(void *target, const void *symbol, void *param1, void *param2,
+		void *param3, void *param4);
+
+typedef struct
+{
+	struct
+	{
+		const void			*symbol;
+		FunctionAction		action;
+	}					entry[kFunctionTableSize];
+	UInt32				count;
+
+} FunctionTable;
+
+void initFunctionTable(FunctionTable *table);
+
+/*!
+	@function addFunction
+	@abstract Routes symbol to action, replacing any action it had.
+	@result 0, or -1 if symbol is NULL or the table is full.
+*/
+int addFunction(FunctionTable *table, const void *symbol, FunctionAction action);
+
+/*!
+	@function lookupFunction
+	@result The action registered for symbol, NULL if there is none.
+*/
+FunctionAction lookupFunction(const FunctionTable *table, const void *symbol);
+
+#endif // FUNCTABLE_H
@@ -0,0 +1,270 @@
+/*
+ * history.c
+ *
+ * Sensor history ring file, see history.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "history.h"
+
+#define kHistoryReadRetries     16
+
+// the on-disk layout must not depend on the compiler
+typedef char historyHeaderSizeCheck[(sizeof(HistoryFileHeader) == 64) ? 1 : -1];
+typedef char historyBlockSizeCheck[(sizeof(HistoryBlock) == kHistoryBlockSize) ? 1 : -1];
+
+static int inRange(SInt32 delta, SInt32 min, SInt32 max) {
+    return delta >= min && delta <= max;
+}
+
+static int fitsDelta(const HistorySample *last, const HistorySample *sample) {
+    int                     i;
+
+    if (sample->timeMs < last->timeMs || sample->timeMs - last->timeMs > 0xFFFF)
+        return 0;
+
+    for (i = 0; i < 3; i++)
+        if (!inRange(sample->temp[i] - last->temp[i], -128, 127) ||
+                !inRange(sample->duty[i] - last->duty[i], -128, 127))
+            return 0;
+
+    if (!inRange(sample->vccpMV - last->vccpMV, -128, 127))
+        return 0;
+
+    for (i = 0; i < 4; i++)
+        if (!inRange(sample->fanRPM[i] - last->fanRPM[i], -32768, 32767))
+            return 0;
+
+    return 1;
+}
+
+static void writeKeyframe(HistoryBlock *block, UInt32 sequence, const HistorySample *sample) {
+    block->startTimeMs = sample->timeMs;
+    block->sequence = sequence;
+    block->deltaCount = 0;
+    memcpy(block->temp, sample->temp, sizeof(block->temp));
+    block->vccpMV = sample->vccpMV;
+    memcpy(block->fanRPM, sample->fanRPM, sizeof(block->fanRPM));
+    memcpy(block->duty, sample->duty, sizeof(block->duty));
+}
+
+static void writeDelta(HistoryBlock *block, const HistorySample *last, const HistorySample *sample) {
+    int                     n = block->deltaCount;
+    int                     i;
+
+    block->deltas[n].dtMs = (UInt16)(sample->timeMs - last->timeMs);
+    for (i = 0; i < 3; i++) {
+        block->deltas[n].dTemp[i] = (SInt8)(sample->temp[i] - last->temp[i]);
+        block->deltas[n].dDuty[i] = (SInt8)(sample->duty[i] - last->duty[i]);
+    }
+    block->deltas[n].dVccpMV = (SInt8)(sample->vccpMV - last->vccpMV);
+    for (i = 0; i < 4; i++)
+        block->deltas[n].dFanRPM[i] = (SInt16)(sample->fanRPM[i] - last->fanRPM[i]);
+
+    // publish the delta before it is counted
+    __sync_synchronize();
+    block->deltaCount = n + 1;
+}
+
+/*
+ * Decode samples of one block into out, skipping the first skip of them.
+ * Returns the number written, at most maxSamples.
+ */
+static int decodeBlock(const HistoryBlock *block, int skip, HistorySample *out, int maxSamples) {
+    HistorySample           sample;
+    int                     n, i, written = 0;
+    int                     count = block->deltaCount;
+
+    if (count > kHistoryDeltasPerBlock)
+        count = kHistoryDeltasPerBlock;
+
+    sample.timeMs = block->startTimeMs;
+    memcpy(sample.temp, block->temp, sizeof(sample.temp));
+    sample.vccpMV = block->vccpMV;
+    memcpy(sample.fanRPM, block->fanRPM, sizeof(sample.fanRPM));
+    memcpy(sample.duty, block->duty, sizeof(sample.duty));
+
+    for (n = -1; n < count && written < maxSamples; n++) {
+        if (n >= 0) {
+            sample.timeMs += block->deltas[n].dtMs;
+            for (i = 0; i < 3; i++) {
+                sample.temp[i] += block->deltas[n].dTemp[i];
+                sample.duty[i] += block->deltas[n].dDuty[i];
+            }
+            sample.vccpMV += block->deltas[n].dVccpMV;
+            for (i = 0; i < 4; i++)
+                sample.fanRPM[i] += block->deltas[n].dFanRPM[i];
+        }
+        if (skip > 0)
+            skip--;
+        else
+            out[written++] = sample;
+    }
+    return written;
+}
+
+static int checkHeader(const HistoryFileHeader *header, size_t length) {
+    if (0 != memcmp(header->magic, kHistoryMagic, sizeof(kHistoryMagic)) ||
+            header->version != kHistoryVersion ||
+            header->byteOrder != kHistoryByteOrder ||
+            header->headerSize != sizeof(HistoryFileHeader) ||
+            header->blockSize != sizeof(HistoryBlock) ||
+            header->blockCount == 0 ||
+            header->headBlock >= header->blockCount ||
+            length != sizeof(HistoryFileHeader) + (size_t)header->blockCount * sizeof(HistoryBlock))
+        return -1;
+    return 0;
+}
+
+int openHistory(HistoryRing *ring, const char *path, UInt32 sizeKB, int writable) {
+    struct stat             st;
+    UInt32                  blockCount;
+    int                     created = 0;
+
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (ring->fd < 0 || 0 != fstat(ring->fd, &st)) {
+        perror(path);
+        goto ERROR;
+    }
+
+    if (st.st_size == 0) {
+        if (!writable) {
+            fprintf(stderr, "%s: empty history\n", path);
+            goto ERROR;
+        }
+        blockCount = (sizeKB * 1024 - sizeof(HistoryFileHeader)) / sizeof(HistoryBlock);
+        if (blockCount < 2)
+            blockCount = 2;
+        ring->length = sizeof(HistoryFileHeader) + (size_t)blockCount * sizeof(HistoryBlock);
+        if (0 != ftruncate(ring->fd, ring->length)) {
+            perror(path);
+            goto ERROR;
+        }
+        created = 1;
+    } else
+        ring->length = st.st_size;
+
+    ring->header = mmap(NULL, ring->length, writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                        MAP_SHARED, ring->fd, 0);
+    if (ring->header == MAP_FAILED) {
+        ring->header = NULL;
+        perror(path);
+        goto ERROR;
+    }
+    ring->blocks = (HistoryBlock *)(ring->header + 1);
+
+    if (created) {
+        // ftruncate zero filled the blocks, sequence 0 marks them unused
+        memcpy(ring->header->magic, kHistoryMagic, sizeof(kHistoryMagic));
+        ring->header->version = kHistoryVersion;
+        ring->header->byteOrder = kHistoryByteOrder;
+        ring->header->headerSize = sizeof(HistoryFileHeader);
+        ring->header->blockSize = sizeof(HistoryBlock);
+        ring->header->blockCount = blockCount;
+        ring->header->headBlock = 0;
+        ring->header->nextSequence = 1;
+    } else if (0 != checkHeader(ring->header, ring->length)) {
+        fprintf(stderr, "%s: not a freezer history file\n", path);
+        goto ERROR;
+    }
+
+    // continue the delta chain of the head block
+    if (writable && ring->blocks[ring->header->headBlock].sequence != 0) {
+        const HistoryBlock  *head = &ring->blocks[ring->header->headBlock];
+
+        decodeBlock(head, head->deltaCount, &ring->last, 1);
+        ring->haveLast = 1;
+    }
+
+    return 0;
+
+ERROR:
+    closeHistory(ring);
+    return -1;
+}
+
+void closeHistory(HistoryRing *ring) {
+    if (ring->header) {
+        msync(ring->header, ring->length, MS_ASYNC);
+        munmap(ring->header, ring->length);
+    }
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+void appendHistory(HistoryRing *ring, const HistorySample *sample) {
+    HistoryFileHeader       *header = ring->header;
+    HistoryBlock            *head = &ring->blocks[header->headBlock];
+
+    header->generation++;
+    __sync_synchronize();
+
+    if (!ring->haveLast || head->sequence == 0 ||
+            head->deltaCount >= kHistoryDeltasPerBlock || !fitsDelta(&ring->last, sample)) {
+        if (head->sequence != 0) {
+            header->headBlock = (header->headBlock + 1) % header->blockCount;
+            head = &ring->blocks[header->headBlock];
+        }
+        writeKeyframe(head, header->nextSequence++, sample);
+    } else
+        writeDelta(head, &ring->last, sample);
+
+    ring->last = *sample;
+    ring->haveLast = 1;
+
+    __sync_synchronize();
+    header->generation++;
+}
+
+int readHistory(const HistoryRing *ring, HistorySample *samples, int maxSamples) {
+    const HistoryFileHeader *header = ring->header;
+    UInt32                  generation, count, block, first, blocks, sequence;
+    int                     total, skip, written, attempt;
+
+    for (attempt = 0; attempt < kHistoryReadRetries; attempt++) {
+        generation = header->generation;
+        if (generation & 1) {
+            usleep(100);
+            continue;
+        }
+        __sync_synchronize();
+
+        // walk back from the head while the sequence numbers are contiguous
+        count = header->blockCount;
+        block = first = header->headBlock;
+        sequence = ring->blocks[block].sequence;
+        total = 0;
+        blocks = 0;
+        while (sequence != 0 && total < maxSamples && blocks < count) {
+            total += ring->blocks[block].deltaCount + 1;
+            first = block;
+            blocks++;
+            block = (block + count - 1) % count;
+            if (ring->blocks[block].sequence != sequence - 1)
+                break;
+            sequence--;
+        }
+
+        skip = total > maxSamples ? total - maxSamples : 0;
+        written = 0;
+        for (block = first; blocks > 0; blocks--, block = (block + 1) % count) {
+            written += decodeBlock(&ring->blocks[block], skip, samples + written,
+                                   maxSamples - written);
+            skip = 0;
+        }
+
+        __sync_synchronize();
+        if (header->generation == generation)
+            return written;
+    }
+    return -1;
+}
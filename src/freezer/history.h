@@ -0,0 +1,137 @@
+/*
+ * history.h
+ *
+ * Sensor history ring file for freezer --daemon.
+ *
+ * The file is a fixed number of 512 byte blocks behind a 64 byte header,
+ * mapped with mmap and written in place, so recording costs no syscall
+ * and no allocation per sample. Each block starts with one absolute
+ * sample (the keyframe) followed by up to kHistoryDeltasPerBlock samples
+ * stored as differences to the sample before. A sample that does not fit
+ * a delta, or a full block, starts the next block; the oldest block is
+ * overwritten once the ring wraps.
+ *
+ * Readers map the file read only and use the header generation as a
+ * sequence lock: it is odd while the writer is appending, and a reader
+ * that sees it change while copying has to retry. Everything is stored
+ * in host byte order, kHistoryByteOrder tells which.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "IOI2CDefs.h"
+
+#define kHistoryMagic			"FRZHIST"
+#define kHistoryVersion			1
+#define kHistoryByteOrder		0x01020304
+#define kHistoryBlockSize		512
+#define kHistoryDeltasPerBlock	26
+#define kDefaultHistoryPath		"/var/tmp/freezer.history"
+#define kDefaultHistorySizeKB	4096	// about 6 hours at 10 Hz
+
+/*!
+	@struct HistorySample
+	@abstract One decoded history entry.
+*/
+typedef struct
+{
+	UInt64		timeMs;			// milliseconds since the epoch
+	SInt16		temp[3];		// local, remote1, remote2 in quarter degrees C
+	UInt16		vccpMV;			// CPU core voltage in millivolts
+	UInt16		fanRPM[4];
+	UInt8		duty[3];		// raw PWM duty cycle registers, 0xFF is 100%
+
+} HistorySample;
+
+/*!
+	@struct HistoryFileHeader
+	@abstract First 64 bytes of the ring file.
+*/
+typedef struct
+{
+	char		magic[8];		// kHistoryMagic
+	UInt32		version;
+	UInt32		byteOrder;		// kHistoryByteOrder as written by the host
+	UInt32		headerSize;
+	UInt32		blockSize;
+	UInt32		blockCount;
+	UInt32		generation;		// odd while a sample is being appended
+	UInt32		headBlock;		// block the last sample went to
+	UInt32		nextSequence;	// sequence number of the next block started
+	UInt8		reserved[24];
+
+} HistoryFileHeader;
+
+/*!
+	@struct HistoryBlock
+	@abstract Keyframe plus deltas, kHistoryBlockSize bytes.
+	@discussion sequence is 0 for a block that was never written, blocks
+	are in time order by sequence.
+*/
+typedef struct
+{
+	UInt64		startTimeMs;
+	UInt32		sequence;
+	UInt16		deltaCount;
+	UInt16		reserved;
+	SInt16		temp[3];
+	UInt16		vccpMV;
+	UInt16		fanRPM[4];
+	UInt8		duty[3];
+	UInt8		reserved2[5];
+
+	struct
+	{
+		UInt16		dtMs;		// since the previous sample
+		SInt8		dTemp[3];
+		SInt8		dVccpMV;
+		SInt16		dFanRPM[4];
+		SInt8		dDuty[3];
+		UInt8		reserved;
+
+	} deltas[kHistoryDeltasPerBlock];
+
+	UInt8		pad[4];
+
+} HistoryBlock;
+
+/*!
+	@struct HistoryRing
+	@abstract An open, mapped ring file.
+*/
+typedef struct
+{
+	int					fd;
+	size_t				length;
+	HistoryFileHeader	*header;
+	HistoryBlock		*blocks;
+	HistorySample		last;		// base for the next delta
+	int					haveLast;
+
+} HistoryRing;
+
+/*!
+	@function openHistory
+	@abstract Maps the ring file at path, creating it with sizeKB worth of blocks if needed.
+	@param writable 0 to map an existing file read only.
+	@result 0 on success, -1 with a message on stderr otherwise.
+*/
+int openHistory(HistoryRing *ring, const char *path, UInt32 sizeKB, int writable);
+
+void closeHistory(HistoryRing *ring);
+
+/*!
+	@function appendHistory
+	@abstract Appends one sample, in place, without allocating.
+*/
+void appendHistory(HistoryRing *ring, const HistorySample *sample);
+
+/*!
+	@function readHistory
+	@abstract Copies the newest maxSamples samples, oldest first.
+	@result The number of samples copied, or -1 if the writer kept getting in the way.
+*/
+int readHistory(const HistoryRing *ring, HistorySample *samples, int maxSamples);
+
+#endif // HISTORY_H
@@ -1,25 +1,21 @@
-#include <CoreFoundation/CoreFoundation.h>
-#include <IOKit/IOKitLib.h>
-#include "IOI2C.h"
-#include "IOI2CDefs.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include "backend.h"
+#include "bench.h"
+#include "discovery.h"
+#include "events.h"
+#include "history.h"
+#include "snapshot.h"
 
 #define DEBUG 1
 
 #include "freezer.h"
 
-#define kIOHWSensor "IOHWSensor" //IOHWSensor name match
-#define kIONamMatchADT7467 "adt7467" //ADT7467 chip name match
-#define kIOServicePathToIOI2CADT746x \
-"IOService:/MacRISC2PE/uni-n@f8000000/AppleUniN/i2c@%x/IOI2CControllerPPC/i2c-bus@%x/IOI2CBus/fan@%x"
-#define kIOI2CADT746xClassName "IOI2CADT746x"
-#define kIOI2CControllerPPCClassname "IOI2CControllerPPC"
-
-#define kNumVariable 3
-#define SHOULD_PRINT_DICT 0
-
-#define kIOPPluginCurrentValueKey "current-value" // current measured value
-#define kIOPPluginLocationKey     "location"      // readable description
-#define kIOPPluginTypeKey         "type"          // sensor/control type
 #define kIOPPluginTypeTempSensor  "temperature"   // desired type value
 #define kIOPPluginTypeVoltSensor  "voltage"   // desired type value
 #define kIOPPluginTypeFanSpeedSensor  "fanspeed"   // desired type value
@@ -34,51 +30,51 @@
 #define SENSOR_TEMP_FMT_F(x) \
     (double)((((double)((x) >> 16) * (double)9) / (double)5) + (double)32)
 
+// macro to convert a PWM duty cycle register to percent
+#define PWM_DUTY_PERCENT(x) ((x) * 100.0 / 255.0)
 
+#define kLocationGone 1 // readFromI2CController: the cached location does not open
+
+static const FreezerBackend *gBackend;
+static const char *gTopologyPath;
+static volatile sig_atomic_t gStop;
+
+/**
+ * @brief I2CSampling Options for the --i2c sampling loop
+ */
+typedef struct {
+    int         count;          // number of samples, -1 until stopped
+    int         intervalMs;     // delay between samples
+    int         holdLock;       // keep the bus lock across the whole loop
+    int         quiet;          // do not print every sample
+    HistoryRing *history;       // append every sample here, if set
+    int         eventWindow;    // --events window in degrees C, 0 to sample every interval
+    UInt32      eventRefreshMs; // --events keepalive sample period
+} I2CSampling;
 
 /**
  * @brief printSensorsInfo
- * @param serviceDict
- * @param encoding
+ * @param reading
  */
-void printSensorsInfo(const void* serviceDict, CFStringEncoding encoding) {
-    SInt32      currentValue;
-    CFNumberRef sensorValue;
-    CFStringRef sensorType, sensorLocation;
-
-    if (!CFDictionaryGetValueIfPresent((CFDictionaryRef)serviceDict,
-                                       CFSTR(kIOPPluginTypeKey),
-                                       (void *)&sensorType))
-        return;
-
-    sensorLocation = CFDictionaryGetValue((CFDictionaryRef)serviceDict,
-                                          CFSTR(kIOPPluginLocationKey));
-
-    sensorValue = CFDictionaryGetValue((CFDictionaryRef)serviceDict,
-                                       CFSTR(kIOPPluginCurrentValueKey));
-
-    (void)CFNumberGetValue(sensorValue, kCFNumberSInt32Type,
-                           (void *)&currentValue);
-                           
-    if (CFStringCompare(sensorType, CFSTR(kIOPPluginTypeTempSensor), 0) ==
-            kCFCompareEqualTo) {
+void printSensorsInfo(const HWSensorReading *reading) {
+    SInt32      currentValue = reading->currentValue;
+
+    if (0 == strcmp(reading->type, kIOPPluginTypeTempSensor)) {
         printf("%24s %15s %7.1f C %9.1f F\n",
-               // see documentation for CFStringGetCStringPtr() caveat
-               CFStringGetCStringPtr(sensorLocation, encoding),
-               CFStringGetCStringPtr(sensorType, encoding),
+               reading->location,
+               reading->type,
                SENSOR_TEMP_FMT_C(currentValue),
                SENSOR_TEMP_FMT_F(currentValue));
-    } else if(CFStringCompare(sensorType, CFSTR(kIOPPluginTypeVoltSensor), 0) ==
-              kCFCompareEqualTo){
+    } else if(0 == strcmp(reading->type, kIOPPluginTypeVoltSensor)){
         printf("%24s %15s %7.3f V\n",
-               CFStringGetCStringPtr(sensorLocation, encoding), 
-               CFStringGetCStringPtr(sensorType, encoding),
+               reading->location,
+               reading->type,
                SENSOR_VOLT_FMT(currentValue));
     } else {
         printf("%24s %15s %7ld\n",
-               CFStringGetCStringPtr(sensorLocation, encoding), 
-               CFStringGetCStringPtr(sensorType, encoding),
-               currentValue);
+               reading->location,
+               reading->type,
+               (long)currentValue);
     }
 }
 
@@ -86,261 +82,527 @@ void printSensorsInfo(const void* serviceDict, CFStringEncoding encoding) {
  * @brief pollIOHWSensor Poll I/O hardware sensor reading
  */
 int pollIOHWSensor() {
-    io_iterator_t           iter;
-    io_service_t            service = 0;
-    kern_return_t           kr;
-    CFMutableDictionaryRef  serviceDict;
-    CFStringEncoding        systemEncoding = CFStringGetSystemEncoding();
-
-    // Create an iterator for all IO Registry objects that match the dictionary
-    kr =  IOServiceGetMatchingServices(kIOMasterPortDefault,
-                                       IOServiceMatching(kIOHWSensor), &iter);
-    if(kr != KERN_SUCCESS) {
-        fprintf(stderr, "IOServiceGetMatchingServices returned 0x%08x\n\n", kr);
+    HWSensorReading         readings[kMaxHWSensors];
+    int                     count, i;
+
+    count = gBackend->pollSensors(readings, kMaxHWSensors);
+    if(count < 0)
         return -1;
-    }
 
-    // Iterate over all matching objects
-    while((service = IOIteratorNext(iter)) != IO_OBJECT_NULL) {
-        kr = IORegistryEntryCreateCFProperties(service, &serviceDict,
-                 kCFAllocatorDefault, kNilOptions);
-        if (kr == KERN_SUCCESS)
-            printSensorsInfo(serviceDict, systemEncoding);
-        CFRelease(serviceDict);
-        IOObjectRelease(service);
-    }
-    
-    IOObjectRelease(iter);
+    for(i = 0; i < count; i++)
+        printSensorsInfo(&readings[i]);
+
     return 0;
 }
 
-int isFoundIOI2CADT746x(io_service_t parentService) {
-    kern_return_t           kr;
-    io_service_t            childService = 0;
-    kr = IORegistryEntryGetChildEntry(parentService, kIOServicePlane, &childService);
-    if(kr != KERN_SUCCESS) {
-        fprintf(stderr, "IORegistryEntryGetChildEntry returned 0x%08x\n\n", kr);
-        return -1;
-    }
+static double nowMicroseconds(void) {
+    struct timeval          tv;
 
-    io_name_t className;
-    kr = IOObjectGetClass(childService, className);
-    if(kr != KERN_SUCCESS) {
-        fprintf(stderr, "IOObjectGetClass returned 0x%08x\n\n", kr);
-        IOObjectRelease(childService);
-        return -1;
-    }
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
 
-    //found IOI2CADT746x class
-    if(0 != strcmp(className, kIOI2CADT746xClassName)) {
-        IOObjectRelease(childService);
-        return -1;
-    }
-    
-    D(printf("Found class %s\n", className));
-
-    io_string_t service_path;
-    kr = IORegistryEntryGetPath(childService, kIOServicePlane, service_path);
-    if(kr == KERN_SUCCESS)
-        D(printf("Found IORegistryEntry with path %s\n", service_path));
-    int chipNum, i2cBusNum, i2cContrlNum;
-    if(kNumVariable !=
-            sscanf(service_path, kIOServicePathToIOI2CADT746x, &chipNum, &i2cBusNum, &i2cContrlNum)) {
-        IOObjectRelease(childService);
-        return -1;
-    }
+static UInt64 nowMilliseconds(void) {
+    return (UInt64)(nowMicroseconds() / 1000);
+}
 
-    printf("found @ 0x%x\n", chipNum);
-    printf(" - Bus I2C @ 0x%x\n", i2cBusNum);
-    printf(" - Controller @ 0x%x\n", i2cContrlNum);
-    IOObjectRelease(childService);
-    return i2cBusNum;
+static void printI2CSampleHeader(void) {
+    printf("%6s %8s %8s %8s %7s %6s %6s %5s %5s %5s %9s\n",
+           "sample", "local", "remote1", "remote2", "vccp",
+           "fan1", "fan2", "pwm1", "pwm2", "pwm3", "latency");
 }
 
-io_service_t matchI2CControllerService(io_service_t service) {
-    kern_return_t           kr;
-    io_service_t childService = service;
-    io_service_t parentService = 0;
-    io_name_t className;
-
-    do {
-        kr = IORegistryEntryGetParentEntry(childService, kIOServicePlane, &parentService);
-        if(kr != KERN_SUCCESS) {
-            fprintf(stderr, "IORegistryEntryGetParentEntry returned 0x%08x\n\n", kr);
-            return 0;
-        }
+static void printI2CSample(int sample, const ADT746xSnapshot *snapshot,
+                           const UInt8 *duty, double latency) {
+    printf("%6d %6.2f C %6.2f C %6.2f C %5.3f V %6lu %6lu %4.0f%% %4.0f%% %4.0f%% %6.0f us\n",
+           sample,
+           snapshot->localTemp / 65536.0,
+           snapshot->remote1Temp / 65536.0,
+           snapshot->remote2Temp / 65536.0,
+           snapshot->voltage / 65536.0,
+           (unsigned long)snapshot->fanRPM[0],
+           (unsigned long)snapshot->fanRPM[1],
+           PWM_DUTY_PERCENT(duty[0]),
+           PWM_DUTY_PERCENT(duty[1]),
+           PWM_DUTY_PERCENT(duty[2]),
+           latency);
+}
 
-        kr = IOObjectGetClass(parentService, className);
-        if(kr != KERN_SUCCESS) {
-            fprintf(stderr, "IOObjectGetClass returned 0x%08x\n\n", kr);
-            return 0;
-        }
+static void stopSampling(int sig) {
+    gStop = 1;
+}
 
-        D(printf("Found parent service with class name %s\n", className));
+/**
+ * @brief toHistorySample Convert a decoded snapshot to the history units
+ */
+static void toHistorySample(const ADT746xSnapshot *snapshot, const UInt8 *duty,
+                            HistorySample *sample) {
+    struct timeval          tv;
+    int                     i;
+
+    gettimeofday(&tv, NULL);
+    sample->timeMs = (UInt64)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+    // 16.16 to quarter degrees
+    sample->temp[0] = (SInt16)(snapshot->localTemp >> 14);
+    sample->temp[1] = (SInt16)(snapshot->remote1Temp >> 14);
+    sample->temp[2] = (SInt16)(snapshot->remote2Temp >> 14);
+    sample->vccpMV = (UInt16)(((SInt64)snapshot->voltage * 1000) >> 16);
+
+    for (i = 0; i < 4; i++)
+        sample->fanRPM[i] = snapshot->fanRPM[i] > 0xFFFF ? 0xFFFF : snapshot->fanRPM[i];
+    for (i = 0; i < kPWMDutyCount; i++)
+        sample->duty[i] = duty[i];
+}
 
-        if(childService != service)
-            IOObjectRelease(childService);
+/**
+ * @brief readFromI2CController Sample the ADT746x over one open connection
+ *
+ * The user client stays open for the whole loop. With holdLock the bus
+ * lock is taken once as well; every other I2C client, including the
+ * kernel thermal drivers, is blocked until the loop ends.
+ *
+ * With an event window the interval only polls the interrupt status
+ * registers, a full sample is taken when a temperature leaves the window
+ * or the keepalive period runs out (see events.h).
+ */
+int readFromI2CController(const ADT746xLocation *location, const I2CSampling *sampling) {
+    IOReturn                kr;
+    I2CConnection           *connect;
+    UInt32                  clientKey = kIOI2C_CLIENT_KEY_DEFAULT;
+    UInt8                   deviceID, config2;
+    UInt8                   duty[kPWMDutyCount];
+    ADT746xSnapshot         snapshot;
+    HistorySample           history;
+    ADT746xEventMonitor     monitor;
+    int                     monitoring = 0;
+    double                  start, latency, total = 0, worst = 0, best = 0;
+    int                     sample, samples = 0, sampled = 1;
+
+    printf("found @ 0x%x\n", (unsigned)location->address);
+    printf(" - Bus I2C @ 0x%x\n", (unsigned)location->bus);
+    printf(" - Controller @ 0x%x\n", (unsigned)location->controller);
 
-        childService = parentService;
+    //open user client of I2CControllerPPC
+    kr = gBackend->open(location, &connect);
+    if (kr == kIOReturnNotFound)
+        return kLocationGone;
+    if (kr != kIOReturnSuccess) {
+        fprintf(stderr, "IOServiceOpen returned 0x%08x\n", kr);
+        return -1;
+    } else {
+        D(printf("IOServiceOpen was successful.\n"));
+    }
 
-    } while(0 != strcmp(className, kIOI2CControllerPPCClassname));
+    //lock I2C Bus for the whole loop
+    if (sampling->holdLock) {
+        kr = gBackend->lock(connect, location->bus, &clientKey);
+        if (kr != kIOReturnSuccess) {
+            fprintf(stderr, "i2cControllerLock returned 0x%08x\n", kr);
+            goto ERROR_CLOSE;
+        }
+    }
 
-    return parentService;
-}
+    //device ID and attenuation select the voltage scale, they do not change
+    kr = readADT746xRegisters(gBackend, connect, location, clientKey,
+                              kDeviceIDReg, &deviceID, 1);
+    if (kr == kIOReturnSuccess)
+        kr = readADT746xRegisters(gBackend, connect, location, clientKey,
+                                  kConfigReg2, &config2, 1);
+    if (kr != kIOReturnSuccess) {
+        fprintf(stderr, "readI2C returned 0x%08x\n", kr);
+        goto ERROR_UNLOCK;
+    }
 
-kern_return_t i2cControllerOpen(io_service_t service, io_connect_t *connect) {
-    return IOServiceOpen(service, mach_task_self(), kIOI2CUserClientType, connect);
-}
+    //save the limit registers the event window borrows
+    if (sampling->eventWindow > 0) {
+        kr = startADT746xEvents(&monitor, gBackend, connect, location, clientKey,
+                                sampling->eventWindow, sampling->eventRefreshMs);
+        if (kr != kIOReturnSuccess) {
+            fprintf(stderr, "startADT746xEvents returned 0x%08x\n", kr);
+            goto ERROR_UNLOCK;
+        }
+        monitoring = 1;
+    }
 
-kern_return_t i2cControllerClose(io_connect_t connect) {
-    return IOServiceClose(connect);
-}
+    if (!sampling->quiet)
+        printI2CSampleHeader();
 
-kern_return_t i2cControllerLock(io_connect_t        connect,
-                                UInt32              bus,
-                                UInt32              *clientKeyRef) {
-    return IOConnectMethodScalarIScalarO(connect,
-                                         kI2CUCLock,
-                                         1,
-                                         1,
-                                         bus,
-                                         clientKeyRef);
-}
+    for (sample = 0; (sampling->count < 0 || sample < sampling->count) && !gStop; sample++) {
+        if (sample > 0 && sampling->intervalMs > 0)
+            usleep(sampling->intervalMs * 1000);
 
-kern_return_t i2cControllerUnlock(io_connect_t      connect,
-                                  UInt32            clientKey) {
-    return IOConnectMethodScalarIScalarO(connect,
-                                         kI2CUCUnlock,
-                                         1,
-                                         0,
-                                         clientKey);
-}
+        start = nowMicroseconds();
 
-kern_return_t i2cControllerRead(io_connect_t        connect,
-                                I2CUserReadInput*   input,
-                                IOByteCount*        structureOutputSize,
-                                I2CUserReadOutput*  output) {
-    return IOConnectMethodStructureIStructureO(connect,
-                                         kI2CUCRead,
-                                         sizeof(*input),
-                                         structureOutputSize,
-                                         input,
-                                         output);
-}
+        if (!sampling->holdLock) {
+            kr = gBackend->lock(connect, location->bus, &clientKey);
+            if (kr != kIOReturnSuccess) {
+                fprintf(stderr, "i2cControllerLock returned 0x%08x\n", kr);
+                goto ERROR_CLOSE;
+            }
+        }
 
-kern_return_t i2cControllerWrite(io_connect_t        connect,
-                                I2CUserWriteInput*   input,
-                                IOByteCount*        structureOutputSize,
-                                I2CUserWriteOutput*  output) {
-    return IOConnectMethodStructureIStructureO(connect,
-                                         kI2CUCWrite,
-                                         sizeof(*input),
-                                         structureOutputSize,
-                                         input,
-                                         output);
-}
+        if (monitoring)
+            kr = stepADT746xEvents(&monitor, gBackend, connect, location, clientKey,
+                                   deviceID, config2, nowMilliseconds(),
+                                   &snapshot, duty, &sampled);
+        else
+            kr = readADT746xSample(gBackend, connect, location, clientKey, deviceID, config2,
+                                   &snapshot, duty);
+
+        if (!sampling->holdLock) {
+            gBackend->unlock(connect, clientKey);
+            clientKey = kIOI2C_CLIENT_KEY_DEFAULT;
+        }
 
-int readFromI2CController(io_service_t service) {
-    kern_return_t           kr;
-    io_connect_t            connect;
-    UInt32                  clientKey;
-    io_service_t            i2cControllerService = 0;
-    //get I2C bus number
-    int busNum = isFoundIOI2CADT746x(service);
+        latency = nowMicroseconds() - start;
 
-    if(-1 == busNum){
-        fprintf(stderr, "Failed to find i2c bus\n\n");
-        return -1;
-    }
+        if (kr != kIOReturnSuccess) {
+            fprintf(stderr, "readI2C returned 0x%08x\n", kr);
+            goto ERROR_UNLOCK;
+        }
 
-    //match I2CControllerPPC
-    i2cControllerService = matchI2CControllerService(service);
+        if (!sampled)
+            continue;
 
-    if(0 == i2cControllerService){
-        fprintf(stderr, "Failed to find I2CControllerPPC\n\n");
-        return -1;
-    }
+        if (!sampling->quiet)
+            printI2CSample(sample, &snapshot, duty, latency);
 
-    //open user client of I2CControllerPPC
-    kr = i2cControllerOpen(i2cControllerService, &connect);
-    if (kr != KERN_SUCCESS) {
-        fprintf(stderr, "IOServiceOpen returned 0x%08x\n", kr);
-        goto ERROR_RELEASE_SERVICE;
-    } else {
-        D(printf("IOServiceOpen was successful.\n"));
+        if (sampling->history) {
+            toHistorySample(&snapshot, duty, &history);
+            appendHistory(sampling->history, &history);
+        }
+
+        total += latency;
+        if (samples == 0 || latency < best)
+            best = latency;
+        if (latency > worst)
+            worst = latency;
+        samples++;
     }
 
-    //lock I2C Bus
-    kr = i2cControllerLock(connect, busNum, &clientKey);
-    if (kr != KERN_SUCCESS) {
-        fprintf(stderr, "i2cControllerLock returned 0x%08x\n", kr);
-        goto ERROR_RELEASE_SERVICE;
-    } else {
-        D(printf("i2cControllerLock was successful.\n"));
+    if (samples > 0)
+        printf("latency min/avg/max %.0f/%.0f/%.0f us over %d samples\n",
+               best, total / samples, worst, samples);
+
+    if (monitoring) {
+        printf("events: %lu window trips, %lu keepalives, %lu quiet intervals\n",
+               (unsigned long)monitor.events, (unsigned long)monitor.refreshes,
+               (unsigned long)monitor.statusReads);
+
+        //give the limit registers back
+        if (!sampling->holdLock)
+            kr = gBackend->lock(connect, location->bus, &clientKey);
+        if (kr == kIOReturnSuccess)
+            kr = stopADT746xEvents(&monitor, gBackend, connect, location, clientKey);
+        if (!sampling->holdLock && clientKey != kIOI2C_CLIENT_KEY_DEFAULT) {
+            gBackend->unlock(connect, clientKey);
+            clientKey = kIOI2C_CLIENT_KEY_DEFAULT;
+        }
+        if (kr != kIOReturnSuccess)
+            fprintf(stderr, "stopADT746xEvents returned 0x%08x\n", kr);
     }
 
     //unlock I2C Bus
-    kr = i2cControllerUnlock(connect, clientKey);
-    if (kr != KERN_SUCCESS) {
-        fprintf(stderr, "i2cControllerUnlock returned 0x%08x\n", kr);
-        goto ERROR_RELEASE_SERVICE;
-    } else {
-        D(printf("i2cControllerUnlock was successful.\n"));
+    if (sampling->holdLock) {
+        kr = gBackend->unlock(connect, clientKey);
+        if (kr != kIOReturnSuccess) {
+            fprintf(stderr, "i2cControllerUnlock returned 0x%08x\n", kr);
+            goto ERROR_CLOSE;
+        }
     }
 
     //close user client of I2CControllerPPC
-    kr = i2cControllerClose(connect);
-    if (kr == KERN_SUCCESS) {
+    kr = gBackend->close(connect);
+    if (kr == kIOReturnSuccess) {
         D(printf("IOServiceClose was successful.\n\n"));
     }
     else {
         fprintf(stderr, "IOServiceClose returned 0x%08x\n\n", kr);
-        goto ERROR_RELEASE_SERVICE;
+        return -1;
     }
 
-    IOObjectRelease(i2cControllerService);
     return 0;
 
-ERROR_RELEASE_SERVICE:
-    IOObjectRelease(i2cControllerService);
+ERROR_UNLOCK:
+    if (monitoring && sampling->holdLock)
+        stopADT746xEvents(&monitor, gBackend, connect, location, clientKey);
+    if (sampling->holdLock)
+        gBackend->unlock(connect, clientKey);
+ERROR_CLOSE:
+    gBackend->close(connect);
     return -1;
 }
 
 /**
  * @brief pollFromI2C
  */
-int pollFromI2C() {
-    io_iterator_t           iter;
-    io_service_t            service = 0;
-    kern_return_t           kr;
-    CFMutableDictionaryRef  matchingDictionary;
-
-    // Create adt7467 name matching dictionary
-    matchingDictionary = IOServiceNameMatching(kIONamMatchADT7467);
-
-    // Create an iterator for all IO Registry objects that match the dictionary
-    kr =  IOServiceGetMatchingServices(kIOMasterPortDefault,
-                                       matchingDictionary, &iter);
-    if(kr != KERN_SUCCESS) {
-        fprintf(stderr, "IOServiceGetMatchingServices returned 0x%08x\n\n", kr);
+int pollFromI2C(const I2CSampling *sampling) {
+    ADT746xLocation         locations[kMaxADT746xChips];
+    int                     count, i;
+    int                     rescanned = 0;
+
+    count = findADT746xCached(gBackend, gTopologyPath, locations, kMaxADT746xChips);
+    if(count < 0)
         return -1;
-    }
 
-    // Iterate over all matching objects
-    while((service = IOIteratorNext(iter)) != IO_OBJECT_NULL) {
-        readFromI2CController(service);
-        IOObjectRelease(service);
+    if(count == 0) {
+        fprintf(stderr, "Failed to find i2c bus\n\n");
+        return -1;
     }
 
-    IOObjectRelease(iter);
+    //one history file records one chip
+    if(sampling->history)
+        count = 1;
+
+    for(i = 0; i < count; i++) {
+        if(kLocationGone != readFromI2CController(&locations[i], sampling) || rescanned)
+            continue;
+
+        //cached topology is stale, walk the registry again
+        D(printf("%s is gone, rescanning\n", locations[i].path));
+        invalidateDiscoveryCache(gTopologyPath);
+        rescanned = 1;
+        count = findADT746xCached(gBackend, gTopologyPath, locations, kMaxADT746xChips);
+        if(count < 0)
+            return -1;
+        i = -1;
+    }
 
     return 0;
 }
 
+/**
+ * @brief dumpHistory Print the newest samples of a history file
+ */
+static int dumpHistory(const char *path, int count) {
+    HistoryRing             ring;
+    HistorySample           *samples;
+    time_t                  seconds;
+    char                    stamp[32];
+    int                     n, i;
+
+    if (0 != openHistory(&ring, path, 0, 0))
+        return -1;
+
+    if (NULL == (samples = malloc(count * sizeof(*samples)))) {
+        closeHistory(&ring);
+        return -1;
+    }
+
+    n = readHistory(&ring, samples, count);
+    if (n < 0)
+        fprintf(stderr, "%s: writer too busy, try again\n", path);
+
+    printf("%23s %8s %8s %8s %7s %6s %6s %5s %5s %5s\n",
+           "time", "local", "remote1", "remote2", "vccp",
+           "fan1", "fan2", "pwm1", "pwm2", "pwm3");
+    for (i = 0; i < n; i++) {
+        seconds = (time_t)(samples[i].timeMs / 1000);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+        printf("%19s.%03u %6.2f C %6.2f C %6.2f C %5.3f V %6u %6u %4.0f%% %4.0f%% %4.0f%%\n",
+               stamp, (unsigned)(samples[i].timeMs % 1000),
+               samples[i].temp[0] / 4.0, samples[i].temp[1] / 4.0, samples[i].temp[2] / 4.0,
+               samples[i].vccpMV / 1000.0,
+               samples[i].fanRPM[0], samples[i].fanRPM[1],
+               PWM_DUTY_PERCENT(samples[i].duty[0]),
+               PWM_DUTY_PERCENT(samples[i].duty[1]),
+               PWM_DUTY_PERCENT(samples[i].duty[2]));
+    }
+
+    free(samples);
+    closeHistory(&ring);
+    return n < 0 ? -1 : 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [--iokit | --sim] [--rescan] [--i2c [--hold-lock] [-i interval_ms]] [-n count]\n"
+            "       %s [--iokit | --sim] --daemon [--history file] [--history-size KB] [-i interval_ms] [-n count]\n"
+            "       %s --dump-history [--history file] [-n count]\n"
+            "       %s [--bench snapshot | discovery | decode | events | publish |\n"
+            "                completion | commandlist | async | deadline | buslock |\n"
+            "                bulk | shadow | fan [--history file] | dfs | pf |\n"
+            "                dispatch | pfindex | pfburst | pmon | thermal] [-n count]\n"
+            "\n"
+            "The ADT746x topology is cached in $FREEZER_TOPOLOGY (default %s),\n"
+            "--rescan walks the IORegistry again. --daemon records until interrupted\n"
+            "into a ring file (default %s, %d KB).\n"
+            "\n"
+            "--events [--event-window C] [--event-refresh ms] with --i2c or --daemon\n"
+            "only polls the interrupt status every interval and samples when a\n"
+            "temperature moves more than C degrees (default %d) or every ms (default %d).\n",
+            name, name, name, name, kDefaultTopologyPath, kDefaultHistoryPath, kDefaultHistorySizeKB,
+            kDefaultEventWindow, kDefaultEventRefreshMs);
+}
+
 int main (int argc, const char * argv[]) {
-    printf("Poll from IOHWSensor:\n");
-    pollIOHWSensor();
-    printf("\nPoll from I2C bus:\n");
-    pollFromI2C();
-    return 0;
+    const char  *bench = NULL;
+    int         i2cOnly = 0;
+    int         rescan = 0;
+    int         daemonMode = 0;
+    int         dump = 0;
+    const char  *historyPath = kDefaultHistoryPath;
+    int         historyGiven = 0;
+    UInt32      historySizeKB = kDefaultHistorySizeKB;
+    HistoryRing history;
+    int         count = -1;
+    int         status;
+    I2CSampling sampling = { 1, 1000, 0, 0, NULL, 0, kDefaultEventRefreshMs };
+    int         i;
+
+    gBackend = defaultBackend();
+
+    for(i = 1; i < argc; i++) {
+        if(0 == strcmp(argv[i], "--bench") && i + 1 < argc) {
+            bench = argv[++i];
+            continue;
+        }
+        if(0 == strcmp(argv[i], "-n") && i + 1 < argc) {
+            count = atoi(argv[++i]);
+            continue;
+        }
+        if(0 == strcmp(argv[i], "-i") && i + 1 < argc) {
+            sampling.intervalMs = atoi(argv[++i]);
+            continue;
+        }
+        if(0 == strcmp(argv[i], "--i2c")) {
+            i2cOnly = 1;
+            continue;
+        }
+        if(0 == strcmp(argv[i], "--daemon")) {
+            daemonMode = 1;
+            continue;
+        }
+        if(0 == strcmp(argv[i], "--dump-history")) {
+            dump = 1;
+            continue;
+        }
+        if(0 == strcmp(argv[i], "--history") && i + 1 < argc) {
+            historyPath = argv[++i];
+            historyGiven = 1;
+            continue;
+        }
+        if(0 == strcmp(argv[i], "--history-size") && i + 1 < argc) {
+            historySizeKB = (UInt32)strtoul(argv[++i], NULL, 0);
+            continue;
+        }
+        if(0 == strcmp(argv[i], "--events")) {
+            if(sampling.eventWindow <= 0)
+                sampling.eventWindow = kDefaultEventWindow;
+            continue;
+        }
+        if(0 == strcmp(argv[i], "--event-window") && i + 1 < argc) {
+            sampling.eventWindow = atoi(argv[++i]);
+            continue;
+        }
+        if(0 == strcmp(argv[i], "--event-refresh") && i + 1 < argc) {
+            sampling.eventRefreshMs = (UInt32)strtoul(argv[++i], NULL, 0);
+            continue;
+        }
+        if(0 == strcmp(argv[i], "--rescan")) {
+            rescan = 1;
+            continue;
+        }
+        if(0 == strcmp(argv[i], "--hold-lock")) {
+            sampling.holdLock = 1;
+            continue;
+        }
+#ifdef __APPLE__
+        if(0 == strcmp(argv[i], "--iokit")) {
+            gBackend = &gIOKitBackend;
+            continue;
+        }
+#endif
+        if(0 == strcmp(argv[i], "--sim")) {
+            gBackend = &gSimBackend;
+            continue;
+        }
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(bench) {
+        if(0 == strcmp(bench, "snapshot"))
+            return benchSnapshot(count > 0 ? count : 1000) ? 1 : 0;
+        if(0 == strcmp(bench, "discovery"))
+            return benchDiscovery(count > 0 ? count : 1000) ? 1 : 0;
+        if(0 == strcmp(bench, "decode"))
+            return benchDecode(count > 0 ? count : 65536) ? 1 : 0;
+        if(0 == strcmp(bench, "events"))
+            return benchEvents(count > 0 ? count : 1) ? 1 : 0;
+        if(0 == strcmp(bench, "publish"))
+            return benchPublish(count > 0 ? count : 8) ? 1 : 0;
+        if(0 == strcmp(bench, "completion"))
+            return benchCompletion(count > 0 ? count : 300) ? 1 : 0;
+        if(0 == strcmp(bench, "commandlist"))
+            return benchCommandList(count > 0 ? count : 200) ? 1 : 0;
+        if(0 == strcmp(bench, "async"))
+            return benchAsync(count > 0 ? count : 50) ? 1 : 0;
+        if(0 == strcmp(bench, "deadline"))
+            return benchDeadline(count > 0 ? count : 600) ? 1 : 0;
+        if(0 == strcmp(bench, "buslock"))
+            return benchBusLock(count > 0 ? count : 5) ? 1 : 0;
+        if(0 == strcmp(bench, "bulk"))
+            return benchBulk(count > 0 ? count : 2000) ? 1 : 0;
+        if(0 == strcmp(bench, "shadow"))
+            return benchShadow(count > 0 ? count : 1000) ? 1 : 0;
+        if(0 == strcmp(bench, "fan"))
+            return benchFanControl(count > 0 ? count : 4, historyGiven ? historyPath : NULL) ? 1 : 0;
+        if(0 == strcmp(bench, "dfs"))
+            return benchDFS(count > 0 ? count : 4) ? 1 : 0;
+        if(0 == strcmp(bench, "pf"))
+            return benchPlatformFunctions(count > 0 ? count : 20000) ? 1 : 0;
+        if(0 == strcmp(bench, "dispatch"))
+            return benchDispatch(count > 0 ? count : 1000000) ? 1 : 0;
+        if(0 == strcmp(bench, "pfindex"))
+            return benchPlatformFunctionIndex(count > 0 ? count : 100000) ? 1 : 0;
+        if(0 == strcmp(bench, "pfburst"))
+            return benchPlatformBursts(count > 0 ? count : 20000) ? 1 : 0;
+        if(0 == strcmp(bench, "pmon"))
+            return benchPlatformMonitorEvents(count > 0 ? count : 5000) ? 1 : 0;
+        if(0 == strcmp(bench, "thermal"))
+            return benchThermalEvents(count > 0 ? count : 10) ? 1 : 0;
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(dump)
+        return dumpHistory(historyPath, count > 0 ? count : 20) ? 1 : 0;
+
+    if(count > 0)
+        sampling.count = count;
+
+    if(NULL == (gTopologyPath = getenv("FREEZER_TOPOLOGY")))
+        gTopologyPath = kDefaultTopologyPath;
+    if(rescan)
+        invalidateDiscoveryCache(gTopologyPath);
+
+    if(daemonMode) {
+        if(0 != openHistory(&history, historyPath, historySizeKB, 1))
+            return 1;
+        sampling.history = &history;
+        sampling.quiet = 1;
+        if(count <= 0)
+            sampling.count = -1;
+        i2cOnly = 1;
+        signal(SIGINT, stopSampling);
+        signal(SIGTERM, stopSampling);
+    }
+
+    D(printf("Using %s backend\n", gBackend->name));
+    if(!i2cOnly) {
+        printf("Poll from IOHWSensor:\n");
+        pollIOHWSensor();
+        printf("\n");
+    }
+    printf("Poll from I2C bus:\n");
+    status = pollFromI2C(&sampling);
+
+    if(sampling.history)
+        closeHistory(sampling.history);
+
+    if(gBackend->shutdown)
+        gBackend->shutdown();
+    return status ? 1 : 0;
 }
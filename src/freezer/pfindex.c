@@ -0,0 +1,166 @@
+/*
+ * pfindex.c
+ *
+ * Index of a device's platform functions, see pfindex.h.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pfindex.h"
+
+static UInt32 listFlag(UInt32 bit) {
+    return 0x80000000U >> bit;
+}
+
+static UInt32 hashName(const PlatformFunctionIndex *index, const void *name) {
+    // allocations are at least 16 byte aligned, the low bits say nothing
+    return ((UInt32)((uintptr_t)name >> 4) * 2654435761U) >> (32 - index->hashBits);
+}
+
+static UInt32 firstNamed(const PlatformFunctionIndex *index, const void *name) {
+    UInt32                  slot;
+
+    if (!index->ready || !name)
+        return 0;
+
+    for (slot = hashName(index, name); index->hash[slot]; slot = (slot + 1) & (index->hashSize - 1)) {
+        if (index->entry[index->hash[slot] - 1].name == name)
+            return index->hash[slot];
+    }
+    return 0;
+}
+
+int allocatePlatformFunctionIndex(PlatformFunctionIndex *index, UInt32 count) {
+    memset(index, 0, sizeof(*index));
+    if (count == 0)
+        return -1;
+
+    for (index->hashBits = 4; (1U << index->hashBits) < 2 * count; index->hashBits++)
+        ;
+    index->hashSize = 1U << index->hashBits;
+
+    index->entry = calloc(count, sizeof(*index->entry));
+    index->hash = calloc(index->hashSize, sizeof(*index->hash));
+    if (!index->entry || !index->hash) {
+        freePlatformFunctionIndex(index);
+        return -1;
+    }
+    index->capacity = count;
+    return 0;
+}
+
+void freePlatformFunctionIndex(PlatformFunctionIndex *index) {
+    free(index->entry);
+    free(index->hash);
+    free(index->list);
+    memset(index, 0, sizeof(*index));
+}
+
+void addPlatformFunction(PlatformFunctionIndex *index, const void *func, const void *name, UInt32 flags) {
+    PlatformFunctionIndexEntry  *entry;
+    UInt32                  i, slot, position;
+
+    if (index->ready || index->count >= index->capacity)
+        return;
+
+    position = index->count++;
+    entry = &index->entry[position];
+    entry->func = func;
+    entry->name = func ? name : NULL;
+    entry->flags = func ? flags : 0;
+    if (!entry->name)
+        return;
+
+    // first of its name goes in the hash, the others at the end of the chain
+    for (slot = hashName(index, name); index->hash[slot]; slot = (slot + 1) & (index->hashSize - 1)) {
+        if (index->entry[index->hash[slot] - 1].name == name) {
+            for (i = index->hash[slot] - 1; index->entry[i].next; i = index->entry[i].next - 1)
+                ;
+            index->entry[i].next = position + 1;
+            return;
+        }
+    }
+    index->hash[slot] = position + 1;
+}
+
+int finishPlatformFunctionIndex(PlatformFunctionIndex *index) {
+    UInt32                  bit, i, total = 0;
+
+    if (index->ready || index->count != index->capacity)
+        return -1;
+
+    for (bit = 0; bit < kPFIndexFlagLists; bit++) {
+        index->listStart[bit] = total;
+        for (i = 0; i < index->count; i++)
+            if (index->entry[i].flags & listFlag(bit))
+                total++;
+        index->listCount[bit] = total - index->listStart[bit];
+    }
+
+    if (total) {
+        if ((index->list = malloc(total * sizeof(*index->list))) == NULL)
+            return -1;
+        for (bit = 0, total = 0; bit < kPFIndexFlagLists; bit++)
+            for (i = 0; i < index->count; i++)
+                if (index->entry[i].flags & listFlag(bit))
+                    index->list[total++] = i;
+    }
+
+    index->ready = 1;
+    return 0;
+}
+
+SInt32 findPlatformFunction(const PlatformFunctionIndex *index, const void *name, UInt32 flags) {
+    UInt32                  i;
+
+    for (i = firstNamed(index, name); i; i = index->entry[i - 1].next) {
+        if (index->entry[i - 1].flags & flags)
+            return i - 1;
+    }
+    return -1;
+}
+
+SInt32 indexOfPlatformFunction(const PlatformFunctionIndex *index, const void *func, const void *name) {
+    UInt32                  i;
+
+    for (i = firstNamed(index, name); i; i = index->entry[i - 1].next) {
+        if (index->entry[i - 1].func == func)
+            return i - 1;
+    }
+    return -1;
+}
+
+SInt32 nextPlatformFunctionWithFlags(const PlatformFunctionIndex *index, UInt32 flags, UInt32 from) {
+    UInt32                  bit, lo, hi, mid, end, next = index->count;
+
+    for (bit = 0; bit < kPFIndexFlagLists; bit++) {
+        if (!(flags & listFlag(bit)))
+            continue;
+
+        // first list entry >= from
+        lo = index->listStart[bit];
+        end = hi = lo + index->listCount[bit];
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            if (index->list[mid] < from)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo < end && index->list[lo] < next)
+            next = index->list[lo];
+    }
+
+    // flags that have no list of their own
+    if (flags & ~kPFIndexListedFlags) {
+        for (; from < next; from++) {
+            if (index->entry[from].flags & flags & ~kPFIndexListedFlags) {
+                next = from;
+                break;
+            }
+        }
+    }
+
+    return next < index->count ? (SInt32)next : -1;
+}
@@ -0,0 +1,90 @@
+/*
+ * pfindex.h
+ *
+ * Index of a device's platform functions, the user space counterpart of
+ * IOI2CPlatformFunctionIndex.
+ *
+ * Functions are added once, in array order. They are then found by name
+ * through a hash keyed by the name symbol's address, functions sharing a
+ * name chained in array order, and by flag through one sorted list of
+ * array positions per kIOPFFlagOnInit ... kIOPFFlagIntGen bit. Every
+ * query answers what a scan of the array in order would, without
+ * touching the functions that do not match.
+ */
+
+#ifndef PFINDEX_H
+#define PFINDEX_H
+
+#include "IOI2CDefs.h"
+
+#define kPFIndexFlagLists		6			// kIOPFFlagOnInit (bit 31) down to kIOPFFlagIntGen (bit 26)
+#define kPFIndexListedFlags		0xfc000000
+
+typedef struct
+{
+	const void		*func;
+	const void		*name;
+	UInt32			flags;
+	UInt32			next;			// array position + 1 of the next function of the same name, 0 at the end
+
+} PlatformFunctionIndexEntry;
+
+typedef struct
+{
+	PlatformFunctionIndexEntry	*entry;
+	UInt32			capacity;
+	UInt32			count;
+	UInt32			*hash;			// array position + 1 of the first function of each name, 0 if empty
+	UInt32			hashSize;		// power of two, at least twice capacity
+	UInt32			hashBits;
+	UInt32			*list;			// array positions, per flag, ascending
+	UInt32			listStart[kPFIndexFlagLists];
+	UInt32			listCount[kPFIndexFlagLists];
+	int				ready;
+
+} PlatformFunctionIndex;
+
+/*!
+	@function allocatePlatformFunctionIndex
+	@abstract Makes room for count functions, to be added with addPlatformFunction.
+	@result 0, or -1 if count is 0 or there is no memory.
+*/
+int allocatePlatformFunctionIndex(PlatformFunctionIndex *index, UInt32 count);
+
+void freePlatformFunctionIndex(PlatformFunctionIndex *index);
+
+/*!
+	@function addPlatformFunction
+	@abstract Adds the next array element, func NULL if it is not a platform function.
+*/
+void addPlatformFunction(PlatformFunctionIndex *index, const void *func, const void *name, UInt32 flags);
+
+/*!
+	@function finishPlatformFunctionIndex
+	@abstract Builds the per-flag lists once every element is added.
+	@result 0, or -1 if elements are missing or there is no memory.
+*/
+int finishPlatformFunctionIndex(PlatformFunctionIndex *index);
+
+/*!
+	@function findPlatformFunction
+	@abstract The first function named name with any of flags set, IOI2CDevice::getPlatformFunction.
+	@result Its array position, or -1.
+*/
+SInt32 findPlatformFunction(const PlatformFunctionIndex *index, const void *name, UInt32 flags);
+
+/*!
+	@function indexOfPlatformFunction
+	@result The array position of func, named name, or -1.
+*/
+SInt32 indexOfPlatformFunction(const PlatformFunctionIndex *index, const void *func, const void *name);
+
+/*!
+	@function nextPlatformFunctionWithFlags
+	@abstract The first function at or after array position from with any of flags set,
+	IOI2CDevice::performFunctionsWithFlags.
+	@result Its array position, or -1.
+*/
+SInt32 nextPlatformFunctionWithFlags(const PlatformFunctionIndex *index, UInt32 flags, UInt32 from);
+
+#endif // PFINDEX_H
@@ -0,0 +1,477 @@
+/*
+ * pfprogram.c
+ *
+ * Platform-do function decoding, see pfprogram.h.
+ */
+
+#include <string.h>
+#include "pfprogram.h"
+
+/*
+ * IOPlatformFunction.cpp's command descriptors: the first entry is the
+ * length in words of a fixed length command, or minus the fixed part of a
+ * variable one, followed by one entry per parameter. A negative parameter
+ * entry is variable data whose byte count is the parameter of that index.
+ */
+static const SInt32 gCommandDesc[kCommandMaxCommand + 1][8] = {
+    { 1 },                          // kCommandCommandList
+    { 2 },                          // kCommandWriteGPIO
+    { 3 },                          // kCommandReadGPIO
+    { 3 },                          // kCommandWriteReg32
+    { 1 },                          // kCommandReadReg32
+    { 3 },                          // kCommandWriteReg16
+    { 1 },                          // kCommandReadReg16
+    { 3 },                          // kCommandWriteReg8
+    { 1 },                          // kCommandReadReg8
+    { 1 },                          // kCommandDelay
+    { 3 },                          // kCommandWaitReg32
+    { 3 },                          // kCommandWaitReg16
+    { 3 },                          // kCommandWaitReg8
+    { 1 },                          // kCommandReadI2C
+    { -1, 4, -1 },                  // kCommandWriteI2C
+    { -3, 4, 4, 4, -1, -2 },        // kCommandRMWI2C
+    { 0 },                          // kCommandGeneralI2C
+    { 2 },                          // kCommandShiftBytesRight
+    { 2 },                          // kCommandShiftBytesLeft
+    { 2 },                          // kCommandReadConfig
+    { -2, 4, 4, -2 },               // kCommandWriteConfig
+    { -4, 4, 4, 4, 4, -2, -3 },     // kCommandRMWConfig
+    { 2 },                          // kCommandReadI2CSubAddr
+    { -2, 4, 4, -2 },               // kCommandWriteI2CSubAddr
+    { 1 },                          // kCommandI2CMode
+    { -4, 4, 4, 4, 4, -2, -3 },     // kCommandRMWI2CSubAddr
+    { 4 },                          // kCommandReadReg32MaskShRtXOR
+    { 4 },                          // kCommandReadReg16MaskShRtXOR
+    { 4 },                          // kCommandReadReg8MaskShRtXOR
+    { 3 },                          // kCommandWriteReg32ShLtMask
+    { 3 },                          // kCommandWriteReg16ShLtMask
+    { 3 },                          // kCommandWriteReg8ShLtMask
+    { -1, 4, -1, -1 },              // kCommandMaskandCompare
+    { 2 },                          // kCommandShiftBitStreamRight
+    { 2 },                          // kCommandShiftBitStreamLeft
+    { -1, 4, -1 },                  // kCommandMaskByteStream
+    { -1, 4, -1 },                  // kCommandXorByteStream
+    { 2 },                          // kCommandWriteI2CValueToSubAddr
+    { 1 },                          // kCommandXORValueToByteStream
+    { 0 },                          // kCommandImplementationSpecific
+};
+
+// Property data is big-endian and variable length data leaves words unaligned.
+static UInt32 readWord(const UInt8 *p) {
+    return ((UInt32)p[0] << 24) | ((UInt32)p[1] << 16) | ((UInt32)p[2] << 8) | p[3];
+}
+
+/*
+ * IOPlatformFunctionIterator::scanSubCommand on the command at offset.
+ * Unlike the kernel version, variable length data that runs past the end
+ * of the set is an error instead of a read past the property.
+ */
+static UInt32 scanCommand(const UInt8 *bytes, UInt32 offset, UInt32 length, PlatformCommand *command) {
+    const SInt32            *desc;
+    UInt32                  remaining = length - offset;
+    UInt32                  words, i, index;
+    SInt32                  entry;
+
+    memset(command, 0, sizeof(*command));
+
+    if (remaining < 4)
+        return kIOPFBadCmdLength;
+
+    command->command = readWord(bytes + offset);
+    if (command->command > kCommandMaxCommand)
+        return kIOPFUnknownCmd;
+
+    desc = gCommandDesc[command->command];
+    words = (desc[0] < 0) ? -desc[0] : desc[0];
+    if (words > kIOPFMaxParams || (words + 1) * 4 > remaining)
+        return kIOPFBadCmdLength;
+
+    for (i = 0; i < words; i++)
+        command->param[i] = readWord(bytes + offset + 4 * (i + 1));
+    command->length = (words + 1) * 4;
+
+    if (desc[0] < 0) {
+        for (i = words + 1; i < 8 && (entry = desc[i]) != 0; i++) {
+            index = (entry < 0) ? -entry : entry;
+            if (i > kIOPFMaxParams || index > words ||
+                    command->param[index - 1] > remaining - command->length)
+                return kIOPFBadCmdLength;
+
+            command->data[i - 1] = bytes + offset + command->length;
+            command->length += command->param[index - 1];
+        }
+    }
+
+    return kIOPFNoError;
+}
+
+UInt32 splitPlatformFunction(const UInt8 *bytes, UInt32 length, UInt32 *setLength,
+                             UInt32 *pHandle, UInt32 *flags) {
+    PlatformCommand         command;
+    UInt32                  offset, listCount = 0, listDone = 0, result;
+    int                     isList = 0;
+
+    // pHandle, flags and at least a command
+    if (length < 12)
+        return kIOPFBadCmdLength;
+
+    *pHandle = readWord(bytes);
+    *flags = readWord(bytes + 4);
+    if (readWord(bytes + 8) > kCommandMaxCommand)
+        return kIOPFBadCmdLength;
+
+    offset = 8;
+    do {
+        if ((result = scanCommand(bytes, offset, length, &command)) != kIOPFNoError)
+            return result;
+        offset += command.length;
+
+        if (command.command == kCommandCommandList && !isList) {
+            isList = 1;
+            listCount = command.param[0];
+            continue;
+        }
+        listDone++;
+
+    } while (offset < length && isList && listDone < listCount);
+
+    *setLength = offset;
+    return kIOPFNoError;
+}
+
+void startPlatformCommands(PlatformCommandIterator *iter, const UInt8 *set, UInt32 length) {
+    memset(iter, 0, sizeof(*iter));
+    iter->bytes = set;
+    iter->length = length;
+}
+
+int nextPlatformCommand(PlatformCommandIterator *iter, PlatformCommand *command, UInt32 *result) {
+    *result = kIOPFNoError;
+    if (iter->done)
+        return 0;
+
+    // skip pHandle and flags, and the command list command if there is one
+    if (iter->offset == 0) {
+        iter->offset = 8;
+        if (iter->length >= 12 && readWord(iter->bytes + 8) == kCommandCommandList) {
+            if ((*result = scanCommand(iter->bytes, iter->offset, iter->length, command)) != kIOPFNoError)
+                return 0;
+            iter->isList = 1;
+            iter->listCount = command->param[0];
+            iter->offset += command->length;
+        }
+    }
+
+    if ((*result = scanCommand(iter->bytes, iter->offset, iter->length, command)) != kIOPFNoError)
+        return 0;
+
+    iter->offset += command->length;
+    if (iter->isList)
+        iter->listDone++;
+
+    if (iter->offset == iter->length || (iter->isList && iter->listDone == iter->listCount))
+        iter->done = 1;
+    return 1;
+}
+
+IOReturn decodePlatformFunctionStatus(const UInt8 *set, UInt32 length) {
+    PlatformCommandIterator iter;
+    PlatformCommand         command;
+    UInt32                  result;
+
+    startPlatformCommands(&iter, set, length);
+    nextPlatformCommand(&iter, &command, &result);
+    return result;
+}
+
+IOReturn interpretPlatformFunction(const UInt8 *set, UInt32 length, const I2CPFTarget *target) {
+    PlatformCommandIterator iter;
+    PlatformCommand         command;
+    UInt8                   scratchBuffer[kI2CPF_READ_BUFFER_LEN] = { 0 };
+    UInt8                   readBuffer[kI2CPF_READ_BUFFER_LEN] = { 0 };
+    UInt32                  mode = kI2CMode_Unspecified;
+    UInt32                  key = 0, result, i;
+    const UInt32            *p = command.param;
+    IOReturn                status = kIOReturnSuccess;
+    int                     isI2CFunction = 0, locked = 0;
+
+    // first pass only looks for an I2C command
+    startPlatformCommands(&iter, set, length);
+    while (nextPlatformCommand(&iter, &command, &result)) {
+        if (command.command == kCommandReadI2CSubAddr || command.command == kCommandWriteI2CSubAddr) {
+            isI2CFunction = 1;
+            break;
+        }
+    }
+    if (result != kIOPFNoError)
+        return result;
+
+    if (isI2CFunction) {
+        if ((status = target->lock(target->context, &key)) != kIOReturnSuccess)
+            return status;
+        locked = 1;
+    }
+
+    startPlatformCommands(&iter, set, length);
+    while (nextPlatformCommand(&iter, &command, &result)) {
+        switch (command.command) {
+            case kCommandDelay:
+                if (p[0] / 1000)
+                    target->delay(target->context, p[0] / 1000);
+                break;
+
+            case kCommandReadI2CSubAddr:
+                if (p[1] > kI2CPF_READ_BUFFER_LEN)
+                    status = kIOPFBadCmdLength;
+                else if (mode == kI2CMode_Unspecified)
+                    status = kIOReturnUnsupportedMode;
+                else
+                    status = target->read(target->context, p[0], readBuffer, p[1], key, mode);
+                break;
+
+            case kCommandWriteI2CSubAddr:
+                if (mode == kI2CMode_Unspecified)
+                    status = kIOReturnUnsupportedMode;
+                else
+                    status = target->write(target->context, p[0], command.data[2], p[1], key, mode);
+                break;
+
+            case kCommandI2CMode:
+                switch (p[0]) {
+                    default:
+                    case kPFMode_Dumb:          status = kIOReturnUnsupportedMode;  break;
+                    case kPFMode_Standard:      mode = kI2CMode_Standard;           break;
+                    case kPFMode_Subaddress:    mode = kI2CMode_StandardSub;        break;
+                    case kPFMode_Combined:      mode = kI2CMode_Combined;           break;
+                }
+                break;
+
+            case kCommandRMWI2CSubAddr:
+                if (p[1] > kI2CPF_READ_BUFFER_LEN || p[2] > kI2CPF_READ_BUFFER_LEN ||
+                        p[3] > kI2CPF_READ_BUFFER_LEN || p[2] > p[1]) {
+                    status = kIOReturnAborted;
+                    break;
+                }
+                if (mode == kI2CMode_Unspecified) {
+                    status = kIOReturnUnsupportedMode;
+                    break;
+                }
+
+                for (i = 0; i < p[1]; i++)
+                    scratchBuffer[i] = (command.data[5][i] & command.data[4][i]) |
+                                       (readBuffer[i] & ~command.data[4][i]);
+                status = target->write(target->context, (UInt8)p[0], scratchBuffer, (UInt16)p[3], key, mode);
+                break;
+
+            default:
+                status = kIOReturnAborted;
+                break;
+        }
+
+        if (status != kIOReturnSuccess)
+            break;
+    }
+    if (status == kIOReturnSuccess && result != kIOPFNoError)
+        status = result;
+
+    if (locked)
+        target->unlock(target->context, key);
+    return status;
+}
+
+IOReturn compileI2CPFProgram(const UInt8 *set, UInt32 length, I2CPFProgram *program) {
+    PlatformCommandIterator iter;
+    PlatformCommand         command;
+    I2CPFInstruction        *insn;
+    const UInt32            *p = command.param;
+    UInt32                  mode = kI2CMode_Unspecified, result;
+    IOReturn                error = kIOReturnSuccess;
+
+    memset(program, 0, sizeof(*program));
+
+    startPlatformCommands(&iter, set, length);
+    while (nextPlatformCommand(&iter, &command, &result)) {
+        if (program->count == kI2CPFProgramMaxInstructions)
+            return kIOReturnNoResources;
+
+        insn = &program->instruction[program->count];
+        memset(insn, 0, sizeof(*insn));
+        insn->mode = mode;
+
+        switch (command.command) {
+            case kCommandDelay:
+                insn->op = kI2CPFOp_Delay;
+                if ((insn->arg = p[0] / 1000) == 0)
+                    continue;
+                break;
+
+            case kCommandReadI2CSubAddr:
+                if (p[1] > kI2CPF_READ_BUFFER_LEN)
+                    error = kIOPFBadCmdLength;
+                else if (mode == kI2CMode_Unspecified)
+                    error = kIOReturnUnsupportedMode;
+                insn->op = kI2CPFOp_Read;
+                insn->arg = p[0];
+                insn->count = p[1];
+                break;
+
+            case kCommandWriteI2CSubAddr:
+                if (mode == kI2CMode_Unspecified)
+                    error = kIOReturnUnsupportedMode;
+                insn->op = kI2CPFOp_Write;
+                insn->arg = p[0];
+                insn->count = p[1];
+                insn->data = command.data[2];
+                break;
+
+            case kCommandI2CMode:
+                switch (p[0]) {
+                    default:
+                    case kPFMode_Dumb:          error = kIOReturnUnsupportedMode;   break;
+                    case kPFMode_Standard:      mode = kI2CMode_Standard;           continue;
+                    case kPFMode_Subaddress:    mode = kI2CMode_StandardSub;        continue;
+                    case kPFMode_Combined:      mode = kI2CMode_Combined;           continue;
+                }
+                break;
+
+            case kCommandRMWI2CSubAddr:
+                if (p[1] > kI2CPF_READ_BUFFER_LEN || p[2] > kI2CPF_READ_BUFFER_LEN ||
+                        p[3] > kI2CPF_READ_BUFFER_LEN || p[2] > p[1])
+                    error = kIOReturnAborted;
+                else if (mode == kI2CMode_Unspecified)
+                    error = kIOReturnUnsupportedMode;
+                insn->op = kI2CPFOp_ModifyWrite;
+                insn->arg = (UInt8)p[0];
+                insn->count = (UInt16)p[3];
+                insn->maskCount = p[1];
+                insn->mask = command.data[4];
+                insn->data = command.data[5];
+                break;
+
+            default:
+                error = kIOReturnAborted;
+                break;
+        }
+
+        if (error != kIOReturnSuccess)
+            break;
+
+        program->count++;
+        if (insn->op != kI2CPFOp_Delay)
+            program->options |= kI2CPFProgram_TouchesI2C;
+    }
+
+    if (error == kIOReturnSuccess && result != kIOPFNoError)
+        error = result;
+
+    // never run part of a set that cannot run to the end
+    if (error != kIOReturnSuccess) {
+        memset(program, 0, sizeof(*program));
+        program->count = 1;
+        program->instruction[0].op = kI2CPFOp_Fail;
+        program->instruction[0].arg = error;
+    }
+
+    return kIOReturnSuccess;
+}
+
+IOReturn runI2CPFProgram(const I2CPFProgram *program, const I2CPFTarget *target) {
+    const I2CPFInstruction  *insn, *end;
+    UInt8                   scratchBuffer[kI2CPF_READ_BUFFER_LEN] = { 0 };
+    UInt8                   readBuffer[kI2CPF_READ_BUFFER_LEN] = { 0 };
+    UInt32                  key = 0, i;
+    IOReturn                status = kIOReturnSuccess;
+
+    if ((program->options & kI2CPFProgram_TouchesI2C) &&
+            (status = target->lock(target->context, &key)) != kIOReturnSuccess)
+        return status;
+
+    for (insn = program->instruction, end = insn + program->count; insn < end; insn++) {
+        switch (insn->op) {
+            case kI2CPFOp_Delay:
+                target->delay(target->context, insn->arg);
+                break;
+
+            case kI2CPFOp_Read:
+                status = target->read(target->context, insn->arg, readBuffer, insn->count, key, insn->mode);
+                break;
+
+            case kI2CPFOp_Write:
+                status = target->write(target->context, insn->arg, insn->data, insn->count, key, insn->mode);
+                break;
+
+            case kI2CPFOp_ModifyWrite:
+                for (i = 0; i < insn->maskCount; i++)
+                    scratchBuffer[i] = (insn->data[i] & insn->mask[i]) | (readBuffer[i] & ~insn->mask[i]);
+                status = target->write(target->context, insn->arg, scratchBuffer, insn->count, key,
+                                       insn->mode);
+                break;
+
+            case kI2CPFOp_Fail:
+            default:
+                status = (IOReturn)insn->arg;
+                break;
+        }
+
+        if (status != kIOReturnSuccess)
+            break;
+    }
+
+    if (program->options & kI2CPFProgram_TouchesI2C)
+        target->unlock(target->context, key);
+    return status;
+}
+
+// Index just past the writes that go out with the one at first, as one write of no more than max bytes.
+static UInt32 burstEnd(const I2CPFProgram *program, UInt32 first, UInt32 max) {
+    const I2CPFInstruction  *insn = &program->instruction[first];
+    const I2CPFInstruction  *next;
+    UInt32                  end, count = insn->count;
+
+    // only subaddress modes put consecutive bytes in consecutive registers
+    if (insn->op != kI2CPFOp_Write || count == 0 ||
+            (insn->mode != kI2CMode_StandardSub && insn->mode != kI2CMode_Combined))
+        return first + 1;
+
+    for (end = first + 1; end < program->count; end++) {
+        next = &program->instruction[end];
+        if (next->op != kI2CPFOp_Write || next->mode != insn->mode || next->count == 0 ||
+                next->arg != insn->arg + count || count + next->count > max ||
+                insn->arg + count + next->count > 0x100)
+            break;
+        count += next->count;
+    }
+    return end;
+}
+
+void optimizeI2CPFProgram(I2CPFProgram *program, UInt32 maxBurst) {
+    I2CPFInstruction        first;
+    UInt8                   *data;
+    UInt32                  i, j, end, bytes, count = 0;
+
+    // in place: an instruction only ever moves down
+    for (i = 0; i < program->count; i = end) {
+        end = burstEnd(program, i, maxBurst);
+
+        first = program->instruction[i];
+        if (end > i + 1) {
+            for (bytes = 0, j = i; j < end; j++)
+                bytes += program->instruction[j].count;
+
+            if (program->burstBytes + bytes > kI2CPFProgramMaxBurstBytes)
+                end = i + 1;
+            else {
+                data = program->burst + program->burstBytes;
+                for (j = i; j < end; j++) {
+                    memcpy(data, program->instruction[j].data, program->instruction[j].count);
+                    data += program->instruction[j].count;
+                }
+                first.data = program->burst + program->burstBytes;
+                first.count = bytes;
+                program->burstBytes += bytes;
+            }
+        }
+        program->instruction[count++] = first;
+    }
+    program->count = count;
+}
@@ -0,0 +1,216 @@
+/*
+ * pfprogram.h
+ *
+ * Platform-do function decoding: IOI2CDevice::decodePlatformFunction, and a
+ * model of decoding the commands once and running them.
+ *
+ * A platform-do-xxx property holds one or more command sets: a pHandle,
+ * a kIOPFFlag_xxx word, then one command or a command list. The iterator
+ * here walks one set the way IOPlatformFunctionIterator does, over the
+ * big-endian property bytes as found in the device tree.
+ *
+ * IOI2CDevice runs no platform-do command: the loops performFunction used
+ * to run stopped as soon as a command decoded and returned that status.
+ * It now decodes that status once per function, which is what
+ * decodePlatformFunctionStatus returns.
+ *
+ * The rest is the model for running the commands, which IOI2CDevice does
+ * not do yet. interpretPlatformFunction runs a set straight from the
+ * iterator, two passes per call, the way performFunction's loops read if
+ * they did not stop early; compileI2CPFProgram decodes it once into the
+ * instructions runI2CPFProgram executes, and optimizeI2CPFProgram merges
+ * adjacent writes to consecutive subaddresses. A set that does not decode,
+ * or that would fail part way through, compiles to a single kI2CPFOp_Fail:
+ * the compiled program returns the same error as the interpreter without
+ * running the commands before the bad one.
+ */
+
+#ifndef PFPROGRAM_H
+#define PFPROGRAM_H
+
+#include "IOI2CDefs.h"
+
+// From IOPlatformFunction.h
+#define kIOPFMaxParams			10
+
+enum
+{
+	kIOPFFlagOnInit			= 0x80000000,
+	kIOPFFlagOnTerm			= 0x40000000,
+	kIOPFFlagOnSleep		= 0x20000000,
+	kIOPFFlagOnWake			= 0x10000000,
+	kIOPFFlagOnDemand		= 0x08000000,
+	kIOPFFlagIntGen			= 0x04000000,
+};
+
+enum
+{
+	kCommandCommandList		= 0,
+	kCommandDelay			= 9,
+	kCommandReadI2CSubAddr	= 22,
+	kCommandWriteI2CSubAddr	= 23,
+	kCommandI2CMode			= 24,
+	kCommandRMWI2CSubAddr	= 25,
+	kCommandMaxCommand		= 0x27,
+};
+
+enum
+{
+	kIOPFNoError			= 0,
+	kIOPFUnknownCmd			= 1,
+	kIOPFBadCmdLength		= 2
+};
+
+// From IOI2CDevice.h
+#define kI2CPF_READ_BUFFER_LEN	32
+
+enum
+{
+	kPFMode_Dumb			= 1,
+	kPFMode_Standard		= 2,
+	kPFMode_Subaddress		= 3,
+	kPFMode_Combined		= 4,
+};
+
+// Platform program instructions
+enum
+{
+	kI2CPFOp_Delay			= 0,
+	kI2CPFOp_Read			= 1,
+	kI2CPFOp_Write			= 2,
+	kI2CPFOp_ModifyWrite	= 3,
+	kI2CPFOp_Fail			= 4,
+};
+
+enum
+{
+	kI2CPFProgram_TouchesI2C	= 0x00000001,
+};
+
+#define kI2CPFProgramMaxInstructions	32
+#define kI2CPFProgramMaxBurstBytes		256
+
+/*!
+	@struct PlatformCommand
+	@abstract One decoded command, as getNextCommand returns it.
+	@field length bytes, the command word included
+	@field param fixed parameters, and lengths of the variable ones
+	@field data variable length parameters, NULL for the fixed ones
+*/
+typedef struct
+{
+	UInt32			command;
+	UInt32			length;
+	UInt32			param[kIOPFMaxParams];
+	const UInt8		*data[kIOPFMaxParams];
+
+} PlatformCommand;
+
+typedef struct
+{
+	const UInt8		*bytes;
+	UInt32			length;
+	UInt32			offset;			// of the next command, 0 before the first
+	int				isList;
+	UInt32			listCount;
+	UInt32			listDone;
+	int				done;
+
+} PlatformCommandIterator;
+
+typedef struct
+{
+	UInt8			op;				// kI2CPFOp_xxx
+	UInt32			mode;			// kI2CMode_xxx
+	UInt32			arg;			// subaddress, delay in ms, or the IOReturn of kI2CPFOp_Fail
+	UInt32			count;
+	UInt32			maskCount;
+	const UInt8		*data;
+	const UInt8		*mask;
+
+} I2CPFInstruction;
+
+typedef struct
+{
+	UInt32				options;	// kI2CPFProgram_xxx
+	UInt32				count;
+	I2CPFInstruction	instruction[kI2CPFProgramMaxInstructions];
+	UInt32				burstBytes;
+	UInt8				burst[kI2CPFProgramMaxBurstBytes];	// merged writes' data
+
+} I2CPFProgram;
+
+/*!
+	@struct I2CPFTarget
+	@abstract The device a platform function runs against, IOI2CDevice's lockI2CBus, readI2C and so on.
+*/
+typedef struct
+{
+	void		*context;
+	IOReturn	(*lock)(void *context, UInt32 *key);
+	void		(*unlock)(void *context, UInt32 key);
+	IOReturn	(*read)(void *context, UInt32 subAddress, UInt8 *buf, UInt32 count, UInt32 key, UInt32 mode);
+	IOReturn	(*write)(void *context, UInt32 subAddress, const UInt8 *buf, UInt32 count, UInt32 key,
+					UInt32 mode);
+	void		(*delay)(void *context, UInt32 ms);
+
+} I2CPFTarget;
+
+/*!
+	@function splitPlatformFunction
+	@abstract Length of the first command set in a property, IOPlatformFunctionIterator::scanCommand.
+	@result kIOPFNoError with setLength, pHandle and flags filled in, or a kIOPFxxx error.
+*/
+UInt32 splitPlatformFunction(const UInt8 *bytes, UInt32 length, UInt32 *setLength,
+		UInt32 *pHandle, UInt32 *flags);
+
+void startPlatformCommands(PlatformCommandIterator *iter, const UInt8 *set, UInt32 length);
+
+/*!
+	@function nextPlatformCommand
+	@abstract IOPlatformFunctionIterator::getNextCommand.
+	@result 1 with command filled in, 0 at the end or on error, result tells which.
+*/
+int nextPlatformCommand(PlatformCommandIterator *iter, PlatformCommand *command, UInt32 *result);
+
+/*!
+	@function decodePlatformFunctionStatus
+	@abstract What IOI2CDevice::performFunction returns for one command set, IOI2CDevice::decodePlatformFunction.
+	@discussion No command runs: this is the first command's decode status.
+*/
+IOReturn decodePlatformFunctionStatus(const UInt8 *set, UInt32 length);
+
+/*!
+	@function interpretPlatformFunction
+	@abstract Runs one command set from the iterator, two passes per call, every command to the end.
+*/
+IOReturn interpretPlatformFunction(const UInt8 *set, UInt32 length, const I2CPFTarget *target);
+
+/*!
+	@function compileI2CPFProgram
+	@abstract Decodes one command set into a program.
+	@discussion The program points into set. Returns kIOReturnNoResources if the set
+	has more than kI2CPFProgramMaxInstructions instructions, otherwise kIOReturnSuccess,
+	also for sets that compile to kI2CPFOp_Fail.
+*/
+IOReturn compileI2CPFProgram(const UInt8 *set, UInt32 length, I2CPFProgram *program);
+
+/*!
+	@function optimizeI2CPFProgram
+	@abstract Merges adjacent writes to consecutive subaddresses into writes of up to maxBurst bytes.
+	@discussion A multi-byte write only fills consecutive registers on a device that auto-increments
+	its subaddress on writes, so merging is opt-in: a device that has not said it does gets a maxBurst
+	of 0, which merges nothing. Nothing is merged across a delay, read or read-modify-write, and reads are never
+	dropped: a status or FIFO register changes when read. A write that would
+	not fit what is left of the program's burst buffer is left alone. Merged writes point into
+	program->burst, so the program must not be copied afterwards.
+*/
+void optimizeI2CPFProgram(I2CPFProgram *program, UInt32 maxBurst);
+
+/*!
+	@function runI2CPFProgram
+	@abstract Runs a program against target, with the bus locked if it has any I2C instructions.
+*/
+IOReturn runI2CPFProgram(const I2CPFProgram *program, const I2CPFTarget *target);
+
+#endif // PFPROGRAM_H
@@ -0,0 +1,163 @@
+/*
+ * pmonring.c
+ *
+ * IOPlatformMonitor's command ring, see pmonring.h.
+ */
+
+#include <string.h>
+#include "pmonring.h"
+
+// with the lock held
+static int takePMonCommandLocked(PMonCommandRing *ring, PMonCommand *command) {
+    if (ring->count == 0)
+        return 0;
+
+    // taken out, it can no longer be merged into
+    *command = ring->ring[ring->head];
+    ring->head = (ring->head + 1) % kPMonCommandRingSize;
+    ring->count--;
+    if (command->command == kPMonCommandHandleEvent)
+        ring->stats.processed++;
+    return 1;
+}
+
+static int isPMonThresholdEvent(UInt32 event) {
+    return event == kPMonEventLowThresholdHit || event == kPMonEventHighThresholdHit;
+}
+
+// IOPlatformMonitor::sameEventSource
+static int samePMonEventSource(const PMonCommand *queued, const PMonCommand *command) {
+    if (queued->command != kPMonCommandHandleEvent || queued->sensor != command->sensor ||
+            queued->sensorID != command->sensorID)
+        return 0;
+    return queued->event == command->event ||
+            (isPMonThresholdEvent(queued->event) && isPMonThresholdEvent(command->event));
+}
+
+static void *runPMonCommandRing(void *arg) {
+    PMonCommandRing         *ring = arg;
+    PMonCommand             command;
+
+    pthread_mutex_lock(&ring->lock);
+    for (;;) {
+        while (ring->count == 0 && !ring->stopping)
+            pthread_cond_wait(&ring->wake, &ring->lock);
+        if (!takePMonCommandLocked(ring, &command))
+            break;
+        ring->busy = 1;
+        pthread_mutex_unlock(&ring->lock);
+
+        ring->handler(ring->refCon, &command);
+
+        pthread_mutex_lock(&ring->lock);
+        ring->busy = 0;
+        if (ring->count == 0)
+            pthread_cond_broadcast(&ring->idle);
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return NULL;
+}
+
+IOReturn startPMonCommandRing(PMonCommandRing *ring, PMonCommandHandler handler, void *refCon) {
+    memset(ring, 0, sizeof(*ring));
+    ring->handler = handler;
+    ring->refCon = refCon;
+
+    if (pthread_mutex_init(&ring->lock, NULL))
+        return kIOReturnNoResources;
+    if (pthread_cond_init(&ring->wake, NULL)) {
+        pthread_mutex_destroy(&ring->lock);
+        return kIOReturnNoResources;
+    }
+    if (pthread_cond_init(&ring->idle, NULL)) {
+        pthread_cond_destroy(&ring->wake);
+        pthread_mutex_destroy(&ring->lock);
+        return kIOReturnNoResources;
+    }
+    if (handler && pthread_create(&ring->thread, NULL, runPMonCommandRing, ring)) {
+        pthread_cond_destroy(&ring->idle);
+        pthread_cond_destroy(&ring->wake);
+        pthread_mutex_destroy(&ring->lock);
+        return kIOReturnNoResources;
+    }
+    return kIOReturnSuccess;
+}
+
+IOReturn postPMonCommand(PMonCommandRing *ring, const PMonCommand *command) {
+    PMonCommand             *queued;
+    UInt32                  i, limit = kPMonCommandRingSize;
+    int                     isEvent = command->command == kPMonCommandHandleEvent;
+    int                     coalesce = isEvent && isPMonThresholdEvent(command->event);
+    int                     merged = 0;
+    IOReturn                status = kIOReturnBusy;
+
+    if (isEvent)
+        limit -= kPMonStateCommandReserve;
+
+    pthread_mutex_lock(&ring->lock);
+    if (isEvent)
+        ring->stats.received++;
+
+    if (coalesce || (isEvent && ring->count >= limit)) {
+        // newest first, the one the handler would see last
+        for (i = ring->count; i-- > 0; ) {
+            queued = &ring->ring[(ring->head + i) % kPMonCommandRingSize];
+            if (queued->command != kPMonCommandHandleEvent)
+                break;                                  // not across a sleep or wake
+            if (samePMonEventSource(queued, command)) {
+                queued->event = command->event;
+                queued->value = command->value;
+                merged = 1;
+                break;
+            }
+        }
+    }
+
+    if (merged) {
+        if (coalesce)
+            ring->stats.coalesced++;
+        else
+            ring->stats.merged++;
+        status = kIOReturnSuccess;
+    } else if (ring->count < limit) {
+        ring->ring[(ring->head + ring->count) % kPMonCommandRingSize] = *command;
+        if (++ring->count > ring->stats.highWater)
+            ring->stats.highWater = ring->count;
+        ring->stats.posted++;
+        pthread_cond_signal(&ring->wake);
+        status = kIOReturnSuccess;
+    } else
+        ring->stats.dropped++;
+    pthread_mutex_unlock(&ring->lock);
+    return status;
+}
+
+int takePMonCommand(PMonCommandRing *ring, PMonCommand *command) {
+    int                     taken;
+
+    pthread_mutex_lock(&ring->lock);
+    taken = takePMonCommandLocked(ring, command);
+    pthread_mutex_unlock(&ring->lock);
+    return taken;
+}
+
+void waitPMonCommandRing(PMonCommandRing *ring) {
+    pthread_mutex_lock(&ring->lock);
+    while (ring->count || ring->busy)
+        pthread_cond_wait(&ring->idle, &ring->lock);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+void stopPMonCommandRing(PMonCommandRing *ring) {
+    if (ring->handler) {
+        pthread_mutex_lock(&ring->lock);
+        ring->stopping = 1;
+        pthread_cond_signal(&ring->wake);
+        pthread_mutex_unlock(&ring->lock);
+
+        pthread_join(ring->thread, NULL);
+    }
+    pthread_cond_destroy(&ring->idle);
+    pthread_cond_destroy(&ring->wake);
+    pthread_mutex_destroy(&ring->lock);
+}
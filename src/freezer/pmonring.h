@@ -0,0 +1,140 @@
+/*
+ * pmonring.h
+ *
+ * IOPlatformMonitor's command ring, the user space counterpart of
+ * IOPlatformMonitor::threadCommon and drainCommandRing.
+ *
+ * Sensor events and sleep and wake commands are copied into a ring of
+ * records allocated with the ring, and one worker thread runs them in
+ * order under the caller's gate. Events may not take the last
+ * kPMonStateCommandReserve records, so a sleep or wake always finds room.
+ * A threshold hit from a sensor that already has one queued overwrites
+ * it in place. Any other event that finds the ring full replaces the
+ * value of a queued event of the same type from the same sensor, or is
+ * refused with kIOReturnBusy; PMonEventStats counts each. Neither folds
+ * an event into one queued before a sleep or wake.
+ *
+ * A ring started without a handler has no worker: the caller takes the
+ * commands itself, which lets a replay step the ring in simulated time.
+ */
+
+#ifndef PMONRING_H
+#define PMONRING_H
+
+#include <pthread.h>
+#include "IOI2CDefs.h"
+
+#define kPMonCommandRingSize		32
+#define kPMonStateCommandReserve	2
+
+// IOPlatformMonitor's kIOPMonCommandXXX
+enum
+{
+	kPMonCommandHandleEvent		= 1,
+	kPMonCommandSaveState		= 2,
+	kPMonCommandRestoreState	= 3
+};
+
+// IOPlatformMonitor's kIOPMonMessageXXX threshold hits, the events that coalesce
+enum
+{
+	kPMonEventLowThresholdHit	= 3,
+	kPMonEventHighThresholdHit	= 4
+};
+
+/*!
+	@struct PMonCommand
+	@abstract One IOPMonCommandThreadSet.
+	@field sensor the conSensor the event came from
+	@field event kIOPMonMessageXXX
+	@field sensorID the event dictionary's sensor-id
+	@field value stands for the event dictionary, newest wins when events merge
+*/
+typedef struct
+{
+	UInt32			command;
+	const void		*sensor;
+	UInt32			event;
+	UInt32			sensorID;
+	UInt32			value;
+
+} PMonCommand;
+
+/*!
+	@struct PMonEventStats
+	@abstract IOPMonEventStats.
+	@field coalesced threshold hits folded into the same sensor's queued threshold hit
+	@field merged other events folded into a queued one when the ring was full
+	@field processed events taken out of the ring
+*/
+typedef struct
+{
+	UInt32			received;
+	UInt32			posted;
+	UInt32			coalesced;
+	UInt32			merged;
+	UInt32			dropped;
+	UInt32			processed;
+	UInt32			highWater;
+
+} PMonEventStats;
+
+/*!
+	@typedef PMonCommandHandler
+	@abstract The monitor's commandGateCaller, called on the worker thread one command at a time.
+*/
+typedef void (*PMonCommandHandler)(void *refCon, const PMonCommand *command);
+
+typedef struct
+{
+	pthread_mutex_t		lock;
+	pthread_cond_t		wake;
+	pthread_cond_t		idle;			// signalled when the worker runs out of commands
+	pthread_t			thread;
+	PMonCommand			ring[kPMonCommandRingSize];
+	UInt32				head;
+	UInt32				count;
+	int					busy;			// the worker is running a command
+	int					stopping;
+	PMonCommandHandler	handler;
+	void				*refCon;
+	PMonEventStats		stats;
+
+} PMonCommandRing;
+
+/*!
+	@function startPMonCommandRing
+	@abstract Starts the worker that hands every posted command to handler.
+	@discussion With a NULL handler no worker is started, see takePMonCommand.
+*/
+IOReturn startPMonCommandRing(PMonCommandRing *ring, PMonCommandHandler handler, void *refCon);
+
+/*!
+	@function postPMonCommand
+	@abstract Copies command into the ring, IOPlatformMonitor::threadCommon.
+	@result kIOReturnSuccess if it was queued or folded into a queued event,
+	kIOReturnBusy if it was dropped.
+*/
+IOReturn postPMonCommand(PMonCommandRing *ring, const PMonCommand *command);
+
+/*!
+	@function takePMonCommand
+	@abstract Takes the oldest command out of a ring started without a handler.
+	@result 1 with command filled in, 0 if the ring is empty.
+*/
+int takePMonCommand(PMonCommandRing *ring, PMonCommand *command);
+
+/*!
+	@function waitPMonCommandRing
+	@abstract Returns once every command posted so far has been handled.
+*/
+void waitPMonCommandRing(PMonCommandRing *ring);
+
+/*!
+	@function stopPMonCommandRing
+	@abstract Runs the commands still queued and joins the worker.
+	@discussion A ring without a worker is released with its commands still queued.
+*/
+void stopPMonCommandRing(PMonCommandRing *ring);
+
+#endif // PMONRING_H
@@ -0,0 +1,51 @@
+/*
+ * published.c
+ *
+ * Single writer ADT746x snapshot publication, see published.h.
+ */
+
+#include <string.h>
+#include "published.h"
+
+void publishADT746xSnapshot(ADT746xPublished *published, const ADT746xSnapshot *snapshot,
+                            const UInt8 *duty, UInt64 timeMs) {
+    published->sequence++;
+    __sync_synchronize();
+
+    published->snapshot = *snapshot;
+    memcpy(published->duty, duty, sizeof(published->duty));
+    published->timeMs = timeMs;
+
+    __sync_synchronize();
+    published->sequence++;
+}
+
+int readPublishedADT746x(const ADT746xPublished *published, UInt64 nowMs, UInt32 maxStalenessMs,
+                         ADT746xSnapshot *snapshot, UInt8 *duty, UInt64 *timeMs) {
+    ADT746xSnapshot         copy;
+    UInt8                   dutyCopy[kPWMDutyCount];
+    UInt64                  sampled;
+    UInt32                  sequence;
+
+    do {
+        // odd: the sampler is in the middle of a handful of stores
+        while ((sequence = published->sequence) & 1)
+            ;
+
+        __sync_synchronize();
+        copy = published->snapshot;
+        memcpy(dutyCopy, published->duty, sizeof(dutyCopy));
+        sampled = published->timeMs;
+        __sync_synchronize();
+    } while (sequence != published->sequence);
+
+    if (sampled == 0 || (nowMs > sampled && nowMs - sampled > maxStalenessMs))
+        return -1;
+
+    *snapshot = copy;
+    if (duty)
+        memcpy(duty, dutyCopy, sizeof(dutyCopy));
+    if (timeMs)
+        *timeMs = sampled;
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * published.h
+ *
+ * Single writer, many reader ADT746x snapshot publication, the user space
+ * counterpart of IOI2CADT746x::getSensorSnapshot.
+ *
+ * One sampler thread owns the bus and publishes every snapshot it reads
+ * together with the time it was read. Any number of readers copy the
+ * latest one without touching the bus or any lock: the sequence number is
+ * odd while the sampler is writing, and a reader that sees it change
+ * while copying simply copies again.
+ */
+
+#ifndef PUBLISHED_H
+#define PUBLISHED_H
+
+#include "snapshot.h"
+
+/*!
+	@struct ADT746xPublished
+	@abstract Latest snapshot of one chip, written by one sampler only.
+*/
+typedef struct
+{
+	volatile UInt32		sequence;		// odd while the sampler is writing
+	UInt64				timeMs;			// when the snapshot was read, 0 before the first one
+	ADT746xSnapshot		snapshot;
+	UInt8				duty[kPWMDutyCount];
+
+} ADT746xPublished;
+
+/*!
+	@function publishADT746xSnapshot
+	@abstract Makes snapshot and duty, read at timeMs, the latest.
+	@discussion Must only ever be called from one thread at a time.
+*/
+void publishADT746xSnapshot(ADT746xPublished *published, const ADT746xSnapshot *snapshot,
+		const UInt8 *duty, UInt64 timeMs);
+
+/*!
+	@function readPublishedADT746x
+	@abstract Lock free copy of the latest snapshot.
+	@discussion Returns 0 with snapshot, duty (may be NULL) and timeMs filled
+	in, or -1 if nothing was published yet or the latest snapshot is more
+	than maxStalenessMs older than nowMs.
+*/
+int readPublishedADT746x(const ADT746xPublished *published, UInt64 nowMs, UInt32 maxStalenessMs,
+		ADT746xSnapshot *snapshot, UInt8 *duty, UInt64 *timeMs);
+
+#endif // PUBLISHED_H
@@ -0,0 +1,108 @@
+/*
+ * shadow.c
+ *
+ * Per chip register shadow, see shadow.h.
+ */
+
+#include <string.h>
+#include "shadow.h"
+
+// 8-bit subaddresses only, and the whole range must fit
+static int shadowable(UInt32 subAddress, UInt32 count) {
+    if ((subAddress >> 24) > 1 || count == 0)
+        return 0;
+    subAddress &= 0x00FFFFFF;
+    return subAddress < kI2CRegisterShadowSize && count <= kI2CRegisterShadowSize - subAddress;
+}
+
+void initI2CRegisterShadow(I2CRegisterShadow *shadow) {
+    memset(shadow, 0, sizeof(*shadow));
+}
+
+void declareI2CRegisters(I2CRegisterShadow *shadow, UInt32 subAddress, UInt32 count,
+                         UInt32 volatility) {
+    if (!shadowable(subAddress, count))
+        return;
+    subAddress &= 0xFF;
+
+    memset(&shadow->volatility[subAddress], volatility, count);
+    memset(&shadow->valid[subAddress], 0, count);
+}
+
+void invalidateI2CRegisterShadow(I2CRegisterShadow *shadow) {
+    memset(shadow->valid, 0, sizeof(shadow->valid));
+}
+
+IOReturn readShadowedRegisters(I2CRegisterShadow *shadow, const FreezerBackend *backend,
+        I2CConnection *connection, const ADT746xLocation *location, UInt32 clientKey,
+        UInt32 subAddress, UInt8 *buf, UInt32 count) {
+    UInt32                  reg, i;
+    int                     declared = 1, known = 1;
+    IOReturn                status;
+
+    if (shadow == NULL || !shadowable(subAddress, count))
+        return readADT746xRegisters(backend, connection, location, clientKey,
+                                    subAddress, buf, count);
+    reg = subAddress & 0xFF;
+
+    for (i = 0; i < count && declared; i++) {
+        declared = shadow->volatility[reg + i] != kI2CRegister_Live;
+        known &= shadow->valid[reg + i];
+    }
+
+    if (declared && known) {
+        memcpy(buf, &shadow->value[reg], count);
+        shadow->hits++;
+        return kIOReturnSuccess;
+    }
+
+    if (declared)
+        shadow->misses++;
+
+    status = readADT746xRegisters(backend, connection, location, clientKey,
+                                  subAddress, buf, count);
+    if (status != kIOReturnSuccess)
+        return status;
+
+    for (i = 0; i < count; i++) {
+        if (shadow->volatility[reg + i] == kI2CRegister_Live)
+            continue;
+        shadow->value[reg + i] = buf[i];
+        shadow->valid[reg + i] = 1;
+    }
+    return kIOReturnSuccess;
+}
+
+IOReturn writeShadowedRegisters(I2CRegisterShadow *shadow, const FreezerBackend *backend,
+        I2CConnection *connection, const ADT746xLocation *location, UInt32 clientKey,
+        UInt32 subAddress, const UInt8 *buf, UInt32 count) {
+    UInt32                  reg, i;
+    int                     redundant = 1;
+    IOReturn                status;
+
+    if (shadow == NULL || !shadowable(subAddress, count))
+        return writeADT746xRegisters(backend, connection, location, clientKey,
+                                     subAddress, buf, count);
+    reg = subAddress & 0xFF;
+
+    for (i = 0; i < count && redundant; i++)
+        redundant = shadow->volatility[reg + i] == kI2CRegister_Config &&
+                    shadow->valid[reg + i] && shadow->value[reg + i] == buf[i];
+
+    if (redundant) {
+        shadow->suppressedWrites++;
+        return kIOReturnSuccess;
+    }
+
+    status = writeADT746xRegisters(backend, connection, location, clientKey,
+                                   subAddress, buf, count);
+
+    for (i = 0; i < count; i++) {
+        if (shadow->volatility[reg + i] == kI2CRegister_Live)
+            continue;
+        shadow->value[reg + i] = buf[i];
+        shadow->valid[reg + i] = status == kIOReturnSuccess && count == 1;
+    }
+
+    return status;
+}
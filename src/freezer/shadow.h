@@ -0,0 +1,83 @@
+/*
+ * shadow.h
+ *
+ * Per chip register shadow, the user space counterpart of
+ * IOI2CRegisterShadow.
+ *
+ * Each 8-bit register is declared kI2CRegister_Live (the default),
+ * kI2CRegister_Static or kI2CRegister_Config. A read whose registers are
+ * all static or config and already known is answered without a
+ * transaction, and a write that would store what the config registers
+ * already hold is dropped; everything else goes to the chip and the
+ * shadow learns from the result. Forget the values with
+ * invalidateI2CRegisterShadow whenever the chip may have been reset.
+ *
+ * A shadow is owned by one thread, and only sees the traffic that goes
+ * through it: a register something else writes must not be declared
+ * config.
+ */
+
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include "snapshot.h"
+
+/*!
+	@struct I2CRegisterShadow
+	@abstract Declarations and last known values of one chip's registers.
+	@field hits reads answered from the shadow
+	@field misses reads of declared registers that went to the chip
+	@field suppressedWrites writes dropped because nothing would have changed
+*/
+typedef struct
+{
+	UInt8		volatility[kI2CRegisterShadowSize];
+	UInt8		valid[kI2CRegisterShadowSize];
+	UInt8		value[kI2CRegisterShadowSize];
+	UInt32		hits;
+	UInt32		misses;
+	UInt32		suppressedWrites;
+
+} I2CRegisterShadow;
+
+/*!
+	@function initI2CRegisterShadow
+	@abstract Every register live, nothing known.
+*/
+void initI2CRegisterShadow(I2CRegisterShadow *shadow);
+
+/*!
+	@function declareI2CRegisters
+	@abstract Sets the kI2CRegister_xxx class of count registers from subAddress and forgets their values.
+*/
+void declareI2CRegisters(I2CRegisterShadow *shadow, UInt32 subAddress, UInt32 count,
+		UInt32 volatility);
+
+/*!
+	@function invalidateI2CRegisterShadow
+	@abstract Forgets every value, the declarations are kept.
+*/
+void invalidateI2CRegisterShadow(I2CRegisterShadow *shadow);
+
+/*!
+	@function readShadowedRegisters
+	@abstract readADT746xRegisters, answered from the shadow when it can be.
+	@discussion shadow may be NULL to always read the chip.
+*/
+IOReturn readShadowedRegisters(I2CRegisterShadow *shadow, const FreezerBackend *backend,
+		I2CConnection *connection, const ADT746xLocation *location, UInt32 clientKey,
+		UInt32 subAddress, UInt8 *buf, UInt32 count);
+
+/*!
+	@function writeShadowedRegisters
+	@abstract writeADT746xRegisters, dropped when it would change nothing.
+	@discussion Single register writes are written through. A multi-byte
+	write, or one that failed, makes its registers read from the chip
+	again: the ADT7467 does not auto-increment on writes. shadow may be
+	NULL to always write the chip.
+*/
+IOReturn writeShadowedRegisters(I2CRegisterShadow *shadow, const FreezerBackend *backend,
+		I2CConnection *connection, const ADT746xLocation *location, UInt32 clientKey,
+		UInt32 subAddress, const UInt8 *buf, UInt32 count);
+
+#endif // SHADOW_H
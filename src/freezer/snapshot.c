@@ -0,0 +1,297 @@
+/*
+ * snapshot.c
+ *
+ * Whole-chip ADT746x reads, see snapshot.h.
+ */
+
+#include <string.h>
+#include "snapshot.h"
+
+#define SENSOR_BYTE(raw, reg)	((raw)->sensor[(reg) - kSensorBlockStart])
+#define EXT_BYTE(raw, reg)		((raw)->ext[(reg) - kExtResBlockStart])
+
+/*
+ * Transfers too large for the inline structs: the data goes through the
+ * start of the shared buffer, in one transaction.
+ */
+static IOReturn mappedADT746xRegisters(const FreezerBackend *backend, I2CConnection *connection,
+		const ADT746xLocation *location, UInt32 clientKey,
+		UInt32 subAddress, UInt8 *buf, UInt32 count, int write)
+{
+	I2CUserMappedInput	input;
+	I2CUserMappedOutput	output;
+	UInt8				*shared;
+	UInt32				size;
+	IOReturn			status;
+
+	if (backend->map == NULL)
+		return kIOReturnUnsupported;
+
+	status = backend->map(connection, &shared, &size);
+	if (status != kIOReturnSuccess)
+		return status;
+
+	if (count > size)
+		return kIOReturnBadArgument;
+
+	memset(&input, 0, sizeof(input));
+	input.mode		= write ? kI2CMode_StandardSub : kI2CMode_Combined;
+	input.busNo		= location->bus;
+	input.addr		= location->address;
+	input.subAddr	= subAddress;
+	input.count		= count;
+	input.key		= clientKey;
+
+	if (write) {
+		memcpy(shared, buf, count);
+		status = backend->mappedWrite(connection, &input, &output);
+	} else
+		status = backend->mappedRead(connection, &input, &output);
+	if (status != kIOReturnSuccess)
+		return status;
+
+	if (output.realCount != count)
+		return kIOReturnError;
+
+	if (!write)
+		memcpy(buf, shared, count);
+	return kIOReturnSuccess;
+}
+
+IOReturn readADT746xRegisters(const FreezerBackend *backend, I2CConnection *connection,
+		const ADT746xLocation *location, UInt32 clientKey,
+		UInt32 subAddress, UInt8 *buf, UInt32 count)
+{
+	I2CUserReadInput	input;
+	I2CUserReadOutput	output;
+	IOReturn			status;
+
+	if (count > kI2CUCBufSize)
+		return mappedADT746xRegisters(backend, connection, location, clientKey,
+				subAddress, buf, count, 0);
+
+	memset(&input, 0, sizeof(input));
+	input.mode		= kI2CMode_Combined;
+	input.busNo		= location->bus;
+	input.addr		= location->address;
+	input.subAddr	= subAddress;
+	input.count		= count;
+	input.key		= clientKey;
+
+	status = backend->read(connection, &input, &output);
+	if (status != kIOReturnSuccess)
+		return status;
+
+	if (output.realCount != count)
+		return kIOReturnError;
+
+	memcpy(buf, output.buf, count);
+	return kIOReturnSuccess;
+}
+
+IOReturn writeADT746xRegisters(const FreezerBackend *backend, I2CConnection *connection,
+		const ADT746xLocation *location, UInt32 clientKey,
+		UInt32 subAddress, const UInt8 *buf, UInt32 count)
+{
+	I2CUserWriteInput	input;
+	I2CUserWriteOutput	output;
+	IOReturn			status;
+
+	if (count > kI2CUCBufSize)
+		return mappedADT746xRegisters(backend, connection, location, clientKey,
+				subAddress, (UInt8 *)buf, count, 1);
+
+	memset(&input, 0, sizeof(input));
+	input.mode		= kI2CMode_StandardSub;
+	input.busNo		= location->bus;
+	input.addr		= location->address;
+	input.subAddr	= subAddress;
+	input.count		= count;
+	input.key		= clientKey;
+	memcpy(input.buf, buf, count);
+
+	status = backend->write(connection, &input, &output);
+	if (status != kIOReturnSuccess)
+		return status;
+
+	return (output.realCount == count) ? kIOReturnSuccess : kIOReturnError;
+}
+
+static IOReturn executeI2CCommand(const FreezerBackend *backend, I2CConnection *connection,
+		UInt32 clientKey, IOI2CCommand *cmd)
+{
+	union {
+		I2CUserReadInput	read;
+		I2CUserWriteInput	write;
+	} input;
+	union {
+		I2CUserReadOutput	read;
+		I2CUserWriteOutput	write;
+	} output;
+	IOReturn			status;
+
+	if ((cmd->buffer == NULL) ^ (cmd->count == 0) || cmd->count > kI2CUCBufSize)
+		return kIOReturnBadArgument;
+
+	memset(&input, 0, sizeof(input));
+
+	if (cmd->command == kI2CCommand_Read) {
+		input.read.options	= cmd->options;
+		input.read.mode		= cmd->mode ? cmd->mode : kI2CMode_Combined;
+		input.read.busNo	= cmd->bus;
+		input.read.addr		= cmd->address;
+		input.read.subAddr	= cmd->subAddress;
+		input.read.count	= cmd->count;
+		input.read.key		= clientKey;
+
+		status = backend->read(connection, &input.read, &output.read);
+		if (status != kIOReturnSuccess)
+			return status;
+
+		cmd->bytesTransfered = output.read.realCount;
+		memcpy(cmd->buffer, output.read.buf, output.read.realCount);
+	} else if (cmd->command == kI2CCommand_Write) {
+		input.write.options	= cmd->options;
+		input.write.mode	= cmd->mode ? cmd->mode : kI2CMode_StandardSub;
+		input.write.busNo	= cmd->bus;
+		input.write.addr	= cmd->address;
+		input.write.subAddr	= cmd->subAddress;
+		input.write.count	= cmd->count;
+		input.write.key		= clientKey;
+		memcpy(input.write.buf, cmd->buffer, cmd->count);
+
+		status = backend->write(connection, &input.write, &output.write);
+		if (status != kIOReturnSuccess)
+			return status;
+
+		cmd->bytesTransfered = output.write.realCount;
+	} else
+		return kIOReturnBadArgument;
+
+	return (cmd->bytesTransfered == cmd->count) ? kIOReturnSuccess : kIOReturnError;
+}
+
+IOReturn executeI2CCommandList(const FreezerBackend *backend, I2CConnection *connection,
+		const ADT746xLocation *location, UInt32 clientKey, IOI2CCommandList *list)
+{
+	IOReturn	status = kIOReturnSuccess;
+	IOReturn	cmdStatus;
+	UInt32		key = clientKey;
+	UInt32		i;
+
+	if (list == NULL || (list->count && list->commands == NULL))
+		return kIOReturnBadArgument;
+
+	list->completed = 0;
+	if (list->count == 0)
+		return kIOReturnSuccess;
+
+	// one lock round trip for the whole list instead of one per command
+	if (clientKey == kIOI2C_CLIENT_KEY_DEFAULT &&
+			kIOReturnSuccess != (status = backend->lock(connection, location->bus, &key)))
+		return status;
+
+	for (i = 0; i < list->count; i++) {
+		list->commands[i].bus = location->bus;
+		list->commands[i].address = location->address;
+		list->commands[i].bytesTransfered = 0;
+
+		cmdStatus = executeI2CCommand(backend, connection, key, &list->commands[i]);
+
+		if (list->status)
+			list->status[i] = cmdStatus;
+		list->completed++;
+
+		if (cmdStatus == kIOReturnSuccess)
+			continue;
+
+		if (status == kIOReturnSuccess)
+			status = cmdStatus;
+
+		if (list->options & kI2CListOption_StopOnError)
+			break;
+	}
+
+	if (list->status) {
+		for (i = list->completed; i < list->count; i++)
+			list->status[i] = kIOReturnAborted;
+	}
+
+	if (clientKey == kIOI2C_CLIENT_KEY_DEFAULT)
+		backend->unlock(connection, key);
+
+	return status;
+}
+
+IOReturn readADT746xRawSnapshot(const FreezerBackend *backend, I2CConnection *connection,
+		const ADT746xLocation *location, UInt32 clientKey, ADT746xRawSnapshot *raw)
+{
+	IOReturn	status;
+
+	// extended resolution first, it freezes the value registers until they are read
+	status = readADT746xRegisters(backend, connection, location, clientKey,
+			kExtResBlockStart, raw->ext, kExtResBlockLength);
+	if (status != kIOReturnSuccess)
+		return status;
+
+	return readADT746xRegisters(backend, connection, location, clientKey,
+			kSensorBlockStart, raw->sensor, kSensorBlockLength);
+}
+
+IOReturn readADT746xSample(const FreezerBackend *backend, I2CConnection *connection,
+		const ADT746xLocation *location, UInt32 clientKey, UInt8 deviceID, UInt8 config2,
+		ADT746xSnapshot *snapshot, UInt8 *duty)
+{
+	ADT746xRawSnapshot	raw;
+	IOReturn			status;
+
+	status = readADT746xRawSnapshot(backend, connection, location, clientKey, &raw);
+	if (status != kIOReturnSuccess)
+		return status;
+
+	status = readADT746xRegisters(backend, connection, location, clientKey,
+			kPWM1DutyCycle, duty, kPWMDutyCount);
+	if (status != kIOReturnSuccess)
+		return status;
+
+	decodeADT746xSnapshot(&raw, deviceID, config2, snapshot);
+	return kIOReturnSuccess;
+}
+
+void decodeADT746xSnapshot(const ADT746xRawSnapshot *raw, UInt8 deviceID, UInt8 config2,
+		ADT746xSnapshot *snapshot)
+{
+	UInt8		ext1 = EXT_BYTE(raw, kExtendedRes1);
+	UInt8		ext2 = EXT_BYTE(raw, kExtendedRes2);
+	UInt8		vccReadAddr;
+	UInt32		volIndex;
+	UInt32		incrementsPerVolt;
+	UInt16		tach;
+	int			i;
+
+	snapshot->localTemp = SIGNED_TEMP_FROM_BYTES((SInt8)SENSOR_BYTE(raw, kLocalTemperature),
+			LOCAL_FROM_EXT_TEMP(ext2));
+	snapshot->remote1Temp = SIGNED_TEMP_FROM_BYTES((SInt8)SENSOR_BYTE(raw, kRemote1Temp),
+			REMOTE1_FROM_EXT_TEMP(ext2));
+	snapshot->remote2Temp = SIGNED_TEMP_FROM_BYTES((SInt8)SENSOR_BYTE(raw, kRemote2Temp),
+			REMOTE2_FROM_EXT_TEMP(ext2));
+
+	// Are we a 7460 or a 7467
+	vccReadAddr = (deviceID == kDeviceIDADT7460) ? k2_5VReading : k2_5VccpReading;
+	volIndex = VOLTAGE_INDEX_FROM_BYTES(SENSOR_BYTE(raw, vccReadAddr), ext1) * 100;
+
+	if (deviceID == kDeviceIDADT7460)
+		incrementsPerVolt = (config2 & k2_5VAttenuationMask) ?
+				kIncrementPerVolt2_25Max : kIncrementPerVolt3_3Max;
+	else	// always attenuated, see IOI2CADT746x::decodeSensorSnapshot
+		incrementsPerVolt = kUnitsPerVoltWithAttenuation7467;
+
+	snapshot->voltage = (SInt32)((volIndex << 16) / incrementsPerVolt);
+
+	for (i = 0; i < 4; i++) {
+		tach = ((UInt16)SENSOR_BYTE(raw, kTACH1HighByte + 2 * i) << 8) |
+				SENSOR_BYTE(raw, kTACH1LowByte + 2 * i);
+		// Fan not spinning or stalled
+		snapshot->fanRPM[i] = ((tach == 0xFFFF) || (tach == 0)) ? 0 : kTachClock / tach;
+	}
+}
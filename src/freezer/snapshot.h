@@ -0,0 +1,143 @@
+/*
+ * snapshot.h
+ *
+ * Whole-chip ADT746x reads: the sensor block (0x20-0x2F) and the extended
+ * resolution pair (0x76-0x77) fetched in two combined mode bursts, and
+ * decoded the same way IOI2CADT746x::readSensorSnapshot does.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "backend.h"
+#include "ADT746x.h"
+
+#define kTachClock		(90000 * 60)	// 90K based on 11.11 microsec timing period
+#define kPWMDutyCount	3				// kPWM1DutyCycle..kPWM3DutyCycle
+
+/*!
+	@struct ADT746xRawSnapshot
+	@abstract Register contents as read off the bus.
+*/
+typedef struct
+{
+	UInt8		ext[kExtResBlockLength];		// kExtResBlockStart...
+	UInt8		sensor[kSensorBlockLength];		// kSensorBlockStart...
+
+} ADT746xRawSnapshot;
+
+/*!
+	@struct ADT746xSnapshot
+	@abstract Decoded sensor values.
+*/
+typedef struct
+{
+	SInt32		localTemp;		// 16.16 fixed point degrees C
+	SInt32		remote1Temp;	// 16.16 fixed point degrees C
+	SInt32		remote2Temp;	// 16.16 fixed point degrees C
+	SInt32		voltage;		// 16.16 fixed point volts
+	UInt32		fanRPM[4];		// 0 if stalled or not connected
+
+} ADT746xSnapshot;
+
+/*!
+	@function readADT746xRegisters
+	@abstract One combined mode read of count registers starting at subAddress.
+	@discussion Up to kI2CUCBufSize registers go inline. More, up to
+	kI2CUCSharedBufSize, are read into the buffer shared with the user
+	client in the same single transaction, if the backend has one.
+*/
+IOReturn readADT746xRegisters(const FreezerBackend *backend, I2CConnection *connection,
+		const ADT746xLocation *location, UInt32 clientKey,
+		UInt32 subAddress, UInt8 *buf, UInt32 count);
+
+/*!
+	@function writeADT746xRegisters
+	@abstract One standard sub-address write of count registers starting at subAddress.
+	@discussion More than kI2CUCBufSize registers go through the shared
+	buffer, see readADT746xRegisters.
+*/
+IOReturn writeADT746xRegisters(const FreezerBackend *backend, I2CConnection *connection,
+		const ADT746xLocation *location, UInt32 clientKey,
+		UInt32 subAddress, const UInt8 *buf, UInt32 count);
+
+/*!
+	@function executeI2CCommandList
+	@abstract Runs list->commands back to back under one bus lock, the user
+	space counterpart of IOI2CDevice::executeI2CCommands.
+	@discussion Pass the key of a held bus lock, or kIOI2C_CLIENT_KEY_DEFAULT
+	to take the lock once for the whole list. Every command must address
+	location's bus; bus and address are filled in from location. Fills in
+	list->status (if not NULL), bytesTransfered and list->completed, and
+	returns the status of the first command that failed.
+*/
+IOReturn executeI2CCommandList(const FreezerBackend *backend, I2CConnection *connection,
+		const ADT746xLocation *location, UInt32 clientKey, IOI2CCommandList *list);
+
+/*!
+	@function readADT746xRawSnapshot
+	@abstract Reads the extended resolution block, then the sensor block.
+	@discussion Two transactions. Pass the key of a held bus lock, or
+	kIOI2C_CLIENT_KEY_DEFAULT.
+*/
+IOReturn readADT746xRawSnapshot(const FreezerBackend *backend, I2CConnection *connection,
+		const ADT746xLocation *location, UInt32 clientKey, ADT746xRawSnapshot *raw);
+
+/*!
+	@function readADT746xSample
+	@abstract Raw snapshot plus the PWM duty cycles, decoded.
+	@discussion Three transactions.
+*/
+IOReturn readADT746xSample(const FreezerBackend *backend, I2CConnection *connection,
+		const ADT746xLocation *location, UInt32 clientKey, UInt8 deviceID, UInt8 config2,
+		ADT746xSnapshot *snapshot, UInt8 *duty);
+
+/*!
+	@function decodeADT746xSnapshot
+	@param deviceID contents of kDeviceIDReg, selects the 7460 or 7467 voltage scale
+	@param config2 contents of kConfigReg2, for the 7460's attenuation bit; a 7467 is always
+	scaled as attenuated, as IOI2CADT746x and AppleADT746x do
+*/
+void decodeADT746xSnapshot(const ADT746xRawSnapshot *raw, UInt8 deviceID, UInt8 config2,
+		ADT746xSnapshot *snapshot);
+
+/*!
+	@struct ADT746xColumns
+	@abstract Column arrays for decodeADT746xBatch, one entry per snapshot.
+	@discussion Same units as ADT746xSnapshot.
+*/
+typedef struct
+{
+	SInt32		*localTemp;
+	SInt32		*remote1Temp;
+	SInt32		*remote2Temp;
+	SInt32		*voltage;
+	UInt32		*fanRPM[4];
+
+} ADT746xColumns;
+
+/*!
+	@function decodeADT746xBatch
+	@abstract Decodes count raw snapshots into columns.
+	@discussion For offline analysis of logged register dumps. deviceID and
+	config2 apply to the whole batch. Uses SSE2 when the compiler targets it
+	and produces exactly what decodeADT746xSnapshot does for every entry.
+*/
+void decodeADT746xBatch(const ADT746xRawSnapshot *raw, UInt32 count, UInt8 deviceID,
+		UInt8 config2, const ADT746xColumns *columns);
+
+/*!
+	@function decodeADT746xBatchReference
+	@abstract decodeADT746xSnapshot applied to every entry, the reference
+	decodeADT746xBatch is checked against.
+*/
+void decodeADT746xBatchReference(const ADT746xRawSnapshot *raw, UInt32 count, UInt8 deviceID,
+		UInt8 config2, const ADT746xColumns *columns);
+
+/*!
+	@function decodeADT746xBatchMethod
+	@abstract "sse2" or "scalar", whichever decodeADT746xBatch was built with.
+*/
+const char *decodeADT746xBatchMethod(void);
+
+#endif // SNAPSHOT_H
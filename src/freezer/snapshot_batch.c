@@ -0,0 +1,231 @@
+/*
+ * snapshot_batch.c
+ *
+ * Batch decode of raw ADT746x snapshots into columns, see snapshot.h.
+ *
+ * The SSE2 path decodes four snapshots per step: the four 16 byte sensor
+ * blocks are transposed so every register becomes one vector of four
+ * 32-bit lanes, and the per sample branches of decodeADT746xSnapshot
+ * become masks. The divisions are done in floating point, which is exact
+ * here: the dividends stay below 2^24 (tach) and 2^53 (voltage), so the
+ * truncated quotient never lands on the wrong side of an integer.
+ */
+
+#include "snapshot.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define SENSOR_OFFSET(reg)		((reg) - kSensorBlockStart)
+#define EXT_OFFSET(reg)			((reg) - kExtResBlockStart)
+
+typedef struct
+{
+	UInt32		vccOffset;			// Vcc register, relative to kSensorBlockStart
+	UInt32		incrementsPerVolt;
+
+} ADT746xScale;
+
+static void batchScale(UInt8 deviceID, UInt8 config2, ADT746xScale *scale)
+{
+	// Are we a 7460 or a 7467
+	if (deviceID == kDeviceIDADT7460) {
+		scale->vccOffset = SENSOR_OFFSET(k2_5VReading);
+		scale->incrementsPerVolt = (config2 & k2_5VAttenuationMask) ?
+				kIncrementPerVolt2_25Max : kIncrementPerVolt3_3Max;
+	} else {
+		scale->vccOffset = SENSOR_OFFSET(k2_5VccpReading);
+		scale->incrementsPerVolt = kUnitsPerVoltWithAttenuation7467;	// see decodeADT746xSnapshot
+	}
+}
+
+// decodeADT746xSnapshot with the per batch decisions taken out of the loop
+static void decodeRange(const ADT746xRawSnapshot *raw, UInt32 first, UInt32 end,
+		const ADT746xScale *scale, const ADT746xColumns *columns)
+{
+	const UInt8		*sensor;
+	UInt8			ext1, ext2;
+	UInt32			volIndex;
+	UInt16			tach;
+	UInt32			i;
+	int				fan;
+
+	for (i = first; i < end; i++) {
+		sensor	= raw[i].sensor;
+		ext1	= raw[i].ext[EXT_OFFSET(kExtendedRes1)];
+		ext2	= raw[i].ext[EXT_OFFSET(kExtendedRes2)];
+
+		columns->localTemp[i] = SIGNED_TEMP_FROM_BYTES(
+				(SInt8)sensor[SENSOR_OFFSET(kLocalTemperature)], LOCAL_FROM_EXT_TEMP(ext2));
+		columns->remote1Temp[i] = SIGNED_TEMP_FROM_BYTES(
+				(SInt8)sensor[SENSOR_OFFSET(kRemote1Temp)], REMOTE1_FROM_EXT_TEMP(ext2));
+		columns->remote2Temp[i] = SIGNED_TEMP_FROM_BYTES(
+				(SInt8)sensor[SENSOR_OFFSET(kRemote2Temp)], REMOTE2_FROM_EXT_TEMP(ext2));
+
+		volIndex = VOLTAGE_INDEX_FROM_BYTES(sensor[scale->vccOffset], ext1) * 100;
+		columns->voltage[i] = (SInt32)((volIndex << 16) / scale->incrementsPerVolt);
+
+		for (fan = 0; fan < 4; fan++) {
+			tach = ((UInt16)sensor[SENSOR_OFFSET(kTACH1HighByte) + 2 * fan] << 8) |
+					sensor[SENSOR_OFFSET(kTACH1LowByte) + 2 * fan];
+			// Fan not spinning or stalled
+			columns->fanRPM[fan][i] = ((tach == 0xFFFF) || (tach == 0)) ? 0 : kTachClock / tach;
+		}
+	}
+}
+
+#if defined(__SSE2__)
+
+// zero extend the low four bytes of x into four 32-bit lanes
+static inline __m128i zeroExtend4(__m128i x)
+{
+	__m128i		zero = _mm_setzero_si128();
+
+	return _mm_unpacklo_epi16(_mm_unpacklo_epi8(x, zero), zero);
+}
+
+// byte reg of the four transposed sensor blocks, one sample per lane
+#define SENSOR_LANES(cols, reg) \
+	zeroExtend4(_mm_srli_si128((cols)[SENSOR_OFFSET(reg) >> 2], 4 * (SENSOR_OFFSET(reg) & 3)))
+
+static inline __m128i signedTempLanes(__m128i high, __m128i low)
+{
+	// sign extend the 8-bit integer part into bits 16..31
+	return _mm_or_si128(_mm_srai_epi32(_mm_slli_epi32(high, 24), 8), _mm_slli_epi32(low, 8));
+}
+
+static inline __m128i voltageLanes(__m128i vcc, __m128i ext1, __m128d incrementsPerVolt)
+{
+	__m128i		index, scaled;
+	__m128d		lo, hi, wrap = _mm_set1_pd(4294967296.0);
+
+	index = _mm_add_epi32(_mm_slli_epi32(vcc, kVoltageShift),
+			_mm_and_si128(ext1, _mm_set1_epi32(kExtVoltageMask)));
+
+	// index * 100 << 16, wrapping at 32 bits like the UInt32 scalar code
+	index = _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(index, 6), _mm_slli_epi32(index, 5)),
+			_mm_slli_epi32(index, 2));
+	scaled = _mm_slli_epi32(index, 16);
+
+	// unsigned lanes to double, two at a time
+	lo = _mm_cvtepi32_pd(scaled);
+	hi = _mm_cvtepi32_pd(_mm_srli_si128(scaled, 8));
+	lo = _mm_add_pd(lo, _mm_and_pd(_mm_cmplt_pd(lo, _mm_setzero_pd()), wrap));
+	hi = _mm_add_pd(hi, _mm_and_pd(_mm_cmplt_pd(hi, _mm_setzero_pd()), wrap));
+
+	return _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_div_pd(lo, incrementsPerVolt)),
+			_mm_cvttpd_epi32(_mm_div_pd(hi, incrementsPerVolt)));
+}
+
+static inline __m128i rpmLanes(__m128i low, __m128i high)
+{
+	__m128i		tach, stalled, rpm;
+
+	tach = _mm_or_si128(_mm_slli_epi32(high, 8), low);
+
+	// Fan not spinning or stalled
+	stalled = _mm_or_si128(_mm_cmpeq_epi32(tach, _mm_setzero_si128()),
+			_mm_cmpeq_epi32(tach, _mm_set1_epi32(0xFFFF)));
+
+	rpm = _mm_cvttps_epi32(_mm_div_ps(_mm_set1_ps((float)kTachClock), _mm_cvtepi32_ps(tach)));
+	return _mm_andnot_si128(stalled, rpm);
+}
+
+static void decodeFour(const ADT746xRawSnapshot *raw, UInt32 i, const ADT746xScale *scale,
+		__m128d incrementsPerVolt, const ADT746xColumns *columns)
+{
+	__m128i		r0, r1, r2, r3, t0, t1, t2, t3, cols[4];
+	__m128i		ext1, ext2, vcc;
+
+	r0 = _mm_loadu_si128((const __m128i *)raw[i].sensor);
+	r1 = _mm_loadu_si128((const __m128i *)raw[i + 1].sensor);
+	r2 = _mm_loadu_si128((const __m128i *)raw[i + 2].sensor);
+	r3 = _mm_loadu_si128((const __m128i *)raw[i + 3].sensor);
+
+	// 4x16 byte transpose: dword j of cols[k] is byte 4k+j of samples 0..3
+	t0 = _mm_unpacklo_epi8(r0, r1);
+	t1 = _mm_unpackhi_epi8(r0, r1);
+	t2 = _mm_unpacklo_epi8(r2, r3);
+	t3 = _mm_unpackhi_epi8(r2, r3);
+	cols[0] = _mm_unpacklo_epi16(t0, t2);
+	cols[1] = _mm_unpackhi_epi16(t0, t2);
+	cols[2] = _mm_unpacklo_epi16(t1, t3);
+	cols[3] = _mm_unpackhi_epi16(t1, t3);
+
+	ext1 = _mm_set_epi32(raw[i + 3].ext[EXT_OFFSET(kExtendedRes1)], raw[i + 2].ext[EXT_OFFSET(kExtendedRes1)],
+			raw[i + 1].ext[EXT_OFFSET(kExtendedRes1)], raw[i].ext[EXT_OFFSET(kExtendedRes1)]);
+	ext2 = _mm_set_epi32(raw[i + 3].ext[EXT_OFFSET(kExtendedRes2)], raw[i + 2].ext[EXT_OFFSET(kExtendedRes2)],
+			raw[i + 1].ext[EXT_OFFSET(kExtendedRes2)], raw[i].ext[EXT_OFFSET(kExtendedRes2)]);
+
+	_mm_storeu_si128((__m128i *)&columns->localTemp[i], signedTempLanes(SENSOR_LANES(cols, kLocalTemperature),
+			_mm_slli_epi32(_mm_and_si128(ext2, _mm_set1_epi32(kLocalExtMask)), kLocalExtShift)));
+	_mm_storeu_si128((__m128i *)&columns->remote1Temp[i], signedTempLanes(SENSOR_LANES(cols, kRemote1Temp),
+			_mm_slli_epi32(_mm_and_si128(ext2, _mm_set1_epi32(kRemote1ExtMask)), kRemote1ExtShift)));
+	_mm_storeu_si128((__m128i *)&columns->remote2Temp[i], signedTempLanes(SENSOR_LANES(cols, kRemote2Temp),
+			_mm_slli_epi32(_mm_and_si128(ext2, _mm_set1_epi32(kRemote2ExtMask)), kRemote2ExtShift)));
+
+	if (scale->vccOffset == SENSOR_OFFSET(k2_5VReading))
+		vcc = SENSOR_LANES(cols, k2_5VReading);
+	else
+		vcc = SENSOR_LANES(cols, k2_5VccpReading);
+	_mm_storeu_si128((__m128i *)&columns->voltage[i], voltageLanes(vcc, ext1, incrementsPerVolt));
+
+	_mm_storeu_si128((__m128i *)&columns->fanRPM[0][i],
+			rpmLanes(SENSOR_LANES(cols, kTACH1LowByte), SENSOR_LANES(cols, kTACH1HighByte)));
+	_mm_storeu_si128((__m128i *)&columns->fanRPM[1][i],
+			rpmLanes(SENSOR_LANES(cols, kTACH2LowByte), SENSOR_LANES(cols, kTACH2HighByte)));
+	_mm_storeu_si128((__m128i *)&columns->fanRPM[2][i],
+			rpmLanes(SENSOR_LANES(cols, kTACH3LowByte), SENSOR_LANES(cols, kTACH3HighByte)));
+	_mm_storeu_si128((__m128i *)&columns->fanRPM[3][i],
+			rpmLanes(SENSOR_LANES(cols, kTACH4LowByte), SENSOR_LANES(cols, kTACH4HighByte)));
+}
+
+#endif // __SSE2__
+
+void decodeADT746xBatch(const ADT746xRawSnapshot *raw, UInt32 count, UInt8 deviceID,
+		UInt8 config2, const ADT746xColumns *columns)
+{
+	ADT746xScale	scale;
+	UInt32			i = 0;
+
+	batchScale(deviceID, config2, &scale);
+
+#if defined(__SSE2__)
+	{
+		__m128d		incrementsPerVolt = _mm_set1_pd((double)scale.incrementsPerVolt);
+
+		for (; i + 4 <= count; i += 4)
+			decodeFour(raw, i, &scale, incrementsPerVolt, columns);
+	}
+#endif
+
+	decodeRange(raw, i, count, &scale, columns);
+}
+
+void decodeADT746xBatchReference(const ADT746xRawSnapshot *raw, UInt32 count, UInt8 deviceID,
+		UInt8 config2, const ADT746xColumns *columns)
+{
+	ADT746xSnapshot	snapshot;
+	UInt32			i;
+	int				fan;
+
+	for (i = 0; i < count; i++) {
+		decodeADT746xSnapshot(&raw[i], deviceID, config2, &snapshot);
+		columns->localTemp[i]	= snapshot.localTemp;
+		columns->remote1Temp[i]	= snapshot.remote1Temp;
+		columns->remote2Temp[i]	= snapshot.remote2Temp;
+		columns->voltage[i]		= snapshot.voltage;
+		for (fan = 0; fan < 4; fan++)
+			columns->fanRPM[fan][i] = snapshot.fanRPM[fan];
+	}
+}
+
+const char *decodeADT746xBatchMethod(void)
+{
+#if defined(__SSE2__)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}